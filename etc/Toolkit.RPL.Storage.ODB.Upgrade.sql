@@ -0,0 +1,96 @@
+USE [%DB_NAME%]
+GO
+
+
+/******************************************************************************/
+/*                       Toolkit.RPL.Storage.ODB upgrade                      */
+/*                                                                            */
+/*  Upgrades database of previous versions to store stream properties in      */
+/*  [_blobs] table. Script can be run more than once: existing objects are    */
+/*  not changed. Content of existing stream properties is kept in [_images]   */
+/*  table and is still read by storage.                                       */
+/******************************************************************************/
+
+/****************************** [dbo].[_blobs] ********************************/
+IF OBJECT_ID( N'[dbo].[_blobs]', N'U' ) IS NULL
+CREATE TABLE [dbo].[_blobs](
+    [ID] int IDENTITY(1,1) NOT NULL,
+    [Hash] binary(20) NOT NULL,
+    [Value] image NULL,
+  CONSTRAINT [PK_blobs] PRIMARY KEY CLUSTERED ([ID] ASC)
+)
+GO
+
+IF COL_LENGTH( N'[dbo].[_blobs]', N'Pending' ) IS NULL
+ALTER TABLE [dbo].[_blobs] ADD
+    [Pending] bit NOT NULL DEFAULT 0
+GO
+
+IF COL_LENGTH( N'[dbo].[_blobs]', N'TimeStamp' ) IS NULL
+ALTER TABLE [dbo].[_blobs] ADD
+    [TimeStamp] datetime NOT NULL DEFAULT GETDATE()
+GO
+
+IF NOT EXISTS( SELECT 1 FROM [sys].[indexes]
+               WHERE  [object_id] = OBJECT_ID( N'[dbo].[_blobs]' ) AND
+                      [name] = N'IX_blobs' )
+CREATE UNIQUE NONCLUSTERED INDEX [IX_blobs] ON [dbo].[_blobs]
+(
+    [Hash] ASC
+)
+GO
+
+IF NOT EXISTS( SELECT 1 FROM [sys].[indexes]
+               WHERE  [object_id] = OBJECT_ID( N'[dbo].[_blobs]' ) AND
+                      [name] = N'IX_blobs_pending' )
+CREATE NONCLUSTERED INDEX [IX_blobs_pending] ON [dbo].[_blobs]
+(
+    [Pending] ASC,
+    [TimeStamp] ASC
+)
+GO
+
+/****************************** [dbo].[_images] *******************************/
+IF COL_LENGTH( N'[dbo].[_images]', N'BlobID' ) IS NULL
+ALTER TABLE [dbo].[_images] ADD
+    [BlobID] int NULL
+GO
+
+IF OBJECT_ID( N'[dbo].[FK_images_blobs]', N'F' ) IS NULL
+ALTER TABLE [dbo].[_images] ADD
+    CONSTRAINT [FK_images_blobs]
+        FOREIGN KEY ([BlobID]) REFERENCES [dbo].[_blobs] ([ID])
+GO
+
+IF NOT EXISTS( SELECT 1 FROM [sys].[indexes]
+               WHERE  [object_id] = OBJECT_ID( N'[dbo].[_images]' ) AND
+                      [name] = N'IX_images_blobs' )
+CREATE NONCLUSTERED INDEX [IX_images_blobs] ON [dbo].[_images]
+(
+    [BlobID] ASC
+)
+GO
+
+IF OBJECT_ID( N'[dbo].[images_blobs]', N'TR' ) IS NOT NULL
+DROP TRIGGER [dbo].[images_blobs]
+GO
+
+CREATE TRIGGER [images_blobs] ON [dbo].[_images]
+       FOR UPDATE, DELETE
+AS
+    -- remove content that is not referenced any more
+    DELETE FROM [dbo].[_blobs]
+    WHERE  [ID] IN( SELECT [BlobID] FROM [deleted] ) AND
+           NOT EXISTS( SELECT 1
+                       FROM   [dbo].[_images] [img]
+                       WHERE  [img].[BlobID] = [dbo].[_blobs].[ID] )
+GO
+
+-- remove unfinished uploads that are not continued during a day
+-- (storage does the same at start of new upload)
+DELETE FROM [dbo].[_blobs]
+WHERE  [Pending] = 1 AND [TimeStamp] < DATEADD(hour, -24, GETDATE()) AND
+       NOT EXISTS( SELECT 1
+                   FROM   [dbo].[_images] [img]
+                   WHERE  [img].[BlobID] = [dbo].[_blobs].[ID] )
+GO
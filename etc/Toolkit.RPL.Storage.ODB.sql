@@ -142,12 +142,33 @@ AS
     END
 GO
 
+/****************************** [dbo].[_blobs] ********************************/
+CREATE TABLE [dbo].[_blobs](
+    [ID] int IDENTITY(1,1) NOT NULL,
+    [Hash] binary(20) NOT NULL,
+    [Value] image NULL,
+    [Pending] bit NOT NULL DEFAULT 0,
+    [TimeStamp] datetime NOT NULL DEFAULT GETDATE(),
+  CONSTRAINT [PK_blobs] PRIMARY KEY CLUSTERED ([ID] ASC)
+)
+CREATE UNIQUE NONCLUSTERED INDEX [IX_blobs] ON [dbo].[_blobs]
+(
+    [Hash] ASC
+)
+CREATE NONCLUSTERED INDEX [IX_blobs_pending] ON [dbo].[_blobs]
+(
+    [Pending] ASC,
+    [TimeStamp] ASC
+)
+GO
+
 /****************************** [dbo].[_images] *******************************/
 CREATE TABLE [dbo].[_images](
     [ID] int IDENTITY(1,1) NOT NULL,
     [ObjectID] int NOT NULL,
     [Name] nvarchar(50) NOT NULL,
     [Value] image NULL,
+    [BlobID] int NULL,
   CONSTRAINT [PK_images] PRIMARY KEY CLUSTERED ([ID] ASC)
 )
 CREATE UNIQUE NONCLUSTERED INDEX [IX_images] ON [dbo].[_images]
@@ -164,6 +185,28 @@ ALTER TABLE [dbo].[_images] ADD
     NOT FOR REPLICATION
 GO
 
+ALTER TABLE [dbo].[_images] ADD
+    CONSTRAINT [FK_images_blobs]
+        FOREIGN KEY ([BlobID]) REFERENCES [dbo].[_blobs] ([ID])
+GO
+
+CREATE NONCLUSTERED INDEX [IX_images_blobs] ON [dbo].[_images]
+(
+    [BlobID] ASC
+)
+GO
+
+CREATE TRIGGER [images_blobs] ON [dbo].[_images]
+       FOR UPDATE, DELETE
+AS
+    -- remove content that is not referenced any more
+    DELETE FROM [dbo].[_blobs]
+    WHERE  [ID] IN( SELECT [BlobID] FROM [deleted] ) AND
+           NOT EXISTS( SELECT 1
+                       FROM   [dbo].[_images] [img]
+                       WHERE  [img].[BlobID] = [dbo].[_blobs].[ID] )
+GO
+
 CREATE TRIGGER [images_objects] ON [dbo].[_images]
        FOR INSERT, UPDATE, DELETE
 AS
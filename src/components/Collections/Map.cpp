@@ -75,6 +75,9 @@ Object^ Map<TKey, TValue>::Enumerator::Current::get( void )
 generic<typename TKey, typename TValue>
 Collections::IEnumerator^ Map<TKey, TValue>::get_enumarator( void )
 {
+	// handler call
+	OnEnumerate();
+
 	return gcnew Enumerator(this);
 }
 
@@ -198,6 +201,9 @@ bool Map<TKey, TValue>::pairs_remove( KeyValuePair<TKey, TValue> pair )
 generic<typename TKey, typename TValue>
 IEnumerator<KeyValuePair<TKey, TValue>>^ Map<TKey, TValue>::pairs_get_enumerator( void )
 {
+	// handler call
+	OnEnumerate();
+
 	return gcnew Enumerator(this);
 }
 
@@ -266,6 +272,22 @@ void Map<TKey, TValue>::OnSet( TKey key, TValue value )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Performs additional custom processes before enumerating the
+/// contents of the Map instance.
+/// </summary><remarks>
+/// The default implementation of this method is intended to be
+/// overridden by a derived class to perform some action before the
+/// enumerator is created.
+/// </remarks>
+//-------------------------------------------------------------------
+generic<typename TKey, typename TValue>
+void Map<TKey, TValue>::OnEnumerate( void )
+{
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Performs additional custom processes after clearing the contents
@@ -77,6 +77,7 @@ protected:
 	virtual void OnInsert( TKey key, TValue value );
 	virtual void OnRemove( TKey key, TValue value );
 	virtual void OnSet( TKey key, TValue value );
+	virtual void OnEnumerate( void );
 	virtual void OnClearComplete( void );
 	virtual void OnInsertComplete( TKey key, TValue value );
 	virtual void OnRemoveComplete( TKey key, TValue value );
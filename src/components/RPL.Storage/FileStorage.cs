@@ -0,0 +1,593 @@
+//****************************************************************************
+//*
+//*	Project		:	Robust Persistence Layer
+//*
+//*	Module		:	FileStorage.cs
+//*
+//*	Content		:	Implements file storage of persistent objects
+//*	Author		:	Oleksii Tkachuk
+//*	Copyright	:	Copyright © 2013 Oleksii Tkachuk
+//*
+//*	Implement Search, Retrive, Save, Delete of PersistentObject in local
+//*	files with write-ahead log
+//*
+//****************************************************************************
+
+using System;
+using System.IO;
+using System.Collections.Generic;
+
+
+namespace Toolkit.RPL.Storage
+{
+/// <summary>
+/// Embedded file storage implementation.
+/// </summary>
+/// <remarks>
+/// Storage keeps objects in the directory on local disk, so it can be used by
+/// applications without database server. Objects and their indexes are kept in
+/// memory in the same way as by MemoryStorage, so requests are processed with
+/// the same semantic. Every committed transaction appends new state of changed
+/// objects to the write-ahead log which is flushed to disk before commit is
+/// completed. When log grows over CheckpointSize, all objects are written to
+/// the new checkpoint file and log is started again. Stream contents are stored
+/// in separate files named by hash. On open storage loads the last checkpoint
+/// and replays log after it: transaction which was written partially before
+/// crash is discarded.
+/// </remarks>
+public class FileStorage : MemoryStorage, IDisposable
+{
+	// stream content that is stored in file
+	private class FileBlob : Blob
+	{
+		private readonly string m_path;
+		private readonly long m_length;
+
+		public FileBlob( byte[] hash, string path ) : base( hash, null )
+		{
+			m_path = path;
+			m_length = new FileInfo( path ).Length;
+		}
+
+		public override long Length
+		{
+			get { return m_length; }
+		}
+
+		public override byte[] Read( long offset, int count )
+		{
+			byte[] data = new byte[(offset < m_length) ? Math.Min( count, m_length - offset ) : 0];
+
+			if( data.Length == 0 ) return data;
+
+			using( FileStream file = new FileStream( m_path, FileMode.Open, FileAccess.Read, FileShare.Read ) ) {
+				file.Seek( offset, SeekOrigin.Begin );
+				read( file, data );
+			}
+			return data;
+		}
+
+		public override PersistentStream Open()
+		{
+			return new PersistentStream( m_path );
+		}
+	}
+
+	// names of storage files
+	private const string CHECKPOINT = "objects.dat";
+	private const string LOG = "objects.log";
+	private const string BLOBS = "blobs";
+	private const string TEMP = ".tmp";
+	private const string UPLOAD = ".upload";
+	// signature of storage files ("RPLS")
+	private const int SIGNATURE = 0x534C5052;
+	// tags of values in storage files
+	private enum TAG : byte { Null, Bool, Int, Double, DateTime, String, Blob }
+
+	private readonly string m_path;
+	private readonly string m_blobs;
+	private FileStream m_log = null;
+	private long m_generation = 0;
+	private long m_checkpointSize = 16 * 1024 * 1024;
+	// objects changed by current transaction
+	private readonly Dictionary<int, Record> m_changed = new Dictionary<int, Record>();
+
+	#region error messages
+	private static string ERROR_CHECKPOINT = "Checkpoint file '{0}' is corrupted!";
+	private static string ERROR_BLOB_IS_ABSENT = "Content file '{0}' doesn't exist!";
+	private static string ERROR_IN_TRANSACTION = "Checkpoint can't be made in transaction!";
+	private static string ERROR_CLOSED = "Storage is closed!";
+	#endregion
+
+	///////////////////////////////////////////////////////////////////////
+	//						Private Section
+	///////////////////////////////////////////////////////////////////////
+	// read whole buffer from the stream
+	private static void read( Stream stream, byte[] data )
+	{
+		for( int offset = 0; offset < data.Length; ) {
+			int read = stream.Read( data, offset, data.Length - offset );
+			if( read == 0 ) throw new EndOfStreamException();
+			offset += read;
+		}
+	}
+
+	// Adler-32 checksum of the buffer range
+	private static uint checksum( byte[] data, int offset, int count )
+	{
+		uint a = 1, b = 0;
+
+		for( int i = offset; i < offset + count; ) {
+			// sums don't overflow in 5552 steps
+			for( int n = Math.Min( 5552, offset + count - i ); n > 0; n--, i++ ) {
+				a += data[i];
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+		}
+		return (b << 16) | a;
+	}
+
+	// return path of the file with stream content
+	private string blob_path( byte[] hash )
+	{
+		return Path.Combine( m_blobs, BitConverter.ToString( hash ).Replace( "-", "" ) );
+	}
+
+	#region encoding of objects
+	// write string that can be null
+	private static void write_string( BinaryWriter bw, string s )
+	{
+		bw.Write( s != null );
+		if( s != null ) bw.Write( s );
+	}
+
+	// read string that can be null
+	private static string read_string( BinaryReader br )
+	{
+		return br.ReadBoolean() ? br.ReadString() : null;
+	}
+
+	// write stored property value (stream content by hash)
+	private static void write_value( BinaryWriter bw, object value )
+	{
+		if( value is bool ) {
+			bw.Write( (byte) TAG.Bool );
+			bw.Write( (bool) value );
+		} else if( value is int ) {
+			bw.Write( (byte) TAG.Int );
+			bw.Write( (int) value );
+		} else if( value is double ) {
+			bw.Write( (byte) TAG.Double );
+			bw.Write( (double) value );
+		} else if( value is DateTime ) {
+			bw.Write( (byte) TAG.DateTime );
+			bw.Write( ((DateTime) value).ToBinary() );
+		} else if( value is string ) {
+			bw.Write( (byte) TAG.String );
+			bw.Write( (string) value );
+		} else if( value is Blob ) {
+			bw.Write( (byte) TAG.Blob );
+			bw.Write( ((Blob) value).Hash.Length );
+			bw.Write( ((Blob) value).Hash );
+		} else {
+			bw.Write( (byte) TAG.Null );
+		}
+	}
+
+	// read stored property value
+	private object read_value( BinaryReader br )
+	{
+		switch( (TAG) br.ReadByte() ) {
+			case TAG.Null:
+				return DBNull.Value;
+			case TAG.Bool:
+				return br.ReadBoolean();
+			case TAG.Int:
+				return br.ReadInt32();
+			case TAG.Double:
+				return br.ReadDouble();
+			case TAG.DateTime:
+				return DateTime.FromBinary( br.ReadInt64() );
+			case TAG.String:
+				return br.ReadString();
+			case TAG.Blob:
+				byte[] hash = br.ReadBytes( br.ReadInt32() );
+				Blob blob = get_blob( hash );
+
+				if( blob != null ) return blob;
+				// content is stored already, so it's file must exist
+				if( !File.Exists( blob_path( hash ) ) ) {
+					throw new InvalidDataException( string.Format( ERROR_BLOB_IS_ABSENT, blob_path( hash ) ) );
+				}
+				return new FileBlob( hash, blob_path( hash ) );
+			default:
+				throw new InvalidDataException();
+		}
+	}
+
+	// write state of the object: header, properties and children (only
+	// ID is written for removed object)
+	private void write_record( BinaryWriter bw, Record rec )
+	{
+		bw.Write( rec.Header.ID );
+		bw.Write( contains( rec ) );
+		if( !contains( rec ) ) return;
+
+		bw.Write( rec.Header.Type );
+		bw.Write( rec.Header.Stamp.ToBinary() );
+		write_string( bw, rec.Header.Name );
+		bw.Write( rec.Props.Count );
+		foreach( KeyValuePair<string, object> prop in rec.Props ) {
+			bw.Write( prop.Key );
+			write_value( bw, prop.Value );
+		}
+		bw.Write( rec.Children.Count );
+		foreach( int child in rec.Children ) {
+			bw.Write( child );
+		}
+	}
+
+	// read and load states of objects: links are loaded after all
+	// objects, because they can refer to objects that follow
+	private void read_records( BinaryReader br, int count )
+	{
+		Dictionary<int, int[]> links = new Dictionary<int, int[]>();
+
+		for( int i = 0; i < count; i++ ) {
+			int id = br.ReadInt32();
+
+			if( !br.ReadBoolean() ) {
+				links.Remove( id );
+				unload( id );
+				continue;
+			}
+			string type = br.ReadString();
+			DateTime stamp = DateTime.FromBinary( br.ReadInt64() );
+			string name = read_string( br );
+
+			Dictionary<string, object> props = new Dictionary<string, object>();
+			for( int n = br.ReadInt32(); n > 0; n-- ) {
+				string prop = br.ReadString();
+				props[prop] = read_value( br );
+			}
+			int[] children = new int[br.ReadInt32()];
+			for( int n = 0; n < children.Length; n++ ) {
+				children[n] = br.ReadInt32();
+			}
+			load( new HEADER( type, id, stamp, name ), props );
+			links[id] = children;
+		}
+		foreach( KeyValuePair<int, int[]> link in links ) {
+			load( link.Key, link.Value );
+		}
+	}
+	#endregion
+
+	#region storage files
+	// load checkpoint file (return false if there is no checkpoint)
+	private bool load_checkpoint()
+	{
+		string path = Path.Combine( m_path, CHECKPOINT );
+
+		if( !File.Exists( path ) ) return false;
+
+		using( BinaryReader br = new BinaryReader( new BufferedStream(
+			   new FileStream( path, FileMode.Open, FileAccess.Read, FileShare.Read ), 64 * 1024 ) ) ) {
+			try {
+				if( br.ReadInt32() != SIGNATURE ) throw new InvalidDataException();
+				m_generation = br.ReadInt64();
+				LastID = br.ReadInt32();
+				read_records( br, br.ReadInt32() );
+				// the end of file is marked by signature
+				if( br.ReadInt32() != SIGNATURE ) throw new InvalidDataException();
+			} catch( EndOfStreamException e ) {
+				throw new InvalidDataException( string.Format( ERROR_CHECKPOINT, path ), e );
+			} catch( InvalidDataException e ) {
+				throw new InvalidDataException( string.Format( ERROR_CHECKPOINT, path ), e );
+			}
+		}
+		return true;
+	}
+
+	// replay transactions from the log of current generation (return
+	// length of log that is replayed or -1 if log can't be used)
+	private long load_log()
+	{
+		string path = Path.Combine( m_path, LOG );
+
+		if( !File.Exists( path ) ) return -1;
+
+		using( FileStream file = new FileStream( path, FileMode.Open, FileAccess.Read, FileShare.Read ) ) {
+			BinaryReader br = new BinaryReader( file );
+			long length;
+
+			// log of other generation was written before checkpoint
+			try {
+				if( (br.ReadInt32() != SIGNATURE) || (br.ReadInt64() != m_generation) ) return -1;
+			} catch( EndOfStreamException ) {
+				return -1;
+			}
+
+			// replay records while they are whole (crash can break the
+			// last one)
+			for( length = file.Position; file.Length - length >= 8; length = file.Position ) {
+				int size = br.ReadInt32();
+				uint sum = br.ReadUInt32();
+
+				if( (size < 0) || (size > file.Length - file.Position) ) break;
+
+				byte[] data = br.ReadBytes( size );
+				if( checksum( data, 0, size ) != sum ) break;
+
+				BinaryReader record = new BinaryReader( new MemoryStream( data ) );
+				read_records( record, record.ReadInt32() );
+			}
+			return length;
+		}
+	}
+
+	// open log for appending after specified length or create new one
+	// for current generation (if length is negative)
+	private void open_log( long length )
+	{
+		string path = Path.Combine( m_path, LOG );
+
+		if( m_log != null ) m_log.Close();
+
+		m_log = new FileStream( path, (length < 0) ? FileMode.Create : FileMode.Open,
+								FileAccess.Write, FileShare.Read, 4096, FileOptions.WriteThrough );
+		if( length < 0 ) {
+			BinaryWriter bw = new BinaryWriter( m_log );
+
+			bw.Write( SIGNATURE );
+			bw.Write( m_generation );
+			bw.Flush();
+		} else {
+			// discard broken record
+			m_log.SetLength( length );
+			m_log.Seek( length, SeekOrigin.Begin );
+		}
+	}
+
+	// append changed objects to the log
+	private void append_log()
+	{
+		MemoryStream ms = new MemoryStream();
+		BinaryWriter bw = new BinaryWriter( ms );
+
+		bw.Write( 0 );
+		bw.Write( (uint) 0 );
+		bw.Write( m_changed.Count );
+		foreach( Record rec in m_changed.Values ) {
+			write_record( bw, rec );
+		}
+		bw.Flush();
+
+		// record is prefixed by size and checksum
+		byte[] data = ms.GetBuffer();
+		int size = (int) ms.Length - 8;
+
+		BitConverter.GetBytes( size ).CopyTo( data, 0 );
+		BitConverter.GetBytes( checksum( data, 8, size ) ).CopyTo( data, 4 );
+
+		// the whole record is written at once
+		m_log.Write( data, 0, (int) ms.Length );
+		m_log.Flush();
+	}
+
+	// write all objects to the new checkpoint and start new log
+	private void checkpoint()
+	{
+		string path = Path.Combine( m_path, CHECKPOINT );
+		string temp = path + TEMP;
+
+		using( FileStream file = new FileStream( temp, FileMode.Create, FileAccess.Write,
+												 FileShare.None, 64 * 1024, FileOptions.WriteThrough ) ) {
+			BinaryWriter bw = new BinaryWriter( file );
+
+			bw.Write( SIGNATURE );
+			bw.Write( m_generation + 1 );
+			bw.Write( LastID );
+			bw.Write( Records.Count );
+			foreach( Record rec in Records ) {
+				write_record( bw, rec );
+			}
+			bw.Write( SIGNATURE );
+			bw.Flush();
+		}
+		// checkpoint is replaced at once: log of previous generation
+		// is ignored after that
+		if( File.Exists( path ) ) {
+			File.Replace( temp, path, null );
+		} else {
+			File.Move( temp, path );
+		}
+		m_generation++;
+		open_log( -1 );
+
+		// remove files of contents that aren't stored anymore
+		Dictionary<string, bool> stored = new Dictionary<string, bool>();
+		foreach( Blob blob in Blobs ) {
+			stored[blob_path( blob.Hash )] = true;
+		}
+		foreach( string file in Directory.GetFiles( m_blobs ) ) {
+			if( !stored.ContainsKey( file ) && (Path.GetExtension( file ) != UPLOAD) ) {
+				delete( file );
+			}
+		}
+	}
+
+	// delete file that can be used now
+	private static void delete( string path )
+	{
+		try {
+			File.Delete( path );
+		} catch( IOException ) {
+		} catch( UnauthorizedAccessException ) {
+		}
+	}
+	#endregion
+
+	///////////////////////////////////////////////////////////////////////
+	//						Internal Section
+	///////////////////////////////////////////////////////////////////////
+	// collect changed objects
+	internal override void changed( Record rec )
+	{
+		m_changed[rec.Header.ID] = rec;
+	}
+
+	// write changed objects to the log
+	internal override void committed()
+	{
+		if( m_log == null ) throw new ObjectDisposedException( GetType().Name, ERROR_CLOSED );
+
+		if( m_changed.Count > 0 ) append_log();
+		m_changed.Clear();
+
+		// changes are in the log already, so checkpoint error
+		// doesn't revert them: checkpoint is repeated on next commit
+		if( m_log.Length >= m_checkpointSize ) {
+			try {
+				checkpoint();
+			} catch( IOException ) {
+			} catch( UnauthorizedAccessException ) {
+			}
+		}
+	}
+
+	// forget changes that were reverted
+	internal override void reverted()
+	{
+		m_changed.Clear();
+	}
+
+	// store content in the file (existing file has the same content)
+	internal override Blob create_blob( byte[] hash, Stream stream )
+	{
+		string path = blob_path( hash );
+
+		if( !File.Exists( path ) ) {
+			string temp = path + TEMP;
+			byte[] buffer = new byte[64 * 1024];
+
+			using( FileStream file = new FileStream( temp, FileMode.Create, FileAccess.Write,
+													 FileShare.None, buffer.Length, FileOptions.WriteThrough ) ) {
+				stream.Seek( 0, SeekOrigin.Begin );
+				for( int read; (read = stream.Read( buffer, 0, buffer.Length )) > 0; ) {
+					file.Write( buffer, 0, read );
+				}
+			}
+			File.Move( temp, path );
+		}
+		return new FileBlob( hash, path );
+	}
+
+	// upload content to the temporary file
+	internal override Stream create_upload( byte[] hash )
+	{
+		return new FileStream( blob_path( hash ) + "." + Guid.NewGuid().ToString( "N" ) + UPLOAD,
+							   FileMode.Create, FileAccess.ReadWrite, FileShare.None,
+							   4096, FileOptions.DeleteOnClose );
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	//						Public Section
+	///////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// Opens storage in the specified directory.
+	/// </summary>
+	/// <remarks>
+	/// Directory is created if it doesn't exist. Objects are loaded from the
+	/// last checkpoint and log.
+	/// </remarks>
+	/// <param name="path">Path of the storage directory.</param>
+	public FileStorage( string path )
+	{
+		// check for null reference
+		if( path == null ) throw new ArgumentNullException( "path" );
+
+		m_path = Path.GetFullPath( path );
+		m_blobs = Path.Combine( m_path, BLOBS );
+		Directory.CreateDirectory( m_blobs );
+
+		// remove files that weren't completed before close
+		delete( Path.Combine( m_path, CHECKPOINT + TEMP ) );
+		foreach( string file in Directory.GetFiles( m_blobs ) ) {
+			if( (Path.GetExtension( file ) == TEMP) || (Path.GetExtension( file ) == UPLOAD) ) {
+				delete( file );
+			}
+		}
+
+		lock( SyncRoot ) {
+			load_checkpoint();
+			open_log( load_log() );
+
+			// loaded objects aren't changes
+			m_changed.Clear();
+		}
+	}
+
+	/// <summary>
+	/// Gets or sets length of log that causes checkpoint.
+	/// </summary>
+	public long CheckpointSize
+	{
+		get { lock( SyncRoot ) { return m_checkpointSize; } }
+		set {
+			// check for right value
+			if( value <= 0 ) throw new ArgumentOutOfRangeException( "value" );
+
+			lock( SyncRoot ) { m_checkpointSize = value; }
+		}
+	}
+
+	/// <summary>
+	/// Writes all objects to the new checkpoint and starts new log.
+	/// </summary>
+	public void Checkpoint()
+	{
+		lock( SyncRoot ) {
+			if( m_log == null ) throw new ObjectDisposedException( GetType().Name, ERROR_CLOSED );
+			if( InTransaction ) throw new InvalidOperationException( ERROR_IN_TRANSACTION );
+
+			checkpoint();
+		}
+	}
+
+	/// <summary>
+	/// Closes storage files.
+	/// </summary>
+	/// <remarks>
+	/// Checkpoint is made if there is no opened transaction, so storage is
+	/// opened faster next time. Unfinished uploads are removed.
+	/// </remarks>
+	public void Close()
+	{
+		lock( SyncRoot ) {
+			if( m_log == null ) return;
+
+			try {
+				if( !InTransaction ) checkpoint();
+			} finally {
+				m_log.Close();
+				m_log = null;
+				// remove temporary files of unfinished uploads
+				drop_uploads( DateTime.MaxValue );
+			}
+		}
+	}
+
+	#region IDisposable Members
+	/// <summary>
+	/// Closes storage files.
+	/// </summary>
+	public void Dispose()
+	{
+		Close();
+	}
+	#endregion
+}
+}
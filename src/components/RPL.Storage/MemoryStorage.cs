@@ -0,0 +1,1472 @@
+//****************************************************************************
+//*
+//*	Project		:	Robust Persistence Layer
+//*
+//*	Module		:	MemoryStorage.cs
+//*
+//*	Content		:	Implements in-memory storage of persistent objects
+//*	Author		:	Oleksii Tkachuk
+//*	Copyright	:	Copyright © 2013 Oleksii Tkachuk
+//*
+//*	Implement Search, Retrive, Save, Delete of PersistentObject in memory
+//*
+//****************************************************************************
+
+using System;
+using System.IO;
+using System.Data;
+using System.Collections.Generic;
+using System.Security.Cryptography;
+using System.Text;
+using System.Text.RegularExpressions;
+
+
+namespace Toolkit.RPL.Storage
+{
+/// <summary>
+/// In-memory storage implementation.
+/// </summary>
+/// <remarks>
+/// Storage keeps objects in the process memory, so it can be used by tests,
+/// benchmarks of broker, cache, criterias and transactions, and by embedded
+/// applications without database. Semantic follows ODB: search conditions are
+/// evaluated in the same way as by Evaluator for objects in memory, stamps are
+/// checked on save and delete, object that is parent of links can't be deleted
+/// and equal stream contents are stored once. Objects are indexed by ID, by type
+/// and by names and values of properties, so comparisons of property values are
+/// found without check of all objects. Nested transactions are supported:
+/// rollback reverts all changes made after the corresponding TransactionBegin.
+/// </remarks>
+public class MemoryStorage : IPersistenceStorage
+{
+	// stored object: header, property values and links
+	internal class Record
+	{
+		public HEADER Header;
+		public readonly Dictionary<string, object> Props = new Dictionary<string, object>();
+		public readonly List<int> Children = new List<int>();
+		public readonly List<int> Parents = new List<int>();
+
+		public Record( HEADER header )
+		{
+			Header = header;
+		}
+	}
+
+	// content of stream properties (shared by all properties
+	// with the same content)
+	internal class Blob
+	{
+		public readonly byte[] Hash;
+		public int Links = 0;
+		private readonly byte[] m_data;
+
+		public Blob( byte[] hash, byte[] data )
+		{
+			Hash = hash;
+			m_data = data;
+		}
+
+		public virtual long Length
+		{
+			get { return m_data.Length; }
+		}
+
+		// read range of the content (shorter then requested at the end)
+		public virtual byte[] Read( long offset, int count )
+		{
+			byte[] data = new byte[(offset < Length) ? Math.Min( count, Length - offset ) : 0];
+
+			if( data.Length > 0 ) Array.Copy( m_data, offset, data, 0, data.Length );
+			return data;
+		}
+
+		// create new stream with the content
+		public virtual PersistentStream Open()
+		{
+			return new PersistentStream( m_data );
+		}
+	}
+
+	// content that is uploaded by ranges and time of the last write
+	private class Upload
+	{
+		public readonly Stream Stream;
+		public DateTime Written = DateTime.UtcNow;
+
+		public Upload( Stream stream )
+		{
+			Stream = stream;
+		}
+	}
+
+	// property value in the index
+	private struct Entry
+	{
+		public readonly object Value;
+		public readonly Record Record;
+
+		public Entry( object value, Record rec )
+		{
+			Value = value;
+			Record = rec;
+		}
+	}
+
+	// objects that have property with the same name: all of them and
+	// ones with comparable values sorted by kind of value, value and ID
+	private class Index : IComparer<Entry>
+	{
+		public readonly Dictionary<int, Record> Objects = new Dictionary<int, Record>();
+		private readonly List<Entry> m_values = new List<Entry>();
+
+		public void Add( Record rec, object value )
+		{
+			Objects.Add( rec.Header.ID, rec );
+			if( value is IComparable ) {
+				Entry entry = new Entry( value, rec );
+				m_values.Insert( ~m_values.BinarySearch( entry, this ), entry );
+			}
+		}
+
+		public void Remove( Record rec, object value )
+		{
+			Objects.Remove( rec.Header.ID );
+			if( value is IComparable ) {
+				m_values.RemoveAt( m_values.BinarySearch( new Entry( value, rec ), this ) );
+			}
+		}
+
+		public int Compare( Entry x, Entry y )
+		{
+			int result = string.CompareOrdinal( kind_of( x.Value ), kind_of( y.Value ) );
+
+			if( result == 0 ) compare( x.Value, y.Value, out result );
+			return (result != 0) ? result : x.Record.Header.ID.CompareTo( y.Record.Header.ID );
+		}
+
+		// return position of the first value of specified kind that is not
+		// less (greater if strict) then specified one (null value means
+		// any value of the kind)
+		private int bound( string kind, object value, bool strict )
+		{
+			int lo = 0;
+			int hi = m_values.Count;
+
+			while( lo < hi ) {
+				int mid = lo + (hi - lo) / 2;
+				int result = string.CompareOrdinal( kind_of( m_values[mid].Value ), kind );
+
+				if( (result == 0) && (value != null) ) compare( m_values[mid].Value, value, out result );
+				if( (result < 0) || ((result == 0) && strict) ) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+			return lo;
+		}
+
+		// return objects with values that satisfy comparison (only values
+		// of the same kind can satisfy it)
+		public List<Record> Find( Where.Clause.OP op, object value )
+		{
+			string kind = kind_of( value );
+			int from = bound( kind, null, false );
+			int to = bound( kind, null, true );
+
+			switch( op ) {
+				case Where.Clause.OP.EQ:
+					from = bound( kind, value, false );
+					to = bound( kind, value, true );
+					break;
+				case Where.Clause.OP.GT:
+					from = bound( kind, value, true );
+					break;
+				case Where.Clause.OP.GE:
+					from = bound( kind, value, false );
+					break;
+				case Where.Clause.OP.LT:
+					to = bound( kind, value, false );
+					break;
+				case Where.Clause.OP.LE:
+					to = bound( kind, value, true );
+					break;
+			}
+
+			List<Record> result = new List<Record>( Math.Max( to - from, 0 ) );
+			for( int i = from; i < to; i++ ) {
+				result.Add( m_values[i].Record );
+			}
+			return result;
+		}
+	}
+
+	// compares records by ORDER BY clause (missing values and stream
+	// contents precede all others, ties are ordered by ID)
+	private class Order : IComparer<Record>
+	{
+		private readonly string[] m_opds;
+		private readonly bool[] m_asc;
+
+		// get value of operand to order by (false means no value)
+		private static bool value_of( Record rec, string opd, out object value )
+		{
+			return get_value( rec, opd, out value ) && !(value is Blob);
+		}
+
+		// compare values of i-th clause (null means no value)
+		private int compare_at( int i, object vx, object vy )
+		{
+			int result = 0;
+
+			if( (vx == null) || (vy == null) ) {
+				// missing value is less than any other
+				result = ((vx != null) ? 1 : 0) - ((vy != null) ? 1 : 0);
+			} else if( !compare( vx, vy, out result ) ) {
+				// values can't be compared, so order them by type
+				result = string.CompareOrdinal( type_of( vx ), type_of( vy ) );
+			}
+			return m_asc[i] ? result : -result;
+		}
+
+		public Order( OrderBy order )
+		{
+			List<string> opds = new List<string>();
+			List<bool> asc = new List<bool>();
+
+			if( order != null ) {
+				foreach( OrderBy.Clause clause in order ) {
+					opds.Add( clause.OPD );
+					asc.Add( clause.Sort == OrderBy.Clause.SORT.ASC );
+				}
+			}
+			m_opds = opds.ToArray();
+			m_asc = asc.ToArray();
+		}
+
+		public bool IsEmpty
+		{
+			get { return m_opds.Length == 0; }
+		}
+
+		// return keyset of the record: values of every clause (DBNull
+		// for missing ones) followed by object ID
+		public ValueBox[] KeyOf( Record rec )
+		{
+			ValueBox[] key = new ValueBox[m_opds.Length + 1];
+
+			for( int i = 0; i < m_opds.Length; i++ ) {
+				object value;
+
+				key[i] = new ValueBox( value_of( rec, m_opds[i], out value ) ? value : DBNull.Value );
+			}
+			key[m_opds.Length] = rec.Header.ID;
+
+			return key;
+		}
+
+		// compare record with keyset
+		public int Compare( Record x, ValueBox[] key )
+		{
+			if( key.Length != m_opds.Length + 1 ) {
+				throw new ArgumentException( ERROR_KEYSET, "after" );
+			}
+			for( int i = 0; i < m_opds.Length; i++ ) {
+				object vx, vy = key[i].ToObject();
+
+				if( !value_of( x, m_opds[i], out vx ) ) vx = null;
+				if( vy == DBNull.Value ) vy = null;
+
+				int result = compare_at( i, vx, vy );
+				if( result != 0 ) return result;
+			}
+			return x.Header.ID.CompareTo( (int) key[m_opds.Length] );
+		}
+
+		public int Compare( Record x, Record y )
+		{
+			for( int i = 0; i < m_opds.Length; i++ ) {
+				object vx, vy;
+
+				if( !value_of( x, m_opds[i], out vx ) ) vx = null;
+				if( !value_of( y, m_opds[i], out vy ) ) vy = null;
+
+				int result = compare_at( i, vx, vy );
+				if( result != 0 ) return result;
+			}
+			// records are equal, so order them by ID
+			return x.Header.ID.CompareTo( y.Header.ID );
+		}
+	}
+
+	// action that reverts one change of the storage
+	private delegate void Undo();
+
+	private readonly object m_sync = new object();
+	// stored objects by ID, by type and by names and values of their
+	// properties
+	private readonly Dictionary<int, Record> m_objects = new Dictionary<int, Record>();
+	private readonly Dictionary<string, SortedDictionary<int, Record>> m_types =
+		new Dictionary<string, SortedDictionary<int, Record>>();
+	private readonly Dictionary<string, Index> m_names = new Dictionary<string, Index>();
+	private int m_id = 0;
+	private DateTime m_stamp = DateTime.MinValue;
+	// stream contents by hash: linked to properties and uploaded ones
+	private readonly Dictionary<string, Blob> m_blobs = new Dictionary<string, Blob>();
+	private readonly Dictionary<string, Upload> m_uploads = new Dictionary<string, Upload>();
+	// uploads that are completed in opened transaction (they are closed
+	// when the outermost transaction is committed)
+	private readonly List<Upload> m_completed = new List<Upload>();
+	// unfinished uploads that are not continued during this time are
+	// removed at start of new upload
+	private const int UPLOAD_TIMEOUT_HOURS = 24;
+	// undo log of opened transactions and it's length at the begin
+	// of every nested transaction
+	private readonly List<Undo> m_undo = new List<Undo>();
+	private readonly Stack<int> m_marks = new Stack<int>();
+	private bool m_reverting = false;
+	// compiled LIKE patterns
+	private const int LIKE_CACHE_SIZE = 1024;
+	private readonly Dictionary<string, Regex> m_likes = new Dictionary<string, Regex>();
+
+	#region error messages
+	private static string ERROR_CHANGED_OBJECT = "Newer object exist. Please retrive object first!";
+	private static string ERROR_IMAGE_IS_ABSENT = "Specified value is absent!";
+	private static string ERROR_BLOB_HASH = "Uploaded content doesn't match specified hash!";
+	private static string ERROR_OBJECT_IS_ABSENT = "Object with id = {0} doesn't exist in storage!";
+	private static string ERROR_OBJECT_IS_PARENT = "Object with id = {0} has links to other objects!";
+	private static string ERROR_NO_TRANSACTION = "There is no opened transaction!";
+	private static string ERROR_SQL = "SQL requests are not supported by in-memory storage!";
+	private static string ERROR_KEYSET = "Keyset doesn't match specified OrderBy!";
+	#endregion
+
+	///////////////////////////////////////////////////////////////////////
+	//						Private Section
+	///////////////////////////////////////////////////////////////////////
+	// return stored object with specified ID
+	private Record get_record( int id )
+	{
+		Record rec;
+
+		if( !m_objects.TryGetValue( id, out rec ) ) {
+			throw new ArgumentException( string.Format( ERROR_OBJECT_IS_ABSENT, id ) );
+		}
+		return rec;
+	}
+
+	// raise error if stored object is newer then specified stamp
+	private static void check_stamp( Record rec, DateTime stamp )
+	{
+		if( rec.Header.Stamp > stamp ) throw new DBConcurrencyException( ERROR_CHANGED_OBJECT );
+	}
+
+	// return new stamp (stamps are unique and always grow)
+	private DateTime next_stamp()
+	{
+		DateTime stamp = DateTime.Now;
+
+		if( stamp <= m_stamp ) stamp = m_stamp.AddTicks( 1 );
+		m_stamp = stamp;
+
+		return stamp;
+	}
+
+	// save action that reverts change if transaction is opened
+	private void log( Undo undo )
+	{
+		if( !m_reverting && (m_marks.Count > 0) ) m_undo.Add( undo );
+	}
+
+	// revert changes that were made after specified length of undo log
+	private void revert( int mark )
+	{
+		m_reverting = true;
+		try {
+			for( int i = m_undo.Count - 1; i >= mark; i-- ) {
+				m_undo[i]();
+			}
+		} finally {
+			m_reverting = false;
+			m_undo.RemoveRange( mark, m_undo.Count - mark );
+		}
+	}
+
+	#region changes of stored data
+	// add object to storage and it's indexes
+	private void insert( Record rec )
+	{
+		SortedDictionary<int, Record> objects;
+
+		if( !m_types.TryGetValue( rec.Header.Type, out objects ) ) {
+			objects = new SortedDictionary<int, Record>();
+			m_types.Add( rec.Header.Type, objects );
+		}
+		objects.Add( rec.Header.ID, rec );
+		m_objects.Add( rec.Header.ID, rec );
+
+		changed( rec );
+		log( delegate { remove( rec ); } );
+	}
+
+	// remove object (without properties and links) from storage
+	private void remove( Record rec )
+	{
+		m_objects.Remove( rec.Header.ID );
+		m_types[rec.Header.Type].Remove( rec.Header.ID );
+
+		changed( rec );
+		log( delegate { insert( rec ); } );
+	}
+
+	// set header of stored object
+	private void set_header( Record rec, HEADER header )
+	{
+		HEADER old = rec.Header;
+
+		rec.Header = header;
+
+		changed( rec );
+		log( delegate { set_header( rec, old ); } );
+	}
+
+	// set name and new stamp of stored object
+	private void touch( Record rec, string name )
+	{
+		set_header( rec, new HEADER( rec.Header.Type, rec.Header.ID, next_stamp(), name ) );
+	}
+
+	// set property value of stored object (null value deletes property)
+	private void set_property( Record rec, string name, object value )
+	{
+		object old;
+		bool exists = rec.Props.TryGetValue( name, out old );
+
+		if( !exists && (value == null) ) return;
+
+		if( exists ) {
+			release( old );
+			rec.Props.Remove( name );
+			m_names[name].Remove( rec, old );
+		}
+		if( value != null ) {
+			Index index;
+
+			if( !m_names.TryGetValue( name, out index ) ) {
+				index = new Index();
+				m_names.Add( name, index );
+			}
+			index.Add( rec, value );
+			rec.Props.Add( name, value );
+			acquire( value );
+		}
+
+		changed( rec );
+		log( delegate { set_property( rec, name, exists ? old : null ); } );
+	}
+
+	// add or remove link between stored objects
+	private void set_link( Record parent, Record child, bool linked )
+	{
+		if( parent.Children.Contains( child.Header.ID ) == linked ) return;
+
+		if( linked ) {
+			parent.Children.Add( child.Header.ID );
+			child.Parents.Add( parent.Header.ID );
+		} else {
+			parent.Children.Remove( child.Header.ID );
+			child.Parents.Remove( parent.Header.ID );
+		}
+
+		changed( parent );
+		log( delegate { set_link( parent, child, !linked ); } );
+	}
+
+	// count link of property to stream content
+	private void acquire( object value )
+	{
+		Blob blob = value as Blob;
+
+		if( blob == null ) return;
+		if( blob.Links++ == 0 ) m_blobs[Convert.ToBase64String( blob.Hash )] = blob;
+	}
+
+	// remove link of property to stream content (content is removed
+	// with the last link)
+	private void release( object value )
+	{
+		Blob blob = value as Blob;
+
+		if( blob == null ) return;
+		if( --blob.Links == 0 ) m_blobs.Remove( Convert.ToBase64String( blob.Hash ) );
+	}
+	#endregion
+
+	#region conversion of property values
+	// return stored content with specified hash (null if there is no
+	// such content)
+	internal Blob get_blob( byte[] hash )
+	{
+		Blob blob;
+
+		return m_blobs.TryGetValue( Convert.ToBase64String( hash ), out blob ) ? blob : null;
+	}
+
+	// convert property value to stored one: streams are replaced by
+	// stored contents
+	private object to_stored( ValueBox value )
+	{
+		PersistentStream stream = value.ToObject() as PersistentStream;
+
+		if( stream == null ) return value.ToObject();
+
+		Blob blob = get_blob( stream.Hash );
+
+		return (blob != null) ? blob : create_blob( (byte[]) stream.Hash.Clone(), stream );
+	}
+
+	// convert stored value to property one
+	private static ValueBox to_value( object stored )
+	{
+		Blob blob = stored as Blob;
+
+		return new ValueBox( (blob == null) ? stored : blob.Open() );
+	}
+	#endregion
+
+	#region evaluation of Where and OrderBy
+	// get value of specified operand: ID, Name and Stamp are header
+	// fields, others are properties (false means no value)
+	private static bool get_value( Record rec, string opd, out object value )
+	{
+		switch( opd ) {
+			case "ID":
+				value = rec.Header.ID;
+				break;
+			case "Name":
+				value = rec.Header.Name;
+				break;
+			case "Stamp":
+				value = rec.Header.Stamp;
+				break;
+			default:
+				if( !rec.Props.TryGetValue( opd, out value ) ) value = null;
+				break;
+		}
+		// DBNull value means missing property
+		if( value == DBNull.Value ) value = null;
+
+		return value != null;
+	}
+
+	// return name of value type (stream contents are streams)
+	private static string type_of( object value )
+	{
+		return (value is Blob) ? typeof(PersistentStream).FullName : value.GetType().FullName;
+	}
+
+	// return kind of value in the index (int and double values are
+	// compared as numbers, so they are of the same kind)
+	private static string kind_of( object value )
+	{
+		return ((value is int) || (value is double)) ? "number" : type_of( value );
+	}
+
+	// compare two values: strings are compared without case, int and
+	// double values are compared as numbers (false means values can't
+	// be compared)
+	private static bool compare( object x, object y, out int result )
+	{
+		Type tx = x.GetType();
+		Type ty = y.GetType();
+
+		result = 0;
+		if( tx == ty ) {
+			// strings are compared without case
+			if( tx == typeof(string) ) {
+				result = string.Compare( (string) x, (string) y,
+										 StringComparison.CurrentCultureIgnoreCase );
+				return true;
+			}
+			// stream contents and other types without order
+			IComparable c = x as IComparable;
+			if( c == null ) return false;
+
+			result = c.CompareTo( y );
+			return true;
+		}
+		// numbers of different types
+		if( ((tx == typeof(int)) || (tx == typeof(double))) &&
+			((ty == typeof(int)) || (ty == typeof(double))) ) {
+			result = Convert.ToDouble( x ).CompareTo( Convert.ToDouble( y ) );
+			return true;
+		}
+		return false;
+	}
+
+	// return compiled LIKE pattern: "%" matches any string, "_" matches
+	// any character
+	private Regex get_like( string like )
+	{
+		Regex regex;
+
+		if( m_likes.TryGetValue( like, out regex ) ) return regex;
+
+		StringBuilder sb = new StringBuilder( "^" );
+		foreach( char c in like ) {
+			switch( c ) {
+				case '%': sb.Append( ".*" ); break;
+				case '_': sb.Append( "." ); break;
+				default: sb.Append( Regex.Escape( c.ToString() ) ); break;
+			}
+		}
+		regex = new Regex( sb.Append( "$" ).ToString(),
+						   RegexOptions.IgnoreCase | RegexOptions.Singleline |
+						   RegexOptions.CultureInvariant );
+
+		if( m_likes.Count >= LIKE_CACHE_SIZE ) m_likes.Clear();
+		m_likes.Add( like, regex );
+
+		return regex;
+	}
+
+	// check stored object against the simple predicate
+	private bool match( Where.Clause clause, Record rec )
+	{
+		object prop;
+		object value = clause.Value.ToObject();
+		bool found = get_value( rec, clause.OPD, out prop );
+		int result;
+
+		// DBNull condition checks property existence
+		if( value == DBNull.Value ) {
+			return (clause.Operator == Where.Clause.OP.EQ) ? !found : found;
+		}
+		// missing properties and streams satisfy no conditions
+		if( !found || (prop is Blob) ) return false;
+
+		switch( clause.Operator ) {
+			case Where.Clause.OP.EQ:
+				// equality for string means LIKE
+				if( value is string ) {
+					return (prop is string) && get_like( (string) value ).IsMatch( (string) prop );
+				}
+				return compare( prop, value, out result ) && (result == 0);
+			case Where.Clause.OP.NE:
+				return !(compare( prop, value, out result ) && (result == 0));
+			case Where.Clause.OP.GT:
+				return compare( prop, value, out result ) && (result > 0);
+			case Where.Clause.OP.LT:
+				return compare( prop, value, out result ) && (result < 0);
+			case Where.Clause.OP.GE:
+				return compare( prop, value, out result ) && (result >= 0);
+			case Where.Clause.OP.LE:
+				return compare( prop, value, out result ) && (result <= 0);
+		}
+		return false;
+	}
+
+	// check stored object against Where
+	private bool match( Where where, Record rec )
+	{
+		if( where is Where.Clause ) {
+			return match( (Where.Clause) where, rec );
+		} else if( where is Where.Operation.And ) {
+			return match( ((Where.Operation.And) where).LeftWhere, rec ) &&
+				   match( ((Where.Operation.And) where).RightWhere, rec );
+		} else if( where is Where.Operation.Or ) {
+			return match( ((Where.Operation.Or) where).LeftWhere, rec ) ||
+				   match( ((Where.Operation.Or) where).RightWhere, rec );
+		} else if( where is Where.Operation.Not ) {
+			return !match( ((Where.Operation.Not) where).SubWhere, rec );
+		}
+		throw new ArgumentException( "Unknown condition type: " + where.GetType(), "where" );
+	}
+
+	// return objects that can satisfy Where (superset of found objects)
+	// by using indexes (null means all objects of requested type)
+	private ICollection<Record> candidates( Where where )
+	{
+		if( where is Where.Clause ) {
+			Where.Clause clause = (Where.Clause) where;
+			object value = clause.Value.ToObject();
+
+			// object with specified ID
+			if( (clause.OPD == "ID") && (clause.Operator == Where.Clause.OP.EQ) && (value is int) ) {
+				Record rec;
+				return m_objects.TryGetValue( (int) value, out rec ) ?
+					   new Record[] { rec } : new Record[0];
+			}
+			// other header fields and property absence are not indexed
+			if( (clause.OPD == "ID") || (clause.OPD == "Name") || (clause.OPD == "Stamp") ||
+				((value == DBNull.Value) && (clause.Operator == Where.Clause.OP.EQ)) ) {
+				return null;
+			}
+			// all other conditions require property existence
+			Index index;
+			if( !m_names.TryGetValue( clause.OPD, out index ) ) return new Record[0];
+
+			// LIKE and inequality are checked for every object that has
+			// property, other comparisons are found by values
+			if( (value == DBNull.Value) || (clause.Operator == Where.Clause.OP.NE) ||
+				((clause.Operator == Where.Clause.OP.EQ) && (value is string)) ) {
+				return index.Objects.Values;
+			}
+			return index.Find( clause.Operator, value );
+		} else if( where is Where.Operation.And ) {
+			ICollection<Record> left = candidates( ((Where.Operation.And) where).LeftWhere );
+			ICollection<Record> right = candidates( ((Where.Operation.And) where).RightWhere );
+
+			// both conditions must be satisfied: use smaller set
+			if( left == null ) return right;
+			if( right == null ) return left;
+			return (left.Count <= right.Count) ? left : right;
+		} else if( where is Where.Operation.Or ) {
+			ICollection<Record> left = candidates( ((Where.Operation.Or) where).LeftWhere );
+			ICollection<Record> right = candidates( ((Where.Operation.Or) where).RightWhere );
+
+			// either condition can be satisfied: use union of sets
+			if( (left == null) || (right == null) ) return null;
+
+			Dictionary<int, Record> union = new Dictionary<int, Record>();
+			foreach( Record rec in left ) union[rec.Header.ID] = rec;
+			foreach( Record rec in right ) union[rec.Header.ID] = rec;
+			return union.Values;
+		}
+		return null;
+	}
+
+	// find objects of specified type that satisfy Where and sort them
+	private List<Record> find( string type, Where where, Order order )
+	{
+		List<Record> result = new List<Record>();
+		SortedDictionary<int, Record> objects;
+
+		if( !m_types.TryGetValue( type, out objects ) ) return result;
+
+		ICollection<Record> recs = (where == null) ? null : candidates( where );
+		if( (recs != null) && (recs.Count < objects.Count) ) {
+			// check objects found by index
+			foreach( Record rec in recs ) {
+				if( (rec.Header.Type == type) && match( where, rec ) ) result.Add( rec );
+			}
+			result.Sort( order );
+		} else {
+			// check all objects of requested type (they are sorted by ID)
+			foreach( Record rec in objects.Values ) {
+				if( (where == null) || match( where, rec ) ) result.Add( rec );
+			}
+			if( !order.IsEmpty ) result.Sort( order );
+		}
+		return result;
+	}
+
+	// return headers of specified range of objects
+	private static HEADER[] headers_of( List<Record> recs, int bottom, int count )
+	{
+		int from = Math.Min( Math.Max( bottom, 0 ), recs.Count );
+		int length = (int) Math.Min( Math.Max( (long) count, 0 ), recs.Count - from );
+
+		HEADER[] result = new HEADER[length];
+		for( int i = 0; i < length; i++ ) {
+			result[i] = recs[from + i].Header;
+		}
+		return result;
+	}
+	#endregion
+
+	///////////////////////////////////////////////////////////////////////
+	//						Internal Section
+	///////////////////////////////////////////////////////////////////////
+	// storages that save objects (FileStorage) are notified about all
+	// changes and restore saved objects by the following members
+
+	// object which is locked by every request
+	internal object SyncRoot
+	{
+		get { return m_sync; }
+	}
+
+	// stored objects
+	internal ICollection<Record> Records
+	{
+		get { return m_objects.Values; }
+	}
+
+	// stored stream contents
+	internal ICollection<Blob> Blobs
+	{
+		get { return m_blobs.Values; }
+	}
+
+	// the last ID given to new object
+	internal int LastID
+	{
+		get { return m_id; }
+		set { m_id = Math.Max( m_id, value ); }
+	}
+
+	// true if transaction is opened
+	internal bool InTransaction
+	{
+		get { return m_marks.Count > 0; }
+	}
+
+	// true if object wasn't removed from storage
+	internal bool contains( Record rec )
+	{
+		Record stored;
+
+		return m_objects.TryGetValue( rec.Header.ID, out stored ) && (stored == rec);
+	}
+
+	// called when stored object is changed
+	internal virtual void changed( Record rec )
+	{
+	}
+
+	// called when changes of the outermost transaction are committed
+	// (exception reverts them)
+	internal virtual void committed()
+	{
+	}
+
+	// called when changes of the outermost transaction are reverted
+	internal virtual void reverted()
+	{
+	}
+
+	// create stored content from the stream (content is read from the
+	// begin of the stream)
+	internal virtual Blob create_blob( byte[] hash, Stream stream )
+	{
+		byte[] data = new byte[stream.Length];
+
+		stream.Seek( 0, SeekOrigin.Begin );
+		for( int offset = 0; offset < data.Length; ) {
+			int read = stream.Read( data, offset, data.Length - offset );
+			if( read == 0 ) break;
+			offset += read;
+		}
+		return new Blob( hash, data );
+	}
+
+	// create stream for content that is uploaded by ranges
+	internal virtual Stream create_upload( byte[] hash )
+	{
+		return new MemoryStream();
+	}
+
+	// close and remove unfinished uploads that are not written since
+	// specified time
+	internal void drop_uploads( DateTime written )
+	{
+		foreach( KeyValuePair<string, Upload> pair in new List<KeyValuePair<string, Upload>>( m_uploads ) ) {
+			if( pair.Value.Written < written ) {
+				m_uploads.Remove( pair.Key );
+				pair.Value.Stream.Close();
+			}
+		}
+	}
+
+	// replace stored object by specified header and properties
+	internal void load( HEADER header, IDictionary<string, object> props )
+	{
+		Record rec;
+
+		if( m_objects.TryGetValue( header.ID, out rec ) ) {
+			set_header( rec, header );
+		} else {
+			rec = new Record( header );
+			insert( rec );
+		}
+		foreach( string name in new List<string>( rec.Props.Keys ) ) {
+			if( !props.ContainsKey( name ) ) set_property( rec, name, null );
+		}
+		foreach( KeyValuePair<string, object> prop in props ) {
+			set_property( rec, prop.Key, prop.Value );
+		}
+
+		LastID = header.ID;
+		if( header.Stamp > m_stamp ) m_stamp = header.Stamp;
+	}
+
+	// replace links of stored object
+	internal void load( int id, int[] children )
+	{
+		Record rec = get_record( id );
+
+		foreach( int child in rec.Children.ToArray() ) {
+			if( Array.IndexOf( children, child ) < 0 ) set_link( rec, m_objects[child], false );
+		}
+		foreach( int child in children ) {
+			set_link( rec, get_record( child ), true );
+		}
+	}
+
+	// remove stored object with it's properties and links
+	internal void unload( int id )
+	{
+		Record rec;
+
+		LastID = id;
+		if( !m_objects.TryGetValue( id, out rec ) ) return;
+
+		foreach( int child in rec.Children.ToArray() ) {
+			set_link( rec, m_objects[child], false );
+		}
+		foreach( int parent in rec.Parents.ToArray() ) {
+			set_link( m_objects[parent], rec, false );
+		}
+		foreach( string name in new List<string>( rec.Props.Keys ) ) {
+			set_property( rec, name, null );
+		}
+		remove( rec );
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	//						Public Section
+	///////////////////////////////////////////////////////////////////////
+	/// <summary>
+	/// Default public constructor
+	/// </summary>
+	public MemoryStorage()
+	{
+	}
+
+	/// <summary>
+	/// Gets count of stored objects.
+	/// </summary>
+	public int ObjectsCount
+	{
+		get { lock( m_sync ) { return m_objects.Count; } }
+	}
+
+	/// <summary>
+	/// Gets count of stored stream contents.
+	/// </summary>
+	public int BlobsCount
+	{
+		get { lock( m_sync ) { return m_blobs.Count; } }
+	}
+
+	#region IPersistenceStorage Members
+	/// <summary>
+	/// Delete object with specified header from storage.
+	/// </summary>
+	/// <param name="header">Header value.</param>
+	public void Delete( HEADER header )
+	{
+		lock( m_sync ) {
+			TransactionBegin();
+			try {
+				Record rec;
+
+				// nothing to delete
+				if( m_objects.TryGetValue( header.ID, out rec ) ) {
+					check_stamp( rec, header.Stamp );
+					if( rec.Children.Count > 0 ) {
+						throw new InvalidOperationException(
+							string.Format( ERROR_OBJECT_IS_PARENT, header.ID ) );
+					}
+					// remove links to object (parents are changed)
+					foreach( int id in rec.Parents.ToArray() ) {
+						Record parent = m_objects[id];
+
+						set_link( parent, rec, false );
+						touch( parent, parent.Header.Name );
+					}
+					// remove properties
+					foreach( string name in new List<string>( rec.Props.Keys ) ) {
+						set_property( rec, name, null );
+					}
+					remove( rec );
+				}
+			} catch {
+				// rollback failed transaction
+				TransactionRollback();
+				throw;
+			}
+			TransactionCommit();
+		}
+	}
+
+	/// <summary>
+	/// Opens content of stream property for reading by ranges.
+	/// </summary>
+	/// <param name="header">Header of the owner object.</param>
+	/// <param name="name">Name of the stream property.</param>
+	/// <param name="hash">Hash of the content.</param>
+	/// <returns>Length of the content.</returns>
+	public long OpenBlob( HEADER header, string name, out byte[] hash )
+	{
+		lock( m_sync ) {
+			object value;
+
+			if( !get_record( header.ID ).Props.TryGetValue( name, out value ) ||
+				!(value is Blob) ) {
+				throw new KeyNotFoundException( ERROR_IMAGE_IS_ABSENT );
+			}
+			hash = (byte[]) ((Blob) value).Hash.Clone();
+
+			return ((Blob) value).Length;
+		}
+	}
+
+	/// <summary>
+	/// Reads range of stream property content.
+	/// </summary>
+	/// <param name="header">Header of the owner object.</param>
+	/// <param name="name">Name of the stream property.</param>
+	/// <param name="hash">Hash of the content (null for current content
+	/// of the property).</param>
+	/// <param name="offset">Position of the range.</param>
+	/// <param name="count">Maximum length of the range.</param>
+	/// <returns>Read data (shorter then requested at the end of content).</returns>
+	public byte[] ReadBlob( HEADER header, string name, byte[] hash, long offset, int count )
+	{
+		// check for right values
+		if( offset < 0 ) throw new ArgumentOutOfRangeException( "offset" );
+		if( count < 0 ) throw new ArgumentOutOfRangeException( "count" );
+
+		lock( m_sync ) {
+			object value = null;
+
+			if( hash != null ) {
+				// content is found by hash while it is stored (property
+				// could be changed after it was opened)
+				value = get_blob( hash );
+			} else {
+				get_record( header.ID ).Props.TryGetValue( name, out value );
+			}
+			if( !(value is Blob) ) throw new KeyNotFoundException( ERROR_IMAGE_IS_ABSENT );
+
+			// read only range that is in the content
+			return ((Blob) value).Read( offset, count );
+		}
+	}
+
+	/// <summary>
+	/// Writes range of the content with specified hash.
+	/// </summary>
+	/// <param name="hash">Hash of the whole content.</param>
+	/// <param name="offset">Position of the range.</param>
+	/// <param name="data">Data of the range.</param>
+	/// <returns>Length of the content stored for this hash.</returns>
+	public long WriteBlob( byte[] hash, long offset, byte[] data )
+	{
+		// check for right values
+		if( hash == null ) throw new ArgumentNullException( "hash" );
+		if( data == null ) throw new ArgumentNullException( "data" );
+		if( offset < 0 ) throw new ArgumentOutOfRangeException( "offset" );
+
+		lock( m_sync ) {
+			string key = Convert.ToBase64String( hash );
+			Blob blob;
+			Upload upload;
+
+			// content is stored already
+			if( m_blobs.TryGetValue( key, out blob ) ) return blob.Length;
+
+			if( !m_uploads.TryGetValue( key, out upload ) ) {
+				// new upload removes abandoned ones
+				drop_uploads( DateTime.UtcNow.AddHours( -UPLOAD_TIMEOUT_HOURS ) );
+				upload = new Upload( create_upload( hash ) );
+				m_uploads.Add( key, upload );
+			}
+			// write range if it follows uploaded data: content is
+			// replaced from the start of the range up to the end
+			if( offset <= upload.Stream.Length ) {
+				upload.Stream.SetLength( offset );
+				upload.Stream.Seek( offset, SeekOrigin.Begin );
+				upload.Stream.Write( data, 0, data.Length );
+				upload.Written = DateTime.UtcNow;
+			}
+			return upload.Stream.Length;
+		}
+	}
+
+	/// <summary>
+	/// Links written content with stream property of the object.
+	/// </summary>
+	/// <param name="header">In/Out header of the owner object.</param>
+	/// <param name="name">Name of the stream property.</param>
+	/// <param name="hash">Hash of the content.</param>
+	public void CommitBlob( ref HEADER header, string name, byte[] hash )
+	{
+		// check for right values
+		if( name == null ) throw new ArgumentNullException( "name" );
+		if( hash == null ) throw new ArgumentNullException( "hash" );
+
+		lock( m_sync ) {
+			TransactionBegin();
+			try {
+				Record rec = get_record( header.ID );
+				string key = Convert.ToBase64String( hash );
+				Blob blob;
+
+				check_stamp( rec, header.Stamp );
+				if( !m_blobs.TryGetValue( key, out blob ) ) {
+					Upload upload;
+
+					// content must be written first
+					if( !m_uploads.TryGetValue( key, out upload ) ) {
+						throw new KeyNotFoundException( ERROR_IMAGE_IS_ABSENT );
+					}
+					// check uploaded content
+					upload.Stream.Seek( 0, SeekOrigin.Begin );
+					if( Convert.ToBase64String( new SHA1Managed().ComputeHash( upload.Stream ) ) != key ) {
+						throw new InvalidDataException( ERROR_BLOB_HASH );
+					}
+					blob = create_blob( (byte[]) hash.Clone(), upload.Stream );
+
+					// complete upload (it is restored on rollback and
+					// closed on commit)
+					m_uploads.Remove( key );
+					m_completed.Add( upload );
+					log( delegate {
+						m_completed.Remove( upload );
+						m_uploads[key] = upload;
+					} );
+				}
+				set_property( rec, name, blob );
+				touch( rec, rec.Header.Name );
+
+				// return new stamp of the object
+				header = rec.Header;
+			} catch {
+				// rollback failed transaction
+				TransactionRollback();
+				throw;
+			}
+			TransactionCommit();
+		}
+	}
+
+	/// <summary>
+	/// Execute specified SQL request on the storage.
+	/// </summary>
+	/// <remarks>
+	/// SQL requests are not supported by this storage.
+	/// </remarks>
+	public DataSet ProcessSQL( string sql, object[] @params )
+	{
+		throw new NotSupportedException( ERROR_SQL );
+	}
+
+	/// <summary>
+	/// Retrieve object header from storage.
+	/// </summary>
+	/// <param name="header">In/Out header value.</param>
+	public void Retrieve( ref HEADER header )
+	{
+		lock( m_sync ) {
+			header = get_record( header.ID ).Header;
+		}
+	}
+
+	/// <summary>
+	/// Retrieve object header, links and properties.
+	/// </summary>
+	/// <param name="header">In/Out header value.</param>
+	/// <param name="links">Array of object links.</param>
+	/// <param name="props">Array of object properties.</param>
+	public void Retrieve( ref HEADER header, out LINK[] links,
+						  out PROPERTY[] props )
+	{
+		Retrieve( ref header, null, out links, out props );
+	}
+
+	/// <summary>
+	/// Retrieve object header, links and specified properties.
+	/// </summary>
+	/// <param name="header">In/Out header value.</param>
+	/// <param name="names">Names of properties to be retrieved (null
+	/// means all properties).</param>
+	/// <param name="links">Array of object links.</param>
+	/// <param name="props">Array of object properties.</param>
+	public void Retrieve( ref HEADER header, string[] names,
+						  out LINK[] links, out PROPERTY[] props )
+	{
+		// init out parameters
+		links = null;
+		props = null;
+
+		lock( m_sync ) {
+			Record rec = get_record( header.ID );
+
+			// object wasn't changed
+			if( header.Stamp == rec.Header.Stamp ) {
+				header = rec.Header;
+				return;
+			}
+
+			List<PROPERTY> _props = new List<PROPERTY>();
+			if( names == null ) {
+				foreach( KeyValuePair<string, object> prop in rec.Props ) {
+					_props.Add( new PROPERTY( prop.Key, to_value( prop.Value ), PROPERTY.STATE.New ) );
+				}
+			} else {
+				// only requested properties
+				foreach( string name in names ) {
+					object value;
+					if( rec.Props.TryGetValue( name, out value ) ) {
+						_props.Add( new PROPERTY( name, to_value( value ), PROPERTY.STATE.New ) );
+					}
+				}
+			}
+
+			LINK[] _links = new LINK[rec.Children.Count];
+			for( int i = 0; i < _links.Length; i++ ) {
+				_links[i] = new LINK( m_objects[rec.Children[i]].Header, LINK.STATE.New );
+			}
+
+			props = _props.ToArray();
+			links = _links;
+			header = rec.Header;
+		}
+	}
+
+	/// <summary>
+	/// Check stamps of the set of objects in one request.
+	/// </summary>
+	/// <param name="headers">Array of headers with known stamps.</param>
+	/// <returns>Array of current headers of outdated objects.</returns>
+	public HEADER[] Validate( HEADER[] headers )
+	{
+		List<HEADER> _headers = new List<HEADER>();	// list to store outdated headers
+
+		lock( m_sync ) {
+			foreach( HEADER header in headers ) {
+				Record rec;
+
+				if( !m_objects.TryGetValue( header.ID, out rec ) ) {
+					// object was deleted: return it with empty stamp
+					_headers.Add( new HEADER( header.Type, header.ID, new DateTime(), header.Name ) );
+				} else if( rec.Header.Stamp != header.Stamp ) {
+					// return header if stamp was changed
+					_headers.Add( rec.Header );
+				}
+			}
+		}
+		return _headers.ToArray();
+	}
+
+	/// <summary>
+	/// Save object header, links and properties to storage.
+	/// </summary>
+	/// <param name="header">In/Out header value.</param>
+	/// <param name="links">Array of modified object links.</param>
+	/// <param name="props">Array of modified object properties.</param>
+	/// <param name="mlinks">Array of new object links.</param>
+	/// <param name="mprops">Array of new object properties.</param>
+	public void Save( ref HEADER header, LINK[] links, PROPERTY[] props,
+					  out LINK[] mlinks, out PROPERTY[] mprops )
+	{
+		// values are stored as is, so nothing is changed
+		mlinks = null;
+		mprops = null;
+
+		lock( m_sync ) {
+			TransactionBegin();
+			try {
+				Record rec;
+
+				// create new object or check it's stamp
+				if( header.ID == 0 ) {
+					rec = new Record( new HEADER( header.Type, ++m_id, DateTime.MinValue, header.Name ) );
+					insert( rec );
+				} else {
+					rec = get_record( header.ID );
+					check_stamp( rec, header.Stamp );
+				}
+
+				foreach( PROPERTY prop in props ) {
+					set_property( rec, prop.Name,
+								  (prop.State == PROPERTY.STATE.Deleted) ? null : to_stored( prop.Value ) );
+				}
+
+				foreach( LINK link in links ) {
+					if( link.State == LINK.STATE.New ) {
+						set_link( rec, get_record( link.Header.ID ), true );
+					} else if( link.State == LINK.STATE.Deleted ) {
+						Record child;
+						if( m_objects.TryGetValue( link.Header.ID, out child ) ) {
+							set_link( rec, child, false );
+						}
+					}
+				}
+
+				// name is always updated
+				touch( rec, header.Name );
+				header = rec.Header;
+			} catch {
+				// rollback failed transaction
+				TransactionRollback();
+				throw;
+			}
+			TransactionCommit();
+		}
+	}
+
+	/// <summary>
+	/// Search objects that sutisfies search criteria.
+	/// </summary>
+	/// <param name="type">Objects type.</param>
+	/// <param name="where">Where object</param>
+	/// <param name="order">>OrderBy object</param>
+	/// <param name="bottom">Bottom limit in the request.</param>
+	/// <param name="count">Count limit in the request.</param>
+	/// <param name="headers">Array of found object headers.</param>
+	/// <returns>Count of found objects</returns>
+	public int Search( string type, Where where, OrderBy order, int bottom, int count,
+					   out HEADER[] headers )
+	{
+		lock( m_sync ) {
+			List<Record> recs = find( type, where, new Order( order ) );
+
+			headers = headers_of( recs, bottom, count );
+			return recs.Count;
+		}
+	}
+
+	/// <summary>
+	/// Search objects that sutisfies search criteria without counting of all
+	/// found objects.
+	/// </summary>
+	/// <param name="type">Objects type.</param>
+	/// <param name="where">Where object</param>
+	/// <param name="order">>OrderBy object</param>
+	/// <param name="bottom">Bottom limit in the request.</param>
+	/// <param name="count">Count limit in the request.</param>
+	/// <returns>Array of found object headers.</returns>
+	public HEADER[] Search( string type, Where where, OrderBy order, int bottom, int count )
+	{
+		// nothing to search for
+		if( count == 0 ) return new HEADER[0];
+
+		lock( m_sync ) {
+			return headers_of( find( type, where, new Order( order ) ), bottom, count );
+		}
+	}
+
+	/// <summary>
+	/// Count objects that sutisfies search criteria.
+	/// </summary>
+	/// <param name="type">Objects type.</param>
+	/// <param name="where">Where object</param>
+	/// <returns>Count of found objects</returns>
+	public int Count( string type, Where where )
+	{
+		lock( m_sync ) {
+			if( where == null ) {
+				SortedDictionary<int, Record> objects;
+				return m_types.TryGetValue( type, out objects ) ? objects.Count : 0;
+			}
+			return find( type, where, new Order( null ) ).Count;
+		}
+	}
+
+	/// <summary>
+	/// Search storage for the next page of persistent objects that satisfy
+	/// specified conditions.
+	/// </summary>
+	/// <param name="type">Objects type.</param>
+	/// <param name="where">Where object.</param>
+	/// <param name="order">OrderBy object.</param>
+	/// <param name="after">In/Out keyset of the last object of the
+	/// previous page (null reference for the first page).</param>
+	/// <param name="bottom">Count of objects to skip after the keyset.
+	/// </param>
+	/// <param name="count">Count limit in the request.</param>
+	/// <returns>Array of found object headers.</returns>
+	/// <remarks>
+	/// Keyset consists of object values for every OrderBy clause (DBNull
+	/// for missing ones and streams) followed by object ID, so position
+	/// doesn't depend on the object itself. On return it is set to keyset
+	/// of the last found object (isn't changed if page is empty).
+	/// </remarks>
+	public HEADER[] SearchAfter( string type, Where where, OrderBy order,
+								 ref ValueBox[] after, int bottom, int count )
+	{
+		lock( m_sync ) {
+			Order _order = new Order( order );
+			List<Record> recs = find( type, where, _order );
+			int from = 0;
+
+			if( after != null ) {
+				// find first record that follows the keyset
+				int to = recs.Count;
+				while( from < to ) {
+					int i = from + (to - from) / 2;
+
+					if( _order.Compare( recs[i], after ) > 0 ) to = i; else from = i + 1;
+				}
+			}
+			from = (int) Math.Min( Math.Max( (long) from + bottom, 0 ), recs.Count );
+
+			HEADER[] headers = headers_of( recs, from, count );
+			if( headers.Length > 0 ) {
+				after = _order.KeyOf( recs[from + headers.Length - 1] );
+			}
+			return headers;
+		}
+	}
+
+	/// <summary>
+	/// Starts a storage transaction.
+	/// </summary>
+	public void TransactionBegin()
+	{
+		lock( m_sync ) {
+			m_marks.Push( m_undo.Count );
+		}
+	}
+
+	/// <summary>
+	/// Commits the storage transaction.
+	/// </summary>
+	public void TransactionCommit()
+	{
+		lock( m_sync ) {
+			if( m_marks.Count == 0 ) throw new InvalidOperationException( ERROR_NO_TRANSACTION );
+
+			int mark = m_marks.Pop();
+			if( m_marks.Count > 0 ) return;
+
+			// changes of the outermost transaction are completed (they
+			// are reverted if they can't be completed)
+			try {
+				committed();
+			} catch {
+				revert( mark );
+				reverted();
+				throw;
+			}
+			m_undo.Clear();
+
+			// completed uploads can't be restored any more
+			foreach( Upload upload in m_completed ) upload.Stream.Close();
+			m_completed.Clear();
+		}
+	}
+
+	/// <summary>
+	/// Rolls back a transaction from a pending state.
+	/// </summary>
+	/// <remarks>
+	/// All changes that were made after the corresponding TransactionBegin
+	/// are reverted (including changes of nested transactions).
+	/// </remarks>
+	public void TransactionRollback()
+	{
+		lock( m_sync ) {
+			if( m_marks.Count == 0 ) throw new InvalidOperationException( ERROR_NO_TRANSACTION );
+
+			revert( m_marks.Pop() );
+			if( m_marks.Count == 0 ) reverted();
+		}
+	}
+	#endregion
+}
+}
@@ -18,6 +18,7 @@ using System.Data;
 using System.Data.Common;
 using System.Data.SqlClient;
 using System.Collections.Generic;
+using System.Security.Cryptography;
 using System.Text.RegularExpressions;
 
 #if (DEBUG)
@@ -38,10 +39,25 @@ public class ODB : IPersistenceStorage
 	// number of currently opened transactions
 	private int m_TransactionCount = 0;
 	private const int BUFFER_LENGTH = 1024 * 1024;
+	// content of read BLOBs by hash (shared by all connections)
+	private const int BLOB_CACHE_LENGTH = 1024 * 1024;
+	private const long BLOB_CACHE_SIZE = 16 * 1024 * 1024;
+	private static readonly Dictionary<string, byte[]> s_blobs = new Dictionary<string, byte[]>();
+	private static long s_blobsSize = 0;
+	// unfinished uploads older than this timeout are deleted
+	private const int PENDING_TIMEOUT_HOURS = 24;
+	// cache of command texts by query shape
+	private const int QUERY_CACHE_SIZE = 1024;
+	private delegate string QueryBuilder();
+	private readonly Dictionary<string, string> m_queries = new Dictionary<string, string>();
+	private long m_queryHits = 0;
+	private long m_queryMisses = 0;
 	
 	#region error messages
 	private static string ERROR_CHANGED_OBJECT = "Newer object exist. Please retrive object first!";
 	private static string ERROR_IMAGE_IS_ABSENT = "Specified value is absent!";
+	private static string ERROR_BLOB_HASH = "Uploaded content doesn't match specified hash!";
+	private static string ERROR_KEYSET = "Keyset doesn't match specified OrderBy!";
 	#endregion
 
 	///////////////////////////////////////////////////////////////////////
@@ -77,8 +93,25 @@ public class ODB : IPersistenceStorage
 		}
 	}
 
+	// append names filter to SqlCommand that requests
+	// properties (null names means all properties)
+	private void names_to_cmd( string[] names, DbCommand cmd )
+	{
+		if( names == null ) return;
+
+		string[] pars = new string[names.Length];
+		for( int i = 0; i < names.Length; i++ ) {
+			pars[i] = "@N" + i;
+			cmd.Parameters.Add( new SqlParameter(pars[i], names[i]) );
+		}
+		// empty projection means no properties at all
+		cmd.CommandText += (names.Length > 0) ?
+			" AND [Name] IN (" + string.Join( ", ", pars ) + ")" :
+			" AND 1 = 0";
+	}
+
 	// create SqlCommand text from Where.Clause
-	private string clause_to_cmd(Where.Clause clause, IDictionary<string, object> parms)
+	private string clause_to_cmd(Where.Clause clause, List<object> values)
 	{
 		string op;
 		string column = "Value";
@@ -146,16 +179,12 @@ public class ODB : IPersistenceStorage
 				}
 				break;
 		}
-		string opd = "@" + clause.OPD;
-		int counter = 0;
-		
-		while( parms.ContainsKey( opd ) ) {
-			opd = "@" + clause.OPD + "_" + counter;
-			counter++;
-		}
-		
+		// parameters are named by position of the clause value,
+		// so command text doesn't depend on values (see where_to_parms)
+		string opd = "@p" + values.Count;
+
 		// property value definition
-		parms.Add( opd, clause.Value.ToObject());
+		values.Add( clause.Value.ToObject() );
 		string result = "";
 
 		if( (clause.OPD == "ID") || (clause.OPD == "Name") || (clause.OPD == "Stamp") ) {
@@ -188,8 +217,10 @@ public class ODB : IPersistenceStorage
 		return result;
 	}
 
-	// return query OrderBy part from OrderBy.Clause
-	private void orderby_to_cmd(OrderBy.Clause clause, out string join, out string orderby)
+	// return query OrderBy part from OrderBy.Clause (column
+	// is sorted expression without direction)
+	private void orderby_to_cmd(OrderBy.Clause clause, out string join, out string column,
+								out string orderby)
 	{
 		join = String.Empty;
 		// format for proxy properties
@@ -212,25 +243,79 @@ public class ODB : IPersistenceStorage
 		orderby = string.Format( orderFormat,
 								 clause.OPD,
 								 clause.Sort == OrderBy.Clause.SORT.ASC ? "ASC" : "DESC" );
+		column = string.Format( orderFormat, clause.OPD, "" ).TrimEnd();
+	}
+
+	// create condition that selects rows which follow the keyset
+	// in specified order (ties are ordered by ID); keys are columns
+	// of [src], @k{i} are their values and @after is ID of keyset
+	private string keyset_to_cmd(List<string> keys, List<bool> asc)
+	{
+		string equal = "";
+		string result = "";
+
+		for( int i = 0; i < keys.Count; i++ ) {
+			string k = keys[i];
+			string a = "@k" + i;
+			// rows where current key follows the [after] key
+			// (NULL values precede all others in ascending order)
+			string next = asc[i] ?
+				string.Format( "({0} > {1} OR ({0} IS NOT NULL AND {1} IS NULL))", k, a ) :
+				string.Format( "({0} < {1} OR ({0} IS NULL AND {1} IS NOT NULL))", k, a );
+
+			result += "(" + equal + next + ") OR\n";
+			equal += string.Format( "({0} = {1} OR ({0} IS NULL AND {1} IS NULL)) AND ", k, a );
+		}
+		// all keys are equal: order by ID
+		return "(" + result + "(" + equal + "[src].[ID] > @after))";
+	}
+
+	// bind keyset values to parameters of SqlCommand (header fields
+	// are typed, property values are sql_variant ones)
+	private void keyset_to_parms(OrderBy order, ValueBox[] after, DbCommand cmd)
+	{
+		int i = 0;
+
+		if( order != null ) {
+			foreach( OrderBy.Clause clause in order ) {
+				SqlParameter parm;
+				object value = after[i].ToObject();
+
+				if( clause.OPD == "ID" ) {
+					parm = new SqlParameter( "@k" + i, SqlDbType.Int );
+				} else if( clause.OPD == "Name" ) {
+					parm = new SqlParameter( "@k" + i, SqlDbType.NVarChar, 4000 );
+				} else if( clause.OPD == "Stamp" ) {
+					parm = new SqlParameter( "@k" + i, SqlDbType.DateTime );
+				} else {
+					parm = new SqlParameter( "@k" + i, SqlDbType.Variant );
+				}
+				parm.Value = value;
+				cmd.Parameters.Add( parm );
+				i++;
+			}
+		}
+		// ties are ordered by ID
+		cmd.Parameters.Add( new SqlParameter( "@after", (int) after[i] ) );
 	}
 
 
 	// create SqlCommand text from Where
-	private string where_to_cmd(Where where, IDictionary<string, object> parms)
+	private string where_to_cmd(Where where, List<object> values)
 	{
 		if( where is Where.Clause ) {
-			return clause_to_cmd((Where.Clause)where, parms);
+			return clause_to_cmd((Where.Clause)where, values);
 		} else {
 			string leftCmd = "";
 			string rightCmd = "";
 			string resultCmd = "";
 			if( where is Where.Operation.And || where is Where.Operation.Or ) {
 				if( where is Where.Operation.And ) {
-					leftCmd = where_to_cmd(((Where.Operation.And)where).LeftWhere, parms);
-					rightCmd = where_to_cmd(((Where.Operation.And)where).RightWhere, parms);
+					leftCmd = where_to_cmd(((Where.Operation.And)where).LeftWhere, values);
+					rightCmd = where_to_cmd(((Where.Operation.And)where).RightWhere, values);
 				} else {
-					leftCmd = where_to_cmd(((Where.Operation.Or)where).LeftWhere, parms);
-					rightCmd = where_to_cmd(((Where.Operation.Or)where).RightWhere, parms);
+					leftCmd = where_to_cmd(((Where.Operation.Or)where).LeftWhere, values);
+					rightCmd = where_to_cmd(((Where.Operation.Or)where).RightWhere, values);
 				}
 
 				resultCmd = string.Format(
@@ -240,13 +325,92 @@ public class ODB : IPersistenceStorage
 								rightCmd );
 			} else if( where is Where.Operation.Not ) {
 				Where.Operation.Not opNot = (Where.Operation.Not)where;
-				string cmd = where_to_cmd(opNot.SubWhere, parms);
+				string cmd = where_to_cmd(opNot.SubWhere, values);
 				resultCmd = string.Format( " NOT({0})", cmd );
 			}
 			return resultCmd;
 		}
 	}
 
+	// collect values of Where clauses that are passed as command
+	// parameters (in the same order as where_to_cmd names them)
+	private void where_to_values(Where where, List<object> values)
+	{
+		if( where is Where.Clause ) {
+			// DBNull values are not passed as parameters
+			object value = ((Where.Clause)where).Value.ToObject();
+			if( value != DBNull.Value ) values.Add( value );
+		} else if( where is Where.Operation.And ) {
+			where_to_values(((Where.Operation.And)where).LeftWhere, values);
+			where_to_values(((Where.Operation.And)where).RightWhere, values);
+		} else if( where is Where.Operation.Or ) {
+			where_to_values(((Where.Operation.Or)where).LeftWhere, values);
+			where_to_values(((Where.Operation.Or)where).RightWhere, values);
+		} else if( where is Where.Operation.Not ) {
+			where_to_values(((Where.Operation.Not)where).SubWhere, values);
+		}
+	}
+
+	// bind values of Where clauses to parameters of SqlCommand (strings
+	// have fixed type and size, because inferred nvarchar(length) makes
+	// new query plan for each length of value)
+	private void where_to_parms(Where where, DbCommand cmd)
+	{
+		if( where == null ) return;
+
+		List<object> values = new List<object>();
+		where_to_values(where, values);
+		for( int i = 0; i < values.Count; i++ ) {
+			SqlParameter parm;
+
+			if( values[i] is string ) {
+				parm = new SqlParameter( "@p" + i, SqlDbType.NVarChar, 4000 );
+				parm.Value = values[i];
+			} else {
+				parm = new SqlParameter( "@p" + i, values[i] );
+			}
+			cmd.Parameters.Add( parm );
+		}
+	}
+
+	// return shape of Where (empty string for null reference)
+	private string shape_of(Where where)
+	{
+		return (where == null) ? "" : where.Shape;
+	}
+
+	// return shape of OrderBy (empty string for null reference)
+	private string shape_of(OrderBy order)
+	{
+		return (order == null) ? "" : order.Shape;
+	}
+
+	// return command text for specified query key: cached text or
+	// new one created by builder (cache is cleared when it is full)
+	private string get_query(string key, QueryBuilder builder)
+	{
+		string text;
+
+		lock( m_queries ) {
+			if( m_queries.TryGetValue( key, out text ) ) {
+				m_queryHits++;
+				return text;
+			}
+			m_queryMisses++;
+		}
+		#region debug info
+#if (DEBUG)
+		Debug.Print("ODB: query cache hits = {0}, misses = {1}", m_queryHits, m_queryMisses );
+#endif
+		#endregion
+		text = builder();
+		lock( m_queries ) {
+			if( m_queries.Count >= QUERY_CACHE_SIZE ) m_queries.Clear();
+			m_queries[key] = text;
+		}
+		return text;
+	}
+
 	/// <summary>
 	/// Converts DateType type according to MS SQL Server precision.
 	/// </summary>
@@ -277,6 +441,224 @@ public class ODB : IPersistenceStorage
 	//						SQL BLOB Section
 	///////////////////////////////////////////////////////////////////////
 	#region SQL BLOB interactions
+	/// <summary>
+	/// Gets content of BLOB with specified hash if it was read already
+	/// </summary>
+	/// <param name="hash">Hash of BLOB content</param>
+	/// <returns>Content or null if it is not found</returns>
+	private static byte[] find_blob( byte[] hash )
+	{
+		byte[] content;
+
+		lock( s_blobs ) {
+			if( s_blobs.TryGetValue( Convert.ToBase64String( hash ), out content ) ) {
+				return content;
+			}
+		}
+		return null;
+	}
+
+	/// <summary>
+	/// Keeps content of small BLOB to share it with other objects. Content
+	/// is addressed by hash, so it is never outdated.
+	/// </summary>
+	/// <param name="hash">Hash of BLOB content</param>
+	/// <param name="stream">Stream with BLOB content</param>
+	private static void keep_blob( byte[] hash, PersistentStream stream )
+	{
+		// large content is not cached
+		if( stream.Length > BLOB_CACHE_LENGTH ) return;
+
+		byte[] content = new byte[stream.Length];
+		stream.ReadAt( 0, content, 0, content.Length );
+
+		lock( s_blobs ) {
+			string key = Convert.ToBase64String( hash );
+
+			if( s_blobs.ContainsKey( key ) ) return;
+			// drop all content if cache is full
+			if( s_blobsSize + content.Length > BLOB_CACHE_SIZE ) {
+				s_blobs.Clear();
+				s_blobsSize = 0;
+			}
+			s_blobs.Add( key, content );
+			s_blobsSize += content.Length;
+		}
+	}
+
+	/// <summary>
+	/// Returns SQL statements that link content with ID in @_blob variable
+	/// to the stream property of object (new or existing record in _images
+	/// table is used, record in _properties table is removed).
+	/// </summary>
+	/// <param name="isnew">Flag to check property existance.</param>
+	/// <returns>Format string with object ID and property name arguments.</returns>
+	private static string blob_link_sql( bool isnew )
+	{
+		string sql = "";
+
+		if( !isnew ) {
+			sql +=   "DELETE  FROM [dbo].[_properties] WHERE [ObjectID]={0} AND [Name]='{1}';                    \n" +
+					 "UPDATE  [dbo].[_images] SET @_id = [ID], [BlobID] = @_blob, [Value] = NULL                 \n" +
+					 "WHERE   @@ROWCOUNT = 0 AND [ObjectID] = {0} AND [Name] ='{1}';                             \n";
+		}
+		sql +=       "IF @_id IS NULL BEGIN                                                                      \n" +
+					 "    INSERT INTO [dbo].[_images] ([ObjectID], [Name], [BlobID]) VALUES ( {0}, '{1}', @_blob ); \n" +
+					 "END;                                                                                       \n";
+		return sql;
+	}
+
+	/// <summary>
+	/// Gets pointer to content of stream property
+	/// </summary>
+	/// <param name="objID">Stream owner object ID</param>
+	/// <param name="propName">Name of stream property</param>
+	/// <param name="table">Table that contains content</param>
+	/// <param name="hash">Hash of content (null for records of previous versions)</param>
+	/// <param name="length">Length of content</param>
+	/// <returns>Text pointer to content (null for empty content)</returns>
+	private object blob_pointer( int objID, string propName,
+								 out string table, out byte[] hash, out int length )
+	{
+		// content is stored in _blobs table by hash or, for records of
+		// previous versions, in _images table itself
+		DbCommand cmd = new SqlCommand(
+			"SELECT [b].[Hash],\n" +
+			"       ISNULL(TEXTPTR([b].[Value]), TEXTPTR([i].[Value])) AS [Pointer],\n" +
+			"       ISNULL(DataLength([b].[Value]), DataLength([i].[Value])) AS [Length]\n" +
+			"FROM [dbo].[_images] [i]\n" +
+			"     LEFT JOIN [dbo].[_blobs] [b] ON [b].[ID] = [i].[BlobID]\n" +
+			"WHERE [i].[ObjectID] = @ID AND [i].[Name] = @Name" );
+		cmd.Connection = m_con;
+		cmd.Transaction = m_trans;
+		cmd.Parameters.Add( new SqlParameter( "@ID", objID ) );
+		cmd.Parameters.Add( new SqlParameter( "@Name", propName ) );
+
+		DbDataReader dr = cmd.ExecuteReader( CommandBehavior.SingleRow );
+		try {
+			//check that BLOB field exists
+			if( !dr.Read() ) throw new KeyNotFoundException( ERROR_IMAGE_IS_ABSENT );
+
+			hash = dr.IsDBNull( 0 ) ? null : (byte[])dr[0];
+			length = dr.IsDBNull( 2 ) ? 0 : Convert.ToInt32( dr[2] );
+			table = (hash != null) ? "_blobs" : "_images";
+			return dr.IsDBNull( 1 ) ? null : dr[1];
+		} finally {
+			dr.Dispose();
+		}
+	}
+
+	/// <summary>
+	/// Gets pointer to stored content with specified hash
+	/// </summary>
+	/// <param name="hash">Hash of content</param>
+	/// <param name="length">Length of content</param>
+	/// <returns>Text pointer to content (null for empty content)</returns>
+	private object blob_pointer( byte[] hash, out int length )
+	{
+		// unfinished uploads are not read
+		DbCommand cmd = new SqlCommand(
+			"SELECT TEXTPTR([Value]) AS [Pointer], DataLength([Value]) AS [Length]\n" +
+			"FROM [dbo].[_blobs]\n" +
+			"WHERE [Hash] = @Hash AND [Pending] = 0" );
+		cmd.Connection = m_con;
+		cmd.Transaction = m_trans;
+		cmd.Parameters.Add( new SqlParameter( "@Hash", hash ) );
+
+		DbDataReader dr = cmd.ExecuteReader( CommandBehavior.SingleRow );
+		try {
+			//check that content is still stored
+			if( !dr.Read() ) throw new KeyNotFoundException( ERROR_IMAGE_IS_ABSENT );
+
+			length = dr.IsDBNull( 1 ) ? 0 : Convert.ToInt32( dr[1] );
+			return dr.IsDBNull( 0 ) ? null : dr[0];
+		} finally {
+			dr.Dispose();
+		}
+	}
+
+	/// <summary>
+	/// Reads range of BLOB field using READTEXT
+	/// </summary>
+	/// <param name="table">Table that contains BLOB field</param>
+	/// <param name="pointer">Text pointer to BLOB field</param>
+	/// <param name="offset">Number of bytes to skip before starting the read</param>
+	/// <param name="size">Number of bytes to read</param>
+	/// <returns>Read data</returns>
+	private byte[] read_text( string table, object pointer, int offset, int size )
+	{
+		DbCommand cmd = new SqlCommand( string.Format(
+			"READTEXT [dbo].[{0}].[Value] @Pointer @Offset @Size HOLDLOCK", table) );
+		cmd.Connection = m_con;
+		cmd.Transaction = m_trans;
+		cmd.Parameters.Add( new SqlParameter( "@Pointer", pointer ) );
+		cmd.Parameters.Add( new SqlParameter( "@Offset", offset ) );
+		cmd.Parameters.Add( new SqlParameter( "@Size", size ) );
+
+		DbDataReader dr = cmd.ExecuteReader( CommandBehavior.SingleRow );
+		try {
+			byte[] buffer = new byte[size];
+			// read data from SqlDataReader
+			dr.Read();
+			int count = Convert.ToInt32( dr.GetBytes( 0, 0, buffer, 0, size ) );
+			// truncate buffer to the size of read data
+			if( count < size ) Array.Resize( ref buffer, count );
+			return buffer;
+		} finally {
+			dr.Dispose();
+		}
+	}
+
+	/// <summary>
+	/// Writes range of the content with specified hash to pending record
+	/// in _blobs table (record is created at first write)
+	/// </summary>
+	/// <param name="hash">Hash of the whole content</param>
+	/// <param name="offset">Position of the range</param>
+	/// <param name="data">Data of the range</param>
+	/// <returns>Length of the content stored for this hash</returns>
+	private long write_blob( byte[] hash, long offset, byte[] data )
+	{
+		// find (or create pending) record with specified hash and
+		// write range if it follows stored data: content is replaced
+		// from the start of the range up to the end (new upload also
+		// deletes unfinished uploads that are not continued too long)
+		DbCommand cmd = new SqlCommand(
+			"DECLARE @_blob as int, @_pending as bit, @_pointer as varbinary(16);        \n" +
+			"SELECT  @_blob = [ID], @_pending = [Pending] FROM [dbo].[_blobs] WHERE [Hash] = @Hash; \n" +
+			"IF @_blob IS NULL BEGIN                                                      \n" +
+			"    DELETE FROM [dbo].[_blobs]                                               \n" +
+			"    WHERE  [Pending] = 1 AND [TimeStamp] < DATEADD(hour, -@Timeout, GETDATE()) AND \n" +
+			"           NOT EXISTS( SELECT 1 FROM [dbo].[_images] [img]                   \n" +
+			"                       WHERE  [img].[BlobID] = [dbo].[_blobs].[ID] );        \n" +
+			"    INSERT INTO [dbo].[_blobs] ([Hash], [Value], [Pending]) VALUES ( @Hash, NULL, 1 ); \n" +
+			"    SET @_blob = SCOPE_IDENTITY();                                           \n" +
+			"    SET @_pending = 1;                                                       \n" +
+			"END;                                                                         \n" +
+			"SELECT  @Length = ISNULL(DataLength([Value]), 0) FROM [dbo].[_blobs] WHERE [ID] = @_blob; \n" +
+			"IF @_pending = 1 AND @Offset = 0 BEGIN                                       \n" +
+			"    UPDATE [dbo].[_blobs] SET [Value] = @Data, [TimeStamp] = GETDATE() WHERE [ID] = @_blob; \n" +
+			"    SET @Length = DataLength(@Data);                                         \n" +
+			"END ELSE IF @_pending = 1 AND @Offset <= @Length BEGIN                       \n" +
+			"    SELECT @_pointer = TEXTPTR([Value]) FROM [dbo].[_blobs] WHERE [ID] = @_blob; \n" +
+			"    UPDATETEXT [dbo].[_blobs].[Value] @_pointer @Offset NULL WITH LOG @Data; \n" +
+			"    UPDATE [dbo].[_blobs] SET [TimeStamp] = GETDATE() WHERE [ID] = @_blob;   \n" +
+			"    SET @Length = @Offset + DataLength(@Data);                               \n" +
+			"END;" );
+		cmd.Connection = m_con;
+		cmd.Transaction = m_trans;
+		cmd.Parameters.Add( new SqlParameter( "@Hash", hash ) );
+		cmd.Parameters.Add( new SqlParameter( "@Offset", offset ) );
+		cmd.Parameters.Add( new SqlParameter( "@Data", SqlDbType.Image ) );
+		cmd.Parameters["@Data"].Value = data;
+		cmd.Parameters.Add( new SqlParameter( "@Timeout", PENDING_TIMEOUT_HOURS ) );
+		cmd.Parameters.Add( new SqlParameter( "@Length", SqlDbType.BigInt ) );
+		cmd.Parameters["@Length"].Direction = ParameterDirection.Output;
+
+		cmd.ExecuteNonQuery();
+		return Convert.ToInt64( cmd.Parameters["@Length"].Value );
+	}
+
 	/// <summary>
 	/// Saves stream property to SQL BLOB field
 	/// </summary>
@@ -293,74 +675,35 @@ public class ODB : IPersistenceStorage
 		#endregion
 		// open connection and start new transaction if required
 		TransactionBegin();
-
-		// create command text to create new or update existing record in th table
-		string sql = "DECLARE @_id as int;                                                                      \n";
-		if( !isnew ) {
-			sql +=   "DELETE  FROM [dbo].[_properties] WHERE [ObjectID]={0} AND [Name]='{1}';                   \n" +
-					 "UPDATE  [dbo].[_images] SET @_id = [ID], [Value] = {2}                                    \n" +
-					 "WHERE   @@ROWCOUNT = 0 AND [ObjectID] = {0} AND [Name] ='{1}';                            \n";
-		}
-		sql +=       "IF @_id IS NULL BEGIN                                                                     \n" +
-					 "    INSERT INTO [dbo].[_images] ([ObjectID], [Name], [Value]) VALUES ( {0}, '{1}', {2} ); \n" +
-					 "    SET @_id = SCOPE_IDENTITY();                                                          \n" +
-					 "END;                                                                                      \n" +
-					 "SELECT @Pointer = TEXTPTR([Value]) FROM [dbo].[_images] WHERE [ID] = @_id;                \n";
-		// command that executes previous sql statement
-		DbCommand cmd = new SqlCommand(string.Format( sql, objID, propName, (stream.Length > 0) ? "0x0" : "NULL"));
-		cmd.Connection = m_con;
-		cmd.Transaction = m_trans;
-
-		DbParameter pointerParam  = new SqlParameter( "@Pointer", SqlDbType.Binary, 16 );
-		pointerParam.Direction = ParameterDirection.Output;
-		cmd.Parameters.Add( pointerParam );
 		try {
-			// get pointer to image data
-			cmd.ExecuteNonQuery();
-			// set up UPDATETEXT command, parameters, and open BinaryReader.
-			cmd = new SqlCommand(
-				"UPDATETEXT [dbo].[_images].[Value] @Pointer @Offset @Delete WITH LOG @Bytes");
+			byte[] hash = stream.Hash;
+			long length = stream.Length;
+
+			// upload content by ranges: the first range replaces content of
+			// unfinished upload, and if the same content is stored already
+			// returned length stops upload at once
+			byte[] buffer = new byte[Math.Min( BUFFER_LENGTH, length )];
+			long offset = 0;
+			do {
+				int size = stream.ReadAt( offset, buffer, 0, buffer.Length );
+				if( size == 0 && offset < length ) throw new EndOfStreamException();
+				if( size < buffer.Length ) Array.Resize( ref buffer, size );
+
+				offset = write_blob( hash, offset, buffer );
+			} while( offset < length );
+
+			// complete upload and link content with new or existing
+			// record in the _images table
+			DbCommand cmd = new SqlCommand( string.Format(
+				"DECLARE @_id as int, @_blob as int;                                    \n" +
+				"SELECT  @_blob = [ID] FROM [dbo].[_blobs] WHERE [Hash] = @Hash;        \n" +
+				"UPDATE  [dbo].[_blobs] SET [Pending] = 0 WHERE [ID] = @_blob;          \n" +
+				blob_link_sql( isnew ),
+				objID, propName.Replace( "'", "''" ) ) );
 			cmd.Connection = m_con;
 			cmd.Transaction = m_trans;
-			// assign value of pointer previously recieved
-			cmd.Parameters.Add( new SqlParameter("@Pointer", SqlDbType.Binary, 16) );
-			cmd.Parameters["@Pointer"].Value = pointerParam.Value;
-			// start insertion from begin
-			DbParameter offsetParam = new SqlParameter( "@Offset", SqlDbType.Int );
-			offsetParam.Value = 0;
-			cmd.Parameters.Add( offsetParam );
-			//delete 0x0 character
-			DbParameter deleteParam = new SqlParameter("@Delete", SqlDbType.Int);
-			deleteParam.Value  = 1;
-			cmd.Parameters.Add( deleteParam );
-			DbParameter bytesParam = new SqlParameter( "@Bytes", SqlDbType.Binary );
-			cmd.Parameters.Add( bytesParam );
-
-			// save current stream position and seek to begin
-			long pos = stream.Position;
-			stream.Seek( 0, SeekOrigin.Begin );
-
-			// read buffer full of data and execute UPDATETEXT statement.
-			Byte[] buffer = new Byte[BUFFER_LENGTH];
-			// make first read from stream
-			int ret = stream.Read( buffer, 0, BUFFER_LENGTH );
-
-			// while something is read from stream, write to apend to BLOB field
-			while( ret > 0 ) {
-				// initing parameters for write
-				bytesParam.Value = buffer;
-				bytesParam.Size = ret;
-				// write to BLOB field
-				cmd.ExecuteNonQuery(); // execute iteration
-				deleteParam.Value = 0; // don't delete any other data
-				// prepare to next iteration
-				offsetParam.Value =
-					Convert.ToInt32( offsetParam.Value ) + ret;
-				// read from stream for next iteration
-				ret = stream.Read( buffer, 0, BUFFER_LENGTH );
-			}
-			// restore stream position after reading
-			stream.Position = pos;
+			cmd.Parameters.Add( new SqlParameter( "@Hash", hash ) );
+			cmd.ExecuteNonQuery();
 		} catch( Exception ex ) {
 			#region debug info
 #if (DEBUG)
@@ -383,12 +726,15 @@ public class ODB : IPersistenceStorage
 	/// <summary>
 	/// Read BLOB field to stream property
 	/// </summary>
+	/// <param name="type">Stream owner object type</param>
 	/// <param name="objID">Stream owner object ID</param>
 	/// <param name="propName">Name of stream property</param>
 	/// <returns>
-	/// Persistent stream that contains BLOB data.
+	/// Persistent stream that contains BLOB data (large content is not
+	/// read: returned stream refers to it and reads it by ReadBlob ranges
+	/// at first access).
 	/// </returns>
-	private PersistentStream read_blob( int objID, string propName )
+	private PersistentStream read_blob( string type, int objID, string propName )
 	{
 		#region debug info
 #if (DEBUG)
@@ -396,87 +742,41 @@ public class ODB : IPersistenceStorage
 #endif
 		#endregion
 
-		// create stream to return as result
-		PersistentStream stream = new PersistentStream();
+		// stream to return as result
+		PersistentStream stream = null;
 
-		// get pointer to BLOB field using TEXTPTR.
-		DbCommand cmd = new SqlCommand( string.Format(
-			"SELECT @Pointer = TEXTPTR([Value]), @Length = DataLength([Value])\n" +
-			"FROM [dbo].[_images]\n" +
-			"WHERE [ObjectID] = {0} AND [Name] ='{1}'",
-			objID, propName) );
-		cmd.Connection = m_con;
-		cmd.Transaction = m_trans;
-		// setup parameters
-		DbParameter pointerParam = new SqlParameter("@Pointer", SqlDbType.VarBinary, 16);
-		pointerParam.Direction = ParameterDirection.Output;
-		cmd.Parameters.Add( pointerParam );
-		DbParameter lengthParam = new SqlParameter("@Length", SqlDbType.Int);
-		lengthParam.Direction = ParameterDirection.Output;
-		cmd.Parameters.Add( lengthParam );
 		// open connection and start new transaction if required
 		TransactionBegin();
 		try {
+			string table;
+			byte[] hash;
+			int length;
 			// get pointer and length of BLOB field
-			cmd.ExecuteNonQuery();
-
-			//check that BLOB field exists
-			if( pointerParam.Value == null ) {
-				throw new KeyNotFoundException( ERROR_IMAGE_IS_ABSENT );
-			}
-
-			// run the query.
-			// set up the READTEXT command to read the BLOB by passing the following
-			// parameters: @Pointer – pointer to blob, @Offset – number of bytes to
-			// skip before starting the read, @Size – number of bytes to read.
-			cmd = new SqlCommand(
-				"READTEXT [dbo].[_images].[Value] @Pointer @Offset @Size HOLDLOCK");
-			cmd.Connection = m_con;
-			cmd.Transaction = m_trans;
-			// temp buffer for read/write purposes
-			Byte[] buffer = new Byte[BUFFER_LENGTH];
-
-			// set up the parameters for the command.
-			cmd.Parameters.Add( new SqlParameter("@Pointer", pointerParam.Value) );
-			// current offset position
-			DbParameter offset = new SqlParameter("@Offset", SqlDbType.Int);
-			offset.Value = 0;
-			cmd.Parameters.Add( offset );
-			DbParameter size =  new SqlParameter("@Size", SqlDbType.Int);
-			size.Value = 0;
-			cmd.Parameters.Add( size );
-
-			while( Convert.ToInt32(offset.Value) < Convert.ToInt32( lengthParam.Value ) ) {
-				// calculate buffer size - may be less than BUFFER_LENGTH for last block.
-				if( (Convert.ToInt32( offset.Value ) + buffer.GetUpperBound( 0 ))
-					>=
-					Convert.ToInt32( lengthParam.Value ) )
-					// setting size parameter
-					size.Value =
-						Convert.ToInt32( lengthParam.Value ) -
-						Convert.ToInt32( offset.Value );
-				else
-					size.Value = buffer.GetUpperBound( 0 );
-
-				// execute reader
-				DbDataReader dr =
-					cmd.ExecuteReader( CommandBehavior.SingleRow );
-
-				try {
-					// read data from SqlDataReader
-					dr.Read();
-					// put data to buffer
-					// and return size of read data
-					int count = Convert.ToInt32(
-						dr.GetBytes( 0, 0, buffer, 0, Convert.ToInt32( size.Value ) ) );
-					// append buffer data to stream
-					stream.Write( buffer, 0, count );
-					// increment offset
-					offset.Value = Convert.ToInt32( offset.Value ) + count;
-				} finally { dr.Dispose(); /*dispose DataReader*/}
+			object pointer = blob_pointer( objID, propName, out table, out hash, out length );
+
+			byte[] content = (hash != null) ? find_blob( hash ) : null;
+			if( hash != null && length > BLOB_CACHE_LENGTH ) {
+				// refer to large content instead of reading it
+				stream = new PersistentStream( type, objID, propName, length, hash );
+			} else if( content != null ) {
+				// the same content was read already
+				stream = new PersistentStream( content );
+			} else {
+				stream = new PersistentStream();
+				// read BLOB by blocks and append them to stream
+				for( int offset = 0; offset < length; ) {
+					byte[] buffer = read_text( table, pointer, offset,
+											   Math.Min( BUFFER_LENGTH, length - offset ) );
+					if( buffer.Length == 0 ) break;
+
+					stream.Write( buffer, 0, buffer.Length );
+					offset += buffer.Length;
+				}
+				// share small content with other objects
+				if( hash != null ) keep_blob( hash, stream );
+				// seek to begin of the stream after writing data
+				stream.Seek( 0, SeekOrigin.Begin );
 			}
-			// seek to begin of the stream after writing data
-			stream.Seek( 0, SeekOrigin.Begin );
 		} catch( Exception ex ) {
 			#region dubug info
 #if (DEBUG)
@@ -533,6 +833,23 @@ public class ODB : IPersistenceStorage
 #endif
 		#endregion
 	}
+
+	/// <summary>
+	/// Gets number of search requests that reused cached command text
+	/// (requests with the same Where and OrderBy shapes).
+	/// </summary>
+	public long QueryCacheHits
+	{
+		get { return m_queryHits; }
+	}
+
+	/// <summary>
+	/// Gets number of search requests that created new command text.
+	/// </summary>
+	public long QueryCacheMisses
+	{
+		get { return m_queryMisses; }
+	}
 	
 	#region IPersistenceStorage Members
 	/// <summary>
@@ -562,14 +879,277 @@ public class ODB : IPersistenceStorage
 			cmd.Parameters.Add(new SqlParameter("@ID", header.ID));
 			cmd.Parameters.Add(new SqlParameter("@Stamp", header.Stamp));
 
-			cmd.CommandText += "DELETE FROM [dbo].[_objects] WHERE [ID] = @_id";
+			cmd.CommandText += "DELETE FROM [dbo].[_objects] WHERE [ID] = @_id";
+
+			// proccess delete opearaton
+			cmd.ExecuteNonQuery();
+		} catch( Exception ex ) {
+			#region dubug info
+#if (DEBUG)
+			Debug.Print( "[ERROR] @ ODB.Delete: {0}", ex.ToString() );
+#endif
+			#endregion
+			// rollback failed transaction
+			TransactionRollback();
+			throw;
+		}
+		// close connection and commit transaction if required
+		TransactionCommit();
+		#region debug info
+#if (DEBUG)
+		Debug.Print( "<- ODB.Delete({0})", header.ID );
+#endif
+		#endregion
+	}
+
+	/// <summary>
+	/// Opens content of stream property for reading by ranges.
+	/// </summary>
+	/// <param name="header">Header of the owner object.</param>
+	/// <param name="name">Name of the stream property.</param>
+	/// <param name="hash">Hash of the content.</param>
+	/// <returns>Length of the content.</returns>
+	public long OpenBlob( HEADER header, string name, out byte[] hash )
+	{
+		#region debug info
+#if (DEBUG)
+		Debug.Print( "-> ODB.OpenBlob( {0}, '{1}' )", header.ID, name );
+#endif
+		#endregion
+
+		int length = 0;
+		hash = null;
+
+		// open connection and start new transaction if required
+		TransactionBegin();
+		try {
+			string table;
+			blob_pointer( header.ID, name, out table, out hash, out length );
+		} catch( Exception ex ) {
+			#region dubug info
+#if (DEBUG)
+			Debug.Print( "[ERROR] @ ODB.OpenBlob: {0}", ex.Message );
+#endif
+			#endregion
+			// rollback failed transaction
+			TransactionRollback();
+			throw;
+		}
+		// close connection and commit transaction if required
+		TransactionCommit();
+
+		#region debug info
+#if (DEBUG)
+		Debug.Print( "<- ODB.OpenBlob( {0}, '{1}' ) = {2}", header.ID, name, length );
+#endif
+		#endregion
+
+		return length;
+	}
+
+	/// <summary>
+	/// Reads range of stream property content.
+	/// </summary>
+	/// <param name="header">Header of the owner object.</param>
+	/// <param name="name">Name of the stream property.</param>
+	/// <param name="hash">Hash of the content (null for current content
+	/// of the property).</param>
+	/// <param name="offset">Position of the range.</param>
+	/// <param name="count">Maximum length of the range.</param>
+	/// <returns>Read data (shorter then requested at the end of content).</returns>
+	public byte[] ReadBlob( HEADER header, string name, byte[] hash, long offset, int count )
+	{
+		// check for right values
+		if( offset < 0 ) throw new ArgumentOutOfRangeException( "offset" );
+		if( count < 0 ) throw new ArgumentOutOfRangeException( "count" );
+
+		#region debug info
+#if (DEBUG)
+		Debug.Print( "-> ODB.ReadBlob( {0}, '{1}', {2}, {3} )", header.ID, name, offset, count );
+#endif
+		#endregion
+
+		byte[] data = new byte[0];
+
+		// open connection and start new transaction if required
+		TransactionBegin();
+		try {
+			string table = "_blobs";
+			byte[] stored;
+			int length;
+			// content is found by hash while it is stored (property could
+			// be changed after it was opened)
+			object pointer = (hash != null) ?
+				blob_pointer( hash, out length ) :
+				blob_pointer( header.ID, name, out table, out stored, out length );
+
+			// read only range that is in the content
+			if( offset < length ) {
+				data = read_text( table, pointer, (int) offset,
+								  (int) Math.Min( count, length - offset ) );
+			}
+		} catch( Exception ex ) {
+			#region dubug info
+#if (DEBUG)
+			Debug.Print( "[ERROR] @ ODB.ReadBlob: {0}", ex.Message );
+#endif
+			#endregion
+			// rollback failed transaction
+			TransactionRollback();
+			throw;
+		}
+		// close connection and commit transaction if required
+		TransactionCommit();
+
+		#region debug info
+#if (DEBUG)
+		Debug.Print( "<- ODB.ReadBlob( {0}, '{1}', {2}, {3} ) = {4}",
+					 header.ID, name, offset, count, data.Length );
+#endif
+		#endregion
+
+		return data;
+	}
+
+	/// <summary>
+	/// Writes range of the content with specified hash.
+	/// </summary>
+	/// <param name="hash">Hash of the whole content.</param>
+	/// <param name="offset">Position of the range.</param>
+	/// <param name="data">Data of the range.</param>
+	/// <returns>Length of the content stored for this hash.</returns>
+	public long WriteBlob( byte[] hash, long offset, byte[] data )
+	{
+		// check for right values
+		if( hash == null ) throw new ArgumentNullException( "hash" );
+		if( data == null ) throw new ArgumentNullException( "data" );
+		if( offset < 0 ) throw new ArgumentOutOfRangeException( "offset" );
+
+		#region debug info
+#if (DEBUG)
+		Debug.Print( "-> ODB.WriteBlob( {0}, {1}, {2} )",
+					 Convert.ToBase64String( hash ), offset, data.Length );
+#endif
+		#endregion
+
+		long length = 0;
+
+		// open connection and start new transaction if required
+		TransactionBegin();
+		try {
+			length = write_blob( hash, offset, data );
+		} catch( Exception ex ) {
+			#region dubug info
+#if (DEBUG)
+			Debug.Print( "[ERROR] @ ODB.WriteBlob: {0}", ex.Message );
+#endif
+			#endregion
+			// rollback failed transaction
+			TransactionRollback();
+			throw;
+		}
+		// close connection and commit transaction if required
+		TransactionCommit();
+
+		#region debug info
+#if (DEBUG)
+		Debug.Print( "<- ODB.WriteBlob( {0}, {1}, {2} ) = {3}",
+					 Convert.ToBase64String( hash ), offset, data.Length, length );
+#endif
+		#endregion
+
+		return length;
+	}
+
+	/// <summary>
+	/// Links written content with stream property of the object.
+	/// </summary>
+	/// <param name="header">In/Out header of the owner object.</param>
+	/// <param name="name">Name of the stream property.</param>
+	/// <param name="hash">Hash of the content.</param>
+	public void CommitBlob( ref HEADER header, string name, byte[] hash )
+	{
+		// check for right values
+		if( name == null ) throw new ArgumentNullException( "name" );
+		if( hash == null ) throw new ArgumentNullException( "hash" );
+
+		#region debug info
+#if (DEBUG)
+		Debug.Print( "-> ODB.CommitBlob( {0}, '{1}', {2} )",
+					 header.ID, name, Convert.ToBase64String( hash ) );
+#endif
+		#endregion
+
+		// open connection and start new transaction if required
+		TransactionBegin();
+		try {
+			// check object stamp. If it is newer then current -> raise error
+			DbCommand cmd = new SqlCommand( string.Format(
+				"IF ((SELECT [TimeStamp] FROM [dbo].[_objects] WHERE [ID] = @ID) > @Stamp) " +
+				"RAISERROR( '{0}', 11, 1 );\n" +
+				"SELECT @Blob = [ID], @Pending = [Pending], @Length = ISNULL(DataLength([Value]), 0),\n" +
+				"       @Pointer = TEXTPTR([Value])\n" +
+				"FROM [dbo].[_blobs] WHERE [Hash] = @Hash",
+				ERROR_CHANGED_OBJECT ) );
+			cmd.Connection = m_con;
+			cmd.Transaction = m_trans;
+			cmd.Parameters.Add( new SqlParameter( "@ID", header.ID ) );
+			cmd.Parameters.Add( new SqlParameter( "@Stamp", header.Stamp ) );
+			cmd.Parameters.Add( new SqlParameter( "@Hash", hash ) );
+			cmd.Parameters.Add( new SqlParameter( "@Blob", SqlDbType.Int ) );
+			cmd.Parameters["@Blob"].Direction = ParameterDirection.Output;
+			cmd.Parameters.Add( new SqlParameter( "@Pending", SqlDbType.Bit ) );
+			cmd.Parameters["@Pending"].Direction = ParameterDirection.Output;
+			cmd.Parameters.Add( new SqlParameter( "@Length", SqlDbType.Int ) );
+			cmd.Parameters["@Length"].Direction = ParameterDirection.Output;
+			cmd.Parameters.Add( new SqlParameter( "@Pointer", SqlDbType.VarBinary, 16 ) );
+			cmd.Parameters["@Pointer"].Direction = ParameterDirection.Output;
+			cmd.ExecuteNonQuery();
+
+			// content must be written first
+			if( cmd.Parameters["@Blob"].Value == DBNull.Value ) {
+				throw new KeyNotFoundException( ERROR_IMAGE_IS_ABSENT );
+			}
+			int blobID = Convert.ToInt32( cmd.Parameters["@Blob"].Value );
+
+			if( Convert.ToBoolean( cmd.Parameters["@Pending"].Value ) ) {
+				// check uploaded content by ranges
+				int length = Convert.ToInt32( cmd.Parameters["@Length"].Value );
+				object pointer = cmd.Parameters["@Pointer"].Value;
 
-			// proccess delete opearaton
+				HashAlgorithm sha = new SHA1Managed();
+				for( int offset = 0; offset < length; ) {
+					byte[] buffer = read_text( "_blobs", pointer, offset,
+											   Math.Min( BUFFER_LENGTH, length - offset ) );
+					if( buffer.Length == 0 ) break;
+
+					sha.TransformBlock( buffer, 0, buffer.Length, buffer, 0 );
+					offset += buffer.Length;
+				}
+				sha.TransformFinalBlock( new byte[0], 0, 0 );
+
+				if( Convert.ToBase64String( sha.Hash ) != Convert.ToBase64String( hash ) ) {
+					throw new InvalidDataException( ERROR_BLOB_HASH );
+				}
+			}
+
+			// complete upload and link content to the property
+			cmd = new SqlCommand( string.Format(
+				"DECLARE @_id as int, @_blob as int; SET @_blob = @Blob;\n" +
+				"UPDATE [dbo].[_blobs] SET [Pending] = 0 WHERE [ID] = @_blob;\n" +
+				blob_link_sql( false ),
+				header.ID, name.Replace( "'", "''" ) ) );
+			cmd.Connection = m_con;
+			cmd.Transaction = m_trans;
+			cmd.Parameters.Add( new SqlParameter( "@Blob", blobID ) );
 			cmd.ExecuteNonQuery();
+
+			// return new stamp of the object
+			header = get_header( header.ID );
 		} catch( Exception ex ) {
 			#region dubug info
 #if (DEBUG)
-			Debug.Print( "[ERROR] @ ODB.Delete: {0}", ex.ToString() );
+			Debug.Print( "[ERROR] @ ODB.CommitBlob: {0}", ex.Message );
 #endif
 			#endregion
 			// rollback failed transaction
@@ -578,9 +1158,11 @@ public class ODB : IPersistenceStorage
 		}
 		// close connection and commit transaction if required
 		TransactionCommit();
+
 		#region debug info
 #if (DEBUG)
-		Debug.Print( "<- ODB.Delete({0})", header.ID );
+		Debug.Print( "<- ODB.CommitBlob( {0}, '{1}', {2} )",
+					 header.ID, name, Convert.ToBase64String( hash ) );
 #endif
 		#endregion
 	}
@@ -670,6 +1252,20 @@ public class ODB : IPersistenceStorage
 	/// <param name="props">Array of object properties.</param>
 	public void Retrieve( ref HEADER header, out LINK[] links,
 						  out PROPERTY[] props )
+	{
+		Retrieve( ref header, null, out links, out props );
+	}
+
+	/// <summary>
+	/// Retrieve object header, links and specified properties.
+	/// </summary>
+	/// <param name="header">In/Out header value.</param>
+	/// <param name="names">Names of properties to be retrieved (null
+	/// means all properties).</param>
+	/// <param name="links">Array of object links.</param>
+	/// <param name="props">Array of object properties.</param>
+	public void Retrieve( ref HEADER header, string[] names,
+						  out LINK[] links, out PROPERTY[] props )
 	{
 		#region debug info
 #if (DEBUG)
@@ -704,6 +1300,8 @@ public class ODB : IPersistenceStorage
 					header.ID) );
 			cmd.Connection = m_con;
 			cmd.Transaction = m_trans;
+			// restrict request by specified names
+			names_to_cmd( names, cmd );
 
 			dr = cmd.ExecuteReader( CommandBehavior.SingleResult );
 			try {
@@ -733,6 +1331,9 @@ public class ODB : IPersistenceStorage
 				header.ID) );
 			cmd.Connection = m_con;
 			cmd.Transaction = m_trans;
+			// restrict request by specified names (so only
+			// requested BLOBs are read)
+			names_to_cmd( names, cmd );
 
 			SqlDataAdapter da = new SqlDataAdapter( (SqlCommand)cmd );
 			DataTable dt = new DataTable(); // table for object proxy properties
@@ -745,7 +1346,7 @@ public class ODB : IPersistenceStorage
 					string name = (string) dtr["Name"];
 					// save property in collection
 					_props.Add( new PROPERTY( name,
-											  new ValueBox( read_blob( header.ID, name ) ),
+											  new ValueBox( read_blob( header.Type, header.ID, name ) ),
 											  PROPERTY.STATE.New ));
 				}
 			} finally {
@@ -799,6 +1400,83 @@ public class ODB : IPersistenceStorage
 		#endregion
 	}
 
+	/// <summary>
+	/// Check stamps of the set of objects in one request.
+	/// </summary>
+	/// <param name="headers">Array of headers with known stamps.</param>
+	/// <returns>Array of current headers of outdated objects.</returns>
+	public HEADER[] Validate( HEADER[] headers )
+	{
+		#region debug info
+#if (DEBUG)
+		Debug.Print( "-> ODB.Validate( {0} )", headers.Length );
+#endif
+		#endregion
+
+		List<HEADER> _headers = new List<HEADER>();	// list to store outdated headers
+		// nothing to validate
+		if( headers.Length == 0 ) return _headers.ToArray();
+
+		// map of requested stamps by object ID
+		Dictionary<int, HEADER> known = new Dictionary<int, HEADER>();
+		string[] ids = new string[headers.Length];
+		for( int i = 0; i < headers.Length; i++ ) {
+			known[headers[i].ID] = headers[i];
+			ids[i] = headers[i].ID.ToString();
+		}
+
+		// open connection and start new transaction if required
+		TransactionBegin();
+		try {
+			DbCommand cmd = new SqlCommand( string.Format(
+				"SELECT [ID], [ObjectName], [ObjectType], [TimeStamp]\n" +
+				"FROM [dbo].[_objects] WHERE [ID] IN ({0})",
+				string.Join( ", ", ids )) );
+			cmd.Connection = m_con;
+			cmd.Transaction = m_trans;
+
+			DbDataReader dr = cmd.ExecuteReader( CommandBehavior.SingleResult );
+			try {
+				while( dr.Read() ) {
+					HEADER header = new HEADER(
+						(string) dr["ObjectType"],
+						Convert.ToInt32( dr["ID"] ),
+						Convert.ToDateTime( dr["TimeStamp"] ),
+						(string) dr["ObjectName"] );
+
+					// return header if stamp was changed
+					if( known[header.ID].Stamp != header.Stamp ) _headers.Add( header );
+					// and mark object as existing one
+					known.Remove( header.ID );
+				}
+			} finally { dr.Dispose(); }
+
+			// all other objects were deleted: return them with empty stamp
+			foreach( HEADER header in known.Values ) {
+				_headers.Add( new HEADER( header.Type, header.ID, new DateTime(), header.Name ) );
+			}
+		} catch( Exception ex ) {
+			#region debug info
+#if (DEBUG)
+			Debug.Print( "[ERROR] @ ODB.Validate: {0}", ex.ToString() );
+#endif
+			#endregion
+			// rollback failed transaction
+			TransactionRollback();
+			throw;
+		}
+		// close connection and commit transaction if required
+		TransactionCommit();
+
+		#region debug info
+#if (DEBUG)
+		Debug.Print( "<- ODB.Validate( {0} ) = {1}", headers.Length, _headers.Count );
+#endif
+		#endregion
+
+		return _headers.ToArray();
+	}
+
 	/// <summary>
 	/// Save object header, links and properties to storage.
 	/// </summary>
@@ -1008,35 +1686,51 @@ public class ODB : IPersistenceStorage
 			// list for HEADERs return purpose
 			List<HEADER> objects = null;
 
-			// for SqlParameter names and values
-			Dictionary<string, object> parms = new Dictionary<string, object>();
-			// create sql command text
-			string whereQuery = "";
-			if( where != null ) {
-				whereQuery = where_to_cmd(where, parms);
-			}
-
-			#region prepare OrderBy part
-			string orderJoin = "";
-			string orderBy = "";
-
-			if( order != null ) {
-				foreach( OrderBy.Clause clause in order ) {
-					string orderJoinOut;
-					string orderByOut;
-					orderby_to_cmd(clause, out orderJoinOut, out orderByOut);
-					orderJoin += orderJoinOut;
-					orderBy += orderByOut + ", ";
-				}
-				orderBy = orderBy.Trim().TrimEnd(',');
-			}
-			#endregion
+			// get search command text by query shape (values are
+			// passed as parameters, so text is the same for them)
+			cmd.CommandText = get_query(
+				"Search\n" + type + "\n" + shape_of( where ) + "\n" + shape_of( order ),
+				delegate {
+					// create sql command text
+					string whereQuery = "";
+					if( where != null ) {
+						whereQuery = where_to_cmd(where, new List<object>());
+					}
 
-			// template for search query:
-			// - gets ids of object that meets {0},
-			// - skips @bottom rows
-			// - return only @count object HEADERs
-			cmd.CommandText="DECLARE @_i as int\n" +
+					#region prepare OrderBy part
+					string orderJoin = "";
+					string orderBy = "";
+
+					if( order != null ) {
+						foreach( OrderBy.Clause clause in order ) {
+							string orderJoinOut;
+							string orderColumnOut;
+							string orderByOut;
+							orderby_to_cmd(clause, out orderJoinOut, out orderColumnOut, out orderByOut);
+							orderJoin += orderJoinOut;
+							orderBy += orderByOut + ", ";
+						}
+						orderBy = orderBy.Trim().TrimEnd(',');
+					}
+					#endregion
+
+					// search query part with ordering
+					string query = string.Format(
+									"SELECT [src].[ID]\n" +
+									"FROM (SELECT * FROM [dbo].[_objects] WHERE [ObjectType] = '{0}') AS [src]" + 
+									"{1}\n" + //orderJoin
+									"{2}\n" + //WHERE
+									"{3}", // ORDER BY
+									type, orderJoin,
+									string.IsNullOrEmpty(whereQuery) ? "" : "WHERE " + whereQuery,
+									orderBy == "" ? "" : "ORDER BY " + orderBy );
+
+					// template for search query:
+					// - gets ids of object that meets {0},
+					// - skips @bottom rows
+					// - return only @count object HEADERs
+					return string.Format(
+							"DECLARE @_i as int\n" +
 							"DECLARE @_id as int\n" +
 							"DECLARE @_ids TABLE ([id] int)\n" +
 							"--return requested count of items\n" +
@@ -1055,18 +1749,9 @@ public class ODB : IPersistenceStorage
 							"DEALLOCATE curs\n" +
 							"--Make SQL request\n" +
 							"SELECT [o].[ID], [o].[ObjectName], [o].[ObjectType], [o].[TimeStamp]\n" +
-							"FROM [dbo].[_objects] [o] INNER JOIN @_ids AS [ids] ON [o].[ID] = [ids].[id]";
-
-			// search query part with ordering
-			string query = string.Format(
-							"SELECT [src].[ID]\n" +
-							"FROM (SELECT * FROM [dbo].[_objects] WHERE [ObjectType] = '{0}') AS [src]" + 
-							"{1}\n" + //orderJoin
-							"{2}\n" + //WHERE
-							"{3}", // ORDER BY
-							type, orderJoin,
-							string.IsNullOrEmpty(whereQuery) ? "" : "WHERE " + whereQuery,
-							orderBy == "" ? "" : "ORDER BY " + orderBy );
+							"FROM [dbo].[_objects] [o] INNER JOIN @_ids AS [ids] ON [o].[ID] = [ids].[id]",
+							query );
+				} );
 			SqlParameter param = new SqlParameter( "@found", SqlDbType.Int );
 			param.Direction = ParameterDirection.Output;
 			cmd.Parameters.Add( param );
@@ -1074,11 +1759,7 @@ public class ODB : IPersistenceStorage
 			cmd.Parameters.Add( new SqlParameter( "@bottom", bottom + 1 ) );
 			cmd.Parameters.Add( new SqlParameter( "@count", count ) );
 			// creating SqlParameters for passed values
-			foreach( string parm in parms.Keys ) {
-				cmd.Parameters.Add( new SqlParameter(parm, parms[parm]));
-			}
-			// replacing parts in search query template
-			cmd.CommandText = string.Format( cmd.CommandText, query );
+			where_to_parms( where, cmd );
 	#if (DEBUG)
 			Debug.Print("ODB.Search: sql search query = '{0}'", cmd.CommandText );
 	#endif
@@ -1129,6 +1810,388 @@ public class ODB : IPersistenceStorage
 		}
 	}
 
+	/// <summary>
+	/// Search objects that sutisfies search criteria without counting of all
+	/// found objects.
+	/// </summary>
+	/// <param name="type">Objects type.</param>
+	/// <param name="where">Where object</param>
+	/// <param name="order">>OrderBy object</param>
+	/// <param name="bottom">Bottom limit in the request.</param>
+	/// <param name="count">Count limit in the request.</param>
+	/// <returns>Array of found object headers.</returns>
+	public HEADER[] Search(string type, Where where, OrderBy order, int bottom, int count)
+	{
+		#region debug info
+#if (DEBUG)
+		Debug.Print("-> ODB.Search( '{0}', {1}, {2})", type, bottom, count );
+#endif
+		#endregion
+		// nothing to search for (zero row count means no limit)
+		if( count == 0 ) return new HEADER[0];
+
+		// init search command
+		using( DbCommand cmd = new SqlCommand() ) {
+			// list for HEADERs return purpose
+			List<HEADER> objects = null;
+
+			// get search command text by query shape (values are
+			// passed as parameters, so text is the same for them)
+			cmd.CommandText = get_query(
+				"SearchPage\n" + type + "\n" + shape_of( where ) + "\n" + shape_of( order ),
+				delegate {
+					// create sql command text
+					string whereQuery = "";
+					if( where != null ) {
+						whereQuery = where_to_cmd(where, new List<object>());
+					}
+
+					#region prepare OrderBy part
+					string orderJoin = "";
+					string orderBy = "";
+
+					if( order != null ) {
+						foreach( OrderBy.Clause clause in order ) {
+							string orderJoinOut;
+							string orderColumnOut;
+							string orderByOut;
+							orderby_to_cmd(clause, out orderJoinOut, out orderColumnOut, out orderByOut);
+							orderJoin += orderJoinOut;
+							orderBy += orderByOut + ", ";
+						}
+						orderBy = orderBy.Trim().TrimEnd(',');
+					}
+					#endregion
+
+					// search query part with ordering
+					string query = string.Format(
+									"SELECT [src].[ID]\n" +
+									"FROM (SELECT * FROM [dbo].[_objects] WHERE [ObjectType] = '{0}') AS [src]" + 
+									"{1}\n" + //orderJoin
+									"{2}\n" + //WHERE
+									"{3}", // ORDER BY
+									type, orderJoin,
+									string.IsNullOrEmpty(whereQuery) ? "" : "WHERE " + whereQuery,
+									orderBy == "" ? "" : "ORDER BY " + orderBy );
+
+					// template for search query:
+					// - gets ids of first @top objects that meets {0}
+					//   (search is stopped as soon as they are found),
+					// - return only HEADERs after @bottom rows
+					return string.Format(
+							"DECLARE @_ids TABLE ([n] int IDENTITY(0, 1), [id] int)\n" +
+							"--return requested count of items\n" +
+							"SET ROWCOUNT @top\n" +
+							"INSERT INTO @_ids ([id])\n" +
+							"{0}\n" +
+							"SET ROWCOUNT 0\n" +
+							"--Make SQL request\n" +
+							"SELECT [o].[ID], [o].[ObjectName], [o].[ObjectType], [o].[TimeStamp]\n" +
+							"FROM [dbo].[_objects] [o] INNER JOIN @_ids AS [ids] ON [o].[ID] = [ids].[id]\n" +
+							"WHERE [ids].[n] >= @bottom\n" +
+							"ORDER BY [ids].[n]",
+							query );
+				} );
+			// setting query count limits
+			cmd.Parameters.Add( new SqlParameter( "@top", (int)Math.Min( (long)bottom + count, int.MaxValue ) ) );
+			cmd.Parameters.Add( new SqlParameter( "@bottom", bottom ) );
+			// creating SqlParameters for passed values
+			where_to_parms( where, cmd );
+	#if (DEBUG)
+			Debug.Print("ODB.Search: sql search query = '{0}'", cmd.CommandText );
+	#endif
+
+			// open connection and start new transaction if required
+			TransactionBegin();
+			try {
+				cmd.Connection = m_con;
+				cmd.Transaction = m_trans;
+				// search query will return table with the following columns:
+				// ID, ObjectName, ObjectType, TimeStamp
+				#region retrive data and create proxies
+				DbDataReader dr = cmd.ExecuteReader();
+				// create List for storing found objects
+				objects = new List<HEADER>();
+				try {
+					while( dr.Read() ) {
+						// save found proxy object
+						objects.Add(new HEADER((string)dr["ObjectType"],
+												Convert.ToInt32(dr["ID"]),
+												Convert.ToDateTime(dr["TimeStamp"]),
+												(string)dr["ObjectName"]));
+					}
+				} finally { dr.Dispose(); }
+				#endregion
+			} catch( Exception ex ) {
+				#region debug info
+	#if (DEBUG)
+				Debug.Print("[ERROR] @ ODB.Search: {0}", ex.ToString());
+	#endif
+				#endregion
+				// rollback failed transaction
+				TransactionRollback();
+				throw;
+			}
+			// close connection and commit transaction if required
+			TransactionCommit();
+
+			#region debug info
+	#if (DEBUG)
+			Debug.Print("<- ODB.Search( '{0}', '{1}') = {2}", type, where, objects.Count);
+	#endif
+			#endregion
+			// return objects found
+			return objects.ToArray();
+		}
+	}
+
+	/// <summary>
+	/// Count objects that sutisfies search criteria.
+	/// </summary>
+	/// <param name="type">Objects type.</param>
+	/// <param name="where">Where object</param>
+	/// <returns>Count of found objects</returns>
+	public int Count(string type, Where where)
+	{
+		#region debug info
+#if (DEBUG)
+		Debug.Print("-> ODB.Count( '{0}')", type );
+#endif
+		#endregion
+		int result = 0;
+
+		// init count command
+		using( DbCommand cmd = new SqlCommand() ) {
+			// get count command text by query shape (values are
+			// passed as parameters, so text is the same for them)
+			cmd.CommandText = get_query(
+				"Count\n" + type + "\n" + shape_of( where ),
+				delegate {
+					// create sql command text
+					string whereQuery = "";
+					if( where != null ) {
+						whereQuery = where_to_cmd(where, new List<object>());
+					}
+					return string.Format(
+							"SELECT COUNT(*)\n" +
+							"FROM (SELECT * FROM [dbo].[_objects] WHERE [ObjectType] = '{0}') AS [src]\n" +
+							"{1}", //WHERE
+							type,
+							string.IsNullOrEmpty(whereQuery) ? "" : "WHERE " + whereQuery );
+				} );
+			// creating SqlParameters for passed values
+			where_to_parms( where, cmd );
+	#if (DEBUG)
+			Debug.Print("ODB.Count: sql count query = '{0}'", cmd.CommandText );
+	#endif
+
+			// open connection and start new transaction if required
+			TransactionBegin();
+			try {
+				cmd.Connection = m_con;
+				cmd.Transaction = m_trans;
+				result = Convert.ToInt32( cmd.ExecuteScalar() );
+			} catch( Exception ex ) {
+				#region debug info
+	#if (DEBUG)
+				Debug.Print("[ERROR] @ ODB.Count: {0}", ex.ToString());
+	#endif
+				#endregion
+				// rollback failed transaction
+				TransactionRollback();
+				throw;
+			}
+			// close connection and commit transaction if required
+			TransactionCommit();
+		}
+		#region debug info
+#if (DEBUG)
+		Debug.Print("<- ODB.Count( '{0}', '{1}') = {2}", type, where, result);
+#endif
+		#endregion
+		// return count objects found
+		return result;
+	}
+
+	/// <summary>
+	/// Search storage for the next page of persistent objects that satisfy
+	/// specified conditions.
+	/// </summary>
+	/// <param name="type">Objects type.</param>
+	/// <param name="where">SQL WHERE clause.</param>
+	/// <param name="order">SQL ORDER BY clause.</param>
+	/// <param name="after">In/Out keyset of the last object of the
+	/// previous page (null reference for the first page).</param>
+	/// <param name="bottom">Count of objects to skip after the keyset.
+	/// </param>
+	/// <param name="count">Count limit in the request.</param>
+	/// <returns>Array of found object headers.</returns>
+	/// <remarks>
+	/// Keyset consists of object values for every OrderBy clause (DBNull
+	/// for missing ones) followed by object ID, so position doesn't depend
+	/// on the object itself. On return it is set to keyset of the last
+	/// found object (isn't changed if page is empty).
+	/// </remarks>
+	public HEADER[] SearchAfter(string type, Where where, OrderBy order,
+								ref ValueBox[] after, int bottom, int count)
+	{
+		#region debug info
+#if (DEBUG)
+		Debug.Print("-> ODB.SearchAfter( '{0}', {1}, {2})", type, bottom, count );
+#endif
+		#endregion
+		// check that keyset has value for every clause and ID
+		int clauses = 0;
+		if( order != null ) {
+			foreach( OrderBy.Clause clause in order ) clauses++;
+		}
+		if( (after != null) && (after.Length != clauses + 1) ) {
+			throw new ArgumentException( ERROR_KEYSET, "after" );
+		}
+		// nothing to search for
+		if( count == 0 ) return new HEADER[0];
+
+		bool first = (after == null);
+		// init search command
+		using( DbCommand cmd = new SqlCommand() ) {
+			// list for HEADERs and keyset of the last one
+			List<HEADER> objects = null;
+			ValueBox[] last = null;
+
+			// get search command text by query shape (values are
+			// passed as parameters, so text is the same for them)
+			cmd.CommandText = get_query(
+				"SearchAfter\n" + type + "\n" + shape_of( where ) + "\n" + shape_of( order ) +
+				(first ? "\nFirst" : "\nNext"),
+				delegate {
+					// create sql command text
+					string whereQuery = "";
+					if( where != null ) {
+						whereQuery = where_to_cmd(where, new List<object>());
+					}
+
+					#region prepare OrderBy part
+					string orderJoin = "";
+					string orderBy = "";
+					string keyColumns = "";
+					string keyValues = "";
+					List<string> keys = new List<string>();
+					List<bool> asc = new List<bool>();
+
+					if( order != null ) {
+						foreach( OrderBy.Clause clause in order ) {
+							string orderJoinOut;
+							string orderColumnOut;
+							string orderByOut;
+							orderby_to_cmd(clause, out orderJoinOut, out orderColumnOut, out orderByOut);
+							orderJoin += orderJoinOut;
+							orderBy += orderByOut + ", ";
+							keyColumns += string.Format( ", [_k{0}] sql_variant", keys.Count );
+							keyValues += ", " + orderColumnOut;
+							keys.Add( orderColumnOut );
+							asc.Add( clause.Sort == OrderBy.Clause.SORT.ASC );
+						}
+					}
+					// ties are always ordered by ID, so every page
+					// (the first one too) has the same order
+					orderBy += "[src].[ID] ASC";
+					#endregion
+
+					// search query: rows that follow the keyset, so
+					// previous pages are neither skipped nor counted
+					string query = string.Format(
+									"SELECT [src].[ID]{1}\n" +
+									"FROM (SELECT * FROM [dbo].[_objects] WHERE [ObjectType] = '{0}') AS [src]" +
+									"{2}\n" + //orderJoin
+									"{3}\n" + //WHERE
+									"ORDER BY {4}",
+									type, keyValues, orderJoin,
+									whereQuery == "" && first ? "" :
+									"WHERE " + (whereQuery == "" ? "(0=0)" : whereQuery) +
+									(first ? "" : " AND\n" + keyset_to_cmd( keys, asc )),
+									orderBy );
+
+					// template for search query:
+					// - gets ids and keys of first @top objects that
+					//   follow the keyset,
+					// - return HEADERs and keys after @bottom rows
+					return string.Format(
+							"DECLARE @_ids TABLE ([n] int IDENTITY(0, 1), [id] int{0})\n" +
+							"--return requested count of items\n" +
+							"SET ROWCOUNT @top\n" +
+							"INSERT INTO @_ids ([id]{1})\n" +
+							"{2}\n" +
+							"SET ROWCOUNT 0\n" +
+							"--Make SQL request\n" +
+							"SELECT [o].[ID], [o].[ObjectName], [o].[ObjectType], [o].[TimeStamp]{1}\n" +
+							"FROM [dbo].[_objects] [o] INNER JOIN @_ids AS [ids] ON [o].[ID] = [ids].[id]\n" +
+							"WHERE [ids].[n] >= @bottom\n" +
+							"ORDER BY [ids].[n]",
+							keyColumns, keyColumns.Replace( " sql_variant", "" ), query );
+				} );
+			// setting query limits
+			cmd.Parameters.Add( new SqlParameter( "@top", (int)Math.Min( (long)bottom + count, int.MaxValue ) ) );
+			cmd.Parameters.Add( new SqlParameter( "@bottom", bottom ) );
+			// creating SqlParameters for keyset and passed values
+			if( !first ) keyset_to_parms( order, after, cmd );
+			where_to_parms( where, cmd );
+	#if (DEBUG)
+			Debug.Print("ODB.SearchAfter: sql search query = '{0}'", cmd.CommandText );
+	#endif
+
+			// open connection and start new transaction if required
+			TransactionBegin();
+			try {
+				cmd.Connection = m_con;
+				cmd.Transaction = m_trans;
+				// search query will return table with the following columns:
+				// ID, ObjectName, ObjectType, TimeStamp, _k0, _k1, ...
+				#region retrive data and create proxies
+				DbDataReader dr = cmd.ExecuteReader();
+				// create List for storing found objects
+				objects = new List<HEADER>();
+				try {
+					while( dr.Read() ) {
+						// save found proxy object
+						objects.Add(new HEADER((string)dr["ObjectType"],
+												Convert.ToInt32(dr["ID"]),
+												Convert.ToDateTime(dr["TimeStamp"]),
+												(string)dr["ObjectName"]));
+						// and keyset of the last one
+						last = new ValueBox[clauses + 1];
+						for( int i = 0; i < clauses; i++ ) {
+							last[i] = new ValueBox( dr["_k" + i] );
+						}
+						last[clauses] = Convert.ToInt32(dr["ID"]);
+					}
+				} finally { dr.Dispose(); }
+				#endregion
+			} catch( Exception ex ) {
+				#region debug info
+	#if (DEBUG)
+				Debug.Print("[ERROR] @ ODB.SearchAfter: {0}", ex.ToString());
+	#endif
+				#endregion
+				// rollback failed transaction
+				TransactionRollback();
+				throw;
+			}
+			// close connection and commit transaction if required
+			TransactionCommit();
+
+			// move keyset to the last found object
+			if( last != null ) after = last;
+
+			#region debug info
+	#if (DEBUG)
+			Debug.Print("<- ODB.SearchAfter( '{0}', {1}, {2}) = {3}", type, bottom, count, objects.Count);
+	#endif
+			#endregion
+			// return objects found
+			return objects.ToArray();
+		}
+	}
+
 	/// <summary>
 	/// Starts a storage transaction.
 	/// </summary>
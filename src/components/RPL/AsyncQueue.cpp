@@ -0,0 +1,278 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		AsyncQueue.cpp												*/
+/*																			*/
+/*	Content:	Implementation of AsyncQueue class							*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#include "AsyncQueue.h"
+
+using namespace System::Reflection;
+using namespace _RPL;
+
+
+//-----------------------------------------------------------------------------
+//						Toolkit::RPL::AsyncQueue::Result
+//-----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Creates state of operation that calls specified method with
+// specified arguments.
+//
+//-------------------------------------------------------------------
+AsyncQueue::Result::Result( Delegate ^method, array<Object^> ^args, \
+							AsyncCallback ^callback, Object ^state ): \
+	_method(method), _args(args), _callback(callback), _state(state), \
+	m_completed(false)
+{
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets user-defined object that was passed to Begin call.
+//
+//-------------------------------------------------------------------
+Object^ AsyncQueue::Result::AsyncState::get( void )
+{
+	return _state;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets handle that is used to wait for operation to complete.
+//
+// Handle is created at first request and is closed by End call.
+//
+//-------------------------------------------------------------------
+WaitHandle^ AsyncQueue::Result::AsyncWaitHandle::get( void )
+{
+	Monitor::Enter( this );
+	try {
+		// create handle in the current state
+		if( m_event == nullptr ) m_event = gcnew ManualResetEvent( m_completed );
+
+		return m_event;
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Operations are always executed by the thread pool.
+//
+//-------------------------------------------------------------------
+bool AsyncQueue::Result::CompletedSynchronously::get( void )
+{
+	return false;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets value indicating whether operation is completed.
+//
+//-------------------------------------------------------------------
+bool AsyncQueue::Result::IsCompleted::get( void )
+{
+	return m_completed;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Calls method and completes operation.
+//
+// Result of the method or raised exception (without reflection
+// wrapper) is stored for End call. Then waiting threads are released
+// and callback is called. Exception of the callback is traced only:
+// there is nobody to catch it on the pool thread.
+//
+//-------------------------------------------------------------------
+void AsyncQueue::Result::Execute( void )
+{
+	try {
+		// call to requested method
+		m_value = _method->DynamicInvoke( _args );
+	} catch( TargetInvocationException ^e ) {
+		// store original exception
+		m_error = e->InnerException;
+	} catch( Exception ^e ) {
+		// store exception as is
+		m_error = e;
+	}
+
+	// mark operation as completed
+	Monitor::Enter( this );
+	try {
+		m_completed = true;
+		// and release waiting threads
+		if( m_event != nullptr ) m_event->Set();
+	} finally {
+		Monitor::Exit( this );
+	}
+
+	// notify about complete
+	try {
+		if( _callback != nullptr ) _callback( this );
+	} catch( Exception ^e ) {
+		System::Diagnostics::Trace::WriteLine( String::Format(
+		ERR_ASYNC_CALLBACK, e->Message ) );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Waits for operation to complete and releases wait handle.
+//
+// Returns value of the called method or throws exception that was
+// raised during operation wrapped by TargetInvocationException (to
+// keep its stack trace).
+//
+//-------------------------------------------------------------------
+Object^ AsyncQueue::Result::Wait( void )
+{
+	// wait for operation if it is not completed yet
+	if( !m_completed ) AsyncWaitHandle->WaitOne();
+
+	// release wait handle
+	Monitor::Enter( this );
+	try {
+		if( m_event != nullptr ) m_event->Close();
+	} finally {
+		Monitor::Exit( this );
+	}
+
+	// pass exception to the caller
+	if( m_error != nullptr ) throw gcnew TargetInvocationException(
+		String::Format( ERR_ASYNC_FAILED, m_error->Message ), m_error );
+
+	return m_value;
+}
+
+
+//-----------------------------------------------------------------------------
+//							Toolkit::RPL::AsyncQueue
+//-----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Executes queued operations in the thread pool.
+//
+// Operations are executed one by one until queue is empty, then
+// thread is returned to the pool. If worker is aborted by unexpected
+// exception, the rest of queue is passed to the new one.
+//
+//-------------------------------------------------------------------
+void AsyncQueue::worker( Object ^state )
+{
+	bool	stopped = false;
+
+	try {
+		while( true ) {
+			Result	^op = nullptr;
+
+			// get next operation
+			Monitor::Enter( this );
+			try {
+				// stop if there is nothing to execute
+				if( m_queue.Count == 0 ) {
+					m_running = false;
+					stopped = true;
+					return;
+				}
+				op = m_queue.Dequeue();
+			} finally {
+				Monitor::Exit( this );
+			}
+
+			// and execute it
+			op->Execute();
+		}
+	} finally {
+		// reset worker state if it was aborted
+		if( !stopped ) {
+			Monitor::Enter( this );
+			try {
+				m_running = false;
+				// and start new worker for the rest of queue
+				if( m_queue.Count > 0 ) {
+					ThreadPool::QueueUserWorkItem(
+						gcnew WaitCallback( this, &AsyncQueue::worker ) );
+					m_running = true;
+				}
+			} finally {
+				Monitor::Exit( this );
+			}
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Starts asynchronous operation.
+//
+// Method will be called with specified arguments after all
+// previously started operations of this queue.
+//
+//-------------------------------------------------------------------
+IAsyncResult^ AsyncQueue::Begin( Delegate ^method, array<Object^> ^args,
+								 AsyncCallback ^callback, Object ^state )
+{
+	// check for null reference
+	if( method == nullptr ) throw gcnew ArgumentNullException("method");
+
+	Result	^op = gcnew Result( method, args, callback, state );
+
+	// lock queue to keep order of operations
+	Monitor::Enter( this );
+	try {
+		// put operation to the end of queue
+		m_queue.Enqueue( op );
+		// and start worker if it is not running
+		if( !m_running ) {
+			ThreadPool::QueueUserWorkItem(
+				gcnew WaitCallback( this, &AsyncQueue::worker ) );
+			m_running = true;
+		}
+		return op;
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Waits for pending asynchronous operation to complete.
+//
+// Returns value of the called method or throws exception that was
+// raised during operation. Wait handle of the operation is released.
+//
+//-------------------------------------------------------------------
+Object^ AsyncQueue::End( IAsyncResult ^result )
+{
+	// check for null reference
+	if( result == nullptr ) throw gcnew ArgumentNullException("result");
+
+	// get operation state
+	Result	^op = dynamic_cast<Result^>( result );
+	// check for result was produced by queue
+	if( op == nullptr ) throw gcnew ArgumentException(
+		ERR_ASYNC_RESULT, "result");
+
+	return op->Wait();
+}
@@ -0,0 +1,90 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		AsyncQueue.h												*/
+/*																			*/
+/*	Content:	Definition of AsyncQueue class								*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#pragma once
+#include "RPL.h"
+
+using namespace System;
+using namespace System::Collections::Generic;
+using namespace System::Threading;
+
+
+_RPL_BEGIN
+/// <summary>
+/// Queue of asynchronous operations on some instance.
+/// </summary><remarks><para>
+/// Operations of one queue are executed one by one by the thread pool:
+/// pool thread is requested when the first operation is started and it
+/// executes queued operations until queue is empty. So operations on
+/// one instance are completed in the order they were started (without
+/// threads waiting for each other), but operations on different
+/// instances can be in flight at once.
+/// </para><para>
+/// Exceptions are passed to the caller through End call as inner
+/// exception of TargetInvocationException. End call releases wait
+/// handle of the operation, so it must be called for every started
+/// one. Exceptions of callbacks are traced and ignored.
+/// </para></remarks>
+ref class AsyncQueue
+{
+public:
+	delegate void OPERATION( void );
+
+private:
+	// State of queued operation
+	ref class Result : IAsyncResult
+	{
+	private:
+		Delegate^			const _method;
+		array<Object^>^		const _args;
+		AsyncCallback^		const _callback;
+		Object^				const _state;
+
+		Object				^m_value;
+		Exception			^m_error;
+		bool				m_completed;
+		ManualResetEvent	^m_event;
+
+	public:
+		Result( Delegate ^method, array<Object^> ^args,
+				AsyncCallback ^callback, Object ^state );
+
+		property Object^ AsyncState {
+			virtual Object^ get( void );
+		}
+		property WaitHandle^ AsyncWaitHandle {
+			virtual WaitHandle^ get( void );
+		}
+		property bool CompletedSynchronously {
+			virtual bool get( void );
+		}
+		property bool IsCompleted {
+			virtual bool get( void );
+		}
+
+		void Execute( void );
+		Object^ Wait( void );
+	};
+
+	Queue<Result^>	m_queue;
+	bool			m_running;
+
+	void worker( Object ^state );
+
+public:
+	IAsyncResult^ Begin( Delegate ^method, array<Object^> ^args,
+						 AsyncCallback ^callback, Object ^state );
+	static Object^ End( IAsyncResult ^result );
+};
+_RPL_END
@@ -38,6 +38,10 @@ using namespace _RPL;
 //-------------------------------------------------------------------
 void DeleteCriteria::OnPerformComplete( void )
 {
+	// count found objects now: after deletion they can't be counted
+	// at first access to CountFound
+	if( m_countFound < 0 ) m_countFound = CountFound;
+
 	// declare stack of changes to emulate transaction
 	Stack<ITransaction^>	changes;
 	try {
@@ -76,7 +80,8 @@ void DeleteCriteria::OnPerformComplete( void )
 DeleteCriteria::DeleteCriteria( String ^type ): \
 	PersistentCriteria( type )
 {
-	// do nothing
+	// objects to delete must be actual
+	m_useCache = false;
 };
 
 
@@ -89,6 +94,7 @@ DeleteCriteria::DeleteCriteria( String ^type ): \
 DeleteCriteria::DeleteCriteria( String ^type, ::Where ^where ): \
 	PersistentCriteria( type )
 {
+	m_useCache = false;
 	m_where = where;
 }
 
@@ -103,6 +109,7 @@ DeleteCriteria::DeleteCriteria( String ^type,					    \
 								::Where ^where, ::OrderBy ^order ): \
 	PersistentCriteria(type)
 {
+	m_useCache = false;
 	m_where = where;
 	m_orderBy = order;
 }
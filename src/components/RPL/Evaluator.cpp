@@ -0,0 +1,417 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		Evaluator.cpp												*/
+/*																			*/
+/*	Content:	Implementation of Evaluator class							*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#include "PersistentObject.h"
+#include "PersistentStream.h"
+#include "Evaluator.h"
+
+using namespace System::Collections::Generic;
+using namespace System::Text;
+using namespace _RPL;
+
+
+//
+// Define regular expression options for LIKE patterns
+//
+#define LIKE_OPTIONS (RegexOptions::IgnoreCase | RegexOptions::Singleline | \
+					  RegexOptions::CultureInvariant)
+
+
+//-----------------------------------------------------------------------------
+//						Toolkit::RPL::Evaluator::Clause
+//-----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Resolves predicate operand, operator and value. LIKE pattern is
+// compiled to regular expression once.
+//
+//-------------------------------------------------------------------
+Evaluator::Clause::Clause( Where::Clause ^clause ):					 \
+	_opd(clause->OPD), _op(clause->Operator),						 \
+	_value(clause->Value.ToObject()),								 \
+	_like(((clause->Operator == Where::Clause::OP::EQ) &&			 \
+		   (dynamic_cast<String^>( clause->Value.ToObject() ) != nullptr)) ? \
+		  gcnew Regex(like_pattern( safe_cast<String^>(				 \
+			  clause->Value.ToObject() ) ),							 \
+			  LIKE_OPTIONS | RegexOptions::Compiled) : nullptr)
+{
+	// do nothing
+}
+
+
+//-------------------------------------------------------------------
+//
+// Checks object against the predicate.
+//
+//-------------------------------------------------------------------
+bool Evaluator::Clause::Match( PersistentObject ^obj )
+{
+	return match( _opd, _op, _value, _like, obj );
+}
+
+
+//-----------------------------------------------------------------------------
+//					Toolkit::RPL::Evaluator::And, Or, Not
+//-----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Combines two compiled predicates by AND operation.
+//
+//-------------------------------------------------------------------
+Evaluator::And::And( Predicate<PersistentObject^> ^left,  \
+					 Predicate<PersistentObject^> ^right ): \
+	_left(left), _right(right)
+{
+	// do nothing
+}
+
+
+//-------------------------------------------------------------------
+//
+// Checks object: returns true if both predicates are true.
+//
+//-------------------------------------------------------------------
+bool Evaluator::And::Match( PersistentObject ^obj )
+{
+	return _left( obj ) && _right( obj );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Combines two compiled predicates by OR operation.
+//
+//-------------------------------------------------------------------
+Evaluator::Or::Or( Predicate<PersistentObject^> ^left,  \
+				   Predicate<PersistentObject^> ^right ): \
+	_left(left), _right(right)
+{
+	// do nothing
+}
+
+
+//-------------------------------------------------------------------
+//
+// Checks object: returns true if either predicate is true.
+//
+//-------------------------------------------------------------------
+bool Evaluator::Or::Match( PersistentObject ^obj )
+{
+	return _left( obj ) || _right( obj );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Negates compiled predicate.
+//
+//-------------------------------------------------------------------
+Evaluator::Not::Not( Predicate<PersistentObject^> ^sub ): \
+	_sub(sub)
+{
+	// do nothing
+}
+
+
+//-------------------------------------------------------------------
+//
+// Checks object: returns true if predicate is false.
+//
+//-------------------------------------------------------------------
+bool Evaluator::Not::Match( PersistentObject ^obj )
+{
+	return !_sub( obj );
+}
+
+
+//-----------------------------------------------------------------------------
+//						Toolkit::RPL::Evaluator::Order
+//-----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Resolves operands and sorting orders of the ORDER BY clause.
+//
+//-------------------------------------------------------------------
+Evaluator::Order::Order( OrderBy ^order )
+{
+	List<String^>	opds;
+	List<bool>		asc;
+
+	for each( OrderBy::Clause ^clause in order ) {
+		opds.Add( clause->OPD );
+		asc.Add( clause->Sort == OrderBy::Clause::SORT::ASC );
+	}
+	_opds = opds.ToArray();
+	_asc = asc.ToArray();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Compares two objects by sorting values. Missing values precede
+// all others, values of different types are ordered by type name
+// and objects with equal values are ordered by ID.
+//
+//-------------------------------------------------------------------
+int Evaluator::Order::Compare( PersistentObject ^x, PersistentObject ^y )
+{
+	for( int i = 0; i < _opds->Length; i++ ) {
+		Object	^vx = nullptr;
+		Object	^vy = nullptr;
+		bool	fx = get_value( x, _opds[i], vx );
+		bool	fy = get_value( y, _opds[i], vy );
+		int		result = 0;
+
+		if( !fx || !fy ) {
+			// missing value is less than any other
+			result = (fx ? 1 : 0) - (fy ? 1 : 0);
+		} else if( !compare( vx, vy, result ) ) {
+			// values can't be compared, so order them by type
+			result = String::CompareOrdinal( vx->GetType()->FullName,
+											 vy->GetType()->FullName );
+		}
+		if( result != 0 ) return _asc[i] ? result : -result;
+	}
+	// objects are equal, so order them by ID
+	return x->ID.CompareTo( y->ID );
+}
+
+
+//-----------------------------------------------------------------------------
+//							Toolkit::RPL::Evaluator
+//-----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Converts SQL LIKE pattern to regular expression: "%" matches any
+// string, "_" matches any character.
+//
+//-------------------------------------------------------------------
+String^ Evaluator::like_pattern( String ^like )
+{
+	StringBuilder	^sb = gcnew StringBuilder("^");
+
+	for each( wchar_t c in like ) {
+		switch( c ) {
+			case '%': sb->Append( ".*" ); break;
+			case '_': sb->Append( "." ); break;
+			default: sb->Append( Regex::Escape( Char::ToString( c ) ) );
+		}
+	}
+	return sb->Append( "$" )->ToString();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets value of specified operand: ID, Name and Stamp are header
+// fields, others are properties. Returns false if there is no such
+// property or it's value is null.
+//
+//-------------------------------------------------------------------
+bool Evaluator::get_value( PersistentObject ^obj, String ^opd, \
+						   [Out] Object^ %value )
+{
+	ValueBox	box;
+
+	if( opd == "ID" ) {
+		value = obj->ID;
+	} else if( opd == "Name" ) {
+		value = obj->Name;
+	} else if( opd == "Stamp" ) {
+		value = obj->Stamp;
+	} else {
+		value = obj->GetProperty( opd, box ) ? box.ToObject() : nullptr;
+	}
+	// DBNull value means missing property
+	if( value == DBNull::Value ) value = nullptr;
+
+	return (value != nullptr);
+}
+
+
+//-------------------------------------------------------------------
+//
+// Compares two values. Strings are compared without case by
+// invariant culture (as LIKE patterns), int and double values are
+// compared as numbers. Returns false if values
+// can't be compared.
+//
+//-------------------------------------------------------------------
+bool Evaluator::compare( Object ^x, Object ^y, [Out] int %result )
+{
+	Type	^tx = x->GetType();
+	Type	^ty = y->GetType();
+
+	result = 0;
+	if( tx == ty ) {
+		// strings are compared without case
+		if( tx == String::typeid ) {
+			result = String::Compare( safe_cast<String^>( x ),
+									  safe_cast<String^>( y ),
+									  StringComparison::InvariantCultureIgnoreCase );
+			return true;
+		}
+		// streams and other types without order
+		IComparable	^c = dynamic_cast<IComparable^>( x );
+		if( c == nullptr ) return false;
+
+		result = c->CompareTo( y );
+		return true;
+	}
+	// numbers of different types
+	if( ((tx == int::typeid) || (tx == double::typeid)) &&
+		((ty == int::typeid) || (ty == double::typeid)) ) {
+		result = Convert::ToDouble( x ).CompareTo( Convert::ToDouble( y ) );
+		return true;
+	}
+	return false;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Checks object against the simple predicate. LIKE pattern is used
+// if it is specified, in other case it is created from value.
+//
+//-------------------------------------------------------------------
+bool Evaluator::match( String ^opd, Where::Clause::OP op, Object ^value, \
+					   Regex ^like, PersistentObject ^obj )
+{
+	Object	^prop = nullptr;
+	bool	found = get_value( obj, opd, prop );
+	int		result = 0;
+
+	// DBNull condition checks property existence
+	if( value == DBNull::Value ) {
+		return (op == Where::Clause::OP::EQ) ? !found : found;
+	}
+	// missing properties and streams satisfy no conditions
+	if( !found || (dynamic_cast<PersistentStream^>( prop ) != nullptr) ) {
+		return false;
+	}
+
+	switch( op ) {
+		case Where::Clause::OP::EQ:
+			// equality for string means LIKE
+			if( dynamic_cast<String^>( value ) != nullptr ) {
+				String	^s = dynamic_cast<String^>( prop );
+
+				if( s == nullptr ) return false;
+				if( like != nullptr ) return like->IsMatch( s );
+
+				return Regex::IsMatch( s,
+					like_pattern( safe_cast<String^>( value ) ), LIKE_OPTIONS );
+			}
+			return compare( prop, value, result ) && (result == 0);
+		case Where::Clause::OP::NE:
+			return !(compare( prop, value, result ) && (result == 0));
+		case Where::Clause::OP::GT:
+			return compare( prop, value, result ) && (result > 0);
+		case Where::Clause::OP::LT:
+			return compare( prop, value, result ) && (result < 0);
+		case Where::Clause::OP::GE:
+			return compare( prop, value, result ) && (result >= 0);
+		case Where::Clause::OP::LE:
+			return compare( prop, value, result ) && (result <= 0);
+	}
+	return false;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Compiles WHERE clause to predicate.
+//
+//-------------------------------------------------------------------
+Predicate<PersistentObject^>^ Evaluator::Compile( Where ^where )
+{
+	// check for the null reference
+	if( where == nullptr ) throw gcnew ArgumentNullException("where");
+
+	Where::Clause			^clause = dynamic_cast<Where::Clause^>( where );
+	Where::Operation::And	^opAnd = dynamic_cast<Where::Operation::And^>( where );
+	Where::Operation::Or	^opOr = dynamic_cast<Where::Operation::Or^>( where );
+	Where::Operation::Not	^opNot = dynamic_cast<Where::Operation::Not^>( where );
+
+	if( clause != nullptr ) {
+		return gcnew Predicate<PersistentObject^>(
+			gcnew Clause(clause), &Clause::Match );
+	} else if( opAnd != nullptr ) {
+		return gcnew Predicate<PersistentObject^>(
+			gcnew And(Compile( opAnd->LeftWhere ), Compile( opAnd->RightWhere )),
+			&And::Match );
+	} else if( opOr != nullptr ) {
+		return gcnew Predicate<PersistentObject^>(
+			gcnew Or(Compile( opOr->LeftWhere ), Compile( opOr->RightWhere )),
+			&Or::Match );
+	} else if( opNot != nullptr ) {
+		return gcnew Predicate<PersistentObject^>(
+			gcnew Not(Compile( opNot->SubWhere )), &Not::Match );
+	}
+	throw gcnew ArgumentException(String::Format(
+		ERR_INVALID_TYPE, where->GetType() ), "where");
+}
+
+
+//-------------------------------------------------------------------
+//
+// Compiles ORDER BY clause to comparison.
+//
+//-------------------------------------------------------------------
+Comparison<PersistentObject^>^ Evaluator::Compile( OrderBy ^order )
+{
+	// check for the null reference
+	if( order == nullptr ) throw gcnew ArgumentNullException("order");
+
+	return gcnew Comparison<PersistentObject^>(
+		gcnew Order(order), &Order::Compare );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Checks object against WHERE clause by walking through the clause
+// tree (without compilation).
+//
+//-------------------------------------------------------------------
+bool Evaluator::Evaluate( Where ^where, PersistentObject ^obj )
+{
+	// check for the null references
+	if( where == nullptr ) throw gcnew ArgumentNullException("where");
+	if( obj == nullptr ) throw gcnew ArgumentNullException("obj");
+
+	Where::Clause			^clause = dynamic_cast<Where::Clause^>( where );
+	Where::Operation::And	^opAnd = dynamic_cast<Where::Operation::And^>( where );
+	Where::Operation::Or	^opOr = dynamic_cast<Where::Operation::Or^>( where );
+	Where::Operation::Not	^opNot = dynamic_cast<Where::Operation::Not^>( where );
+
+	if( clause != nullptr ) {
+		return match( clause->OPD, clause->Operator,
+					  clause->Value.ToObject(), nullptr, obj );
+	} else if( opAnd != nullptr ) {
+		return Evaluate( opAnd->LeftWhere, obj ) &&
+			   Evaluate( opAnd->RightWhere, obj );
+	} else if( opOr != nullptr ) {
+		return Evaluate( opOr->LeftWhere, obj ) ||
+			   Evaluate( opOr->RightWhere, obj );
+	} else if( opNot != nullptr ) {
+		return !Evaluate( opNot->SubWhere, obj );
+	}
+	throw gcnew ArgumentException(String::Format(
+		ERR_INVALID_TYPE, where->GetType() ), "where");
+}
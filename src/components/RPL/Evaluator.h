@@ -0,0 +1,129 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		Evaluator.h													*/
+/*																			*/
+/*	Content:	Definition of Evaluator class								*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#pragma once
+#include "RPL.h"
+#include "Query.h"
+
+using namespace System;
+using namespace System::Text::RegularExpressions;
+using namespace System::Runtime::InteropServices;
+
+
+_RPL_BEGIN
+ref class PersistentObject;
+
+/// <summary>
+/// Evaluates WHERE and ORDER BY clauses over objects in memory.
+/// </summary><remarks><para>
+/// Semantic follows database storage: ID, Name and Stamp operands
+/// refer to object header, others refer to properties. Missing
+/// property is equal to DBNull only, string values are compared
+/// without case and "equal" condition for string means LIKE pattern
+/// ("%" and "_" wildcards). Stream values satisfy no conditions.
+/// </para><para>
+/// Compiled clauses are trees of delegates with resolved operands,
+/// operators and patterns.
+/// </para></remarks>
+ref class Evaluator
+{
+private:
+	//
+	// Compiled predicate (simple WHERE clause).
+	//
+	ref class Clause
+	{
+	private:
+		String^				const _opd;
+		Where::Clause::OP	const _op;
+		Object^				const _value;
+		Regex^				const _like;
+
+	public:
+		Clause( Where::Clause ^clause );
+
+		bool Match( PersistentObject ^obj );
+	};
+
+	//
+	// Compiled logical operations.
+	//
+	ref class And
+	{
+	private:
+		Predicate<PersistentObject^>^	const _left;
+		Predicate<PersistentObject^>^	const _right;
+
+	public:
+		And( Predicate<PersistentObject^> ^left,
+			 Predicate<PersistentObject^> ^right );
+
+		bool Match( PersistentObject ^obj );
+	};
+
+	ref class Or
+	{
+	private:
+		Predicate<PersistentObject^>^	const _left;
+		Predicate<PersistentObject^>^	const _right;
+
+	public:
+		Or( Predicate<PersistentObject^> ^left,
+			Predicate<PersistentObject^> ^right );
+
+		bool Match( PersistentObject ^obj );
+	};
+
+	ref class Not
+	{
+	private:
+		Predicate<PersistentObject^>^	const _sub;
+
+	public:
+		Not( Predicate<PersistentObject^> ^sub );
+
+		bool Match( PersistentObject ^obj );
+	};
+
+	//
+	// Compiled ORDER BY clause.
+	//
+	ref class Order
+	{
+	private:
+		initonly array<String^>	^_opds;
+		initonly array<bool>	^_asc;
+
+	public:
+		Order( OrderBy ^order );
+
+		int Compare( PersistentObject ^x, PersistentObject ^y );
+	};
+
+private:
+	Evaluator( void ) {};
+
+	static String^ like_pattern( String ^like );
+	static bool get_value( PersistentObject ^obj, String ^opd,
+						   [Out] Object^ %value );
+	static bool compare( Object ^x, Object ^y, [Out] int %result );
+	static bool match( String ^opd, Where::Clause::OP op, Object ^value,
+					   Regex ^like, PersistentObject ^obj );
+
+public:
+	static Predicate<PersistentObject^>^ Compile( Where ^where );
+	static Comparison<PersistentObject^>^ Compile( OrderBy ^order );
+	static bool Evaluate( Where ^where, PersistentObject ^obj );
+};
+_RPL_END
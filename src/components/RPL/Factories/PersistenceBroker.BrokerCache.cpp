@@ -0,0 +1,536 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		PersistenceBroker.BrokerCache.cpp							*/
+/*																			*/
+/*	Content:	Implementation of PersistenceBroker::BrokerCache class		*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#include "..\PersistentObject.h"
+#include "PersistenceBroker.BrokerCache.h"
+
+using namespace _RPL;
+using namespace _RPL::Factories;
+
+
+//-----------------------------------------------------------------------------
+//					C O M M O N   D E C L A R A T I O N S
+//-----------------------------------------------------------------------------
+
+//
+// Clear thread sleep timeout. Default value is 0.512 sec.
+//
+#define SLEEP_TIMEOUT		0x00000200
+
+//
+// Default timeout to clear cache inaccessible
+// weak references. Default value is 600 sec.
+//
+#define CLEAR_TIMEOUT		0x000927C0
+
+//
+// Number of cache shards.
+//
+#define SHARDS_COUNT		0x00000020
+
+//
+// Initial number of buckets in shard. Shard grows twice
+// when average length of bucket chain exceeds SHARD_LOAD.
+//
+#define SHARD_CAPACITY		0x00000010
+#define SHARD_LOAD			0x00000002
+
+
+//----------------------------------------------------------------------------
+//		Toolkit::RPL::Factories::PersistenceBroker::BrokerCache::Entry
+//----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Create new node of the bucket chain.
+//
+//-------------------------------------------------------------------
+PersistenceBroker::BrokerCache::								   \
+Entry::Entry( KEY key, WeakReference ^ref, Entry ^next ):		   \
+	_key(key), _ref(ref), _next(next)
+{
+	// do nothing
+}
+
+
+//----------------------------------------------------------------------------
+//		Toolkit::RPL::Factories::PersistenceBroker::BrokerCache::Shard
+//----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Returns bucket index of the key for table with specified length.
+//
+// Low bits of the hash code are used to choose shard, so skip them.
+//
+//-------------------------------------------------------------------
+int PersistenceBroker::BrokerCache:: \
+Shard::index( KEY key, int length )
+{
+	return ((key.GetHashCode() & 0x7FFFFFFF) / SHARDS_COUNT) % length;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Copy bucket chain without specified key and inaccessible weak
+// references.
+//
+// Chain nodes can't be changed, so new chain is built. Number of
+// removed nodes is subtracted from specified counter.
+//
+//-------------------------------------------------------------------
+PersistenceBroker::BrokerCache::Entry^ PersistenceBroker::BrokerCache:: \
+Shard::filter( Entry ^head, KEY key, int %count )
+{
+	Entry	^chain = nullptr;
+
+	// look through all nodes
+	for( Entry ^e = head; e != nullptr; e = e->_next ) {
+		// skip nodes with specified key and collected objects
+		if( e->_key.Equals( key ) || (e->_ref->Target == nullptr) ) {
+			// decrease number of nodes
+			count--;
+		} else {
+			// copy node to new chain
+			chain = gcnew Entry(e->_key, e->_ref, chain);
+		}
+	}
+	return chain;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Insert (or replace) weak reference to object with specified key.
+//
+// Must be called under shard lock. New chain is published by one
+// assignment, so readers see old or new chain only.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::BrokerCache:: \
+Shard::insert( KEY key, PersistentObject ^obj )
+{
+	array<Entry^>	^buckets = m_buckets;
+	int				i = index( key, buckets->Length );
+
+	// remove old node and collected objects from chain
+	Entry	^chain = filter( buckets[i], key, m_count );
+	// add new node to chain (null reference means remove)
+	if( obj != nullptr ) {
+		chain = gcnew Entry(key, gcnew WeakReference(obj), chain);
+		m_count++;
+	}
+	// node must be fully initialized before publication
+	Thread::MemoryBarrier();
+	buckets[i] = chain;
+
+	// grow table if chains are too long
+	if( m_count > buckets->Length * SHARD_LOAD ) resize();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Double buckets table.
+//
+// Must be called under shard lock. New table is filled completely
+// before publication, so readers use old one until that.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::BrokerCache:: \
+Shard::resize( void )
+{
+	array<Entry^>	^buckets = gcnew array<Entry^>(m_buckets->Length * 2);
+
+	// reset counter
+	m_count = 0;
+	// look through all chains of the old table
+	for each( Entry ^head in m_buckets ) {
+		for( Entry ^e = head; e != nullptr; e = e->_next ) {
+			// skip collected objects
+			if( e->_ref->Target == nullptr ) continue;
+
+			// and copy node to new table
+			int		i = index( e->_key, buckets->Length );
+			buckets[i] = gcnew Entry(e->_key, e->_ref, buckets[i]);
+			m_count++;
+		}
+	}
+	// publish new table
+	Thread::MemoryBarrier();
+	m_buckets = buckets;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Acquire shard lock.
+//
+// If lock is held by other thread, contention counter is increased
+// before waiting.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::BrokerCache:: \
+Shard::enter( void )
+{
+	// try to get lock without waiting
+	if( !Monitor::TryEnter( this ) ) {
+		// register contention
+		Interlocked::Increment( m_contention );
+		// and wait for lock
+		Monitor::Enter( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Create empty shard.
+//
+//-------------------------------------------------------------------
+PersistenceBroker::BrokerCache:: \
+Shard::Shard( void ):			 \
+	m_count(0), m_contention(0)
+{
+	m_buckets = gcnew array<Entry^>(SHARD_CAPACITY);
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets number of times writers have waited for the shard lock.
+//
+//-------------------------------------------------------------------
+int PersistenceBroker::BrokerCache:: \
+Shard::Contention::get( void )
+{
+	return m_contention;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Search for object with specified key.
+//
+// This function doesn't lock shard. If object not found or it was
+// collected nullptr will be returned.
+//
+//-------------------------------------------------------------------
+PersistentObject^ PersistenceBroker::BrokerCache:: \
+Shard::Find( KEY key )
+{
+	// get current table (it can be replaced by writer)
+	array<Entry^>	^buckets = m_buckets;
+
+	// look through bucket chain
+	for( Entry ^e = buckets[index( key, buckets->Length )];
+		 e != nullptr; e = e->_next ) {
+		// and return target object if key is found
+		if( e->_key.Equals( key ) ) {
+			return safe_cast<PersistentObject^>( e->_ref->Target );
+		}
+	}
+	return nullptr;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Search for object with specified key and create it using factory
+// if unsuccessful.
+//
+// Object is created under shard lock, so threads that resolve the
+// same key get the same instance.
+//
+//-------------------------------------------------------------------
+PersistentObject^ PersistenceBroker::BrokerCache::			 \
+Shard::Resolve( KEY key, HEADER header, OBJECT_FACTORY ^factory )
+{
+	// search without lock first
+	PersistentObject	^obj = Find( key );
+	if( obj != nullptr ) return obj;
+
+	enter();
+	try {
+		// object can be created while waiting for lock
+		obj = Find( key );
+		if( obj == nullptr ) {
+			// check for factory has been initialized already
+			if( factory == nullptr ) {
+				// throw exception
+				throw gcnew InvalidOperationException(ERR_OBJECT_FACTORY);
+			}
+			// create object through factory
+			obj = factory( header.Type,
+						   header.ID, header.Stamp, header.Name );
+			// check for succeded object creation
+			if( obj == nullptr) {
+				throw gcnew InvalidOperationException(String::Format(
+				ERR_OBJECT_CREATION, header.Type) );
+			}
+			// and push new object to cache
+			insert( key, obj );
+		}
+		return obj;
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Sets object with specified key.
+//
+// Null reference removes key from shard.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::BrokerCache:: \
+Shard::Set( KEY key, PersistentObject ^obj )
+{
+	enter();
+	try {
+		// insert or remove node
+		insert( key, obj );
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Remove inaccessible weak references from shard.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::BrokerCache:: \
+Shard::Clean( void )
+{
+	enter();
+	try {
+		array<Entry^>	^buckets = m_buckets;
+
+		// look through all chains
+		for( int i = 0; i < buckets->Length; i++ ) {
+			// and replace them by filtered ones (no key is
+			// specified, so only collected objects are skipped)
+			Entry	^chain = filter( buckets[i], KEY(String::Empty, 0), m_count );
+
+			Thread::MemoryBarrier();
+			buckets[i] = chain;
+		}
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Dispose all objects and clear shard.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::BrokerCache:: \
+Shard::Clear( void )
+{
+	enter();
+	try {
+		// look through all chains
+		for each( Entry ^head in m_buckets ) {
+			for( Entry ^e = head; e != nullptr; e = e->_next ) {
+				// dispose object
+				delete e->_ref->Target;
+			}
+		}
+		// replace table by empty one
+		m_buckets = gcnew array<Entry^>(SHARD_CAPACITY);
+		m_count = 0;
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//----------------------------------------------------------------------------
+//			Toolkit::RPL::Factories::PersistenceBroker::BrokerCache
+//----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Thread function that provide clearing cache functionality.
+//
+// This function removes inaccessible objects only. Shards are
+// cleaned one by one, so other shards are not locked.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+BrokerCache::thread_clean( void )
+{
+	// initialize value to current time
+	DateTime time = DateTime::Now;
+
+	try {
+		// check for thread must be terminated
+		while( !m_disposed ) {
+			// sleep for specified time
+			Thread::Sleep( SLEEP_TIMEOUT );
+			// if time spent enought
+			if ( time.AddSeconds( CLEAR_TIMEOUT ) < DateTime::Now ) {
+				// save time of clearing
+				time = DateTime::Now;
+
+				// remove inaccessible weak references
+				for each( Shard ^shard in _shards ) {
+					// check for thread must be terminated
+					if( m_disposed ) break;
+
+					shard->Clean();
+				}
+			}
+		}
+	} catch( Exception ^e ) {
+		// output error message
+		System::Diagnostics::Debug::WriteLine( "ERROR! " + e->Message );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Returns shard for specified key.
+//
+//-------------------------------------------------------------------
+PersistenceBroker::BrokerCache::Shard^ PersistenceBroker:: \
+BrokerCache::shard( KEY key )
+{
+	// check for disposed state
+	if( m_disposed ) throw gcnew ObjectDisposedException(
+		this->GetType()->ToString());
+
+	return _shards[(key.GetHashCode() & 0x7FFFFFFF) % SHARDS_COUNT];
+}
+
+
+//-------------------------------------------------------------------
+//
+// Create new cache instance.
+//
+//-------------------------------------------------------------------
+PersistenceBroker::						 \
+BrokerCache::BrokerCache( void ):		 \
+	m_disposed(false)
+{
+	// create all shards
+	_shards = gcnew array<Shard^>(SHARDS_COUNT);
+	for( int i = 0; i < _shards->Length; i++ ) _shards[i] = gcnew Shard();
+
+	// create thread instance to clear current
+	// cache from inaccessible weak references
+	Thread^	thread = gcnew Thread(
+						gcnew ThreadStart(this, &BrokerCache::thread_clean));
+	thread->Name = "Cache cleaning thread";
+	thread->IsBackground = true;
+	thread->Start();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Class disposer.
+//
+// Has to use it to clear internal storage and stop clearing thread
+// (in other case this object will never be destroyed because of
+// object-thread cross references).
+//
+//-------------------------------------------------------------------
+PersistenceBroker::				  \
+BrokerCache::~BrokerCache( void )
+{
+	// check for disposer was not called
+	if( !m_disposed ) {
+		// prevent future cache usage
+		m_disposed = true;
+
+		// dispose objects of all shards
+		for each( Shard ^shard in _shards ) shard->Clear();
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets number of lock contentions for every shard.
+//
+// Reads are never locked, so this is number of times writers have
+// waited for other writers of the same shard.
+//
+//-------------------------------------------------------------------
+array<int>^ PersistenceBroker:: \
+BrokerCache::Contention::get( void )
+{
+	array<int>	^result = gcnew array<int>(_shards->Length);
+
+	// collect counters of all shards
+	for( int i = 0; i < _shards->Length; i++ ) {
+		result[i] = _shards[i]->Contention;
+	}
+	return result;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets or sets object in the cache.
+//
+// If object not found nullptr will be returned. Getter doesn't lock
+// cache. Setter doesn't check for existing weak references to
+// object: just create new weak reference.
+//
+//-------------------------------------------------------------------
+PersistentObject^ PersistenceBroker::			  \
+BrokerCache::default::get( String ^type, int id )
+{
+	KEY		key(type, id);
+
+	// search for object without lock
+	return shard( key )->Find( key );
+}
+
+void PersistenceBroker::												 \
+BrokerCache::default::set( String ^type, int id, PersistentObject ^obj )
+{
+	KEY		key(type, id);
+
+	// create week references to object
+	shard( key )->Set( key, obj );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Search for object by specified header and create it using factory
+// if unsuccessful.
+//
+// Object is created at most once: concurrent requests for the same
+// header get the same instance.
+//
+//-------------------------------------------------------------------
+PersistentObject^ PersistenceBroker::							   \
+BrokerCache::Resolve( HEADER header, OBJECT_FACTORY ^factory )
+{
+	KEY		key(header.Type, header.ID);
+
+	return shard( key )->Resolve( key, header, factory );
+}
@@ -0,0 +1,107 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		PersistenceBroker.BrokerCache.h								*/
+/*																			*/
+/*	Content:	Definition of PersistenceBroker::BrokerCache class			*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#pragma once
+#include "..\RPL.h"
+#include "PersistenceBroker.h"
+
+using namespace System;
+using namespace System::Threading;
+
+
+_RPL_BEGIN
+namespace Factories {
+	/// <summary>
+	/// Cache of objects for some session (identity map).
+	/// </summary><remarks><para>
+	/// Cache is divided into shards by hash of the object's key. Every
+	/// shard is a hash table with own lock, that is used by writers only:
+	/// readers never lock cache, because bucket chains are immutable and
+	/// are replaced as a whole.</para><para>
+	/// Only weak references to objects are stored, so inaccessible
+	/// references are removed by background thread.
+	/// </para></remarks>
+	ref class PersistenceBroker::
+	BrokerCache
+	{
+	private:
+		//
+		// Node of the bucket chain. It is never changed after
+		// it has been published to readers.
+		//
+		ref class Entry
+		{
+		public:
+			KEY				const _key;
+			WeakReference^	const _ref;
+			Entry^			const _next;
+
+			Entry( KEY key, WeakReference ^ref, Entry ^next );
+		};
+
+		//
+		// Shard of the cache: hash table with lock-free reads
+		// and serialized writes.
+		//
+		ref class Shard
+		{
+		private:
+			array<Entry^>^ volatile	m_buckets;
+			int						m_count;
+			int						m_contention;
+
+			int index( KEY key, int length );
+			Entry^ filter( Entry ^head, KEY key, int %count );
+			void insert( KEY key, PersistentObject ^obj );
+			void resize( void );
+			void enter( void );
+
+		public:
+			Shard( void );
+
+			property int Contention {
+				int get( void );
+			}
+
+			PersistentObject^ Find( KEY key );
+			PersistentObject^ Resolve( KEY key, HEADER header,
+									   OBJECT_FACTORY ^factory );
+			void Set( KEY key, PersistentObject ^obj );
+			void Clean( void );
+			void Clear( void );
+		};
+
+	private:
+		initonly array<Shard^>	^_shards;
+
+		bool volatile			m_disposed;
+
+		void thread_clean( void );
+		Shard^ shard( KEY key );
+
+	public:
+		BrokerCache( void );
+		~BrokerCache( void );
+
+		property array<int>^ Contention {
+			array<int>^ get( void );
+		}
+		property PersistentObject^ default[String^, int] {
+			PersistentObject^ get( String ^type, int id );
+			void set( String ^type, int id, PersistentObject ^obj );
+		}
+
+		PersistentObject^ Resolve( HEADER header, OBJECT_FACTORY ^factory );
+	};
+}_RPL_END
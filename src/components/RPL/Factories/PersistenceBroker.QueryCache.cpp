@@ -0,0 +1,374 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		PersistenceBroker.QueryCache.cpp							*/
+/*																			*/
+/*	Content:	Implementation of PersistenceBroker::QueryCache class		*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#include "PersistenceBroker.QueryCache.h"
+
+using namespace System::Globalization;
+using namespace System::Threading;
+using namespace _RPL;
+using namespace _RPL::Factories;
+
+
+//
+// Define maximum number of cache records
+//
+#define MAX_ENTRIES	1024
+
+
+//----------------------------------------------------------------------------
+//		Toolkit::RPL::Factories::PersistenceBroker::QueryCache::Entry
+//----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Create new cache record.
+//
+//-------------------------------------------------------------------
+PersistenceBroker::QueryCache::									   \
+Entry::Entry( String ^type, DateTime expires, Object ^result ): \
+	_type(type), _expires(expires), _result(result)
+{
+	// do nothing
+}
+
+
+//----------------------------------------------------------------------------
+//			Toolkit::RPL::Factories::PersistenceBroker::QueryCache
+//----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Appends normalized WHERE clause (with values) to the key. Values
+// are written with their types in invariant culture, strings are
+// prefixed by length to avoid ambiguity.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+QueryCache::append( StringBuilder ^sb, Where ^where )
+{
+	Where::Clause			^clause = dynamic_cast<Where::Clause^>( where );
+	Where::Operation::And	^opAnd = dynamic_cast<Where::Operation::And^>( where );
+	Where::Operation::Or	^opOr = dynamic_cast<Where::Operation::Or^>( where );
+	Where::Operation::Not	^opNot = dynamic_cast<Where::Operation::Not^>( where );
+
+	if( clause != nullptr ) {
+		Object	^value = clause->Value.ToObject();
+		String	^s = nullptr;
+
+		// format value without loss of precision
+		if( dynamic_cast<DateTime^>( value ) != nullptr ) {
+			s = safe_cast<DateTime>( value ).ToString(
+				"o", CultureInfo::InvariantCulture );
+		} else if( dynamic_cast<double^>( value ) != nullptr ) {
+			s = safe_cast<double>( value ).ToString(
+				"R", CultureInfo::InvariantCulture );
+		} else {
+			s = Convert::ToString( value, CultureInfo::InvariantCulture );
+		}
+		sb->AppendFormat( "[{0}] {1} {2}({3}:{4})",
+						  clause->OPD->Replace( "]", "]]" ),
+						  clause->Operator, value->GetType()->Name,
+						  s->Length, s );
+	} else if( opAnd != nullptr ) {
+		sb->Append( "(" );
+		append( sb, opAnd->LeftWhere );
+		sb->Append( " AND " );
+		append( sb, opAnd->RightWhere );
+		sb->Append( ")" );
+	} else if( opOr != nullptr ) {
+		sb->Append( "(" );
+		append( sb, opOr->LeftWhere );
+		sb->Append( " OR " );
+		append( sb, opOr->RightWhere );
+		sb->Append( ")" );
+	} else if( opNot != nullptr ) {
+		sb->Append( "NOT (" );
+		append( sb, opNot->SubWhere );
+		sb->Append( ")" );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Returns common part of the key: request name, type and normalized
+// WHERE clause.
+//
+//-------------------------------------------------------------------
+String^ PersistenceBroker:: \
+QueryCache::key( String ^request, String ^type, Where ^where )
+{
+	StringBuilder	^sb = gcnew StringBuilder();
+
+	sb->Append( request )->Append( "\n" );
+	sb->Append( type )->Append( "\n" );
+	if( where != nullptr ) append( sb, where );
+
+	return sb->ToString();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Remove specified record from cache.
+//
+// Must be called under cache lock.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+QueryCache::remove( String ^key )
+{
+	Entry			^entry = nullptr;
+	List<String^>	^keys = nullptr;
+
+	// search for record
+	if( !m_entries.TryGetValue( key, entry ) ) return;
+	m_entries.Remove( key );
+
+	// and remove it from the type index
+	if( m_types.TryGetValue( entry->_type, keys ) ) {
+		keys->Remove( key );
+		if( keys->Count == 0 ) m_types.Remove( entry->_type );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Remove expired records. If cache is still full, all records are
+// removed.
+//
+// Must be called under cache lock.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+QueryCache::shrink( void )
+{
+	List<String^>	expired;
+	DateTime		now = DateTime::UtcNow;
+
+	for each( KeyValuePair<String^, Entry^> pair in m_entries ) {
+		if( pair.Value->_expires <= now ) expired.Add( pair.Key );
+	}
+	for each( String ^key in expired ) remove( key );
+
+	if( m_entries.Count >= MAX_ENTRIES ) {
+		m_entries.Clear();
+		m_types.Clear();
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Create disabled cache (with zero time to live).
+//
+//-------------------------------------------------------------------
+PersistenceBroker:: \
+QueryCache::QueryCache( void ): \
+	m_ttl(TimeSpan::Zero), m_version(0)
+{
+	// do nothing
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets or sets time to live of cache records.
+//
+// Zero value disables cache and removes all records.
+//
+//-------------------------------------------------------------------
+TimeSpan PersistenceBroker:: \
+QueryCache::TTL::get( void )
+{
+	return m_ttl;
+}
+
+void PersistenceBroker:: \
+QueryCache::TTL::set( TimeSpan value )
+{
+	// check for right value
+	if( value < TimeSpan::Zero ) throw gcnew ArgumentOutOfRangeException(
+		"value", ERR_LESS_THEN_ZERRO);
+
+	Monitor::Enter( this );
+	try {
+		m_ttl = value;
+		// drop records of disabled cache
+		if( m_ttl == TimeSpan::Zero ) Clear();
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Returns key of search request.
+//
+//-------------------------------------------------------------------
+String^ PersistenceBroker::									  \
+QueryCache::SearchKey( String ^type, Where ^where, OrderBy ^order, \
+					   int bottom, int count )
+{
+	return String::Format( "{0}\n{1}\n{2}\n{3}",
+						   key( "Search", type, where ),
+						   (order != nullptr) ? order->Shape : "",
+						   bottom, count );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Returns key of count request.
+//
+//-------------------------------------------------------------------
+String^ PersistenceBroker:: \
+QueryCache::CountKey( String ^type, Where ^where )
+{
+	return key( "Count", type, where );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets result of request with specified key.
+//
+// Expired record is removed.
+//
+//-------------------------------------------------------------------
+bool PersistenceBroker:: \
+QueryCache::Get( String ^key, [Out] Object^ %result )
+{
+	// initialize output value
+	result = nullptr;
+
+	Monitor::Enter( this );
+	try {
+		Entry	^entry = nullptr;
+
+		// search for record
+		if( !m_entries.TryGetValue( key, entry ) ) return false;
+		// check for record is not expired
+		if( entry->_expires <= DateTime::UtcNow ) {
+			remove( key );
+			return false;
+		}
+		result = entry->_result;
+		return true;
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets version of the cache that is changed by every removal of
+// records. Must be taken before request to storage and passed to Put.
+//
+//-------------------------------------------------------------------
+int PersistenceBroker:: \
+QueryCache::Version::get( void )
+{
+	Monitor::Enter( this );
+	try {
+		return m_version;
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Stores result of request with specified key for objects of
+// specified type. Result is not stored if records were removed
+// after specified version was taken (result can be outdated).
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::											 \
+QueryCache::Put( String ^key, String ^type, Object ^result, \
+				 int version )
+{
+	Monitor::Enter( this );
+	try {
+		List<String^>	^keys = nullptr;
+
+		// check for cache is enabled
+		if( m_ttl == TimeSpan::Zero ) return;
+		// check for result is not outdated
+		if( version != m_version ) return;
+
+		// remove previous record and free space
+		remove( key );
+		if( m_entries.Count >= MAX_ENTRIES ) shrink();
+
+		// add new record and index it by type
+		m_entries[key] = gcnew Entry(type, DateTime::UtcNow + m_ttl, result);
+		if( !m_types.TryGetValue( type, keys ) ) {
+			keys = gcnew List<String^>();
+			m_types[type] = keys;
+		}
+		keys->Add( key );
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Removes all records of specified type.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+QueryCache::Invalidate( String ^type )
+{
+	Monitor::Enter( this );
+	try {
+		List<String^>	^keys = nullptr;
+
+		// results of running requests are outdated
+		m_version++;
+		// search for records of type and remove them
+		if( !m_types.TryGetValue( type, keys ) ) return;
+
+		for each( String ^key in keys ) m_entries.Remove( key );
+		m_types.Remove( type );
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Removes all records.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+QueryCache::Clear( void )
+{
+	Monitor::Enter( this );
+	try {
+		// results of running requests are outdated
+		m_version++;
+		m_entries.Clear();
+		m_types.Clear();
+	} finally {
+		Monitor::Exit( this );
+	}
+}
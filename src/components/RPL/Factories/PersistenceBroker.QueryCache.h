@@ -0,0 +1,90 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		PersistenceBroker.QueryCache.h								*/
+/*																			*/
+/*	Content:	Definition of PersistenceBroker::QueryCache class			*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#pragma once
+#include "..\RPL.h"
+#include "PersistenceBroker.h"
+
+using namespace System;
+using namespace System::Text;
+using namespace System::Collections::Generic;
+using namespace System::Runtime::InteropServices;
+
+
+_RPL_BEGIN
+namespace Factories {
+	/// <summary>
+	/// Cache of search results.
+	/// </summary><remarks><para>
+	/// Stores results of search and count requests by normalized query
+	/// (type, WHERE and ORDER BY clauses with values, limits). Every
+	/// record lives for specified time to take into account external
+	/// changes of storage, records of some type are removed when object
+	/// of this type is saved or deleted through broker.</para><para>
+	/// Every removal changes version of the cache, so result that was
+	/// requested from storage before removal is not stored after it.
+	/// </para><para>
+	/// Zero time to live disables cache.
+	/// </para></remarks>
+	ref class PersistenceBroker::
+	QueryCache
+	{
+	private:
+		//
+		// Cache record: type of objects, expiration time and
+		// result of request.
+		//
+		ref class Entry
+		{
+		public:
+			String^			const _type;
+			DateTime		const _expires;
+			Object^			const _result;
+
+			Entry( String ^type, DateTime expires, Object ^result );
+		};
+
+	private:
+		Dictionary<String^, Entry^>				m_entries;
+		Dictionary<String^, List<String^>^>		m_types;
+
+		TimeSpan	m_ttl;
+		int			m_version;
+
+		static void append( StringBuilder ^sb, Where ^where );
+		static String^ key( String ^request, String ^type, Where ^where );
+		void remove( String ^key );
+		void shrink( void );
+
+	public:
+		QueryCache( void );
+
+		property TimeSpan TTL {
+			TimeSpan get( void );
+			void set( TimeSpan value );
+		}
+		property int Version {
+			int get( void );
+		}
+
+		static String^ SearchKey( String ^type, Where ^where, OrderBy ^order,
+								  int bottom, int count );
+		static String^ CountKey( String ^type, Where ^where );
+
+		bool Get( String ^key, [Out] Object^ %result );
+		void Put( String ^key, String ^type, Object ^result, int version );
+		void Invalidate( String ^type );
+		void Clear( void );
+	};
+}_RPL_END
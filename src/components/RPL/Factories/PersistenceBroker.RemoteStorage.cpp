@@ -0,0 +1,281 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		PersistenceBroker.RemoteStorage.cpp							*/
+/*																			*/
+/*	Content:	Implementation of PersistenceBroker::RemoteStorage class	*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#include "..\Storage\WireFormat.h"
+#include "PersistenceBroker.RemoteStorage.h"
+
+using namespace _RPL;
+using namespace _RPL::Factories;
+using namespace _RPL::Storage;
+
+
+//----------------------------------------------------------------------------
+//			Toolkit::RPL::Factories::PersistenceBroker::RemoteStorage
+//----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Create client side for specified proxy of remote broker.
+//
+// IIRemoteStorage hides overloads of IPersistenceStorage, so both
+// interfaces of the proxy are stored.
+//
+//-------------------------------------------------------------------
+PersistenceBroker::									   \
+RemoteStorage::RemoteStorage( IIRemoteStorage ^broker ): \
+	_broker(broker), _storage(broker)
+{
+	// check for null reference
+	if( broker == nullptr ) throw gcnew ArgumentNullException("broker");
+}
+
+
+//-------------------------------------------------------------------
+//
+// Forward transaction requests.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+RemoteStorage::TransactionBegin( void )
+{
+	_storage->TransactionBegin();
+}
+
+void PersistenceBroker:: \
+RemoteStorage::TransactionCommit( void )
+{
+	_storage->TransactionCommit();
+}
+
+void PersistenceBroker:: \
+RemoteStorage::TransactionRollback( void )
+{
+	_storage->TransactionRollback();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Forward search requests.
+//
+//-------------------------------------------------------------------
+int PersistenceBroker::										 \
+RemoteStorage::Search( String ^type, Where ^where, OrderBy ^order, \
+					   int bottom, int count,					 \
+					   [Out] array<HEADER>^ %headers )
+{
+	return _storage->Search( type, where, order, bottom, count, headers );
+}
+
+array<HEADER>^ PersistenceBroker::								 \
+RemoteStorage::Search( String ^type, Where ^where, OrderBy ^order, \
+					   int bottom, int count )
+{
+	return _storage->Search( type, where, order, bottom, count );
+}
+
+int PersistenceBroker:: \
+RemoteStorage::Count( String ^type, Where ^where )
+{
+	return _storage->Count( type, where );
+}
+
+int PersistenceBroker:: \
+RemoteStorage::Count( String ^type, Where ^where, bool cached )
+{
+	return _broker->Count( type, where, cached );
+}
+
+array<HEADER>^ PersistenceBroker::									\
+RemoteStorage::SearchAfter( String ^type, Where ^where, OrderBy ^order, \
+							array<ValueBox>^ %after, int bottom,		\
+							int count )
+{
+	return _storage->SearchAfter( type, where, order, after, bottom, count );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Search request with packed result (it is used by criterias and
+// cursors).
+//
+//-------------------------------------------------------------------
+array<HEADER>^ PersistenceBroker::								 \
+RemoteStorage::Search( String ^type, Where ^where, OrderBy ^order, \
+					   int bottom, int count, bool cached )
+{
+	WireFormat	^wf = gcnew WireFormat(
+		_broker->SearchPacked( type, where, order, bottom, count, cached ));
+
+	return wf->ReadHeaders();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Forward request of object header.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+RemoteStorage::Retrieve( HEADER %header )
+{
+	_storage->Retrieve( header );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Retrieve requests with packed links and properties.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::											  \
+RemoteStorage::Retrieve( HEADER %header,							  \
+						 [Out] array<LINK>^ %links,					  \
+						 [Out] array<PROPERTY>^ %props )
+{
+	Retrieve( header, nullptr, links, props );
+}
+
+void PersistenceBroker::											  \
+RemoteStorage::Retrieve( HEADER %header, array<String^> ^names,		  \
+						 [Out] array<LINK>^ %links,					  \
+						 [Out] array<PROPERTY>^ %props )
+{
+	WireFormat	^wf = gcnew WireFormat(
+		_broker->RetrievePacked( header, names ));
+
+	links = wf->ReadLinks();
+	props = wf->ReadProperties();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Forward validation request.
+//
+//-------------------------------------------------------------------
+array<HEADER>^ PersistenceBroker:: \
+RemoteStorage::Validate( array<HEADER> ^headers )
+{
+	return _storage->Validate( headers );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Save request with packed links and properties.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::												 \
+RemoteStorage::Save( HEADER %header,									 \
+					 [In] array<LINK> ^links, [In] array<PROPERTY> ^props, \
+					 [Out] array<LINK>^ %mlinks,						 \
+					 [Out] array<PROPERTY>^ %mprops )
+{
+	WireFormat	^state = gcnew WireFormat();
+
+	state->Write( links );
+	state->Write( props );
+
+	WireFormat	^wf = gcnew WireFormat(
+		_broker->SavePacked( header, state->ToArray() ));
+
+	mlinks = wf->ReadLinks();
+	mprops = wf->ReadProperties();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Forward delete request.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+RemoteStorage::Delete( HEADER header )
+{
+	_storage->Delete( header );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Forward BLOB requests (they pass raw data already).
+//
+//-------------------------------------------------------------------
+__int64 PersistenceBroker::									   \
+RemoteStorage::OpenBlob( HEADER header, String ^name,		   \
+						 [Out] array<unsigned char>^ %hash )
+{
+	return _storage->OpenBlob( header, name, hash );
+}
+
+array<unsigned char>^ PersistenceBroker::					   \
+RemoteStorage::ReadBlob( HEADER header, String ^name,		   \
+						 array<unsigned char> ^hash,		   \
+						 __int64 offset, int count )
+{
+	return _storage->ReadBlob( header, name, hash, offset, count );
+}
+
+__int64 PersistenceBroker::									   \
+RemoteStorage::WriteBlob( array<unsigned char> ^hash,		   \
+						  __int64 offset, array<unsigned char> ^data )
+{
+	return _storage->WriteBlob( hash, offset, data );
+}
+
+void PersistenceBroker::										   \
+RemoteStorage::CommitBlob( HEADER %header, String ^name,		   \
+						   array<unsigned char> ^hash )
+{
+	_storage->CommitBlob( header, name, hash );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Forward SQL request.
+//
+//-------------------------------------------------------------------
+DataSet^ PersistenceBroker:: \
+RemoteStorage::ProcessSQL( String ^sql, array<Object^> ^params )
+{
+	return _storage->ProcessSQL( sql, params );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Forward packed requests.
+//
+//-------------------------------------------------------------------
+array<Byte>^ PersistenceBroker::									   \
+RemoteStorage::SearchPacked( String ^type, Where ^where, OrderBy ^order, \
+							 int bottom, int count, bool cached )
+{
+	return _broker->SearchPacked( type, where, order, bottom, count, cached );
+}
+
+array<Byte>^ PersistenceBroker:: \
+RemoteStorage::RetrievePacked( HEADER %header, array<String^> ^names )
+{
+	return _broker->RetrievePacked( header, names );
+}
+
+array<Byte>^ PersistenceBroker:: \
+RemoteStorage::SavePacked( HEADER %header, array<Byte> ^state )
+{
+	return _broker->SavePacked( header, state );
+}
@@ -0,0 +1,96 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		PersistenceBroker.RemoteStorage.h							*/
+/*																			*/
+/*	Content:	Definition of PersistenceBroker::RemoteStorage class		*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#pragma once
+#include "..\RPL.h"
+#include "PersistenceBroker.h"
+
+using namespace System;
+using namespace System::Data;
+using namespace System::Runtime::InteropServices;
+
+
+_RPL_BEGIN
+namespace Factories {
+	/// <summary>
+	/// Client side of remote broker.
+	/// </summary><remarks>
+	/// Forwards all requests to the transparent proxy of remote
+	/// broker. Requests that transfer arrays of headers, links and
+	/// properties are replaced by packed ones, so arrays are passed
+	/// through remoting in WireFormat encoding instead of default
+	/// serialization.
+	/// </remarks>
+	ref class PersistenceBroker::
+	RemoteStorage : IIRemoteStorage
+	{
+	private:
+		IIRemoteStorage^		const _broker;
+		IPersistenceStorage^	const _storage;
+
+	public:
+		RemoteStorage( IIRemoteStorage ^broker );
+
+		virtual void TransactionBegin( void );
+		virtual void TransactionCommit( void );
+		virtual void TransactionRollback( void );
+
+		virtual int Search( String ^type, Where ^where, OrderBy ^order,
+							int bottom, int count,
+							[Out] array<HEADER>^ %headers );
+		virtual array<HEADER>^ Search( String ^type, Where ^where,
+									   OrderBy ^order, int bottom, int count );
+		virtual int Count( String ^type, Where ^where );
+		virtual array<HEADER>^ Search( String ^type, Where ^where,
+									   OrderBy ^order, int bottom, int count,
+									   bool cached );
+		virtual int Count( String ^type, Where ^where, bool cached );
+		virtual array<HEADER>^ SearchAfter( String ^type, Where ^where,
+											OrderBy ^order,
+											array<ValueBox>^ %after,
+											int bottom, int count );
+
+		virtual void Retrieve( HEADER %header );
+		virtual void Retrieve( HEADER %header, [Out] array<LINK>^ %links,
+							   [Out] array<PROPERTY>^ %props );
+		virtual void Retrieve( HEADER %header, array<String^> ^names,
+							   [Out] array<LINK>^ %links,
+							   [Out] array<PROPERTY>^ %props );
+		virtual array<HEADER>^ Validate( array<HEADER> ^headers );
+		virtual void Save( HEADER %header,
+						   [In] array<LINK> ^links, [In] array<PROPERTY> ^props,
+						   [Out] array<LINK>^ %mlinks,
+						   [Out] array<PROPERTY>^ %mprops );
+		virtual void Delete( HEADER header );
+
+		virtual __int64 OpenBlob( HEADER header, String ^name,
+								  [Out] array<unsigned char>^ %hash );
+		virtual array<unsigned char>^ ReadBlob( HEADER header, String ^name,
+												array<unsigned char> ^hash,
+												__int64 offset, int count );
+		virtual __int64 WriteBlob( array<unsigned char> ^hash,
+								   __int64 offset, array<unsigned char> ^data );
+		virtual void CommitBlob( HEADER %header, String ^name,
+								 array<unsigned char> ^hash );
+
+		virtual DataSet^ ProcessSQL( String ^sql, array<Object^> ^params );
+
+		virtual array<Byte>^ SearchPacked( String ^type, Where ^where,
+										   OrderBy ^order, int bottom,
+										   int count, bool cached );
+		virtual array<Byte>^ RetrievePacked( HEADER %header,
+											 array<String^> ^names );
+		virtual array<Byte>^ SavePacked( HEADER %header, array<Byte> ^state );
+	};
+}_RPL_END
@@ -0,0 +1,292 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		PersistenceBroker.StateCache.cpp							*/
+/*																			*/
+/*	Content:	Implementation of PersistenceBroker::StateCache class		*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#include "PersistenceBroker.StateCache.h"
+
+using namespace System::IO;
+using namespace System::Runtime::Serialization::Formatters::Binary;
+using namespace System::Threading;
+using namespace _RPL;
+using namespace _RPL::Factories;
+
+
+//----------------------------------------------------------------------------
+//		Toolkit::RPL::Factories::PersistenceBroker::StateCache::Entry
+//----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Create new cache record.
+//
+//-------------------------------------------------------------------
+PersistenceBroker::StateCache::							  \
+Entry::Entry( KEY key, DateTime stamp, array<Byte> ^data ): \
+	_key(key), _stamp(stamp), _data(data)
+{
+	// do nothing
+}
+
+
+//----------------------------------------------------------------------------
+//			Toolkit::RPL::Factories::PersistenceBroker::StateCache
+//----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Remove specified record from cache.
+//
+// Must be called under cache lock.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+StateCache::remove( LinkedListNode<Entry^> ^node )
+{
+	m_index.Remove( node->Value->_key );
+	m_lru.Remove( node );
+	m_size -= node->Value->_data->Length;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Remove least recently used records until cache size exceeds the
+// limit.
+//
+// Must be called under cache lock.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+StateCache::shrink( void )
+{
+	while( (m_size > m_limit) && (m_lru.Count > 0) ) remove( m_lru.Last );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Create disabled cache (with zero limit).
+//
+//-------------------------------------------------------------------
+PersistenceBroker:: \
+StateCache::StateCache( void ): \
+	m_limit(0), m_size(0)
+{
+	// do nothing
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets or sets maximum size of serialized data in bytes.
+//
+// Decreasing of the limit removes least recently used records. Zero
+// value disables cache.
+//
+//-------------------------------------------------------------------
+long long PersistenceBroker:: \
+StateCache::Limit::get( void )
+{
+	return m_limit;
+}
+
+void PersistenceBroker:: \
+StateCache::Limit::set( long long value )
+{
+	// check for right value
+	if( value < 0 ) throw gcnew ArgumentOutOfRangeException(
+		"value", ERR_LESS_THEN_ZERRO);
+
+	Monitor::Enter( this );
+	try {
+		m_limit = value;
+		// remove records that are out of new limit
+		shrink();
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets current size of serialized data in bytes.
+//
+//-------------------------------------------------------------------
+long long PersistenceBroker:: \
+StateCache::Size::get( void )
+{
+	return m_size;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Search for record of specified object.
+//
+// Returns stamp of stored state if record is found.
+//
+//-------------------------------------------------------------------
+bool PersistenceBroker::										  \
+StateCache::Find( String ^type, int id, [Out] DateTime %stamp )
+{
+	// initialize output value
+	stamp = DateTime();
+
+	Monitor::Enter( this );
+	try {
+		LinkedListNode<Entry^>	^node = nullptr;
+
+		// search for record
+		if( !m_index.TryGetValue( KEY(type, id), node ) ) return false;
+
+		stamp = node->Value->_stamp;
+		return true;
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets state of the object with specified header.
+//
+// State is returned only if stored stamp equals to header stamp. In
+// other case record is outdated and it will be removed.
+//
+//-------------------------------------------------------------------
+bool PersistenceBroker::											   \
+StateCache::Get( HEADER header,										   \
+				 [Out] array<LINK>^ %links, [Out] array<PROPERTY>^ %props )
+{
+	array<Byte>	^data = nullptr;
+
+	// initialize output values
+	links = nullptr;
+	props = nullptr;
+
+	Monitor::Enter( this );
+	try {
+		LinkedListNode<Entry^>	^node = nullptr;
+
+		// search for record
+		if( !m_index.TryGetValue( KEY(header.Type, header.ID), node ) ) {
+			return false;
+		}
+		// check for record is up-to-date
+		if( node->Value->_stamp != header.Stamp ) {
+			// remove outdated record
+			remove( node );
+			return false;
+		}
+		// move record to the head of the usage list
+		m_lru.Remove( node );
+		m_lru.AddFirst( node );
+
+		data = node->Value->_data;
+	} finally {
+		Monitor::Exit( this );
+	}
+
+	// deserialize state out of lock (every call creates new
+	// instances, so objects don't share property values)
+	array<Object^>	^state = safe_cast<array<Object^>^>(
+		(gcnew BinaryFormatter())->Deserialize( gcnew MemoryStream(data) ));
+
+	links = safe_cast<array<LINK>^>( state[0] );
+	props = safe_cast<array<PROPERTY>^>( state[1] );
+
+	return true;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Stores state of the object with specified header.
+//
+// Previous record of this object is replaced. If serialized state
+// exceeds the limit, it is not stored.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::											 \
+StateCache::Put( HEADER header, array<LINK> ^links, array<PROPERTY> ^props )
+{
+	// check for cache is enabled
+	if( m_limit == 0 ) return;
+
+	// serialize state out of lock
+	MemoryStream	^ms = gcnew MemoryStream();
+	(gcnew BinaryFormatter())->Serialize( ms, gcnew array<Object^>{links, props} );
+
+	KEY		key(header.Type, header.ID);
+	Entry	^entry = gcnew Entry(key, header.Stamp, ms->ToArray());
+
+	Monitor::Enter( this );
+	try {
+		LinkedListNode<Entry^>	^node = nullptr;
+
+		// remove previous record
+		if( m_index.TryGetValue( key, node ) ) remove( node );
+		// check for state fits to the limit
+		if( entry->_data->Length > m_limit ) return;
+
+		// add new record to the head of the usage list
+		m_index[key] = m_lru.AddFirst( entry );
+		m_size += entry->_data->Length;
+
+		// and remove least recently used records
+		shrink();
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Removes record of specified object.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+StateCache::Remove( String ^type, int id )
+{
+	Monitor::Enter( this );
+	try {
+		LinkedListNode<Entry^>	^node = nullptr;
+
+		// search for record and remove it
+		if( m_index.TryGetValue( KEY(type, id), node ) ) remove( node );
+	} finally {
+		Monitor::Exit( this );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Removes all records.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker:: \
+StateCache::Clear( void )
+{
+	Monitor::Enter( this );
+	try {
+		m_index.Clear();
+		m_lru.Clear();
+		m_size = 0;
+	} finally {
+		Monitor::Exit( this );
+	}
+}
@@ -0,0 +1,82 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		PersistenceBroker.StateCache.h								*/
+/*																			*/
+/*	Content:	Definition of PersistenceBroker::StateCache class			*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#pragma once
+#include "..\RPL.h"
+#include "PersistenceBroker.h"
+
+using namespace System;
+using namespace System::Collections::Generic;
+using namespace System::Runtime::InteropServices;
+
+
+_RPL_BEGIN
+namespace Factories {
+	/// <summary>
+	/// Second-level cache of serialized objects state.
+	/// </summary><remarks><para>
+	/// Stores links and properties of retrieved objects in serialized
+	/// form with strong references, so objects collected from the
+	/// identity map can be restored without storage queries. Every
+	/// record is marked by object's stamp and is valid while storage
+	/// has the same stamp.</para><para>
+	/// Total size of records is limited: least recently used records
+	/// are removed first. Zero limit disables cache.
+	/// </para></remarks>
+	ref class PersistenceBroker::
+	StateCache
+	{
+	private:
+		//
+		// Cache record: object stamp and serialized state.
+		//
+		ref class Entry
+		{
+		public:
+			KEY					const _key;
+			DateTime			const _stamp;
+			array<Byte>^		const _data;
+
+			Entry( KEY key, DateTime stamp, array<Byte> ^data );
+		};
+
+	private:
+		Dictionary<KEY, LinkedListNode<Entry^>^>	m_index;
+		LinkedList<Entry^>							m_lru;
+
+		long long	m_limit;
+		long long	m_size;
+
+		void remove( LinkedListNode<Entry^> ^node );
+		void shrink( void );
+
+	public:
+		StateCache( void );
+
+		property long long Limit {
+			long long get( void );
+			void set( long long value );
+		}
+		property long long Size {
+			long long get( void );
+		}
+
+		bool Find( String ^type, int id, [Out] DateTime %stamp );
+		bool Get( HEADER header,
+				  [Out] array<LINK>^ %links, [Out] array<PROPERTY>^ %props );
+		void Put( HEADER header, array<LINK> ^links, array<PROPERTY> ^props );
+		void Remove( String ^type, int id );
+		void Clear( void );
+	};
+}_RPL_END
@@ -13,175 +13,73 @@
 /****************************************************************************/
 
 #include "..\PersistentObject.h"
+#include "..\Storage\WireFormat.h"
 #include "PersistenceBroker.h"
+#include "PersistenceBroker.BrokerCache.h"
+#include "PersistenceBroker.StateCache.h"
+#include "PersistenceBroker.QueryCache.h"
+#include "PersistenceBroker.RemoteStorage.h"
 
+using namespace System::Runtime::CompilerServices;
+using namespace System::Runtime::Remoting;
 using namespace _RPL;
 using namespace _RPL::Factories;
 
 
-//-----------------------------------------------------------------------------
-//					C O M M O N   D E C L A R A T I O N S
-//-----------------------------------------------------------------------------
-
-//
-// Clear thread sleep timeout. Default value is 0.512 sec.
-//
-#define SLEEP_TIMEOUT		0x00000200
-
-//
-// Default timeout to clear cache inaccessible
-// weak references. Default value is 600 sec.
-//
-#define CLEAR_TIMEOUT		0x000927C0
-
-
 //----------------------------------------------------------------------------
-//			Toolkit::RPL::Factories::PersistenceBroker::BrokerCache
+//				Toolkit::RPL::Factories::PersistenceBroker::KEY
 //----------------------------------------------------------------------------
 
 //-------------------------------------------------------------------
 //
-// Thread function that provide clearing cache functionality.
+// Create key for object with specified type and ID.
 //
-// This function removes inaccessible objects only.
+// Type string is interned, so keys can compare types by reference
+// and don't need any string allocation.
 //
 //-------------------------------------------------------------------
-void PersistenceBroker::		  \
-BrokerCache::thread_clean( void )
+PersistenceBroker::						 \
+KEY::KEY( String ^type, int id ):		 \
+	_type(type == nullptr ? nullptr : String::Intern( type )), _id(id)
 {
-	// initialize value to current time
-	DateTime time = DateTime::Now;
-
-	try {
-		// check for thread must be terminated
-		while( !m_disposed ) {
-			// sleep for specified time
-			Thread::Sleep( SLEEP_TIMEOUT );
-			// if time spent enought
-			if ( time.AddSeconds( CLEAR_TIMEOUT ) < DateTime::Now ) {
-				// save time of clearing
-				time = DateTime::Now;
-
-				ENTER_WRITE(_lock)
-				// remove inaccessible weak references
-				for each( String ^key in m_cache.Keys ) {
-					// check for null references
-					if( m_cache[key]->Target == nullptr ) m_cache.Remove( key );
-				}
-				EXIT_WRITE(_lock)
-			}
-		}
-	} catch( Exception ^e ) {
-		// output error message
-		System::Diagnostics::Debug::WriteLine( "ERROR! " + e->Message );
-	}
+	// check for null reference
+	if( type == nullptr ) throw gcnew ArgumentNullException("type");
 }
 
 
 //-------------------------------------------------------------------
 //
-// Build string from object's Type and ID for using as key in the
-// map.
+// Determines whether the specified key is equal to this one.
 //
 //-------------------------------------------------------------------
-String^	PersistenceBroker::				 \
-BrokerCache::key( String ^type, int id )
+bool PersistenceBroker:: \
+KEY::Equals( KEY key )
 {
-	if( type == nullptr ) throw gcnew ArgumentNullException("type");
-
-	return (type + "_" + id.ToString());
+	return ((_id == key._id) && Object::ReferenceEquals( _type, key._type ));
 }
 
-
-//-------------------------------------------------------------------
-//
-// Create new cache instance.
-//
-//-------------------------------------------------------------------
-PersistenceBroker::									   \
-BrokerCache::BrokerCache( void ):					   \
-	_lock(gcnew ReaderWriterLock()), m_disposed(false)
+bool PersistenceBroker:: \
+KEY::Equals( Object ^obj )
 {
-	// create thread instance to clear current
-	// cache from inaccessible weak references
-	Thread^	thread = gcnew Thread(
-						gcnew ThreadStart(this, &BrokerCache::thread_clean));
-	thread->Name = "Cache cleaning thread";
-	thread->IsBackground = true;
-	thread->Start();
+	// check for the same type and compare as keys
+	return ((dynamic_cast<KEY^>( obj ) != nullptr) && Equals( safe_cast<KEY>( obj ) ));
 }
 
 
 //-------------------------------------------------------------------
 //
-// Class disposer.
-//
-// Has to use it to clear internal storage and stop clearing thread
-// (in other case this object will never be destroyed because of
-// object-thread cross references).
+// Returns hash code of the key.
 //
 //-------------------------------------------------------------------
-PersistenceBroker::				  \
-BrokerCache::~BrokerCache( void )
+int PersistenceBroker:: \
+KEY::GetHashCode( void )
 {
-	// check for disposer was not called
-	if( !m_disposed ) {
-		// prevent future cache usage
-		m_disposed = true;
-
-		ENTER_WRITE(_lock)
-		// pass through all references
-		for each( WeakReference ^wr in m_cache.Values ) {
-			// dispose object
-			delete wr->Target;
-		}
-		m_cache.Clear();
-		EXIT_WRITE(_lock)
-	}
+	// interned string is unique, so it's reference hash code is
+	// enought (and much faster then string hash calculation)
+	return (RuntimeHelpers::GetHashCode( _type ) * 31) ^ _id;
 }
 
 
-//-------------------------------------------------------------------
-//
-// Gets or sets object in the cache.
-//
-// If object not found nullptr will be returned.
-// Setter doesn't check for existing weak references to object: just
-// create new weak reference.
-// 
-//-------------------------------------------------------------------
-PersistentObject^ PersistenceBroker::			  \
-BrokerCache::default::get( String ^type, int id )
-{ENTER_READ(_lock)
-
-	// check for disposed state
-	if( m_disposed ) throw gcnew ObjectDisposedException(
-		this->GetType()->ToString());
-
-	WeakReference	^wr = nullptr;
-	// try get weak reference for object
-	if( m_cache.TryGetValue( key( type, id ), wr ) ) {
-		// and return target object if succeeded
-		return safe_cast<PersistentObject^>( wr->Target );
-	}
-	return nullptr;
-
-EXIT_READ(_lock)}
-
-void PersistenceBroker::												 \
-BrokerCache::default::set( String ^type, int id, PersistentObject ^obj )
-{ENTER_WRITE(_lock)
-
-	// check for disposed state
-	if( m_disposed ) throw gcnew ObjectDisposedException(
-		this->GetType()->ToString());
-
-	// create week references to object
-	m_cache[key( type, id )] = gcnew WeakReference(obj);
-
-EXIT_WRITE(_lock)}
-
-
 //-----------------------------------------------------------------------------
 //					Toolkit::RPL::Factories::PersistenceBroker
 //-----------------------------------------------------------------------------
@@ -201,6 +99,8 @@ void PersistenceBroker::trans_begin( void )
 
 	// call to real storage
 	s_storage->TransactionBegin();
+	// count open transactions
+	Interlocked::Increment( s_transactions );
 }
 
 
@@ -217,8 +117,23 @@ void PersistenceBroker::trans_commit( void )
 	if( s_storage == nullptr ) throw gcnew InvalidOperationException( 
 		ERR_BROKER_DISCONNECTED);
 
-	// call to real storage
-	s_storage->TransactionCommit();
+	try {
+		// call to real storage
+		s_storage->TransactionCommit();
+	} finally {
+		// count open transactions
+		Interlocked::Decrement( s_transactions );
+	}
+	// drop results that were requested by other threads before commit
+	// and cached after it (types saved or deleted in transaction)
+	Monitor::Enter( s_changed );
+	try {
+		for each( String ^type in s_changed ) s_queries->Invalidate( type );
+		// forget types when all transactions are completed
+		if( s_transactions == 0 ) s_changed->Clear();
+	} finally {
+		Monitor::Exit( s_changed );
+	}
 }
 
 
@@ -235,8 +150,15 @@ void PersistenceBroker::trans_rollback( void )
 	if( s_storage == nullptr ) throw gcnew InvalidOperationException( 
 		ERR_BROKER_DISCONNECTED);
 
-	// call to real storage
-	s_storage->TransactionRollback();
+	try {
+		// call to real storage
+		s_storage->TransactionRollback();
+	} finally {
+		// count open transactions
+		Interlocked::Decrement( s_transactions );
+	}
+	// cached results can contain rolled back changes
+	s_queries->Clear();
 }
 
 
@@ -264,6 +186,151 @@ search( String ^type,										 \
 }
 
 
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::Search implementation.
+//
+// Search storage for persistent objects that satisfy specified
+// conditions without counting of all found objects.
+//
+//-------------------------------------------------------------------
+array<HEADER>^ PersistenceBroker::							  \
+search( String ^type,										  \
+		Where ^where, OrderBy ^order, int bottom, int count )
+{
+	return search( type, where, order, bottom, count, true );
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::Count implementation.
+//
+// Count persistent objects that satisfy specified conditions.
+//
+//-------------------------------------------------------------------
+int PersistenceBroker::count( String ^type, Where ^where )
+{
+	return count( type, where, true );
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::Search implementation.
+//
+// Search storage for persistent objects that satisfy specified
+// conditions without counting of all found objects. Result is taken
+// from broker cache if it is allowed and present.
+//
+//-------------------------------------------------------------------
+array<HEADER>^ PersistenceBroker::							  \
+search( String ^type,										  \
+		Where ^where, OrderBy ^order, int bottom, int count,  \
+		bool cached )
+{
+	// check for disconnected state
+	if( s_storage == nullptr ) throw gcnew InvalidOperationException(
+		ERR_BROKER_DISCONNECTED);
+
+	// check for cache is disabled or not requested
+	if( !cached || (s_queries->TTL == TimeSpan::Zero) ) {
+		// call to real storage
+		return s_storage->Search( type, where, order, bottom, count );
+	}
+
+	String	^key = QueryCache::SearchKey( type, where, order, bottom, count );
+	Object	^result = nullptr;
+
+	// try to get headers from cache (caller can modify array,
+	// so return a copy)
+	if( s_queries->Get( key, result ) ) {
+		Interlocked::Increment( s_queryHits );
+		return safe_cast<array<HEADER>^>(
+			safe_cast<array<HEADER>^>( result )->Clone() );
+	}
+	Interlocked::Increment( s_queryMisses );
+
+	// call to real storage and store result (in concurrent mode
+	// result can contain uncommitted changes of open transaction
+	// that must not be visible to other threads; result is not
+	// stored if objects were changed during request)
+	int				version = s_queries->Version;
+	array<HEADER>	^headers = s_storage->Search( type,
+												  where, order, bottom, count );
+	if( !s_concurrent || (s_transactions == 0) ) {
+		s_queries->Put( key, type, headers->Clone(), version );
+	}
+
+	return headers;
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::Count implementation.
+//
+// Count persistent objects that satisfy specified conditions. Result
+// is taken from broker cache if it is allowed and present.
+//
+//-------------------------------------------------------------------
+int PersistenceBroker::count( String ^type, Where ^where, bool cached )
+{
+	// check for disconnected state
+	if( s_storage == nullptr ) throw gcnew InvalidOperationException(
+		ERR_BROKER_DISCONNECTED);
+
+	// check for cache is disabled or not requested
+	if( !cached || (s_queries->TTL == TimeSpan::Zero) ) {
+		// call to real storage
+		return s_storage->Count( type, where );
+	}
+
+	String	^key = QueryCache::CountKey( type, where );
+	Object	^result = nullptr;
+
+	// try to get count from cache
+	if( s_queries->Get( key, result ) ) {
+		Interlocked::Increment( s_queryHits );
+		return safe_cast<int>( result );
+	}
+	Interlocked::Increment( s_queryMisses );
+
+	// call to real storage and store result (in concurrent mode
+	// result can contain uncommitted changes of open transaction
+	// that must not be visible to other threads; result is not
+	// stored if objects were changed during request)
+	int	version = s_queries->Version;
+	int	found = s_storage->Count( type, where );
+	if( !s_concurrent || (s_transactions == 0) ) {
+		s_queries->Put( key, type, found, version );
+	}
+
+	return found;
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::SearchAfter implementation.
+//
+// Search storage for the next page of persistent objects that
+// satisfy specified conditions.
+//
+//-------------------------------------------------------------------
+array<HEADER>^ PersistenceBroker::									\
+search_after( String ^type, Where ^where, OrderBy ^order,			\
+			  array<ValueBox>^ %after, int bottom, int count )
+{
+	// check for disconnected state
+	if( s_storage == nullptr ) throw gcnew InvalidOperationException(
+		ERR_BROKER_DISCONNECTED);
+
+	// call to real storage
+	return s_storage->SearchAfter( type, where, order, after, bottom, count );
+}
+
+
 //-------------------------------------------------------------------
 //
 // IIRemoteStorage::Retrieve implementation.
@@ -289,6 +356,10 @@ retrieve( HEADER %header )
 //
 // Retrieve object header, links and properties from storage.
 //
+// If second-level cache contains object's state, only header is
+// requested from storage to check stamp. If stamp was not changed
+// links and properties are restored from cache.
+//
 //-------------------------------------------------------------------
 void PersistenceBroker::											 \
 retrieve( HEADER %header,											 \
@@ -298,8 +369,85 @@ retrieve( HEADER %header,											 \
 	if( s_storage == nullptr ) throw gcnew InvalidOperationException(
 		ERR_BROKER_DISCONNECTED);
 
+	DateTime	stamp;
+	// check for object's state is in the second-level cache
+	if( s_states->Find( header.Type, header.ID, stamp ) ) {
+		// request current header only
+		HEADER	current = header;
+		s_storage->Retrieve( current );
+
+		// caller already has actual state
+		if( current.Stamp == header.Stamp ) {
+			header = current;
+			links = nullptr;
+			props = nullptr;
+			return;
+		}
+		// try to restore actual state from cache
+		if( s_states->Get( current, links, props ) ) {
+			// register cache hit
+			Interlocked::Increment( s_stateHits );
+
+			header = current;
+			return;
+		}
+	}
+	// register cache miss
+	Interlocked::Increment( s_stateMisses );
+
 	// call to real storage
 	s_storage->Retrieve( header, links, props );
+	// and store received state to cache
+	if( props != nullptr ) s_states->Put( header, links, props );
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::Retrieve implementation.
+//
+// Retrieve object header, links and specified properties from
+// storage.
+//
+// Second-level cache stores complete state only, so partial request
+// is passed to storage directly. Request of all properties is
+// processed as full retrieve.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::											 \
+retrieve( HEADER %header, array<String^> ^names,					 \
+		  [Out] array<LINK>^ %links, [Out] array<PROPERTY>^ %props )
+{
+	// all properties are requested: process as full retrieve
+	if( names == nullptr ) {
+		retrieve( header, links, props );
+		return;
+	}
+	// check for disconnected state
+	if( s_storage == nullptr ) throw gcnew InvalidOperationException(
+		ERR_BROKER_DISCONNECTED);
+
+	// call to real storage
+	s_storage->Retrieve( header, names, links, props );
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::Validate implementation.
+//
+// Check stamps of the set of objects in one request.
+//
+//-------------------------------------------------------------------
+array<HEADER>^ PersistenceBroker:: \
+validate( array<HEADER> ^headers )
+{
+	// check for disconnected state
+	if( s_storage == nullptr ) throw gcnew InvalidOperationException(
+		ERR_BROKER_DISCONNECTED);
+
+	// call to real storage
+	return s_storage->Validate( headers );
 }
 
 
@@ -319,8 +467,13 @@ save( HEADER %header,											   \
 	if( s_storage == nullptr ) throw gcnew InvalidOperationException( 
 		ERR_BROKER_DISCONNECTED);
 
+	// object state will be changed, so remove it from cache
+	s_states->Remove( header.Type, header.ID );
+
 	// call to real storage
 	s_storage->Save( header, links, props, mlinks, mprops );
+	// and drop search results for objects of this type
+	invalidate( header.Type );
 }
 
 
@@ -338,8 +491,95 @@ remove( HEADER header )
 	if( s_storage == nullptr ) throw gcnew InvalidOperationException( 
 		ERR_BROKER_DISCONNECTED);
 
+	// remove object state from cache
+	s_states->Remove( header.Type, header.ID );
+
 	// call to real storage
 	s_storage->Delete( header );
+	// and drop search results for objects of this type
+	invalidate( header.Type );
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::OpenBlob implementation.
+//
+// Open content of stream property for range reading.
+//
+//-------------------------------------------------------------------
+__int64 PersistenceBroker::									   \
+open_blob( HEADER header, String ^name, [Out] array<unsigned char>^ %hash )
+{
+	// check for disconnected state
+	if( s_storage == nullptr ) throw gcnew InvalidOperationException( 
+		ERR_BROKER_DISCONNECTED);
+
+	// call to real storage
+	return s_storage->OpenBlob( header, name, hash );
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::ReadBlob implementation.
+//
+// Read range of stream property content.
+//
+//-------------------------------------------------------------------
+array<unsigned char>^ PersistenceBroker::						 \
+read_blob( HEADER header, String ^name, array<unsigned char> ^hash, \
+		   __int64 offset, int count )
+{
+	// check for disconnected state
+	if( s_storage == nullptr ) throw gcnew InvalidOperationException( 
+		ERR_BROKER_DISCONNECTED);
+
+	// call to real storage
+	return s_storage->ReadBlob( header, name, hash, offset, count );
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::WriteBlob implementation.
+//
+// Write range of content that is uploaded to the storage.
+//
+//-------------------------------------------------------------------
+__int64 PersistenceBroker::											 \
+write_blob( array<unsigned char> ^hash, __int64 offset, array<unsigned char> ^data )
+{
+	// check for disconnected state
+	if( s_storage == nullptr ) throw gcnew InvalidOperationException( 
+		ERR_BROKER_DISCONNECTED);
+
+	// call to real storage
+	return s_storage->WriteBlob( hash, offset, data );
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::CommitBlob implementation.
+//
+// Assign uploaded content to stream property of the object.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::										 \
+commit_blob( HEADER %header, String ^name, array<unsigned char> ^hash )
+{
+	// check for disconnected state
+	if( s_storage == nullptr ) throw gcnew InvalidOperationException( 
+		ERR_BROKER_DISCONNECTED);
+
+	// object will be changed, so remove its state from cache
+	s_states->Remove( header.Type, header.ID );
+
+	// call to real storage
+	s_storage->CommitBlob( header, name, hash );
+	// and drop search results for objects of this type
+	invalidate( header.Type );
 }
 
 
@@ -357,17 +597,92 @@ process_sql( String ^sql, array<Object^> ^params )
 	if( s_storage == nullptr ) throw gcnew InvalidOperationException( 
 		ERR_BROKER_DISCONNECTED);
 
+	// SQL can change any objects, so drop all search results
+	s_queries->Clear();
+
 	// call to real storage
 	return s_storage->ProcessSQL( sql, params );
 }
 
 
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::SearchPacked implementation.
+//
+// Search objects and return headers in WireFormat encoding.
+//
+//-------------------------------------------------------------------
+array<Byte>^ PersistenceBroker::								 \
+search_packed( String ^type, Where ^where, OrderBy ^order,		 \
+			   int bottom, int count, bool cached )
+{
+	WireFormat	^wf = gcnew WireFormat();
+
+	wf->Write( search( type, where, order, bottom, count, cached ) );
+	return wf->ToArray();
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::RetrievePacked implementation.
+//
+// Retrieve object header, links and specified properties (null
+// reference means all properties) and return links and properties
+// in WireFormat encoding.
+//
+//-------------------------------------------------------------------
+array<Byte>^ PersistenceBroker:: \
+retrieve_packed( HEADER %header, array<String^> ^names )
+{
+	array<LINK>		^links = nullptr;
+	array<PROPERTY>	^props = nullptr;
+
+	retrieve( header, names, links, props );
+
+	WireFormat	^wf = gcnew WireFormat();
+	wf->Write( links );
+	wf->Write( props );
+
+	return wf->ToArray();
+}
+
+
+//-------------------------------------------------------------------
+//
+// IIRemoteStorage::SavePacked implementation.
+//
+// Save object header, links and properties passed in WireFormat
+// encoding and return changed links and properties in the same
+// encoding.
+//
+//-------------------------------------------------------------------
+array<Byte>^ PersistenceBroker:: \
+save_packed( HEADER %header, array<Byte> ^state )
+{
+	WireFormat		^in = gcnew WireFormat(state);
+	array<LINK>		^links = in->ReadLinks();
+	array<PROPERTY>	^props = in->ReadProperties();
+	array<LINK>		^mlinks = nullptr;
+	array<PROPERTY>	^mprops = nullptr;
+
+	save( header, links, props, mlinks, mprops );
+
+	WireFormat	^out = gcnew WireFormat();
+	out->Write( mlinks );
+	out->Write( mprops );
+
+	return out->ToArray();
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Gets internal access to the storage.
 /// </summary><remarks>
 /// Access to the members from this interface can acts through .NET
-/// Remoting.
+/// Remoting. In this case client side of remote broker is returned,
+/// so arrays are passed in compact encoding.
 /// </remarks>
 //-------------------------------------------------------------------
 IIRemoteStorage^ PersistenceBroker::Storage::get( void )
@@ -376,16 +691,40 @@ IIRemoteStorage^ PersistenceBroker::Storage::get( void )
 	if( s_instance == nullptr ) throw gcnew InvalidOperationException(
 		ERR_BROKER_CLOSED);
 
+	if( s_remote != nullptr ) return s_remote;
+
 	return s_instance;
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets object that must be used to lock storage access.
+/// </summary><remarks>
+/// By default all threads share one lock object (storage itself), so
+/// storage requests are serialized. In concurrent mode every thread
+/// gets it's own lock object and requests from different threads are
+/// passed to the storage at the same time.
+/// </remarks>
+//-------------------------------------------------------------------
+Object^ PersistenceBroker::SyncRoot::get( void )
+{
+	// serialize all requests by default
+	if( !s_concurrent ) return Storage;
+
+	// create lock object for current thread
+	if( s_syncRoot == nullptr ) s_syncRoot = gcnew Object();
+
+	return s_syncRoot;
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Gets or sets object by specified header.
 /// </summary><remarks>
 /// Getter searchs for object in cache and if unsuccessful creates it
-/// using factory.
+/// using factory. Cache is not locked while search.
 /// </remarks>
 //-------------------------------------------------------------------
 PersistentObject^ PersistenceBroker::Cache::get( HEADER header )
@@ -400,33 +739,10 @@ PersistentObject^ PersistenceBroker::Cache::get( HEADER header )
 		throw gcnew ArgumentException(ERR_OBJECT_HEADER, "header");
 	}
 
-	// lock cache access
-	Monitor::Enter( s_cache );
-	try {
-		// search for object already exists
-		PersistentObject	^obj = s_cache[header.Type, header.ID];
-		if( obj == nullptr ) {
-			// check for factory has been initialized already
-			if( s_objectFactory == nullptr ) {
-				// throw exception
-				throw gcnew InvalidOperationException(ERR_OBJECT_FACTORY);
-			}
-			// create object through factory
-			obj = s_objectFactory( header.Type,
-								   header.ID, header.Stamp, header.Name );
-			// check for succeded object creation
-			if( obj == nullptr) {
-				throw gcnew InvalidOperationException(String::Format(
-				ERR_OBJECT_CREATION, header.Type) );
-			}
-			// and push new object to cache
-			s_cache[header.Type, header.ID] = obj;
-		}
-		return obj;
-	} finally {
-		// unlock cache access
-		Monitor::Exit( s_cache );
-	}
+	// search for object already exists and create it through
+	// factory if not found (cache guarantees that object will be
+	// created at most once)
+	return s_cache->Resolve( header, s_objectFactory );
 }
 
 void PersistenceBroker::Cache::set( HEADER header, PersistentObject ^obj )
@@ -441,14 +757,45 @@ void PersistenceBroker::Cache::set( HEADER header, PersistentObject ^obj )
 		throw gcnew ArgumentException(ERR_OBJECT_HEADER, "header");
 	}
 
-	// lock cache access
-	Monitor::Enter( s_cache );
+	// push new object to cache
+	s_cache[header.Type, header.ID] = obj;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Creates second-level cache and cache of search results (both are
+// disabled by default) and list of types changed in transactions. Is called by static class constructor that
+// is defined in class body (out of line definition can't differ from
+// the default constructor one).
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::create_caches( void )
+{
+	s_states = gcnew StateCache();
+	s_queries = gcnew QueryCache();
+	s_changed = gcnew List<String^>();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Drops search results for objects of specified type. Type that is
+// changed in open transaction is remembered to drop its results
+// again on commit: other threads could cache them in between.
+//
+//-------------------------------------------------------------------
+void PersistenceBroker::invalidate( String ^type )
+{
+	s_queries->Invalidate( type );
+
+	if( s_transactions == 0 ) return;
+
+	Monitor::Enter( s_changed );
 	try {
-		// and push new object to cache
-		s_cache[header.Type, header.ID] = obj;
+		if( !s_changed->Contains( type ) ) s_changed->Add( type );
 	} finally {
-		// unlock cache access
-		Monitor::Exit( s_cache );
+		Monitor::Exit( s_changed );
 	}
 }
 
@@ -533,6 +880,153 @@ bool PersistenceBroker::IsOpened::get( void )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets or sets value indicating that storage requests from different
+/// threads can be processed at the same time.
+/// </summary><remarks><para>
+/// Set it only if storage supports multiple connections and handles
+/// transactions of every thread separately. In other case (default)
+/// all requests and transactions are serialized.</para><para>
+/// This value can be changed while persistent mechanism is closed
+/// only.
+/// </para></remarks>
+//-------------------------------------------------------------------
+bool PersistenceBroker::IsConcurrent::get( void )
+{
+	return s_concurrent;
+}
+
+void PersistenceBroker::IsConcurrent::set( bool value )
+{
+	// check for the broker is closed
+	if( s_instance != nullptr ) throw gcnew InvalidOperationException(
+		ERR_BROKER_OPENED);
+
+	s_concurrent = value;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets number of lock contentions for every shard of the objects
+/// cache.
+/// </summary><remarks>
+/// Cache reads are lock-free, so only writers (object creation and
+/// registration) can wait for each other. Large values mean that
+/// many threads create objects at the same time.
+/// </remarks>
+//-------------------------------------------------------------------
+array<int>^ PersistenceBroker::CacheContention::get( void )
+{
+	// check for the broker is opened
+	if( s_instance == nullptr ) throw gcnew InvalidOperationException(
+		ERR_BROKER_CLOSED);
+
+	return s_cache->Contention;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets or sets maximum size (in bytes) of the second-level cache.
+/// </summary><remarks><para>
+/// Second-level cache keeps serialized links and properties of
+/// retrieved objects, so objects removed from the identity map by
+/// garbage collector can be restored by header request only (if
+/// storage stamp was not changed). Least recently used states are
+/// removed when cache exceeds the limit. Zero value (default)
+/// disables cache.</para><para>
+/// Cache is used by broker, so in client-server configuration set
+/// this value on the server side.
+/// </para></remarks>
+//-------------------------------------------------------------------
+long long PersistenceBroker::StateCacheLimit::get( void )
+{
+	return s_states->Limit;
+}
+
+void PersistenceBroker::StateCacheLimit::set( long long value )
+{
+	s_states->Limit = value;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets number of full retrieve requests that were served by the
+/// second-level cache.
+/// </summary>
+//-------------------------------------------------------------------
+long long PersistenceBroker::StateCacheHits::get( void )
+{
+	return Interlocked::Read( s_stateHits );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets number of full retrieve requests that were passed to the
+/// storage.
+/// </summary>
+//-------------------------------------------------------------------
+long long PersistenceBroker::StateCacheMisses::get( void )
+{
+	return Interlocked::Read( s_stateMisses );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets or sets time to live of cached search results.
+/// </summary><remarks><para>
+/// Broker keeps found headers and counts of criterias by type, WHERE
+/// and ORDER BY clauses (with values) and page limits. Results for
+/// some type are dropped when object of this type is saved or deleted
+/// through broker, all results are dropped by transaction rollback
+/// and SQL processing. Changes made by other applications are seen
+/// after time to live only. Zero value (default) disables cache.
+/// </para><para>
+/// Cache is used by broker, so in client-server configuration set
+/// this value on the server side. Criteria can bypass cache by
+/// UseCache property.
+/// </para></remarks>
+//-------------------------------------------------------------------
+TimeSpan PersistenceBroker::QueryCacheTTL::get( void )
+{
+	return s_queries->TTL;
+}
+
+void PersistenceBroker::QueryCacheTTL::set( TimeSpan value )
+{
+	s_queries->TTL = value;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets number of search and count requests that were served by the
+/// cache of search results.
+/// </summary>
+//-------------------------------------------------------------------
+long long PersistenceBroker::QueryCacheHits::get( void )
+{
+	return Interlocked::Read( s_queryHits );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets number of cacheable search and count requests that were
+/// passed to the storage.
+/// </summary>
+//-------------------------------------------------------------------
+long long PersistenceBroker::QueryCacheMisses::get( void )
+{
+	return Interlocked::Read( s_queryMisses );
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Connects to persistent storage using specified interface.
@@ -552,6 +1046,9 @@ void PersistenceBroker::Connect( IPersistenceStorage ^storage )
 
 	// save storage interface
 	s_storage = storage;
+	// and drop states and results of previous storage
+	s_states->Clear();
+	s_queries->Clear();
 }
 
 
@@ -576,6 +1073,9 @@ void PersistenceBroker::Disconnect( void )
 	// dispose storage interface
 	delete s_storage;
 	s_storage = nullptr;
+	// and drop cached states and results
+	s_states->Clear();
+	s_queries->Clear();
 }
 
 
@@ -603,6 +1103,10 @@ void PersistenceBroker::Open( void )
 		// use default constructor to create object
 		s_instance = gcnew PersistenceBroker();
 	}
+	// use client side for remote broker
+	if( RemotingServices::IsTransparentProxy( s_instance ) ) {
+		s_remote = gcnew RemoteStorage(s_instance);
+	}
 	// create object's cache
 	s_cache = gcnew BrokerCache();
 
@@ -638,6 +1142,7 @@ void PersistenceBroker::Close( void )
 		}
 		// prevent from future cals
 		s_instance = nullptr;
+		s_remote = nullptr;
 	}
 
 	dbgprint( "<- [" + AppDomain::CurrentDomain->FriendlyName + "]" );
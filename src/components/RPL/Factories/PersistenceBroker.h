@@ -17,6 +17,7 @@
 #include "..\Storage\IPersistenceStorage.h"
 
 using namespace System;
+using namespace System::Collections::Generic;
 using namespace System::Threading;
 using namespace Toolkit::Collections;
 using namespace _RPL;
@@ -62,11 +63,22 @@ namespace Factories {
 	/// storage from implementer access. But still have one bug:
 	/// implicit cast to IPersistenceStorage remove access
 	/// restrictions. To avoid this just duplicate IPersistenceStorage
-	/// code here.
+	/// code here.</para><para>
+	/// Additional Search and Count members allow criteria to bypass
+	/// broker cache of search results.</para><para>
+	/// Packed members pass headers, links and properties encoded by
+	/// WireFormat: they are used by client side of remote broker.
 	/// </para></remarks>
 	private interface class IIRemoteStorage : IPersistenceStorage
 	{
-		// no additional members
+		array<HEADER>^ Search( String ^type, Where ^where, OrderBy ^order,
+							   int bottom, int count, bool cached );
+		int Count( String ^type, Where ^where, bool cached );
+
+		array<Byte>^ SearchPacked( String ^type, Where ^where, OrderBy ^order,
+								   int bottom, int count, bool cached );
+		array<Byte>^ RetrievePacked( HEADER %header, array<String^> ^names );
+		array<Byte>^ SavePacked( HEADER %header, array<Byte> ^state );
 	};
 
 
@@ -97,35 +109,61 @@ namespace Factories {
 	{
 	private:
 		//
-		// Cache of objects for some session.
+		// Key of the object in the cache: interned object's type
+		// and ID (type strings are compared by reference only).
 		//
-		ref class BrokerCache
+		value class KEY : IEquatable<KEY>
 		{
 		private:
-			ReaderWriterLock^				const _lock;
-
-			bool volatile					m_disposed;
-			Map<String^, WeakReference^>	m_cache;
-
-			void thread_clean( void );
-			String^ key( String ^type, int id );
+			String^	const _type;
+			int		const _id;
 
 		public:
-			BrokerCache( void );
-			~BrokerCache( void );
+			KEY( String ^type, int id );
 
-			property PersistentObject^ default[String^, int] {
-				PersistentObject^ get( String ^type, int id );
-				void set( String ^type, int id, PersistentObject ^obj );
-			}
+			virtual bool Equals( KEY key );
+			virtual bool Equals( Object ^obj ) override;
+			virtual int GetHashCode( void ) override;
 		};
 
+		//
+		// Cache of objects for some session.
+		//
+		ref class BrokerCache;
+
+		//
+		// Second-level cache of serialized objects state.
+		//
+		ref class StateCache;
+
+		//
+		// Cache of search results.
+		//
+		ref class QueryCache;
+
+		//
+		// Client side of remote broker.
+		//
+		ref class RemoteStorage;
+
 	private:
 		static BROKER_FACTORY		^s_brokerFactory = nullptr;
 		static OBJECT_FACTORY		^s_objectFactory = nullptr;
 		static PersistenceBroker	^s_instance = nullptr;
 		static BrokerCache			^s_cache = nullptr;
 		static IPersistenceStorage	^s_storage = nullptr;
+		static bool					s_concurrent = false;
+		static StateCache			^s_states = nullptr;
+		static long long			s_stateHits = 0;
+		static long long			s_stateMisses = 0;
+		static QueryCache			^s_queries = nullptr;
+		static long long			s_queryHits = 0;
+		static long long			s_queryMisses = 0;
+		static RemoteStorage		^s_remote = nullptr;
+		static int					s_transactions = 0;
+		static List<String^>		^s_changed = nullptr;
+		[ThreadStatic]
+		static Object				^s_syncRoot;
 
 	// IIRemoteStorage
 	private:
@@ -139,30 +177,77 @@ namespace Factories {
 		virtual int search( String^, Where^, OrderBy^, int, int,
 							[Out] array<HEADER>^% ) sealed =
 			IIRemoteStorage::Search;
+		virtual array<HEADER>^ search( String^, Where^, OrderBy^,
+									   int, int ) sealed =
+			IIRemoteStorage::Search;
+		virtual int count( String^, Where^ ) sealed =
+			IIRemoteStorage::Count;
+		virtual array<HEADER>^ search( String^, Where^, OrderBy^,
+									   int, int, bool ) sealed =
+			IIRemoteStorage::Search;
+		virtual int count( String^, Where^, bool ) sealed =
+			IIRemoteStorage::Count;
+		virtual array<HEADER>^ search_after( String^, Where^, OrderBy^,
+											 array<ValueBox>^%, int,
+											 int ) sealed =
+			IIRemoteStorage::SearchAfter;
 
 		virtual void retrieve( HEADER% ) sealed =
 			IIRemoteStorage::Retrieve;
 		virtual void retrieve( HEADER%, [Out] array<LINK>^%,
 							   [Out] array<PROPERTY>^% ) sealed =
 			IIRemoteStorage::Retrieve;
+		virtual void retrieve( HEADER%, array<String^>^, [Out] array<LINK>^%,
+							   [Out] array<PROPERTY>^% ) sealed =
+			IIRemoteStorage::Retrieve;
+		virtual array<HEADER>^ validate( array<HEADER>^ ) sealed =
+			IIRemoteStorage::Validate;
 		virtual void save( HEADER%, [In] array<LINK>^, [In] array<PROPERTY>^,
 						   [Out] array<LINK>^%, [Out] array<PROPERTY>^% ) sealed =
 			IIRemoteStorage::Save;
 		virtual void remove( HEADER ) sealed =
 			IIRemoteStorage::Delete;
+		virtual __int64 open_blob( HEADER, String^,
+								   [Out] array<unsigned char>^% ) sealed =
+			IIRemoteStorage::OpenBlob;
+		virtual array<unsigned char>^ read_blob( HEADER, String^,
+												 array<unsigned char>^,
+												 __int64, int ) sealed =
+			IIRemoteStorage::ReadBlob;
+		virtual __int64 write_blob( array<unsigned char>^, __int64,
+									array<unsigned char>^ ) sealed =
+			IIRemoteStorage::WriteBlob;
+		virtual void commit_blob( HEADER%, String^,
+								  array<unsigned char>^ ) sealed =
+			IIRemoteStorage::CommitBlob;
 
 		virtual DataSet^ process_sql( String^, array<Object^>^ ) sealed =
 			IIRemoteStorage::ProcessSQL;
 
+		virtual array<Byte>^ search_packed( String^, Where^, OrderBy^,
+											int, int, bool ) sealed =
+			IIRemoteStorage::SearchPacked;
+		virtual array<Byte>^ retrieve_packed( HEADER%, array<String^>^ ) sealed =
+			IIRemoteStorage::RetrievePacked;
+		virtual array<Byte>^ save_packed( HEADER%, array<Byte>^ ) sealed =
+			IIRemoteStorage::SavePacked;
+
 	internal:
 		property IIRemoteStorage^ Storage {
 			static IIRemoteStorage^ get( void );
 		}
+		property Object^ SyncRoot {
+			static Object^ get( void );
+		}
 		property PersistentObject^ Cache[HEADER] {
 			static PersistentObject^ get( HEADER header );
 			static void set( HEADER header, PersistentObject ^obj );
 		}
 
+	private:
+		static void create_caches( void );
+		static void invalidate( String ^type );
+		static PersistenceBroker( void ) {create_caches();}
 	protected:
 		PersistenceBroker( void );
 		~PersistenceBroker( void );
@@ -177,6 +262,33 @@ namespace Factories {
 		property bool IsOpened {
 			static bool get( void );
 		}
+		property bool IsConcurrent {
+			static bool get( void );
+			static void set( bool value );
+		}
+		property array<int>^ CacheContention {
+			static array<int>^ get( void );
+		}
+		property long long StateCacheLimit {
+			static long long get( void );
+			static void set( long long value );
+		}
+		property long long StateCacheHits {
+			static long long get( void );
+		}
+		property long long StateCacheMisses {
+			static long long get( void );
+		}
+		property TimeSpan QueryCacheTTL {
+			static TimeSpan get( void );
+			static void set( TimeSpan value );
+		}
+		property long long QueryCacheHits {
+			static long long get( void );
+		}
+		property long long QueryCacheMisses {
+			static long long get( void );
+		}
 
 		static void Connect( IPersistenceStorage ^storage );
 		static void Disconnect( void );
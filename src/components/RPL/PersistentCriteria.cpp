@@ -13,6 +13,7 @@
 /****************************************************************************/
 
 #include ".\Factories\PersistenceBroker.h"
+#include "AsyncQueue.h"
 #include "PersistentCriteria.h"
 
 using namespace _RPL;
@@ -30,7 +31,8 @@ using namespace _RPL::Factories;
 /// </summary>
 //-------------------------------------------------------------------
 PersistentCriteria::PersistentCriteria( String ^type ):					\
-	_type(type), m_bottom(0), m_count(Int32::MaxValue), m_countFound(0)
+	_type(type), m_bottom(0), m_count(Int32::MaxValue), m_countFound(0), \
+	m_useCache(true), _async(gcnew AsyncQueue())
 {
 	dbgprint( String::Format( "-> {0}\n{1}", 
 							  this->GetType(), type ) );
@@ -197,17 +199,61 @@ void PersistentCriteria::CountLimit::set( int value )
 /// <summary>
 /// Gets number of founded objects using specified InnerQuery request
 /// with current WHERE clause.
-/// </summary><remarks>
+/// </summary><remarks><para>
 /// To get count of objects that was processed by this criteria
 /// request (with specified "CountLimit" value) use "Count" property.
-/// </remarks>
+/// </para><para>
+/// Search request doesn't count all found objects, so separate count
+/// request is performed (if number of objects can't be determined by
+/// the result of search). DeleteCriteria performs it before objects
+/// are deleted, other criterias perform it at first access to this
+/// property: storage can be changed after search, so value can be
+/// inconsistent with objects in the collection.
+/// </para></remarks>
 //-------------------------------------------------------------------
 int PersistentCriteria::CountFound::get( void )
 {
+	// check for objects are counted already
+	if( m_countFound >= 0 ) return m_countFound;
+
+	// object to lock storage access
+	Object	^sync = PersistenceBroker::SyncRoot;
+
+	// lock storage for one executable thread
+	Monitor::Enter( sync );
+	try {
+		// perform storage count request
+		m_countFound = PersistenceBroker::Storage->Count(
+							_type, m_where, m_useCache );
+	} finally {
+		// unlock storage in any case
+		Monitor::Exit( sync );
+	}
 	return m_countFound;
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets or sets value indicating whether criteria can use broker
+/// cache of search results.
+/// </summary><remarks>
+/// By default it is set to true, but cache is used only if it is
+/// enabled by PersistenceBroker.QueryCacheTTL. Set to false if
+/// criteria must see changes made by other applications immediately.
+/// </remarks>
+//-------------------------------------------------------------------
+bool PersistentCriteria::UseCache::get( void )
+{
+	return m_useCache;
+}
+
+void PersistentCriteria::UseCache::set( bool value )
+{
+	m_useCache = value;
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Gets the object at the specified index.
@@ -243,15 +289,26 @@ void PersistentCriteria::Perform( void )
 {
 	// array to store search results
 	array<HEADER>	^headers = nullptr;
+	// object to lock storage access
+	Object			^sync = PersistenceBroker::SyncRoot;
 
 	// lock storage for one executable thread
-	Monitor::Enter( PersistenceBroker::Storage );
+	Monitor::Enter( sync );
 	try {
-		// perform storage search request and set CountFound property
-		m_countFound = PersistenceBroker::Storage->Search(
+		// perform storage search request (without counting)
+		headers = PersistenceBroker::Storage->Search(
 							_type,
 							m_where, m_orderBy, m_bottom, m_count,
-							headers );
+							m_useCache );
+
+		// if page is not full, then number of found objects
+		// is known, in other case it will be counted on demand
+		if( (headers->Length < m_count) &&
+			((headers->Length > 0) || (m_bottom == 0)) ) {
+			m_countFound = m_bottom + headers->Length;
+		} else {
+			m_countFound = -1;
+		}
 
 		// first of all clear objects list
 		m_list.Clear();
@@ -277,6 +334,40 @@ void PersistentCriteria::Perform( void )
 		}
 	} finally {
 		// unlock storage in any case
-		Monitor::Exit( PersistenceBroker::Storage );
+		Monitor::Exit( sync );
 	}
 }
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Begins an asynchronous Perform operation.
+/// </summary><remarks>
+/// Asynchronous operations on the same criteria are performed in the
+/// order they were started. Collection must not be accessed until
+/// operation is completed. Use EndPerform to get the result of
+/// operation.
+/// </remarks>
+//-------------------------------------------------------------------
+IAsyncResult^ PersistentCriteria::BeginPerform( AsyncCallback ^callback, \
+												Object ^state )
+{
+	AsyncQueue::OPERATION	^op = gcnew AsyncQueue::OPERATION(
+		this, &PersistentCriteria::Perform);
+
+	return _async->Begin( op, nullptr, callback, state );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Waits for the pending asynchronous Perform operation to complete.
+/// </summary><remarks>
+/// Exception raised during operation is thrown by this call as inner
+/// exception of TargetInvocationException.
+/// </remarks>
+//-------------------------------------------------------------------
+void PersistentCriteria::EndPerform( IAsyncResult ^result )
+{
+	AsyncQueue::End( result );
+}
@@ -22,6 +22,8 @@ using namespace System::Collections::Generic;
 
 
 _RPL_BEGIN
+ref class AsyncQueue;
+
 /// <summary>
 /// This abstract class encapsulates the common behavior needed to search,
 /// delete and update scope of persistent objects.
@@ -33,6 +35,9 @@ _RPL_BEGIN
 /// </remarks>
 public ref class PersistentCriteria abstract : PersistentObjects
 {
+private:
+	AsyncQueue^	const _async;
+
 protected:
 	String^		const _type;
 
@@ -41,6 +46,7 @@ protected:
 	int			m_countFound;
 	int			m_bottom;
 	int			m_count;
+	bool		m_useCache;
 
 	PersistentCriteria( String ^type );
 
@@ -70,11 +76,18 @@ public:
 	property int CountFound {
 		int get( void );
 	}
+	property bool UseCache {
+		bool get( void );
+		void set( bool value );
+	}
 	property PersistentObject^ default[int] {
 		PersistentObject^ get( int index );
 	}
 
 	int IndexOf( PersistentObject ^obj );
 	void Perform( void );
+
+	IAsyncResult^ BeginPerform( AsyncCallback ^callback, Object ^state );
+	void EndPerform( IAsyncResult ^result );
 };
 _RPL_END
@@ -122,38 +122,69 @@ ObjectLinks::clear( void )
 
 //-------------------------------------------------------------------
 //
-// ITransaction::Begin implementation.
+// Stores all collection's data to the top restore point.
 //
-// Stores all collection's data until trans_commit will be called to
-// have ability to restore data by trans_rollback.
+// Restore point is filled at the first change of collection during
+// transaction only (copy on write), so transactions that don't
+// change links don't copy it. Must be called before any change.
 //
 //-------------------------------------------------------------------
 void PersistentObject::
-ObjectLinks::trans_begin( void )
+ObjectLinks::save_point( void )
 {
-	// create backup record
-	RESTORE_POINT	point;
+	// check for transaction exists and data was not stored yet
+	if( (backup.Count == 0) || (backup.Peek()._objs != nullptr) ) return;
+
+	// get top record from stack
+	RESTORE_POINT	point = backup.Pop();
 	// and fill it by current data
 	point._objs = gcnew PersistentObjects(%m_list);
 	point._log = gcnew Dictionary<PersistentObject^, STATE>(m_log);
 
-	// push record to stack
+	// push record back to stack
 	backup.Push( point );
 }
 
 
+//-------------------------------------------------------------------
+//
+// ITransaction::Begin implementation.
+//
+// Creates empty restore point. Collection's data will be stored at
+// the first change (see save_point) until trans_commit will be
+// called to have ability to restore data by trans_rollback.
+//
+//-------------------------------------------------------------------
+void PersistentObject::
+ObjectLinks::trans_begin( void )
+{
+	// push empty record to stack
+	backup.Push( RESTORE_POINT() );
+}
+
+
 //-------------------------------------------------------------------
 //
 // ITransaction::Commit implementation.
 //
 // Transaction was completed successfuly, so free backup record.
+// If data was stored by nested transaction only, then it is initial
+// data for outer transaction too, so pass it to outer restore point.
 //
 //-------------------------------------------------------------------
 void PersistentObject::
 ObjectLinks::trans_commit( void )
 {
 	// remove top record from stack
-	backup.Pop();
+	RESTORE_POINT	point = backup.Pop();
+
+	// check for outer restore point has no stored data
+	if( (point._objs != nullptr) &&
+		(backup.Count > 0) && (backup.Peek()._objs == nullptr) ) {
+		// replace it by stored data
+		backup.Pop();
+		backup.Push( point );
+	}
 }
 
 
@@ -170,6 +201,9 @@ ObjectLinks::trans_rollback( void )
 	// get top record from stack
 	RESTORE_POINT	point = backup.Pop();
 
+	// collection was not changed during transaction
+	if( point._objs == nullptr ) return;
+
 	// clear content
 	m_list.Clear();
 
@@ -190,6 +224,9 @@ ObjectLinks::trans_rollback( void )
 void PersistentObject::
 ObjectLinks::OnClear( void )
 {
+	// store data before changes
+	save_point();
+
 	// notify parent using following specific call
 	_owner->on_change( nullptr );
 
@@ -212,6 +249,9 @@ ObjectLinks::OnClear( void )
 void PersistentObject::
 ObjectLinks::OnInsert( PersistentObject ^obj )
 {
+	// store data before changes
+	save_point();
+
 	// call parent method to perform addition processing
 	_owner->on_change( obj );
 }
@@ -228,6 +268,9 @@ ObjectLinks::OnInsert( PersistentObject ^obj )
 void PersistentObject::
 ObjectLinks::OnRemove( PersistentObject ^obj )
 {
+	// store data before changes
+	save_point();
+
 	// call parent method to perform addition processing
 	_owner->on_change( obj );
 }
@@ -321,7 +364,9 @@ ObjectLinks::ObjectLinks( PersistentObject ^owner,			   \
 PersistentObject::
 ObjectLinks::~ObjectLinks( void )
 {
-	// just call 'clear'
+	// store data before changes
+	save_point();
+	// and call 'clear'
 	clear();
 }
 
@@ -356,6 +401,9 @@ ObjectLinks::IsChanged::get( void )
 void PersistentObject::
 ObjectLinks::Accept( void )
 {
+	// store data before changes
+	save_point();
+
 	// clear log
 	m_log->Clear();
 
@@ -415,6 +463,8 @@ ObjectLinks::Reload( IEnumerable<PersistentObject^> ^e )
 	// check for null reference
 	if( e == nullptr ) throw gcnew ArgumentNullException( "e" );
 
+	// store data before changes
+	save_point();
 	// remove all items
 	clear();
 	// and fill instance by given enumeration
@@ -57,6 +57,8 @@ private:
 	};
 	Stack<RESTORE_POINT>	backup;
 
+	void save_point( void );
+
 	virtual void trans_begin( void ) sealed = ITransaction::Begin;
 	virtual void trans_commit( void ) sealed = ITransaction::Commit;
 	virtual void trans_rollback( void ) sealed = ITransaction::Rollback;
@@ -97,14 +97,16 @@ ObjectProperties::log_record::set( String ^key, STATE action )
 //
 // If specified object is PersistentStream returns true, in other
 // case returns false.
-// Only one subscription to PersistentStream can exist.
+// Only one subscription to PersistentStream can exist. All
+// subscribed streams are stored in the list to process transactions
+// without looking through all properties.
 //
 //-------------------------------------------------------------------
 bool PersistentObject::
 ObjectProperties::subscribe_to( ValueBox %value, bool subscribe )
 {
 	// check for being stream
-	PersistentStream	^ps = dynamic_cast<PersistentStream^>( value.ToObject() );
+	PersistentStream	^ps = value.AsStream();
 	if( ps != nullptr ) {
 		// create subscription delegate
 		PersistentStream::ON_CHANGE		^change = nullptr;
@@ -112,10 +114,13 @@ ObjectProperties::subscribe_to( ValueBox %value, bool subscribe )
 						&PersistentObject::ObjectProperties::on_ps_change );
 
 		// and (un)subscribe depend on passed parameter
-		if( subscribe )
+		if( subscribe ) {
 			ps->on_change += change;
-		else
+			m_streams.Add( ps );
+		} else {
 			ps->on_change -= change;
+			m_streams.Remove( ps );
+		}
 
 		return true;
 	}
@@ -133,8 +138,11 @@ ObjectProperties::subscribe_to( ValueBox %value, bool subscribe )
 void PersistentObject::
 ObjectProperties::on_ps_change( PersistentStream ^sender )
 {
+	// store data before changes
+	save_point();
+
 	// look through all values
-	for each( KeyValuePair<String^, ValueBox> pair in this ) {
+	for each( KeyValuePair<String^, ValueBox> pair in pairs() ) {
 		// check for specified value being sender
 		if( pair.Value == sender ) {
 			// stream conten is already changed, so
@@ -191,7 +199,7 @@ void PersistentObject::
 ObjectProperties::clear( void )
 {
 	// look through all pairs
-	for each( KeyValuePair<String^, ValueBox> pair in this ) {
+	for each( KeyValuePair<String^, ValueBox> pair in pairs() ) {
 		// and unsubscribe from PersistentStream events if needed
 		subscribe_to( pair.Value, false );
 	}
@@ -199,34 +207,120 @@ ObjectProperties::clear( void )
 	DeleteAll();
 	// and clear log
 	m_log->Clear();
+	m_origin->Clear();
+	m_absent.Clear();
 }
 
 
 //-------------------------------------------------------------------
 //
-// ITransaction::Begin implementation.
+// Loads properties that were not loaded if collection is filled
+// partially.
 //
-// Stores all collection's data until trans_commit will be called to
-// have ability to restore data by trans_rollback.
+// Specified property is loaded if it is not known yet (null reference
+// means request to all properties). Properties that have log records
+// (loaded, changed or deleted) are never reloaded, and properties that
+// are absent in storage are not requested again.
 //
 //-------------------------------------------------------------------
 void PersistentObject::
-ObjectProperties::trans_begin( void )
+ObjectProperties::load( String ^key )
 {
-	// process all properties in the collection
-	for each( KeyValuePair<String^, ValueBox> pair in this ) {
-		// if property value supports transactions
-		ITransaction	^trans = dynamic_cast<ITransaction^>(
-									pair.Value.ToObject() );
-		// notify it about beginning
-		if( trans != nullptr ) trans->Begin();
+	// check for collection is filled partially
+	if( !m_partial ) return;
+
+	if( key != nullptr ) {
+		// check for property is already known
+		if( m_log->ContainsKey( key ) || m_absent.Contains( key ) ) return;
+
+		// request owner to load this property only
+		_owner->load_properties( gcnew array<String^> {key} );
+	} else {
+		// request owner to load the rest of properties
+		_owner->load_properties( nullptr );
 	}
+}
 
-	// create backup record
-	RESTORE_POINT	point;
+
+//-------------------------------------------------------------------
+//
+// Returns properties that are in the collection now.
+//
+// Enumeration of the collection loads properties that were not
+// loaded, so internal routines pass through the log instead (every
+// property in the collection has log record).
+//
+//-------------------------------------------------------------------
+List<KeyValuePair<String^, ValueBox>>^ PersistentObject::
+ObjectProperties::pairs( void )
+{
+	List<KeyValuePair<String^, ValueBox>>	^result =
+		gcnew List<KeyValuePair<String^, ValueBox>>( m_log->Count );
+
+	// look through all log records
+	for each( String ^key in m_log->Keys ) {
+		ValueBox	value;
+		// and add properties that are not deleted
+		if( Find( key, value ) ) {
+			result->Add( KeyValuePair<String^, ValueBox>(key, value) );
+		}
+	}
+	return result;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Stores all collection's data to the top restore point.
+//
+// Restore point is filled at the first change of collection during
+// transaction only (copy on write), so transactions that don't
+// change properties don't copy it. Must be called before any change.
+//
+//-------------------------------------------------------------------
+void PersistentObject::
+ObjectProperties::save_point( void )
+{
+	// check for transaction exists and data was not stored yet
+	if( (backup.Count == 0) || (backup.Peek()._props != nullptr) ) return;
+
+	// get top record from stack
+	RESTORE_POINT	point = backup.Pop();
 	// and fill it by current data
-	point._props = gcnew PersistentProperties(this);
+	point._props = gcnew PersistentProperties(pairs());
 	point._log = gcnew Map<String^, STATE>(m_log);
+	point._origin = gcnew Map<String^, ValueBox>(m_origin);
+	point._partial = m_partial;
+	point._absent = m_absent.ToArray();
+
+	// push record back to stack
+	backup.Push( point );
+}
+
+
+//-------------------------------------------------------------------
+//
+// ITransaction::Begin implementation.
+//
+// Notifies all streams about transaction and creates restore point.
+// Collection's data will be stored at the first change (see
+// save_point) until trans_commit will be called to have ability to
+// restore data by trans_rollback.
+//
+//-------------------------------------------------------------------
+void PersistentObject::
+ObjectProperties::trans_begin( void )
+{
+	// create backup record
+	RESTORE_POINT	point;
+	// and store subscribed streams only
+	point._streams = m_streams.ToArray();
+
+	// process all streams in the collection
+	for each( ITransaction ^trans in point._streams ) {
+		// and notify it about beginning
+		trans->Begin();
+	}
 
 	// push record to stack
 	backup.Push( point );
@@ -238,6 +332,8 @@ ObjectProperties::trans_begin( void )
 // ITransaction::Commit implementation.
 //
 // Transaction was completed successfuly, so free backup record.
+// If data was stored by nested transaction only, then it is initial
+// data for outer transaction too, so pass it to outer restore point.
 //
 //-------------------------------------------------------------------
 void PersistentObject::
@@ -246,13 +342,24 @@ ObjectProperties::trans_commit( void )
 	// removes top record from stack
 	RESTORE_POINT	point = backup.Pop();
 
-	// look through old properties
-	for each( KeyValuePair<String^, ValueBox> pair in point._props ) {
-		// if property value supports transactions
-		ITransaction	^trans = dynamic_cast<ITransaction^>(
-									pair.Value.ToObject() );
-		// notify it about commit request
-		if( trans != nullptr ) trans->Commit();
+	// look through streams that was at transaction begin
+	for each( ITransaction ^trans in point._streams ) {
+		// and notify it about commit request
+		trans->Commit();
+	}
+
+	// check for outer restore point has no stored data
+	if( (point._props != nullptr) &&
+		(backup.Count > 0) && (backup.Peek()._props == nullptr) ) {
+		// replace it by stored data (keep outer streams)
+		RESTORE_POINT	outer = backup.Pop();
+
+		outer._props = point._props;
+		outer._log = point._log;
+		outer._origin = point._origin;
+		outer._partial = point._partial;
+		outer._absent = point._absent;
+		backup.Push( outer );
 	}
 }
 
@@ -270,19 +377,22 @@ ObjectProperties::trans_rollback( void )
 	// get top record from stack
 	RESTORE_POINT	point = backup.Pop();
 
-	// clear instance
-	clear();
-	// restore previous state
-	fill_by( point._props );
-	m_log = point._log;
-
-	// process all properties in the collection
-	for each( KeyValuePair<String^, ValueBox> pair in this ) {
-		// if property value supports transactions
-		ITransaction	^trans = dynamic_cast<ITransaction^>(
-									pair.Value.ToObject() );
-		// notify it about aborting
-		if( trans != nullptr ) trans->Rollback();
+	// check for collection was changed during transaction
+	if( point._props != nullptr ) {
+		// clear instance
+		clear();
+		// restore previous state
+		fill_by( point._props );
+		m_log = point._log;
+		m_origin = point._origin;
+		m_partial = point._partial;
+		m_absent.AddRange( point._absent );
+	}
+
+	// process all streams that was at transaction begin
+	for each( ITransaction ^trans in point._streams ) {
+		// and notify it about aborting
+		trans->Rollback();
 	}
 }
 
@@ -298,11 +408,14 @@ ObjectProperties::trans_rollback( void )
 void PersistentObject::
 ObjectProperties::OnClear( void )
 {
+	// store data before changes
+	save_point();
+
 	// notify parent using following specific call
 	_owner->on_change( nullptr, DBNull::Value, DBNull::Value );
 
 	// process all properties in collection
-	for each( KeyValuePair<String^, ValueBox> pair in this ) {
+	for each( KeyValuePair<String^, ValueBox> pair in pairs() ) {
 		// if value is PersistentStream, unsubscribe from events
 		subscribe_to( pair.Value, false );
 
@@ -325,6 +438,9 @@ ObjectProperties::OnClear( void )
 void PersistentObject::
 ObjectProperties::OnInsert( String ^key, ValueBox value )
 {
+	// store data before changes
+	save_point();
+
 	// if value is PersistentStream, try subscribe to events
 	// (this call can throw exception (in case of multiple
 	// subscriptions), so execute it before owner call)
@@ -352,6 +468,9 @@ ObjectProperties::OnInsert( String ^key, ValueBox value )
 void PersistentObject::
 ObjectProperties::OnRemove( String ^key, ValueBox value )
 {
+	// store data before changes
+	save_point();
+
 	// call parent method to perform addition processing
 	_owner->on_change( key, value, DBNull::Value );
 }
@@ -370,6 +489,9 @@ ObjectProperties::OnRemove( String ^key, ValueBox value )
 void PersistentObject::
 ObjectProperties::OnSet( String ^key, ValueBox value )
 {
+	// store data before changes
+	save_point();
+
 	// initialize old value to DBNull
 	ValueBox	old;
 	// try to get existing value by key
@@ -399,7 +521,15 @@ ObjectProperties::OnSet( String ^key, ValueBox value )
 	}
 
 	// if this is new property add 'new' record to log
-	if( !exists ) log_record[key] = STATE::New;
+	if( !exists ) {
+		log_record[key] = STATE::New;
+	} else if( (log_record[key] == STATE::None) &&
+			   (old.AsStream() == nullptr) ) {
+		// store loaded value at the first change to detect
+		// return to it (streams are changed in place, so they
+		// can't be compared)
+		m_origin[key] = old;
+	}
 }
 
 
@@ -445,7 +575,8 @@ ObjectProperties::OnRemoveComplete( String ^key, ValueBox value )
 /// Performs additional custom processes after setting a value to
 /// some property from the ObjectProperties instance.
 /// </summary><remarks>
-/// Just adds log record.
+/// Adds log record. If property gets loaded value back, then it is
+/// marked as not changed.
 /// </remarks>
 //-------------------------------------------------------------------
 void PersistentObject::
@@ -453,6 +584,31 @@ ObjectProperties::OnSetComplete( String ^key, ValueBox value )
 {
 	// write 'changed' log record
 	log_record[key] = STATE::Changed;
+
+	// check for value is equal to loaded one
+	ValueBox	origin;
+	if( (log_record[key] == STATE::Changed) &&
+		m_origin->TryGetValue( key, origin ) && (origin == value) ) {
+		// so there is nothing to save
+		m_log[key] = STATE::None;
+		m_origin->Remove( key );
+	}
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Performs additional custom processes before enumerating the
+/// properties of the ObjectProperties instance.
+/// </summary><remarks>
+/// Loads the rest of properties if collection is filled partially.
+/// </remarks>
+//-------------------------------------------------------------------
+void PersistentObject::
+ObjectProperties::OnEnumerate( void )
+{
+	// load all properties
+	load( nullptr );
 }
 
 
@@ -473,6 +629,7 @@ ObjectProperties::ObjectProperties( PersistentObject ^owner ): \
 
 	// create change log
 	m_log = gcnew Map<String^, STATE>();
+	m_origin = gcnew Map<String^, ValueBox>();
 }
 
 
@@ -498,6 +655,7 @@ ObjectProperties::ObjectProperties(									   \
 
 	// create change log
 	m_log = gcnew Map<String^, STATE>();
+	m_origin = gcnew Map<String^, ValueBox>();
 
 	// fill instance by specified collection
 	fill_by( e );
@@ -515,7 +673,9 @@ ObjectProperties::ObjectProperties(									   \
 PersistentObject::
 ObjectProperties::~ObjectProperties( void )
 {
-	// just call 'clear'
+	// store data before changes
+	save_point();
+	// and call 'clear'
 	clear();
 }
 
@@ -537,6 +697,216 @@ ObjectProperties::IsChanged::get( void )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Indicates that collection is filled by some of the properties
+/// only.
+/// </summary>
+//-------------------------------------------------------------------
+bool PersistentObject::
+ObjectProperties::IsPartial::get( void )
+{
+	return m_partial;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets or sets the value associated with the specified property
+/// name.
+/// </summary><remarks>
+/// Loads the rest of properties if requested one was not loaded.
+/// </remarks>
+//-------------------------------------------------------------------
+ValueBox PersistentObject::
+ObjectProperties::default::get( String ^key )
+{
+	// load properties if needed
+	load( key );
+
+	return PersistentProperties::default::get( key );
+}
+
+void PersistentObject::
+ObjectProperties::default::set( String ^key, ValueBox value )
+{
+	// load properties if needed
+	load( key );
+
+	PersistentProperties::default::set( key, value );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets the number of properties.
+/// </summary><remarks>
+/// Loads the rest of properties if collection is filled partially.
+/// </remarks>
+//-------------------------------------------------------------------
+int PersistentObject::
+ObjectProperties::Count::get( void )
+{
+	// load all properties
+	load( nullptr );
+
+	return PersistentProperties::Count::get();
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets a collection containing the property names.
+/// </summary><remarks>
+/// Loads the rest of properties if collection is filled partially.
+/// </remarks>
+//-------------------------------------------------------------------
+ICollection<String^>^ PersistentObject::
+ObjectProperties::Keys::get( void )
+{
+	// load all properties
+	load( nullptr );
+
+	return PersistentProperties::Keys::get();
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets a collection containing the property values.
+/// </summary><remarks>
+/// Loads the rest of properties if collection is filled partially.
+/// </remarks>
+//-------------------------------------------------------------------
+ICollection<ValueBox>^ PersistentObject::
+ObjectProperties::Values::get( void )
+{
+	// load all properties
+	load( nullptr );
+
+	return PersistentProperties::Values::get();
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Adds the specified property.
+/// </summary><remarks>
+/// Loads the rest of properties if specified one was not loaded, so
+/// existing property can't be added twice.
+/// </remarks>
+//-------------------------------------------------------------------
+void PersistentObject::
+ObjectProperties::Add( String ^key, ValueBox value )
+{
+	// load properties if needed
+	load( key );
+
+	PersistentProperties::Add( key, value );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Removes all properties.
+/// </summary><remarks>
+/// Loads the rest of properties if collection is filled partially,
+/// so all of them will be deleted.
+/// </remarks>
+//-------------------------------------------------------------------
+void PersistentObject::
+ObjectProperties::Clear( void )
+{
+	// load all properties
+	load( nullptr );
+
+	PersistentProperties::Clear();
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Determines whether the collection contains the specified property.
+/// </summary><remarks>
+/// Loads the rest of properties if requested one was not loaded.
+/// </remarks>
+//-------------------------------------------------------------------
+bool PersistentObject::
+ObjectProperties::ContainsKey( String ^key )
+{
+	// load properties if needed
+	load( key );
+
+	return PersistentProperties::ContainsKey( key );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Determines whether the collection contains a specific value.
+/// </summary><remarks>
+/// Loads the rest of properties if collection is filled partially.
+/// </remarks>
+//-------------------------------------------------------------------
+bool PersistentObject::
+ObjectProperties::ContainsValue( ValueBox value )
+{
+	// load all properties
+	load( nullptr );
+
+	return PersistentProperties::ContainsValue( value );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Removes the property with the specified name.
+/// </summary><remarks>
+/// Loads the rest of properties if specified one was not loaded.
+/// </remarks>
+//-------------------------------------------------------------------
+bool PersistentObject::
+ObjectProperties::Remove( String ^key )
+{
+	// load properties if needed
+	load( key );
+
+	return PersistentProperties::Remove( key );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets the value associated with the specified property name.
+/// </summary><remarks>
+/// Loads the rest of properties if requested one was not loaded.
+/// </remarks>
+//-------------------------------------------------------------------
+bool PersistentObject::
+ObjectProperties::TryGetValue( String ^key, ValueBox %value )
+{
+	// load properties if needed
+	load( key );
+
+	return PersistentProperties::TryGetValue( key, value );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets the value of loaded property with the specified name.
+/// </summary><remarks>
+/// Unlike TryGetValue, properties are never loaded: property that
+/// was not loaded by partial retrieve is reported as missing.
+/// </remarks>
+//-------------------------------------------------------------------
+bool PersistentObject::
+ObjectProperties::Peek( String ^key, ValueBox %value )
+{
+	return PersistentProperties::TryGetValue( key, value );
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Accept all changes of content in this ObjectProperties instance.
@@ -548,10 +918,17 @@ ObjectProperties::IsChanged::get( void )
 void PersistentObject::
 ObjectProperties::Accept( void )
 {
+	// store data before changes
+	save_point();
+
+	// get properties before log is cleared
+	List<KeyValuePair<String^, ValueBox>>	^props = pairs();
+
 	// clear log
 	m_log->Clear();
+	m_origin->Clear();
 
-	for each( KeyValuePair<String^, ValueBox> pair in this ) {
+	for each( KeyValuePair<String^, ValueBox> pair in props ) {
 		// fill log by None states
 		m_log[pair.Key] = STATE::None;
 	}
@@ -585,6 +962,42 @@ ObjectProperties::Get( STATE states )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Returns all changes of the content to be saved.
+/// </summary><remarks>
+/// Change set is composed by one pass through the log. Values of
+/// deleted properties are DBNull::Value.
+/// </remarks>
+//-------------------------------------------------------------------
+array<PROPERTY>^ PersistentObject::
+ObjectProperties::GetChanges( void )
+{
+	List<PROPERTY>	props;
+
+	// look through all pairs in log
+	for each( KeyValuePair<String^, STATE> pair in m_log ) {
+		ValueBox	value;
+		// and add property depend on it's state
+		switch( pair.Value ) {
+			case STATE::New:
+				Find( pair.Key, value );
+				props.Add( PROPERTY(pair.Key, value, PROPERTY::STATE::New) );
+			break;
+			case STATE::Deleted:
+				props.Add(
+					PROPERTY(pair.Key, DBNull::Value, PROPERTY::STATE::Deleted) );
+			break;
+			case STATE::Changed:
+				Find( pair.Key, value );
+				props.Add( PROPERTY(pair.Key, value, PROPERTY::STATE::Changed) );
+			break;
+		}
+	}
+	return props.ToArray();
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Fill current ObjectProperties instance by specified collection
@@ -596,12 +1009,80 @@ ObjectProperties::Get( STATE states )
 //-------------------------------------------------------------------
 void PersistentObject::
 ObjectProperties::Reload( IEnumerable<KeyValuePair<String^, ValueBox>> ^e )
+{
+	Reload( e, false );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Fill current ObjectProperties instance by specified collection
+/// of properties that can be partial.
+/// </summary><remarks>
+/// This function is used in 'Retrieve' request with projection to
+/// update object properties. If collection is partial, the rest of
+/// properties will be loaded on demand.
+/// </remarks>
+//-------------------------------------------------------------------
+void PersistentObject::
+ObjectProperties::Reload( IEnumerable<KeyValuePair<String^, ValueBox>> ^e, \
+						  bool partial )
 {
 	// check for null reference
 	if( e == nullptr ) throw gcnew ArgumentNullException( "e" );
 
+	// store data before changes
+	save_point();
 	// remove all properties
 	clear();
-	// and fill instance by given enumeration
+	// fill instance by given enumeration
 	fill_by( e );
+	// and store filling mode
+	m_partial = partial;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Adds properties that were not loaded by partial retrieve.
+/// </summary><remarks>
+/// Properties that are already known (loaded, changed or deleted)
+/// are not replaced. Names are the requested ones: requested names
+/// that are absent in specified collection are not requested again.
+/// Null reference means all properties, so after this call collection
+/// is not partial.
+/// </remarks>
+//-------------------------------------------------------------------
+void PersistentObject::
+ObjectProperties::Complete( IEnumerable<KeyValuePair<String^, ValueBox>> ^e, \
+							array<String^> ^names )
+{
+	// check for null reference
+	if( e == nullptr ) throw gcnew ArgumentNullException( "e" );
+
+	// store data before changes
+	save_point();
+
+	// pass through all pairs in collection
+	for each( KeyValuePair<String^, ValueBox> pair in e ) {
+		// ignore null references and known properties
+		if( (pair.Key == nullptr) || m_log->ContainsKey( pair.Key ) ) continue;
+
+		// add value to this
+		Insert( pair.Key, pair.Value, true );
+		// subscribe to events (if needed)
+		subscribe_to( pair.Value, true );
+		// and initialize property state to None
+		m_log[pair.Key] = STATE::None;
+	}
+	if( names == nullptr ) {
+		// all properties are loaded now
+		m_partial = false;
+		m_absent.Clear();
+	} else {
+		// remember requested properties that are absent
+		for each( String ^name in names ) {
+			if( !m_log->ContainsKey( name ) ) m_absent.Add( name );
+		}
+	}
 }
@@ -17,10 +17,12 @@
 #include "ITransaction.h"
 #include "PersistentObject.h"
 #include "PersistentProperties.h"
+#include ".\Storage\IPersistenceStorage.h"
 
 using namespace System;
 using namespace System::Collections::Generic;
 using namespace Toolkit::Collections;
+using namespace _RPL::Storage;
 
 
 _RPL_BEGIN
@@ -28,10 +30,15 @@ ref class PersistentStream;
 
 /// <summary>
 /// Store object properties.
-/// </summary><remarks>
+/// </summary><remarks><para>
 /// This class derived from PersistentProperties and was developed
-/// to link properties with it's owner object.
-/// </remarks>
+/// to link properties with it's owner object.</para><para>
+/// Collection can be filled partially (by some of the properties).
+/// In this case property that was not loaded is requested at first
+/// access to it through keyed members, and the rest of properties is
+/// loaded at first access to Count, Keys, Values, ContainsValue, Clear
+/// or enumeration of the collection.
+/// </para></remarks>
 ref class PersistentObject::
 ObjectProperties : PersistentProperties, ITransaction
 {
@@ -42,6 +49,10 @@ public:
 private:
 	PersistentObject^		const _owner;
 	Map<String^, STATE>		^m_log;
+	Map<String^, ValueBox>	^m_origin;
+	List<PersistentStream^>	m_streams;
+	bool					m_partial;
+	List<String^>			m_absent;
 
 	property STATE log_record[String^] {
 		STATE get( String ^key );
@@ -51,16 +62,24 @@ private:
 	void on_ps_change( PersistentStream ^sender );
 	void fill_by( IEnumerable<KeyValuePair<String^, ValueBox>> ^e );
 	void clear( void );
+	void load( String ^key );
+	List<KeyValuePair<String^, ValueBox>>^ pairs( void );
 
 // ITransaction
 private:
 	value class RESTORE_POINT {
 	public:
-		PersistentProperties	^_props;
-		Map<String^, STATE>		^_log;
+		PersistentProperties		^_props;
+		Map<String^, STATE>			^_log;
+		Map<String^, ValueBox>		^_origin;
+		array<PersistentStream^>	^_streams;
+		bool						_partial;
+		array<String^>				^_absent;
 	};
 	Stack<RESTORE_POINT>	backup;
 
+	void save_point( void );
+
 	virtual void trans_begin( void ) sealed = ITransaction::Begin;
 	virtual void trans_commit( void ) sealed = ITransaction::Commit;
 	virtual void trans_rollback( void ) sealed = ITransaction::Rollback;
@@ -73,6 +92,7 @@ protected:
 	virtual void OnInsertComplete( String ^key, ValueBox value ) override;
 	virtual void OnRemoveComplete( String ^key, ValueBox value ) override;
 	virtual void OnSetComplete( String ^key, ValueBox value ) override;
+	virtual void OnEnumerate( void ) override;
 
 public:
 	ObjectProperties( PersistentObject ^owner );
@@ -83,9 +103,38 @@ public:
 	property bool IsChanged {
 		bool get( void );
 	}
+	property bool IsPartial {
+		bool get( void );
+	}
+
+	property ValueBox default[String^] {
+		virtual ValueBox get( String ^key ) override;
+		virtual void set( String ^key, ValueBox value ) override;
+	}
+	property int Count {
+		virtual int get( void ) override;
+	}
+	property ICollection<String^>^ Keys {
+		virtual ICollection<String^>^ get( void ) override;
+	}
+	property ICollection<ValueBox>^ Values {
+		virtual ICollection<ValueBox>^ get( void ) override;
+	}
+
+	virtual void Add( String ^key, ValueBox value ) override;
+	virtual void Clear( void ) override;
+	virtual bool ContainsKey( String ^key ) override;
+	virtual bool ContainsValue( ValueBox value ) override;
+	virtual bool Remove( String ^key ) override;
+	virtual bool TryGetValue( String ^key, ValueBox %value ) override;
 
+	bool Peek( String ^key, ValueBox %value );
 	void Accept( void );
 	PersistentProperties^ Get( STATE states );
+	array<PROPERTY>^ GetChanges( void );
 	void Reload( IEnumerable<KeyValuePair<String^, ValueBox>> ^e );
+	void Reload( IEnumerable<KeyValuePair<String^, ValueBox>> ^e, bool partial );
+	void Complete( IEnumerable<KeyValuePair<String^, ValueBox>> ^e,
+				   array<String^> ^names );
 };
 _RPL_END
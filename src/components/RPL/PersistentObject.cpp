@@ -13,14 +13,23 @@
 /****************************************************************************/
 
 #include ".\Factories\PersistenceBroker.h"
+#include "AsyncQueue.h"
 #include "PersistentObject.ObjectLinks.h"
 #include "PersistentObject.ObjectProperties.h"
 #include "PersistentObject.h"
+#include "PersistentStream.h"
 
 using namespace _RPL;
 using namespace _RPL::Factories;
 
 
+//
+// Define size of the range that is used to upload large streams (streams
+// that don't exceed it are sent with other properties).
+//
+#define UPLOAD_CHUNK	(1024*1024)
+
+
 //-----------------------------------------------------------------------------
 //						Toolkit::RPL::PersistentObject
 //-----------------------------------------------------------------------------
@@ -113,6 +122,148 @@ void PersistentObject::on_change( String ^prop,							 \
 }
 
 
+//-------------------------------------------------------------------
+//
+// Reload object from persistance mechanism making it up-to-date.
+//
+// If property names are specified, only these properties are loaded
+// and the rest of them will be loaded on first access (this is not
+// applied to full object that has all properties already).
+//
+//-------------------------------------------------------------------
+void PersistentObject::retrieve( bool upgrade, array<String^> ^names )
+{
+	// check object state
+	check_state( true, true, false );
+
+	Object	^sync = PersistenceBroker::SyncRoot;
+
+	// lock storage for one executable thread
+	Monitor::Enter( sync );
+	try {
+		// fire OnRetrieve event
+		OnRetrieve();
+
+		// full object is never downgraded to partial one
+		if( (m_state == STATE::Full) && !_props->IsPartial ) names = nullptr;
+
+		// have to ignore stamp check in some cases
+		bool ignore = (_links->IsChanged || _props->IsChanged || 
+					   (upgrade && (m_state == STATE::Proxy)) ||
+					   (upgrade && (names == nullptr) && _props->IsPartial));
+		// if no timestamp check is needed pass initial DateTime
+		HEADER			header(Type, m_id, (ignore ? DateTime() : m_stamp), m_name);
+		array<LINK>		^links = nullptr;
+		array<PROPERTY>	^props = nullptr;
+
+		// depend on current state select retreive request
+		if( (upgrade || (m_state == STATE::Full)) && (names != nullptr) ) {
+			// partial retreive request
+			PersistenceBroker::Storage->Retrieve( header, names, links, props );
+		} else if( upgrade || (m_state == STATE::Full) ) {
+			// full retreive request
+			PersistenceBroker::Storage->Retrieve( header, links, props );
+		} else {
+			// retreive header only
+			PersistenceBroker::Storage->Retrieve( header );
+		}
+
+		// update object
+		m_stamp = header.Stamp;
+		m_name = header.Name;
+		m_originName = header.Name;
+		m_changed = false;
+		m_state = (upgrade ? STATE::Full : m_state);
+		// update links if needed
+		if( links != nullptr ) {
+			// create list of new links
+			PersistentObjects		^newlinks = gcnew PersistentObjects;
+			// look through each link in received array
+			for each( LINK link in links ) {
+				// request object frome cache and add it to list
+				newlinks->Add( PersistenceBroker::Cache[link.Header] );
+			}
+			_links->Reload( newlinks );
+		}
+		// update properties if needed
+		if( props != nullptr ) {
+			// create list of new properties
+			PersistentProperties	^newprops = gcnew PersistentProperties;
+			// look through each property in received array
+			for each( PROPERTY prop in props ) {
+				// add it to the list
+				newprops->Add( prop.Name, prop.Value );
+			}
+			_props->Reload( newprops, (names != nullptr) );
+		}
+
+		// notify about complete
+		OnRetrieveComplete();
+	} finally {
+		// unlock storage in any case
+		Monitor::Exit( sync );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Loads properties that were not loaded by partial retrieve.
+//
+// Properties with specified names are requested (null reference
+// means all properties) and are added to already loaded ones, so
+// changed properties are not lost. Request is performed without
+// stamp check, so if stored object is newer than loaded one, then
+// unchanged object is reloaded at all (changed one can't be mixed
+// with newer properties, so exception is raised).
+//
+//-------------------------------------------------------------------
+void PersistentObject::load_properties( array<String^> ^names )
+{
+	// check object state
+	check_state( true, true, false );
+
+	Object	^sync = PersistenceBroker::SyncRoot;
+
+	// lock storage for one executable thread
+	Monitor::Enter( sync );
+	try {
+		HEADER			header(Type, m_id, DateTime(), m_name);
+		array<LINK>		^links = nullptr;
+		array<PROPERTY>	^props = nullptr;
+
+		// partial retreive request
+		PersistenceBroker::Storage->Retrieve( header, names, links, props );
+
+		// check for properties belong to loaded object version
+		if( header.Stamp != m_stamp ) {
+			// changed object can't be reloaded
+			if( _props->IsChanged || _links->IsChanged ||
+				!String::Equals( m_name, m_originName ) ) {
+				throw gcnew DBConcurrencyException(
+					String::Format( ERR_OBJECT_CHANGED, m_id ) );
+			}
+			// so reload all object data
+			retrieve( true, nullptr );
+			return;
+		}
+
+		// create list of all properties
+		PersistentProperties	^newprops = gcnew PersistentProperties;
+		// look through each property in received array
+		for each( PROPERTY prop in props ) {
+			// add it to the list
+			newprops->Add( prop.Name, prop.Value );
+		}
+		// and add properties that were not loaded
+		_props->Complete( newprops, names );
+	} finally {
+		// unlock storage in any case
+		Monitor::Exit( sync );
+	}
+}
+
+
 //-------------------------------------------------------------------
 //
 // ITransaction::Begin implementation.
@@ -132,6 +283,7 @@ void PersistentObject::trans_begin( void )
 	point._id = m_id;
 	point._stamp = m_stamp;
 	point._name = m_name;
+	point._originName = m_originName;
 	point._state = m_state;
 	point._changed = m_changed;
 
@@ -193,6 +345,7 @@ void PersistentObject::trans_rollback( void )
 	m_id = point._id;
 	m_stamp = point._stamp;
 	m_name = point._name;
+	m_originName = point._originName;
 	m_state = point._state;
 	m_changed = point._changed;
 
@@ -214,14 +367,16 @@ void PersistentObject::trans_rollback( void )
 //-------------------------------------------------------------------
 DataSet^ PersistentObject::ProcessSQL( String ^sql, ... array<Object^> ^params )
 {
+	Object	^sync = PersistenceBroker::SyncRoot;
+
 	// lock storage for one executable thread
-	Monitor::Enter( PersistenceBroker::Storage );
+	Monitor::Enter( sync );
 	try{
 		// retrieve DataSet from storage
 		return PersistenceBroker::Storage->ProcessSQL( sql, params );
 	} finally {
 		// unlock storage in any case
-		Monitor::Exit( PersistenceBroker::Storage );
+		Monitor::Exit( sync );
 	}
 }
 
@@ -235,6 +390,7 @@ DataSet^ PersistentObject::ProcessSQL( String ^sql, ... array<Object^> ^params )
 //-------------------------------------------------------------------
 PersistentObject::PersistentObject( void ):	\
 	m_id(0), m_stamp(), m_name(""),			\
+	m_originName(""),						\
 	m_state(STATE::Full), m_changed(false)
 {
 	dbgprint( "-> " + this->GetType()->ToString() );
@@ -242,6 +398,8 @@ PersistentObject::PersistentObject( void ):	\
 	// create empty collections
 	_links = gcnew ObjectLinks(this);
 	_props = gcnew ObjectProperties(this);
+	// and queue of asynchronous operations
+	_async = gcnew AsyncQueue();
 
 	dbgprint( "<- " + this->GetType()->ToString() );
 }
@@ -258,6 +416,7 @@ PersistentObject::PersistentObject( void ):	\
 //-------------------------------------------------------------------
 PersistentObject::PersistentObject( int id, DateTime stamp, String ^name ): \
 	m_id(id), m_stamp(stamp), m_name(name),									\
+	m_originName(name),														\
 	m_state(STATE::Proxy), m_changed(false)
 {
 	dbgprint( String::Format( 
@@ -269,6 +428,8 @@ PersistentObject::PersistentObject( int id, DateTime stamp, String ^name ): \
 	// create empty collections
 	_links = gcnew ObjectLinks(this);
 	_props = gcnew ObjectProperties(this);
+	// and queue of asynchronous operations
+	_async = gcnew AsyncQueue();
 
 	dbgprint( "<- " + this->GetType()->ToString() );
 }
@@ -325,6 +486,23 @@ PersistentProperties^ PersistentObject::Properties::get( void )
 }
 
 
+//-------------------------------------------------------------------
+//
+// Gets value of the property with specified name. Returns false if
+// object has no such property (proxy has no properties at all).
+// Properties are not loaded from storage, so property that was not
+// loaded by partial retrieve is missing too.
+//
+// Used by in-memory search, so it is accessible inside assembly
+// only.
+//
+//-------------------------------------------------------------------
+bool PersistentObject::GetProperty( String ^name, [Out] ValueBox %value )
+{
+	return _props->Peek( name, value );
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Performs additional custom processes when transaction starts.
@@ -596,65 +774,76 @@ void PersistentObject::Name::set( String ^value )
 //-------------------------------------------------------------------
 void PersistentObject::Retrieve( bool upgrade )
 {
-	// check object state
-	check_state( true, true, false );
+	retrieve( upgrade, nullptr );
+}
 
-	// lock storage for one executable thread
-	Monitor::Enter( PersistenceBroker::Storage );
-	try {
-		// fire OnRetrieve event
-		OnRetrieve();
 
-		// have to ignore stamp check in some cases
-		bool ignore = (_links->IsChanged || _props->IsChanged || 
-					   (upgrade && (m_state == STATE::Proxy)));
-		// if no timestamp check is needed pass initial DateTime
-		HEADER			header(Type, m_id, (ignore ? DateTime() : m_stamp), m_name);
-		array<LINK>		^links = nullptr;
-		array<PROPERTY>	^props = nullptr;
+//-------------------------------------------------------------------
+/// <summary>
+/// Reload object from persistance mechanism making it up-to-date
+/// with specified properties only.
+/// </summary>
+/// <param name="names">
+/// Names of properties to be loaded (null reference means all
+/// properties).
+/// </param><remarks><para>
+/// Proxy object becomes full one, but only specified properties are
+/// retrieved. All other properties will be loaded at first access to
+/// them through Properties. This is useful when some properties hold
+/// large values (such as streams) that are not needed.</para><para>
+/// Full object that has all properties already (and null reference
+/// names) is processed by Retrieve(true) call. In other cases partial
+/// retrieve doesn't call Retrieve(bool), so derived class that
+/// overrides it must override this routine too (OnRetrieve and
+/// OnRetrieveComplete events are raised in both cases).
+/// </para></remarks>
+//-------------------------------------------------------------------
+void PersistentObject::Retrieve( array<String^> ^names )
+{
+	// all properties are requested or are loaded already
+	if( (names == nullptr) ||
+		((m_state == STATE::Full) && !_props->IsPartial) ) {
+		// so pass request through virtual routine
+		Retrieve( true );
+	} else {
+		// partial retrieve request
+		retrieve( true, names );
+	}
+}
 
-		// depend on current state select retreive request
-		if( upgrade || (m_state == STATE::Full) ) {
-			// full retreive request
-			PersistenceBroker::Storage->Retrieve( header, links, props );
-		} else {
-			// retreive header only
-			PersistenceBroker::Storage->Retrieve( header );
-		}
 
-		// update object
-		m_stamp = header.Stamp;
-		m_name = header.Name;
-		m_changed = false;
-		m_state = (upgrade ? STATE::Full : m_state);
-		// update links if needed
-		if( links != nullptr ) {
-			// create list of new links
-			PersistentObjects		^newlinks = gcnew PersistentObjects;
-			// look through each link in received array
-			for each( LINK link in links ) {
-				// request object frome cache and add it to list
-				newlinks->Add( PersistenceBroker::Cache[link.Header] );
-			}
-			_links->Reload( newlinks );
+//-------------------------------------------------------------------
+//
+// Uploads content of the stream to the storage by bounded ranges.
+//
+// Content is identified by its hash, so upload starts from the length
+// that is stored already: interrupted upload is resumed and content
+// that is stored already (by this or other object) is not sent at
+// all. Uploaded content is not visible until CommitBlob call.
+//
+//-------------------------------------------------------------------
+void PersistentObject::upload( PersistentStream ^stream )
+{
+	array<unsigned char>	^hash = stream->Hash;
+	__int64					length = stream->Length;
+
+	// request stored length by empty range (it is not written)
+	__int64	offset = PersistenceBroker::Storage->WriteBlob(
+						hash, length, gcnew array<unsigned char>(0) );
+
+	array<unsigned char>	^buf = nullptr;
+	// write content range by range
+	while( offset < length ) {
+		int	size = (int) Math::Min( length - offset, (__int64) UPLOAD_CHUNK );
+		// last range can be shorter than others
+		if( (buf == nullptr) || (buf->Length != size) ) {
+			buf = gcnew array<unsigned char>(size);
 		}
-		// update properties if needed
-		if( props != nullptr ) {
-			// create list of new properties
-			PersistentProperties	^newprops = gcnew PersistentProperties;
-			// look through each property in received array
-			for each( PROPERTY prop in props ) {
-				// add it to the list
-				newprops->Add( prop.Name, prop.Value );
-			}
-			_props->Reload( newprops );
+		// check for unexpected end of stream
+		if( stream->ReadAt( offset, buf, 0, size ) != size ) {
+			throw gcnew EndOfStreamException();
 		}
-
-		// notify about complete
-		OnRetrieveComplete();
-	} finally {
-		// unlock storage in any case
-		Monitor::Exit( PersistenceBroker::Storage );
+		offset = PersistenceBroker::Storage->WriteBlob( hash, offset, buf );
 	}
 }
 
@@ -667,7 +856,10 @@ void PersistentObject::Retrieve( bool upgrade )
 /// operation timestamp will be modified and for the new objects auto
 /// generated ID will be assign. Two events will be raised: OnSave
 /// before and OnSaveComplete after operation. Default implementation
-/// check for the next object states: "deleted".
+/// check for the next object states: "deleted". Stored object that
+/// has no changes is not sent to storage. Large streams are uploaded
+/// by bounded ranges before saving and are committed with other
+/// changes in one storage transaction.
 /// </remarks>
 //-------------------------------------------------------------------
 void PersistentObject::Save( void )
@@ -675,15 +867,29 @@ void PersistentObject::Save( void )
 	// check for object state
 	check_state( false, true, false );
 
+	Object	^sync = PersistenceBroker::SyncRoot;
+
 	// lock storage for one executable thread
-	Monitor::Enter( PersistenceBroker::Storage );
+	Monitor::Enter( sync );
 	try {
 		// fire OnSave event
 		OnSave();
 
+		// stored object without changes: there is nothing to save
+		// (values that were set back to loaded ones are not changes)
+		if( (m_id != 0) && !_props->IsChanged && !_links->IsChanged &&
+			String::Equals( m_name, m_originName ) ) {
+			// object is equal to stored one
+			m_changed = false;
+			// notify about complete
+			OnSaveComplete();
+			return;
+		}
+
 		HEADER	header(Type, m_id, m_stamp, m_name);
 		List<LINK>		^links = gcnew List<LINK>;
 		List<PROPERTY>	^props = gcnew List<PROPERTY>;
+		List<PROPERTY>	^blobs = gcnew List<PROPERTY>;
 		array<LINK>		^mlinks = nullptr;
 		array<PROPERTY>	^mprops = nullptr;
 
@@ -700,27 +906,48 @@ void PersistentObject::Save( void )
 				LINK(HEADER(obj->Type, obj->m_id, obj->m_stamp, obj->m_name),
 				LINK::STATE::Deleted ) );
 		}
-		// compose list of changed properties
-		for each( KeyValuePair<String^, ValueBox> prop in
-				  _props->Get(ObjectProperties::STATE::New) ) {
-			props->Add(
-				PROPERTY(prop.Key, prop.Value, PROPERTY::STATE::New) );
-		}
-		for each( KeyValuePair<String^, ValueBox> prop in
-				  _props->Get(ObjectProperties::STATE::Deleted) ) {
-			props->Add(
-				PROPERTY(prop.Key, prop.Value, PROPERTY::STATE::Deleted) );
+		// compose list of changed properties (large streams are
+		// not sent with them)
+		for each( PROPERTY prop in _props->GetChanges() ) {
+			PersistentStream	^ps = prop.Value.AsStream();
+
+			if( (prop.State != PROPERTY::STATE::Deleted) &&
+				(ps != nullptr) && (ps->Length > UPLOAD_CHUNK) ) {
+				// upload stream content before saving
+				upload( ps );
+				blobs->Add( prop );
+			} else {
+				props->Add( prop );
+			}
 		}
-		for each( KeyValuePair<String^, ValueBox> prop in
-				  _props->Get(ObjectProperties::STATE::Changed) ) {
-			props->Add(
-				PROPERTY(prop.Key, prop.Value, PROPERTY::STATE::Changed) );
+
+		if( blobs->Count == 0 ) {
+			// request storage to save changes
+			PersistenceBroker::Storage->Save( header,
+											  links->ToArray(), props->ToArray(),
+											  mlinks, mprops );
+		} else {
+			// save changes and link uploaded content at once
+			PersistenceBroker::Storage->TransactionBegin();
+			try {
+				// request storage to save changes
+				PersistenceBroker::Storage->Save( header,
+												  links->ToArray(), props->ToArray(),
+												  mlinks, mprops );
+				// and link uploaded streams (header gets new stamp)
+				for each( PROPERTY prop in blobs ) {
+					PersistenceBroker::Storage->CommitBlob(
+						header, prop.Name, prop.Value.AsStream()->Hash );
+				}
+			} catch( Exception^ ) {
+				// rollback storage changes
+				PersistenceBroker::Storage->TransactionRollback();
+				// and restore exception
+				throw;
+			}
+			PersistenceBroker::Storage->TransactionCommit();
 		}
 
-		// request storage to save changes
-		PersistenceBroker::Storage->Save( header,
-										  links->ToArray(), props->ToArray(),
-										  mlinks, mprops );
 		// if this is new object - add to cache
 		if( m_id == 0 ) PersistenceBroker::Cache[header] = this;
 
@@ -728,6 +955,7 @@ void PersistentObject::Save( void )
 		m_id = header.ID;
 		m_stamp = header.Stamp;
 		m_name = header.Name;
+		m_originName = header.Name;
 		m_changed = false;
 		// update links if needed
 		if( (mlinks != nullptr) && (mlinks->Length > 0) ) {
@@ -774,7 +1002,7 @@ void PersistentObject::Save( void )
 					break;
 				}
 			}
-			_props->Reload( newprops );
+			_props->Reload( newprops, _props->IsPartial );
 		} else {
 			// just accept property changes
 			_props->Accept();
@@ -784,7 +1012,7 @@ void PersistentObject::Save( void )
 		OnSaveComplete();
 	} finally {
 		// unlock storage in any case
-		Monitor::Exit( PersistenceBroker::Storage );
+		Monitor::Exit( sync );
 	}
 }
 
@@ -804,8 +1032,10 @@ void PersistentObject::Delete( void )
 	// check for object state
 	check_state( true, true, false );
 
+	Object	^sync = PersistenceBroker::SyncRoot;
+
 	// lock storage for one executable thread
-	Monitor::Enter( PersistenceBroker::Storage );
+	Monitor::Enter( sync );
 	try {
 		// fair OnDelete event
 		OnDelete();
@@ -830,11 +1060,114 @@ void PersistentObject::Delete( void )
 		OnDeleteComplete();
 	} finally {
 		// unlock storage in any case
-		Monitor::Exit( PersistenceBroker::Storage ); 
+		Monitor::Exit( sync );
 	}
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Begins an asynchronous Retrieve operation.
+/// </summary><remarks>
+/// Asynchronous operations on the same object are performed in the
+/// order they were started, operations on different objects can be
+/// processed at once (see PersistenceBroker::IsConcurrent). Use
+/// EndRetrieve to get the result of operation.
+/// </remarks>
+//-------------------------------------------------------------------
+IAsyncResult^ PersistentObject::BeginRetrieve( bool upgrade,				   \
+											   AsyncCallback ^callback,		   \
+											   Object ^state )
+{
+	Action<bool>	^op = gcnew Action<bool>(
+		this, &PersistentObject::Retrieve);
+
+	return _async->Begin( op, gcnew array<Object^>{upgrade}, callback, state );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Waits for the pending asynchronous Retrieve operation to complete.
+/// </summary><remarks>
+/// Exception raised during operation is thrown by this call as inner
+/// exception of TargetInvocationException.
+/// </remarks>
+//-------------------------------------------------------------------
+void PersistentObject::EndRetrieve( IAsyncResult ^result )
+{
+	AsyncQueue::End( result );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Begins an asynchronous Save operation.
+/// </summary><remarks>
+/// Asynchronous operations on the same object are performed in the
+/// order they were started, operations on different objects can be
+/// processed at once (see PersistenceBroker::IsConcurrent). Use
+/// EndSave to get the result of operation.
+/// </remarks>
+//-------------------------------------------------------------------
+IAsyncResult^ PersistentObject::BeginSave( AsyncCallback ^callback, \
+										   Object ^state )
+{
+	AsyncQueue::OPERATION	^op = gcnew AsyncQueue::OPERATION(
+		this, &PersistentObject::Save);
+
+	return _async->Begin( op, nullptr, callback, state );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Waits for the pending asynchronous Save operation to complete.
+/// </summary><remarks>
+/// Exception raised during operation is thrown by this call as inner
+/// exception of TargetInvocationException.
+/// </remarks>
+//-------------------------------------------------------------------
+void PersistentObject::EndSave( IAsyncResult ^result )
+{
+	AsyncQueue::End( result );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Begins an asynchronous Delete operation.
+/// </summary><remarks>
+/// Asynchronous operations on the same object are performed in the
+/// order they were started, operations on different objects can be
+/// processed at once (see PersistenceBroker::IsConcurrent). Use
+/// EndDelete to get the result of operation.
+/// </remarks>
+//-------------------------------------------------------------------
+IAsyncResult^ PersistentObject::BeginDelete( AsyncCallback ^callback, \
+											 Object ^state )
+{
+	AsyncQueue::OPERATION	^op = gcnew AsyncQueue::OPERATION(
+		this, &PersistentObject::Delete);
+
+	return _async->Begin( op, nullptr, callback, state );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Waits for the pending asynchronous Delete operation to complete.
+/// </summary><remarks>
+/// Exception raised during operation is thrown by this call as inner
+/// exception of TargetInvocationException.
+/// </remarks>
+//-------------------------------------------------------------------
+void PersistentObject::EndDelete( IAsyncResult ^result )
+{
+	AsyncQueue::End( result );
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Returns hash code for the current PersistentObject.
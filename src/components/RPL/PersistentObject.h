@@ -22,9 +22,11 @@
 using namespace System;
 using namespace System::Data;
 using namespace System::Collections::Generic;
+using namespace System::Runtime::InteropServices;
 
 
 _RPL_BEGIN
+ref class AsyncQueue;
 ref class PersistentObjects;
 ref class PersistentProperties;
 
@@ -53,10 +55,12 @@ private:
 private:
 	initonly ObjectLinks		^_links;
 	initonly ObjectProperties	^_props;
+	initonly AsyncQueue			^_async;
 
 	int					m_id;
 	DateTime			m_stamp;
 	String				^m_name;
+	String				^m_originName;
 	STATE				m_state;
 	bool				m_changed;
 
@@ -66,6 +70,10 @@ private:
 	void on_change( PersistentObject ^obj );
 	void on_change( String ^prop, ValueBox oldValue, ValueBox newValue );
 
+	void retrieve( bool upgrade, array<String^> ^names );
+	void load_properties( array<String^> ^names );
+	static void upload( PersistentStream ^stream );
+
 // ITransaction
 private:
 	value class RESTORE_POINT {
@@ -73,6 +81,7 @@ private:
 		int					_id;
 		DateTime			_stamp;
 		String				^_name;
+		String				^_originName;
 		STATE				_state;
 		bool				_changed;
 	};
@@ -132,10 +141,22 @@ public:
 	}
 
 	virtual void Retrieve( bool upgrade );
+	virtual void Retrieve( array<String^> ^names );
 	virtual void Save( void );
 	virtual void Delete( void );
 
+	IAsyncResult^ BeginRetrieve( bool upgrade,
+								 AsyncCallback ^callback, Object ^state );
+	void EndRetrieve( IAsyncResult ^result );
+	IAsyncResult^ BeginSave( AsyncCallback ^callback, Object ^state );
+	void EndSave( IAsyncResult ^result );
+	IAsyncResult^ BeginDelete( AsyncCallback ^callback, Object ^state );
+	void EndDelete( IAsyncResult ^result );
+
 	virtual int GetHashCode( void ) override;
 	virtual String^ ToString( void ) override;
+
+internal:
+	bool GetProperty( String ^name, [Out] ValueBox %value );
 };
 _RPL_END
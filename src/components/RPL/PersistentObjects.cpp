@@ -12,9 +12,13 @@
 /*																			*/
 /****************************************************************************/
 
+#include ".\Factories\PersistenceBroker.h"
+#include "PersistentObject.h"
+#include "Query.h"
 #include "PersistentObjects.h"
 
 using namespace _RPL;
+using namespace _RPL::Factories;
 
 
 //-----------------------------------------------------------------------------
@@ -361,4 +365,112 @@ void PersistentObjects::ForEach( Action<PersistentObject^> ^action )
 bool PersistentObjects::TrueForAll( Predicate<PersistentObject^> ^match )
 {
 	return m_list.TrueForAll( match );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Retrieves all the objects that satisfy specified WHERE clause in
+/// specified order.
+/// </summary><remarks><para>
+/// Search is performed in memory without storage requests: WHERE
+/// clause is compiled to predicate once and is applied to every
+/// object of the collection. Null reference of the clause means all
+/// objects (no filter or no sorting).</para><para>
+/// Proxy objects have no properties in memory, so they satisfy only
+/// conditions on ID, Name and Stamp. Properties that were not loaded
+/// by partial retrieve are treated as missing (they are not loaded).
+/// Objects with equal sorting values are ordered by ID. Strings are
+/// compared without case by invariant culture.
+/// </para></remarks>
+//-------------------------------------------------------------------
+PersistentObjects^ PersistentObjects::Filter( Where ^where, OrderBy ^order )
+{
+	List<PersistentObject^>	^list = (where != nullptr) ?
+		m_list.FindAll( where->Compile() ) :
+		gcnew List<PersistentObject^>(%m_list);
+
+	// sort found objects if needed
+	if( order != nullptr ) list->Sort( order->Compile() );
+
+	return gcnew PersistentObjects(list);
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Makes outdated objects of the collection up-to-date.
+/// </summary><remarks><para>
+/// Stamps of all stored objects are checked by one storage request,
+/// and only objects changed in the storage are retrieved (proxies
+/// stay proxies). New objects and objects removed from the storage
+/// are not affected.</para><para>
+/// This is atomar operation, so it performs under transactional
+/// control.
+/// </para></remarks><returns>
+/// Number of retrieved objects.
+/// </returns>
+//-------------------------------------------------------------------
+int PersistentObjects::Refresh( void )
+{
+	List<HEADER>	headers;
+	// build headers of all stored objects
+	for each( PersistentObject ^obj in m_list ) {
+		// skip new and deleted objects
+		if( obj->ID <= 0 ) continue;
+
+		headers.Add( HEADER(obj->Type, obj->ID, obj->Stamp, obj->Name) );
+	}
+	// nothing to check
+	if( headers.Count == 0 ) return 0;
+
+	array<HEADER>	^stale = nullptr;
+	Object			^sync = PersistenceBroker::SyncRoot;
+
+	// lock storage for one executable thread
+	Monitor::Enter( sync );
+	try {
+		// check all stamps by one request
+		stale = PersistenceBroker::Storage->Validate( headers.ToArray() );
+	} finally {
+		// unlock storage in any case
+		Monitor::Exit( sync );
+	}
+
+	// build map of outdated objects that still exist in storage
+	Dictionary<int, HEADER>		map;
+	for each( HEADER header in stale ) {
+		if( header.Stamp != DateTime() ) map[header.ID] = header;
+	}
+	// nothing to retrieve
+	if( map.Count == 0 ) return 0;
+
+	// declare stack of changes to emulate transaction
+	Stack<ITransaction^>	changes;
+	try {
+		for each( PersistentObject ^obj in m_list ) {
+			HEADER	header;
+			// check for object is outdated
+			if( !map.TryGetValue( obj->ID, header ) ||
+				(header.Type != obj->Type) ) continue;
+
+			// save all object's properties
+			safe_cast<ITransaction^>( obj )->Begin();
+			// add push to stack to future rollback
+			changes.Push( obj );
+
+			// make object up-to-date
+			obj->Retrieve( false );
+		}
+		int count = changes.Count;
+		// retrieve operations was completed
+		// successfuly, now commit object changes
+		while( changes.Count > 0 ) changes.Pop()->Commit();
+
+		return count;
+	} catch( Exception^ ) {
+		// revert all modified objects to previous state
+		while( changes.Count > 0 ) changes.Pop()->Rollback();
+		throw;
+	}
 }
\ No newline at end of file
@@ -21,6 +21,8 @@ using namespace System::Collections::Generic;
 
 _RPL_BEGIN
 ref class PersistentObject;
+ref class Where;
+ref class OrderBy;
 
 /// <summary>
 /// This class provide services for collection of objects.
@@ -77,5 +79,9 @@ public:
 	virtual PersistentObjects^ FindAll( Predicate<PersistentObject^> ^match );
 	virtual void ForEach( Action<PersistentObject^> ^action );
 	virtual bool TrueForAll( Predicate<PersistentObject^> ^match );
+
+	virtual PersistentObjects^ Filter( Where ^where, OrderBy ^order );
+
+	virtual int Refresh( void );
 };
 _RPL_END
\ No newline at end of file
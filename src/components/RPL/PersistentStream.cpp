@@ -12,9 +12,24 @@
 /*																			*/
 /****************************************************************************/
 
+#include ".\Factories\PersistenceBroker.h"
 #include "PersistentStream.h"
 
+using namespace System::Threading;
 using namespace _RPL;
+using namespace _RPL::Factories;
+
+
+//
+// Define size of the temporary file buffer.
+//
+#define FILE_BUFFER		4096
+
+
+//
+// Define maximum size of the content chunk in serialization data.
+//
+#define CHUNK_SIZE		(1024*1024)
 
 
 //
@@ -224,7 +239,178 @@ String^ PersistentStream::StreamWrapper::ToString( void )
 
 //-------------------------------------------------------------------
 //
-// Check for stream being in the correct state.
+// Opens specified temporary file. File will be deleted on close.
+//
+//-------------------------------------------------------------------
+FileStream^ PersistentStream::open_file( String ^path )
+{
+	return gcnew FileStream(path, FileMode::OpenOrCreate,
+							FileAccess::ReadWrite, FileShare::None,
+							FILE_BUFFER, FileOptions::DeleteOnClose);
+}
+
+
+//-------------------------------------------------------------------
+//
+// Creates empty internal stream to store content of specified
+// length: memory buffer if length doesn't exceed memory limit and
+// temporary file in other case.
+//
+//-------------------------------------------------------------------
+void PersistentStream::create( __int64 length )
+{
+	if( length <= MemoryLimit ) {
+		// allocate memory for whole content at once
+		m_path = nullptr;
+		m_stream = gcnew MemoryStream((int) length);
+	} else {
+		// create empty temporary file
+		m_path = Path::GetTempFileName();
+		// open this file with FileStream
+		m_stream = open_file( m_path );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Moves content of memory buffer to the temporary file if it exceeds
+// memory limit.
+//
+//-------------------------------------------------------------------
+void PersistentStream::spill( void )
+{
+	MemoryStream	^ms = dynamic_cast<MemoryStream^>( m_stream );
+
+	// check for content is in memory and exceeds the limit
+	if( (ms == nullptr) || (ms->Length <= MemoryLimit) ) return;
+
+	// create temporary file
+	String		^path = Path::GetTempFileName();
+	FileStream	^fs = open_file( path );
+	try {
+		// copy buffer content to the file
+		ms->WriteTo( fs );
+		fs->Position = ms->Position;
+	} catch( Exception^ ) {
+		// close (and delete) new file
+		fs->Close();
+		// and restore exception
+		throw;
+	}
+	// replace internal stream
+	m_path = path;
+	m_stream = fs;
+	ms->Close();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Fills specified buffer by content from current position (stream
+// can return less bytes than requested by one read).
+//
+//-------------------------------------------------------------------
+void PersistentStream::read_chunk( array<unsigned char> ^buffer )
+{
+	for( int offset = 0, size = 0;
+		 offset < buffer->Length;
+		 offset += size ) {
+		// read next part of the chunk
+		size = m_stream->Read( buffer, offset, buffer->Length - offset );
+		// check for unexpected end of stream
+		if( size == 0 ) throw gcnew EndOfStreamException();
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Calculates SHA-1 hash of the internal stream content.
+//
+//-------------------------------------------------------------------
+array<unsigned char>^ PersistentStream::compute_hash( void )
+{
+	SHA1	^sha = gcnew SHA1Managed();
+
+	if( m_path == nullptr ) {
+		// calculate hash of memory buffer
+		return sha->ComputeHash(
+			safe_cast<MemoryStream^>( m_stream )->GetBuffer(),
+			0, (int) m_stream->Length );
+	}
+	// store current position
+	__int64	pos = m_stream->Position;
+	try {
+		// calculate hash of whole file
+		m_stream->Seek( 0, SeekOrigin::Begin );
+		return sha->ComputeHash( m_stream );
+	} finally {
+		// restore internal stream position
+		m_stream->Position = pos;
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Reads stored content to the internal stream by bounded ranges.
+// Content is requested by hash that was received with reference, so
+// it is read even if property was changed in storage since then (and
+// is checked by this hash too).
+//
+//-------------------------------------------------------------------
+void PersistentStream::load( void )
+{
+	HEADER	header(m_source->_type, m_source->_id, DateTime(), nullptr);
+	__int64	length = m_source->_length;
+	Object	^sync = PersistenceBroker::SyncRoot;
+
+	// create internal stream for whole content
+	create( length );
+	// lock storage for one executable thread
+	Monitor::Enter( sync );
+	try {
+		// read content range by range
+		for( __int64 offset = 0; offset < length; ) {
+			array<unsigned char>	^buf = PersistenceBroker::Storage->ReadBlob(
+				header, m_source->_name, m_hash, offset,
+				(int) Math::Min( length - offset, (__int64) CHUNK_SIZE ) );
+			// check for unexpected end of content
+			if( buf->Length == 0 ) throw gcnew EndOfStreamException();
+
+			m_stream->Write( buf, 0, buf->Length );
+			offset += buf->Length;
+		}
+		// set position to the begin of the stream
+		m_stream->Seek( 0, SeekOrigin::Begin );
+
+		// compare content with the referred one
+		if( Convert::ToBase64String( compute_hash() ) !=
+			Convert::ToBase64String( m_hash ) ) {
+			throw gcnew InvalidDataException( String::Format(
+				ERR_STREAM_HASH, m_source->_name, m_source->_id ) );
+		}
+	} catch( Exception^ ) {
+		// close internal stream
+		m_stream->Close();
+		m_stream = nullptr;
+		m_path = nullptr;
+		// and restore exception
+		throw;
+	} finally {
+		// unlock storage in any case
+		Monitor::Exit( sync );
+	}
+	// content is read, so reference is not needed more
+	m_source = nullptr;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Check for stream being in the correct state. Stored content is
+// read at first check.
 //
 //-------------------------------------------------------------------
 void PersistentStream::check_state( void )
@@ -232,6 +418,35 @@ void PersistentStream::check_state( void )
 	// check for disposed stream
 	if( m_disposed ) throw gcnew ObjectDisposedException(
 		this->GetType()->ToString(), ERR_STREAM_CLOSED);
+	// read stored content
+	if( m_source != nullptr ) load();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Saves stream content for all transactions that have no copy yet.
+// Must be called before any content change.
+//
+//-------------------------------------------------------------------
+void PersistentStream::save_snapshot( void )
+{
+	// check for transaction exists and it has no copy
+	if( (backup.Count == 0) || backup.Peek()._snapshot->_saved ) return;
+
+	SNAPSHOT	^snapshot = backup.Peek()._snapshot;
+
+	if( m_path == nullptr ) {
+		// copy memory buffer
+		snapshot->_data = safe_cast<MemoryStream^>( m_stream )->ToArray();
+	} else {
+		// create new temporary file
+		String	^path = Path::GetTempFileName();
+		// and save stream content to it
+		ExportToFile( path );
+		snapshot->_path = path;
+	}
+	snapshot->_saved = true;
 }
 
 
@@ -239,22 +454,25 @@ void PersistentStream::check_state( void )
 //
 // ITransaction::Begin implementation.
 //
-// Stores all stream's data until trans_commit will be called to have
-// ability to restore data by trans_rollback.
+// Creates restore point, but stream content is copied at first
+// change only (copy on write). So begin, commit and rollback of
+// unchanged stream don't copy any data.
 //
 //-------------------------------------------------------------------
 void PersistentStream::trans_begin( void )
 {
-	// create new temporary file
-	String	^path = Path::GetTempFileName();
-	// and save stream content to it
-	ExportToFile( path );
-
 	// create backup record
 	RESTORE_POINT	point;
-	// fill it by current data
-	point._path = path;
-	point._position = m_fs->Position;
+
+	// content was not changed since previous transaction begin,
+	// so share it's copy, in other case create new one
+	if( (backup.Count > 0) && !backup.Peek()._snapshot->_saved ) {
+		point._snapshot = backup.Peek()._snapshot;
+	} else {
+		point._snapshot = gcnew SNAPSHOT();
+	}
+	// stored content that is not read yet has initial position
+	point._position = (m_stream != nullptr) ? m_stream->Position : 0;
 	// push record to stack
 	backup.Push( point );
 }
@@ -271,8 +489,15 @@ void PersistentStream::trans_commit( void )
 {
 	// remove top record from stack
 	RESTORE_POINT	point = backup.Pop();
+
+	// check for copy is still used by outer transaction
+	if( (backup.Count > 0) &&
+		(backup.Peek()._snapshot == point._snapshot) ) return;
+
 	// delete temporary file
-	DELETE_FILE( point._path );
+	if( point._snapshot->_path != nullptr ) {
+		DELETE_FILE( point._snapshot->_path );
+	}
 }
 
 
@@ -285,17 +510,34 @@ void PersistentStream::trans_commit( void )
 //-------------------------------------------------------------------
 void PersistentStream::trans_rollback( void )
 {
-	// close internal stream
-	m_fs->Close();
-
 	// get top record from stack
 	RESTORE_POINT	point = backup.Pop();
-	// restore previous state
-	m_path = point._path;
-	m_fs = gcnew FileStream(m_path, FileMode::OpenOrCreate,
-							FileAccess::ReadWrite, FileShare::None, 8,
-							FileOptions::DeleteOnClose);
-	m_fs->Position = point._position;
+	SNAPSHOT		^snapshot = point._snapshot;
+
+	// content was changed, so restore it
+	if( snapshot->_saved ) {
+		// close internal stream
+		m_stream->Close();
+
+		// restore previous state
+		m_path = snapshot->_path;
+		if( m_path == nullptr ) {
+			m_stream = gcnew MemoryStream(snapshot->_data->Length);
+			m_stream->Write( snapshot->_data, 0, snapshot->_data->Length );
+		} else {
+			m_stream = open_file( m_path );
+		}
+
+		m_hash = nullptr;
+
+		// now content equals to the copy, so outer transaction
+		// that shares it can take new one at next change
+		snapshot->_saved = false;
+		snapshot->_path = nullptr;
+		snapshot->_data = nullptr;
+	}
+	// stored content can be not read yet
+	if( m_stream != nullptr ) m_stream->Position = point._position;
 }
 
 
@@ -319,20 +561,54 @@ PersistentStream::PersistentStream( SerializationInfo ^info,
 										FileIOPermissionAccess::Write, tp);
 	io->Assert();
 	try {
-		// create empty temporary file
-		m_path = Path::GetTempFileName();
-		// open this file with FileStream
-		m_fs = gcnew FileStream(m_path, FileMode::OpenOrCreate,
-								FileAccess::ReadWrite, FileShare::None, 8,
-								FileOptions::DeleteOnClose);
-
-		// restore stream content
-		array<unsigned char>	^buf = safe_cast<array<unsigned char>^>(
-											info->GetValue( "content",
-											array<unsigned char>::typeid ) );
-		m_fs->Write( buf, 0, buf->Length );
+		bool	chunked = false;
+		bool	stored = false;
+
+		// check for content is splitted into chunks or
+		// refers to the storage
+		for each( SerializationEntry entry in info ) {
+			if( entry.Name == "chunks" ) chunked = true;
+			if( entry.Name == "hash" ) stored = true;
+		}
+
+		if( stored ) {
+			// restore reference to stored content
+			m_source = gcnew SOURCE();
+			m_source->_type = info->GetString( "type" );
+			m_source->_id = info->GetInt32( "id" );
+			m_source->_name = info->GetString( "name" );
+			m_source->_length = info->GetInt64( "length" );
+			m_hash = safe_cast<array<unsigned char>^>(
+						info->GetValue( "hash", array<unsigned char>::typeid ) );
+			// content will be read at first access
+			return;
+		}
+		if( chunked ) {
+			// get content chunks
+			array<array<unsigned char>^>	^chunks = 
+				safe_cast<array<array<unsigned char>^>^>(
+					info->GetValue( "chunks",
+					array<array<unsigned char>^>::typeid ) );
+			// create internal stream
+			create( info->GetInt64( "length" ) );
+
+			// restore stream content chunk by chunk
+			for each( array<unsigned char> ^buf in chunks ) {
+				m_stream->Write( buf, 0, buf->Length );
+			}
+		} else {
+			// get stream content
+			array<unsigned char>	^buf = safe_cast<array<unsigned char>^>(
+												info->GetValue( "content",
+												array<unsigned char>::typeid ) );
+			// create internal stream
+			create( buf->Length );
+
+			// restore stream content
+			m_stream->Write( buf, 0, buf->Length );
+		}
 		// and stream position
-		m_fs->Position = info->GetInt64( "position" );
+		m_stream->Position = info->GetInt64( "position" );
 	} finally {
 		// revert write assert
 		FileIOPermission::RevertAssert();
@@ -353,25 +629,59 @@ void PersistentStream::get_object_data( SerializationInfo ^info,
 {
 	// check for null reference
 	if( info == nullptr ) throw gcnew ArgumentNullException("info");
-	// check stream state
-	check_state();
-	// check for the stream length
-	if( m_fs->Length > int::MaxValue ) throw gcnew SerializationException(
-		ERR_STREAM_LENGTH);
+	// check for disposed stream
+	if( m_disposed ) throw gcnew ObjectDisposedException(
+		this->GetType()->ToString(), ERR_STREAM_CLOSED);
+
+	// stored content that is not read yet is passed by reference
+	// only, so it is never transfered as a whole
+	if( m_source != nullptr ) {
+		info->AddValue( "type", m_source->_type );
+		info->AddValue( "id", m_source->_id );
+		info->AddValue( "name", m_source->_name );
+		info->AddValue( "length", m_source->_length );
+		info->AddValue( "hash", m_hash );
+		return;
+	}
 
-	// allocate memory for stream content
-	array<unsigned char>	^buf = gcnew array<unsigned char>(
-										(int) m_fs->Length);
 	// save current position
-	__int64		pos = m_fs->Position;
-	// copy stream content to the buffer
-	m_fs->Seek( 0, SeekOrigin::Begin );
-	m_fs->Read( buf, 0, buf->Length );
-	// restore position
-	m_fs->Position = pos;
+	__int64		pos = m_stream->Position;
+	__int64		length = m_stream->Length;
+
+	if( (m_path == nullptr) && (length <= CHUNK_SIZE) ) {
+		// copy memory buffer
+		info->AddValue( "content",
+						safe_cast<MemoryStream^>( m_stream )->ToArray() );
+	} else {
+		// split content into bounded chunks
+		array<array<unsigned char>^>	^chunks =
+			gcnew array<array<unsigned char>^>(
+				(int) ((length + CHUNK_SIZE - 1) / CHUNK_SIZE));
+		try {
+			// copy stream content to the chunks
+			m_stream->Seek( 0, SeekOrigin::Begin );
+			for( int i = 0; i < chunks->Length; i++ ) {
+				chunks[i] = gcnew array<unsigned char>(
+					(int) Math::Min( length - (__int64) i*CHUNK_SIZE,
+									 (__int64) CHUNK_SIZE ));
+				read_chunk( chunks[i] );
+			}
+		} finally {
+			// restore position
+			m_stream->Position = pos;
+		}
 
+		if( chunks->Length > 1 ) {
+			info->AddValue( "length", length );
+			info->AddValue( "chunks", chunks );
+		} else {
+			// small content is stored as single array to be
+			// compatible with previous versions
+			info->AddValue( "content", (chunks->Length > 0) ?
+				chunks[0] : gcnew array<unsigned char>(0) );
+		}
+	}
 	// save serialization data
-	info->AddValue( "content",  buf );
 	info->AddValue( "position", pos );
 }
 
@@ -418,12 +728,8 @@ void PersistentStream::on_change::raise( PersistentStream ^sender )
 PersistentStream::PersistentStream( void ) : \
 	m_path(nullptr), m_disposed(false)
 {
-	// create empty temporary file
-	m_path = Path::GetTempFileName();
-	// open this file with FileStream
-	m_fs = gcnew FileStream(m_path, FileMode::OpenOrCreate,
-							FileAccess::ReadWrite, FileShare::None, 8,
-							FileOptions::DeleteOnClose);
+	// create empty memory buffer
+	create( 0 );
 }
 
 
@@ -436,31 +742,30 @@ PersistentStream::PersistentStream( void ) : \
 PersistentStream::PersistentStream( String ^path ) : \
 	m_path(nullptr), m_disposed(false)
 {
-	// create empty temporary file
-	m_path = Path::GetTempFileName();
-	// open this file with FileStream
-	m_fs = gcnew FileStream(m_path, FileMode::OpenOrCreate,
-							FileAccess::ReadWrite, FileShare::None, 8,
-							FileOptions::DeleteOnClose);
-
+	// open specified file
+	FileStream	^fs = gcnew FileStream(path,
+									   FileMode::Open, FileAccess::Read);
 	try {
-		// open specified file
-		FileStream	^fs = gcnew FileStream(path,
-										   FileMode::Open, FileAccess::Read);
-		// and copy it's content to the internal stream
-		array<unsigned char>	^buf = gcnew array<unsigned char>(1024*1024);
-		for( int size = 0;
-			 size = fs->Read( buf, 0, buf->Length );
-			 m_fs->Write( buf, 0, size ) );
+		// create internal stream for file content
+		create( fs->Length );
+		try {
+			// and copy it's content to the internal stream
+			array<unsigned char>	^buf = gcnew array<unsigned char>(
+				(int) Math::Min( fs->Length + 1, (__int64) 1024*1024 ));
+			for( int size = 0;
+				 size = fs->Read( buf, 0, buf->Length );
+				 m_stream->Write( buf, 0, size ) );
+			// set position to the begin of the stream
+			m_stream->Seek( 0, SeekOrigin::Begin );
+		} catch( Exception^ ) {
+			// close internal stream
+			m_stream->Close();
+			// and restore exception
+			throw;
+		}
+	} finally {
 		// close source stream
 		fs->Close();
-		// set position to the begin of the stream
-		m_fs->Seek( 0, SeekOrigin::Begin );
-	} catch( Exception^ ) {
-		// close internal stream
-		m_fs->Close();
-		// and restore exception
-		throw;
 	}
 }
 
@@ -474,17 +779,48 @@ PersistentStream::PersistentStream( String ^path ) : \
 PersistentStream::PersistentStream( array<unsigned char> ^buffer ) : \
 	m_path(nullptr), m_disposed(false)
 {
-	// create empty temporary file
-	m_path = Path::GetTempFileName();
-	// open this file with FileStream
-	m_fs = gcnew FileStream(m_path, FileMode::OpenOrCreate,
-							FileAccess::ReadWrite, FileShare::None, 8,
-							FileOptions::DeleteOnClose);
+	// check for null reference
+	if( buffer == nullptr ) throw gcnew ArgumentNullException("buffer");
+
+	// create internal stream for buffer's content
+	create( buffer->Length );
 
 	// copy buffer's content to internal stream
-	m_fs->Write( buffer, 0, buffer->Length );
+	m_stream->Write( buffer, 0, buffer->Length );
 	// set position to the begin of the stream
-	m_fs->Seek( 0, SeekOrigin::Begin );
+	m_stream->Seek( 0, SeekOrigin::Begin );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Initializes a new instance of the PersistentStream class that
+/// refers to the content of stream property in the storage.
+/// </summary><remarks>
+/// Storage creates such streams for large content. It is read by
+/// bounded ranges through ReadBlob at first access and is checked
+/// by the specified hash. Length and Hash don't read content.
+/// </remarks>
+//-------------------------------------------------------------------
+PersistentStream::PersistentStream( String ^type, int id, String ^name,	\
+									__int64 length,						\
+									array<unsigned char> ^hash ) :		\
+	m_path(nullptr), m_disposed(false)
+{
+	// check for null reference
+	if( type == nullptr ) throw gcnew ArgumentNullException("type");
+	if( name == nullptr ) throw gcnew ArgumentNullException("name");
+	if( hash == nullptr ) throw gcnew ArgumentNullException("hash");
+	// check for right value
+	if( length < 0 ) throw gcnew ArgumentOutOfRangeException(
+		"length", ERR_LESS_THEN_ZERRO);
+
+	m_source = gcnew SOURCE();
+	m_source->_type = type;
+	m_source->_id = id;
+	m_source->_name = name;
+	m_source->_length = length;
+	m_hash = safe_cast<array<unsigned char>^>( hash->Clone() );
 }
 
 
@@ -499,7 +835,7 @@ PersistentStream::~PersistentStream( void )
 {
 	if( !m_disposed ) {
 		// dispose internal stream
-		delete m_fs;
+		delete m_stream;
 		// call finalizer to clean up unmanaged resources
 		this->!PersistentStream();
 		// prevent from future cals
@@ -523,8 +859,9 @@ PersistentStream::!PersistentStream( void )
 		if( %backup != nullptr ){
 			// if contains unfinished transactions
 			while( backup.Count > 0 ) {
+				String	^path = backup.Pop()._snapshot->_path;
 				// delete transaction files
-				DELETE_FILE( backup.Pop()._path );
+				if( path != nullptr ) DELETE_FILE( path );
 			}
 		}
 		// prevent from future cals
@@ -549,6 +886,35 @@ PersistentStream::operator Stream^( PersistentStream ^ps )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets or sets maximum size (in bytes) of the stream content that is
+/// kept in memory.
+/// </summary><remarks>
+/// Streams are created in memory and their content is moved to the
+/// temporary file as soon as it exceeds this limit. Zero value stores
+/// all non-empty streams in temporary files. New value is applied to
+/// the streams at next write operation.
+/// </remarks>
+//-------------------------------------------------------------------
+__int64 PersistentStream::MemoryLimit::get( void )
+{
+	return Interlocked::Read( s_memoryLimit );
+}
+
+void PersistentStream::MemoryLimit::set( __int64 value )
+{
+	// check for right value
+	if( value < 0 ) throw gcnew ArgumentOutOfRangeException(
+		"value", ERR_LESS_THEN_ZERRO);
+	// memory buffer can't exceed maximum array size
+	if( value > int::MaxValue ) throw gcnew ArgumentOutOfRangeException(
+		"value");
+
+	Interlocked::Exchange( s_memoryLimit, value );
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Gets a value indicating whether the current stream supports
@@ -557,7 +923,10 @@ PersistentStream::operator Stream^( PersistentStream ^ps )
 //-------------------------------------------------------------------
 bool PersistentStream::CanRead::get( void )
 {
-	return m_fs->CanRead;
+	// stored content is not read yet
+	if( m_stream == nullptr ) return !m_disposed;
+
+	return m_stream->CanRead;
 }
 
 
@@ -569,7 +938,10 @@ bool PersistentStream::CanRead::get( void )
 //-------------------------------------------------------------------
 bool PersistentStream::CanSeek::get( void )
 {
-	return m_fs->CanSeek;
+	// stored content is not read yet
+	if( m_stream == nullptr ) return !m_disposed;
+
+	return m_stream->CanSeek;
 }
 
 
@@ -581,7 +953,10 @@ bool PersistentStream::CanSeek::get( void )
 //-------------------------------------------------------------------
 bool PersistentStream::CanWrite::get( void )
 {
-	return m_fs->CanWrite;
+	// stored content is not read yet
+	if( m_stream == nullptr ) return !m_disposed;
+
+	return m_stream->CanWrite;
 }
 
 
@@ -592,10 +967,34 @@ bool PersistentStream::CanWrite::get( void )
 //-------------------------------------------------------------------
 __int64 PersistentStream::Length::get( void )
 {
+	// length of stored content is known without reading
+	if( !m_disposed && (m_source != nullptr) ) return m_source->_length;
 	// check stream state
 	check_state();
 
-	return m_fs->Length;
+	return m_stream->Length;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets SHA-1 hash of the stream content.
+/// </summary><remarks>
+/// Hash is calculated at first request and is kept until content
+/// change. Storage can use it to save equal content only once.
+/// </remarks>
+//-------------------------------------------------------------------
+array<unsigned char>^ PersistentStream::Hash::get( void )
+{
+	// hash of stored content is known without reading
+	if( m_disposed || (m_source == nullptr) ) {
+		// check stream state
+		check_state();
+
+		if( m_hash == nullptr ) m_hash = compute_hash();
+	}
+	// return copy to protect cached value
+	return safe_cast<array<unsigned char>^>( m_hash->Clone() );
 }
 
 
@@ -609,7 +1008,7 @@ __int64 PersistentStream::Position::get( void )
 	// check stream state
 	check_state();
 
-	return m_fs->Position;
+	return m_stream->Position;
 }
 
 void PersistentStream::Position::set( __int64 value )
@@ -617,7 +1016,7 @@ void PersistentStream::Position::set( __int64 value )
 	// check stream state
 	check_state();
 
-	m_fs->Position = value;
+	m_stream->Position = value;
 }
 
 
@@ -630,24 +1029,37 @@ void PersistentStream::Position::set( __int64 value )
 //-------------------------------------------------------------------
 void PersistentStream::ExportToFile( String ^path )
 {
-	// open specified file for writing
+	// check stream state
+	check_state();
+
+	// open specified file for writing (without buffering,
+	// because content is written by large blocks)
 	FileStream	^fs = gcnew FileStream(path,
-									   FileMode::Create, FileAccess::Write);
+									   FileMode::Create, FileAccess::Write,
+									   FileShare::None, 1);
 	// store current position
-	__int64		pos = m_fs->Position;
+	__int64		pos = m_stream->Position;
 	try {
-		// seek to begin of the internal stream
-		m_fs->Seek( 0, SeekOrigin::Begin );
-		// and copy it's content to the new stream
-		array<unsigned char>	^buf = gcnew array<unsigned char>(1024*1024);
-		for( int size = 0;
-			 size = m_fs->Read( buf, 0, buf->Length );
-			 fs->Write( buf, 0, size ) );
+		// allocate file space at once
+		fs->SetLength( m_stream->Length );
+
+		if( m_path == nullptr ) {
+			// write memory buffer at once
+			safe_cast<MemoryStream^>( m_stream )->WriteTo( fs );
+		} else {
+			// seek to begin of the internal stream
+			m_stream->Seek( 0, SeekOrigin::Begin );
+			// and copy it's content to the new stream
+			array<unsigned char>	^buf = gcnew array<unsigned char>(1024*1024);
+			for( int size = 0;
+				 size = m_stream->Read( buf, 0, buf->Length );
+				 fs->Write( buf, 0, size ) );
+		}
 	} finally {
 		// close output stream
 		fs->Close();
 		// restore internal stream position
-		m_fs->Position = pos;
+		m_stream->Position = pos;
 	}
 }
 
@@ -663,7 +1075,7 @@ void PersistentStream::Flush( void )
 	// check stream state
 	check_state();
 
-	m_fs->Flush();
+	m_stream->Flush();
 }
 
 
@@ -679,7 +1091,104 @@ int PersistentStream::Read( [In] [Out] array<unsigned char> ^buffer,
 	// check stream state
 	check_state();
 
-	return m_fs->Read( buffer, offset, count );
+	return m_stream->Read( buffer, offset, count );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Reads a sequence of bytes from the specified position of the
+/// stream. Current position of the stream is not changed.
+/// </summary><remarks>
+/// Use this function for random access reads of the content.
+/// </remarks>
+//-------------------------------------------------------------------
+int PersistentStream::ReadAt( __int64 position,
+							  [In] [Out] array<unsigned char> ^buffer,
+							  int offset, int count )
+{
+	// check stream state
+	check_state();
+	// check for null reference
+	if( buffer == nullptr ) throw gcnew ArgumentNullException("buffer");
+	// check for right values
+	if( (position < 0) || (offset < 0) || (count < 0) ) {
+		throw gcnew ArgumentOutOfRangeException(ERR_LESS_THEN_ZERRO);
+	}
+	if( offset + count > buffer->Length ) throw gcnew ArgumentException();
+
+	// calculate size of available data
+	count = (int) Math::Min( (__int64) count,
+							 Math::Max( m_stream->Length - position, 0LL ) );
+	// check for end of stream
+	if( count == 0 ) return 0;
+
+	if( m_path == nullptr ) {
+		// copy directly from memory buffer
+		Buffer::BlockCopy( safe_cast<MemoryStream^>( m_stream )->GetBuffer(),
+						   (int) position, buffer, offset, count );
+	} else {
+		// store current position
+		__int64	pos = m_stream->Position;
+		try {
+			m_stream->Position = position;
+			count = m_stream->Read( buffer, offset, count );
+		} finally {
+			// restore internal stream position
+			m_stream->Position = pos;
+		}
+	}
+	return count;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets a segment of the content that starts at the specified
+/// position. Current position of the stream is not changed.
+/// </summary><remarks><para>
+/// If content is kept in memory, segment is an alias of the internal
+/// buffer (it is not a copy). Caller must not write to its array:
+/// such writes change stream content without change notification and
+/// can't be rolled back by transaction. Segment is valid until next
+/// change of the stream only. Use Read to get a copy of content.
+/// </para><para>
+/// Segment can be shorter than requested if end of stream is
+/// reached.
+/// </para></remarks>
+//-------------------------------------------------------------------
+ArraySegment<unsigned char> PersistentStream::Slice( __int64 position,
+													 int count )
+{
+	// check stream state
+	check_state();
+	// check for right values
+	if( (position < 0) || (count < 0) ) {
+		throw gcnew ArgumentOutOfRangeException(ERR_LESS_THEN_ZERRO);
+	}
+
+	// calculate size of available data
+	count = (int) Math::Min( (__int64) count,
+							 Math::Max( m_stream->Length - position, 0LL ) );
+
+	if( m_path == nullptr ) {
+		// refer to memory buffer
+		return ArraySegment<unsigned char>(
+			safe_cast<MemoryStream^>( m_stream )->GetBuffer(),
+			(int) Math::Min( position, m_stream->Length ), count);
+	}
+
+	// read content from file
+	array<unsigned char>	^buf = gcnew array<unsigned char>(count);
+	__int64					pos = m_stream->Position;
+	try {
+		m_stream->Position = position;
+		read_chunk( buf );
+	} finally {
+		// restore internal stream position
+		m_stream->Position = pos;
+	}
+	return ArraySegment<unsigned char>(buf);
 }
 
 
@@ -694,7 +1203,7 @@ int PersistentStream::ReadByte( void )
 	// check stream state
 	check_state();
 
-	return m_fs->ReadByte();
+	return m_stream->ReadByte();
 }
 
 
@@ -708,7 +1217,7 @@ __int64 PersistentStream::Seek( __int64 offset, SeekOrigin origin )
 	// check stream state
 	check_state();
 
-	return m_fs->Seek( offset, origin );
+	return m_stream->Seek( offset, origin );
 }
 
 
@@ -722,12 +1231,19 @@ void PersistentStream::SetLength( __int64 value )
 	// check stream state
 	check_state();
 	// save length before action
-	__int64	length = m_fs->Length;
+	__int64	length = m_stream->Length;
 
-	m_fs->SetLength( value );
+	// save content for transaction rollback
+	save_snapshot();
+	// and drop hash of previous content
+	m_hash = nullptr;
+
+	m_stream->SetLength( value );
+	// move large content to the file
+	spill();
 
 	// notify about content change
-	if( length != m_fs->Length ) on_change( this );
+	if( length != m_stream->Length ) on_change( this );
 }
 
 
@@ -744,12 +1260,19 @@ void PersistentStream::Write( array<unsigned char> ^buffer, \
 	// check stream state
 	check_state();
 	// save position before action
-	__int64	pos = m_fs->Position;
+	__int64	pos = m_stream->Position;
+
+	// save content for transaction rollback
+	save_snapshot();
+	// and drop hash of previous content
+	m_hash = nullptr;
 
-	m_fs->Write( buffer, offset, count );
+	m_stream->Write( buffer, offset, count );
+	// move large content to the file
+	spill();
 
 	// notify about content change
-	if( pos != m_fs->Position ) on_change( this );
+	if( pos != m_stream->Position ) on_change( this );
 }
 
 
@@ -764,12 +1287,19 @@ void PersistentStream::WriteByte( unsigned char value )
 	// check stream state
 	check_state();
 	// save position before action
-	__int64	pos = m_fs->Position;
+	__int64	pos = m_stream->Position;
+
+	// save content for transaction rollback
+	save_snapshot();
+	// and drop hash of previous content
+	m_hash = nullptr;
 
-	m_fs->WriteByte( value );
+	m_stream->WriteByte( value );
+	// move large content to the file
+	spill();
 
 	// notify about content change
-	if( pos != m_fs->Position ) on_change( this );
+	if( pos != m_stream->Position ) on_change( this );
 }
 
 
@@ -19,6 +19,7 @@
 using namespace System;
 using namespace System::IO;
 using namespace System::Collections::Generic;
+using namespace System::Security::Cryptography;
 using namespace System::Security::Permissions;
 using namespace System::Runtime::Serialization;
 using namespace System::Runtime::InteropServices;
@@ -31,7 +32,11 @@ _RPL_BEGIN
 /// This stream is designed as atomic value, so you can use one instance in one
 /// property only.</para><para>
 /// Attempt to assign existing instance to more than one property will throw
-/// InvalidOperationException.
+/// InvalidOperationException.</para><para>
+/// Content is kept in memory until it exceeds MemoryLimit, then it is moved
+/// to the temporary file.</para><para>
+/// Stream that refers to stored content reads it from the storage by ranges
+/// at first access to content and is serialized as reference only.
 /// </para></remarks>
 [Serializable]
 public ref class PersistentStream sealed : ISerializable, ITransaction
@@ -89,22 +94,57 @@ internal:
 	delegate void ON_CHANGE( PersistentStream ^sender );
 
 private:
+	//
+	// Reference to content of stream property in the storage. It is
+	// kept until content is read.
+	//
+	ref class SOURCE {
+	public:
+		String					^_type;
+		int						_id;
+		String					^_name;
+		__int64					_length;
+	};
+
+	static __int64	s_memoryLimit = 64*1024;
+
 	bool			m_disposed;
 	String			^m_path;
-	FileStream		^m_fs;
+	Stream			^m_stream;
+	SOURCE			^m_source;
 	ON_CHANGE		^m_on_change;
-
+	array<unsigned char>	^m_hash;
+
+	static FileStream^ open_file( String ^path );
+	void create( __int64 length );
+	void spill( void );
+	void read_chunk( array<unsigned char> ^buffer );
+	array<unsigned char>^ compute_hash( void );
+	void load( void );
 	void check_state( void );
 
 // ITransaction
 private:
+	//
+	// Copy of stream content. It is taken at first write after
+	// transaction begin and is shared by all nested transactions
+	// that were started before this write.
+	//
+	ref class SNAPSHOT {
+	public:
+		bool					_saved;
+		String					^_path;
+		array<unsigned char>	^_data;
+	};
 	value class RESTORE_POINT {
 	public:
-		String		^_path;
-		__int64		_position;
+		SNAPSHOT				^_snapshot;
+		__int64					_position;
 	};
 	Stack<RESTORE_POINT>	backup;
 
+	void save_snapshot( void );
+
 	virtual void trans_begin( void ) sealed = ITransaction::Begin;
 	virtual void trans_commit( void ) sealed = ITransaction::Commit;
 	virtual void trans_rollback( void ) sealed = ITransaction::Rollback;
@@ -132,11 +172,17 @@ public:
 	PersistentStream( void );
 	explicit PersistentStream( String ^path );
 	explicit PersistentStream( array<unsigned char> ^buffer );
+	PersistentStream( String ^type, int id, String ^name,
+					  __int64 length, array<unsigned char> ^hash );
 	~PersistentStream( void );
 	!PersistentStream( void );
 
 	static operator Stream^( PersistentStream ^ps );
 
+	property __int64 MemoryLimit {
+		static __int64 get( void );
+		static void set( __int64 value );
+	}
 	property bool CanRead {
 		bool get( void );
 	}
@@ -149,6 +195,9 @@ public:
 	property __int64 Length {
 		__int64 get( void );
 	}
+	property array<unsigned char>^ Hash {
+		array<unsigned char>^ get( void );
+	}
 	property __int64 Position {
 		__int64 get( void ) ;
 		void set( __int64 value );
@@ -158,6 +207,9 @@ public:
 	void Flush( void )  ;
     int Read( [In] [Out] array<unsigned char> ^buffer,
 					  int offset, int count );
+	int ReadAt( __int64 position, [In] [Out] array<unsigned char> ^buffer,
+				int offset, int count );
+	ArraySegment<unsigned char> Slice( __int64 position, int count );
 	int ReadByte( void );
 	__int64 Seek( __int64 offset, SeekOrigin origin );
 	void SetLength( __int64 value );
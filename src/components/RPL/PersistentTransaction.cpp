@@ -13,9 +13,11 @@
 /****************************************************************************/
 
 #include ".\Factories\PersistenceBroker.h"
+#include "AsyncQueue.h"
 #include "PersistentObject.h"
 #include "PersistentTransaction.h"
 
+using namespace System::Runtime::CompilerServices;
 using namespace _RPL;
 using namespace _RPL::Factories;
 
@@ -44,13 +46,17 @@ PersistentTransaction::Task::Task( PersistentObject ^obj, ACTION act ) : \
 //
 // This function performs atomar action and saves object initial
 // state. PersistentTransaction doesn't support nested transactions
-// so i extract all objects into top level stack.
+// so i extract all objects into top level stack of current thread.
+// To check for object was accessed already hash set of touched
+// objects is used (stack search is O(N) operation).
 //
 //-------------------------------------------------------------------
 void PersistentTransaction::Task::Perform( void )
 {
 	// at the first object access in entire transaction stack
-	if( !s_stack->Contains( m_obj ) ) {
+	if( !s_objs->ContainsKey( m_obj ) ) {
+		// mark object as touched by transaction
+		s_objs->Add( m_obj, true );
 		// save ITransaction interface to be able revert operation later
 		s_stack->Push( m_obj );
 		// and save all internal object's data
@@ -78,6 +84,34 @@ void PersistentTransaction::Task::Perform( void )
 }
 
 
+//----------------------------------------------------------------------------
+//		Toolkit::RPL::PersistentTransaction::ReferenceComparer
+//----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Determines whether the specified objects are the same instance.
+//
+//-------------------------------------------------------------------
+bool PersistentTransaction::							\
+ReferenceComparer::Equals( ITransaction ^x, ITransaction ^y )
+{
+	return Object::ReferenceEquals( x, y );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Returns hash code that doesn't depend on the object's state.
+//
+//-------------------------------------------------------------------
+int PersistentTransaction::					   \
+ReferenceComparer::GetHashCode( ITransaction ^obj )
+{
+	return RuntimeHelpers::GetHashCode( obj );
+}
+
+
 //----------------------------------------------------------------------------
 //					Toolkit::RPL::PersistentTransaction
 //----------------------------------------------------------------------------
@@ -89,7 +123,7 @@ void PersistentTransaction::Task::Perform( void )
 /// </summary>
 //-------------------------------------------------------------------
 PersistentTransaction::PersistentTransaction( void ) : \
-	_tasks(gcnew Queue<Task>)
+	_tasks(gcnew Queue<Task>), _async(gcnew AsyncQueue())
 {
 	// do nothing
 }
@@ -103,7 +137,7 @@ PersistentTransaction::PersistentTransaction( void ) : \
 //-------------------------------------------------------------------
 PersistentTransaction::PersistentTransaction( PersistentObject ^obj, \
 											  ACTION action ) :		 \
-	_tasks(gcnew Queue<Task>)
+	_tasks(gcnew Queue<Task>), _async(gcnew AsyncQueue())
 {
 	// check for initialized reference
 	if( obj == nullptr ) throw gcnew ArgumentNullException("obj");
@@ -123,7 +157,7 @@ PersistentTransaction::PersistentTransaction( PersistentObject ^obj, \
 //-------------------------------------------------------------------
 PersistentTransaction::
 PersistentTransaction( IEnumerable<PersistentObject^> ^objs, ACTION action ) : \
-	_tasks(gcnew Queue<Task>)
+	_tasks(gcnew Queue<Task>), _async(gcnew AsyncQueue())
 {
 	// check for initialized reference
 	if( objs == nullptr ) throw gcnew ArgumentNullException("objs");
@@ -175,14 +209,19 @@ void PersistentTransaction::Add( IEnumerable<PersistentObject^> ^objs, \
 //-------------------------------------------------------------------
 /// <summary>
 /// Process transaction.
-/// </summary><remarks>
-/// Exposes internal content of transaction.
-/// </remarks>
+/// </summary><remarks><para>
+/// Exposes internal content of transaction.</para><para>
+/// Transaction stack is stored per thread, so nested transactions
+/// are detected for the calling thread only. Storage is locked for
+/// the whole transaction unless broker is in concurrent mode.
+/// </para></remarks>
 //-------------------------------------------------------------------
 void PersistentTransaction::Process( void )
 {
+	Object	^sync = PersistenceBroker::SyncRoot;
+
 	// lock storage for one executable thread 
-	Monitor::Enter( PersistenceBroker::Storage );
+	Monitor::Enter( sync );
 	try {
 		// check to be top level transaction
 		if( s_stack == nullptr ) {
@@ -190,6 +229,9 @@ void PersistentTransaction::Process( void )
 			PersistenceBroker::Storage->TransactionBegin();
 			// initialize transaction objects stack
 			s_stack = gcnew Stack<ITransaction^>();
+			// and set of touched objects
+			s_objs = gcnew Dictionary<ITransaction^, bool>(
+							gcnew ReferenceComparer());
 
 			try {
 				// process all tasks in right order
@@ -209,6 +251,7 @@ void PersistentTransaction::Process( void )
 			} finally {
 				// free transaction objects stack
 				s_stack = nullptr;
+				s_objs = nullptr;
 			}
 		} else {
 			// this is nested transaction: process all tasks in right order only
@@ -216,6 +259,40 @@ void PersistentTransaction::Process( void )
 		}
 	} finally {
 		// unlock storage in any case
-		Monitor::Exit( PersistenceBroker::Storage );
+		Monitor::Exit( sync );
 	}
 }
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Begins an asynchronous Process operation.
+/// </summary><remarks>
+/// Asynchronous operations on the same transaction are performed in
+/// the order they were started. Transaction is processed by thread
+/// pool, so it is independent of transactions of the calling thread.
+/// Use EndProcess to get the result of operation.
+/// </remarks>
+//-------------------------------------------------------------------
+IAsyncResult^ PersistentTransaction::BeginProcess( AsyncCallback ^callback, \
+												   Object ^state )
+{
+	AsyncQueue::OPERATION	^op = gcnew AsyncQueue::OPERATION(
+		this, &PersistentTransaction::Process);
+
+	return _async->Begin( op, nullptr, callback, state );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Waits for the pending asynchronous Process operation to complete.
+/// </summary><remarks>
+/// Exception raised during operation is thrown by this call as inner
+/// exception of TargetInvocationException.
+/// </remarks>
+//-------------------------------------------------------------------
+void PersistentTransaction::EndProcess( IAsyncResult ^result )
+{
+	AsyncQueue::End( result );
+}
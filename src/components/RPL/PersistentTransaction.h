@@ -21,6 +21,7 @@ using namespace System::Collections::Generic;
 
 _RPL_BEGIN
 interface class ITransaction;
+ref class AsyncQueue;
 ref class PersistentObject;
 
 /// <summary>
@@ -30,7 +31,10 @@ ref class PersistentObject;
 /// action to transaction instance (use "Add" method) and perform operation
 /// by calling Process().</para><para>
 /// If transaction will be not succeded, then some error (from persistence
-/// storage) will be raised and all changes will be rolled back.
+/// storage) will be raised and all changes will be rolled back.</para><para>
+/// Transaction context is thread-affine: every thread has it's own stack of
+/// objects, so independent transactions can be processed by different
+/// threads at the same time (see PersistenceBroker::IsConcurrent).
 /// </para></remarks>
 public ref class PersistentTransaction sealed : MarshalByRefObject
 {
@@ -50,10 +54,26 @@ private:
 		void Perform( void );
 	};
 
+	//
+	// Compares transaction objects by reference. Object's hash code
+	// can be changed during transaction (new object receives ID
+	// while saving), so it cann't be used to track touched objects.
+	//
+	ref class ReferenceComparer : IEqualityComparer<ITransaction^>
+	{
+	public:
+		virtual bool Equals( ITransaction ^x, ITransaction ^y );
+		virtual int GetHashCode( ITransaction ^obj );
+	};
+
 private:
-	static Stack<ITransaction^>^	s_stack = nullptr;
+	[ThreadStatic]
+	static Stack<ITransaction^>^	s_stack;
+	[ThreadStatic]
+	static Dictionary<ITransaction^, bool>^	s_objs;
 
 	Queue<Task>^	const _tasks;
+	AsyncQueue^		const _async;
 
 public:
 	// TODO: понять как будет работать даное решение при тонком клиенте
@@ -69,5 +89,8 @@ public:
 	void Add( IEnumerable<PersistentObject^> ^objs, ACTION action );
 
 	void Process( void );
+
+	IAsyncResult^ BeginProcess( AsyncCallback ^callback, Object ^state );
+	void EndProcess( IAsyncResult ^result );
 };
 _RPL_END
@@ -12,6 +12,7 @@
 /*																			*/
 /****************************************************************************/
 
+#include "Evaluator.h"
 #include "Query.h"
 
 using namespace _RPL;
@@ -119,6 +120,40 @@ OrderBy::operator OrderBy^( OrderBy::Clause ^clause )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets structural key of the ORDER BY clause.
+/// </summary><remarks>
+/// Requests with equal shapes are sorted by the same operands in the
+/// same order, so storage can reuse compiled request for them.
+/// </remarks>
+//-------------------------------------------------------------------
+String^ OrderBy::Shape::get( void )
+{
+	array<String^>	^shapes = gcnew array<String^>(_args->Length);
+
+	for( int i = 0; i < _args->Length; i++ ) {
+		shapes[i] = String::Format( "[{0}] {1}",
+			_args[i]->OPD->Replace( "]", "]]" ), _args[i]->Sort );
+	}
+	return String::Join( ", ", shapes );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Creates comparison of objects according to the ORDER BY clause.
+/// </summary><remarks>
+/// Comparison is used to sort objects in memory. Objects with equal
+/// sorting values are ordered by ID.
+/// </remarks>
+//-------------------------------------------------------------------
+Comparison<PersistentObject^>^ OrderBy::Compile( void )
+{
+	return Evaluator::Compile( this );
+}
+
+
 //-----------------------------------------------------------------------------
 //							Toolkit::RPL::Where::Clause
 //-----------------------------------------------------------------------------
@@ -197,6 +232,22 @@ ValueBox Where::Clause::Value::get( void )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets structural key of the predicate.
+/// </summary><remarks>
+/// Shape consists of operand, operator and type of the value (value
+/// itself is excluded), so predicates with equal shapes differ by
+/// values only.
+/// </remarks>
+//-------------------------------------------------------------------
+String^ Where::Clause::Shape::get( void )
+{
+	return String::Format( "[{0}] {1} {2}",
+		_opd->Replace( "]", "]]" ), _op, _value.ToObject()->GetType()->Name );
+}
+
+
 //-----------------------------------------------------------------------------
 //					Toolkit::RPL::Where::Operation::Or
 //-----------------------------------------------------------------------------
@@ -238,6 +289,17 @@ Where^ Where::Operation::Or::RightWhere::get( void )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets structural key of the OR operation.
+/// </summary>
+//-------------------------------------------------------------------
+String^ Where::Operation::Or::Shape::get( void )
+{
+	return String::Format( "({0} OR {1})", _left->Shape, _right->Shape );
+}
+
+
 //-----------------------------------------------------------------------------
 //					Toolkit::RPL::Where::Operation::And
 //-----------------------------------------------------------------------------
@@ -279,6 +341,17 @@ Where^ Where::Operation::And::RightWhere::get( void )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets structural key of the AND operation.
+/// </summary>
+//-------------------------------------------------------------------
+String^ Where::Operation::And::Shape::get( void )
+{
+	return String::Format( "({0} AND {1})", _left->Shape, _right->Shape );
+}
+
+
 //-----------------------------------------------------------------------------
 //					Toolkit::RPL::Where::Operation::Not
 //-----------------------------------------------------------------------------
@@ -308,10 +381,50 @@ Where^ Where::Operation::Not::SubWhere::get( void )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets structural key of the NOT operation.
+/// </summary>
+//-------------------------------------------------------------------
+String^ Where::Operation::Not::Shape::get( void )
+{
+	return String::Format( "NOT ({0})", _sub->Shape );
+}
+
+
 //-----------------------------------------------------------------------------
 //							Toolkit::RPL::Where
 //-----------------------------------------------------------------------------
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Creates predicate that checks object against the condition.
+/// </summary><remarks>
+/// Condition tree is compiled once: operands, operators and values
+/// are resolved while predicate is created, so it is faster than
+/// "Evaluate" for the set of objects.
+/// </remarks>
+//-------------------------------------------------------------------
+Predicate<PersistentObject^>^ Where::Compile( void )
+{
+	return Evaluator::Compile( this );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Checks specified object against the condition.
+/// </summary><remarks>
+/// Condition tree is interpreted on every call. Use "Compile" to
+/// check a number of objects.
+/// </remarks>
+//-------------------------------------------------------------------
+bool Where::Evaluate( PersistentObject ^obj )
+{
+	return Evaluator::Evaluate( this, obj );
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Creates combination of two predicates that uses the logical
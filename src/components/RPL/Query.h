@@ -21,6 +21,8 @@ using namespace System::Runtime::InteropServices;
 
 
 _RPL_BEGIN
+ref class PersistentObject;
+
 /// <summary>
 /// Encapsulates the common behavoir to organize search request.
 /// </summary>
@@ -77,6 +79,12 @@ private:
 public:
 	OrderBy( ... array<Clause^> ^args );
 
+	property String^ Shape {
+		String^ get( void );
+	}
+
+	Comparison<PersistentObject^>^ Compile( void );
+
 	static operator OrderBy^( Clause ^clause );
 };
 
@@ -98,6 +106,13 @@ private:
 	Where() {};
 
 public:
+	property String^ Shape {
+		virtual String^ get( void ) abstract;
+	}
+
+	Predicate<PersistentObject^>^ Compile( void );
+	bool Evaluate( PersistentObject ^obj );
+
 	static Operation^ operator |( Where ^left, Where ^right );
 	static Operation^ operator &( Where ^left, Where ^right );
 	static Operation^ operator !( Where ^sub );
@@ -149,6 +164,9 @@ public:
 	property ValueBox Value {
 		ValueBox get( void );
 	}
+	property String^ Shape {
+		virtual String^ get( void ) override;
+	}
 };
 
 
@@ -190,6 +208,9 @@ public:
 	property Where^ RightWhere {
 		Where^ get( void );
 	}
+	property String^ Shape {
+		virtual String^ get( void ) override;
+	}
 };
 
 
@@ -214,6 +235,9 @@ public:
 	property Where^ RightWhere {
 		Where^ get( void );
 	}
+	property String^ Shape {
+		virtual String^ get( void ) override;
+	}
 };
 
 
@@ -233,5 +257,8 @@ public:
 	property Where^ SubWhere {
 		Where^ get( void );
 	}
+	property String^ Shape {
+		virtual String^ get( void ) override;
+	}
 };
 _RPL_END
@@ -49,16 +49,28 @@ using namespace System::Diagnostics;
 	"Operation is not allowed while in disconnected state."
 #define ERR_STREAM_CLOSED													\
 	"Cannot access a closed stream."
-#define ERR_STREAM_LENGTH													\
-	"Stream is to big for serialization."
 #define ERR_STREAM_ASSIGN													\
 	"Instance of the Stream cann't be assigned to multiple properties."
+#define ERR_STREAM_HASH														\
+	"Content of property '{0}' of object with id = {1} was changed in storage."
 #define ERR_LOG_STATES														\
 	"ERROR! Incompatible log record states: from {0} to {1}."
 #define ERR_DELETE_FILE														\
 	"ERROR! Cann't delete file '{0}': {1}"
 #define ERR_DISPOSE															\
 	"ERROR! Object {0} dispose failed: {1}"
+#define ERR_ASYNC_RESULT													\
+	"IAsyncResult object was not returned by the corresponding Begin method."
+#define ERR_ASYNC_FAILED													\
+	"Asynchronous operation failed: {0}"
+#define ERR_ASYNC_CALLBACK													\
+	"ERROR! Callback of asynchronous operation failed: {0}"
+#define ERR_WIRE_MODE														\
+	"Operation is not allowed while {0}."
+#define ERR_WIRE_DATA														\
+	"Invalid or truncated encoded data."
+#define ERR_OBJECT_CHANGED													\
+	"Object with id = {0} was changed in storage after partial retrieve."
 
 
 //
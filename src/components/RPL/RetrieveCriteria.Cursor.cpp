@@ -0,0 +1,233 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		RetrieveCriteria.Cursor.cpp									*/
+/*																			*/
+/*	Content:	Implementation of RetrieveCriteria::Cursor class			*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#include ".\Factories\PersistenceBroker.h"
+#include "PersistentObject.h"
+#include "RetrieveCriteria.Cursor.h"
+
+using namespace System::Threading;
+using namespace _RPL;
+using namespace _RPL::Factories;
+
+
+//
+// Define macro for determine MIN value
+//
+#define MIN(x,y) ((x) < (y) ? (x) : (y))
+
+
+//-----------------------------------------------------------------------------
+//					Toolkit::RPL::RetrieveCriteria::Cursor
+//-----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Clears current page and requests next one from storage.
+//
+// First page is requested after bottom limit and all others after
+// the keyset of the last object of the previous page (all of them
+// are ordered in the same way). Returns false if page is empty.
+//
+//-------------------------------------------------------------------
+bool RetrieveCriteria::Cursor::next_page( void )
+{
+	// array to store search results
+	array<HEADER>	^headers = nullptr;
+	// object to lock storage access
+	Object			^sync = PersistenceBroker::SyncRoot;
+
+	// release previous page
+	m_page.Clear();
+	m_index = -1;
+
+	// calculate page size according to count limit
+	int count = MIN(_size, _count - m_passed);
+	if( count <= 0 ) {
+		m_finished = true;
+		return false;
+	}
+
+	// lock storage for one executable thread
+	Monitor::Enter( sync );
+	try {
+		// continue after the last object of previous page (the
+		// first page starts after bottom limit) and store keyset
+		// of the page end
+		headers = PersistenceBroker::Storage->SearchAfter(
+			_type, _where, _order, m_after,
+			(m_after == nullptr ? _bottom : 0), count );
+		// look through all founded object headers
+		for each( HEADER header in headers ) {
+			// get object from cache by header
+			PersistentObject	^obj = PersistenceBroker::Cache[header];
+			// disable add null references
+			if( obj != nullptr ) m_page.Add( obj );
+		}
+		// make objects up-to-date
+		retrieve( %m_page, _asProxies, _projection );
+	} catch( Exception^ ) {
+		// stop enumeration
+		m_page.Clear();
+		m_finished = true;
+		// and restore exception
+		throw;
+	} finally {
+		// unlock storage in any case
+		Monitor::Exit( sync );
+	}
+
+	// short page means the end of found objects
+	m_passed += headers->Length;
+	m_finished = (headers->Length < count);
+
+	return (m_page.Count > 0);
+}
+
+
+//-------------------------------------------------------------------
+//
+// Returns object (as Object) that enumerator in current state is
+// pointed on. This is "Current" call only.
+//
+//-------------------------------------------------------------------
+Object^ RetrieveCriteria::Cursor::current_item( void )
+{
+	return Current;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Returns an enumerator that iterates through found objects. This
+// is "GetEnumerator" call only.
+//
+//-------------------------------------------------------------------
+System::Collections::IEnumerator^ RetrieveCriteria::Cursor::get_enumerator( void )
+{
+	return GetEnumerator();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Creates cursor for specified criteria with specified page size.
+//
+// Criteria settings are copied, so their changes don't affect the
+// enumeration.
+//
+//-------------------------------------------------------------------
+RetrieveCriteria::Cursor::Cursor( RetrieveCriteria ^criteria, \
+								  unsigned short size ): \
+	_type(criteria->_type), _where(criteria->m_where),	 \
+	_order(criteria->m_orderBy), _bottom(criteria->m_bottom), \
+	_count(criteria->m_count), _asProxies(criteria->m_asProxies), \
+	_projection(criteria->m_projection == nullptr ? nullptr :  \
+		safe_cast<array<String^>^>( criteria->m_projection->Clone() )), \
+	_size(size)
+{
+	Reset();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Creates new cursor with the same settings as specified one.
+//
+//-------------------------------------------------------------------
+RetrieveCriteria::Cursor::Cursor( Cursor ^cursor ): \
+	_type(cursor->_type), _where(cursor->_where), \
+	_order(cursor->_order), _bottom(cursor->_bottom), \
+	_count(cursor->_count), _asProxies(cursor->_asProxies), \
+	_projection(cursor->_projection), _size(cursor->_size)
+{
+	Reset();
+}
+
+
+//-------------------------------------------------------------------
+//
+// Releases current page and stops enumeration.
+//
+//-------------------------------------------------------------------
+RetrieveCriteria::Cursor::~Cursor( void )
+{
+	m_page.Clear();
+	m_finished = true;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Gets the object at the current position of the enumerator.
+//
+//-------------------------------------------------------------------
+PersistentObject^ RetrieveCriteria::Cursor::Current::get( void )
+{
+	// check for enumerator is positioned on object
+	if( (m_index < 0) || (m_index >= m_page.Count) ) {
+		throw gcnew InvalidOperationException();
+	}
+	return m_page[m_index];
+}
+
+
+//-------------------------------------------------------------------
+//
+// Returns new enumerator that starts enumeration from the beginning.
+//
+//-------------------------------------------------------------------
+IEnumerator<PersistentObject^>^ RetrieveCriteria::Cursor::GetEnumerator( void )
+{
+	return gcnew Cursor(this);
+}
+
+
+//-------------------------------------------------------------------
+//
+// Advances the enumerator to the next object. Next page is requested
+// when current one is passed.
+//
+//-------------------------------------------------------------------
+bool RetrieveCriteria::Cursor::MoveNext( void )
+{
+	// move inside current page
+	if( ++m_index < m_page.Count ) return true;
+
+	// request pages until not empty one is found
+	// (page is empty if all objects are removed
+	// from the cache by factory)
+	while( !m_finished ) {
+		if( next_page() ) {
+			m_index = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Sets the enumerator to its initial position, which is before the
+// first object.
+//
+//-------------------------------------------------------------------
+void RetrieveCriteria::Cursor::Reset( void )
+{
+	m_page.Clear();
+	m_index = -1;
+	m_after = nullptr;
+	m_passed = 0;
+	m_finished = false;
+}
@@ -0,0 +1,76 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		RetrieveCriteria.Cursor.h									*/
+/*																			*/
+/*	Content:	Definition of RetrieveCriteria::Cursor class				*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#pragma once
+#include "RPL.h"
+#include "RetrieveCriteria.h"
+
+using namespace System;
+using namespace System::Collections::Generic;
+
+
+_RPL_BEGIN
+/// <summary>
+/// Forward-only enumeration of found objects.
+/// </summary><remarks><para>
+/// Objects are requested from storage page by page: every page starts
+/// after the keyset (OrderBy values and ID) of the last object of the
+/// previous one, so no server cursor is held between requests and only
+/// one page is stored in memory.</para><para>
+/// Criteria settings are copied when cursor is created. Every call to
+/// GetEnumerator starts new enumeration with the same settings.
+/// </para></remarks>
+ref class RetrieveCriteria::
+Cursor : IEnumerable<PersistentObject^>, IEnumerator<PersistentObject^>
+{
+private:
+	String^					const _type;
+	Where^					const _where;
+	OrderBy^				const _order;
+	int						const _bottom;
+	int						const _count;
+	bool					const _asProxies;
+	array<String^>^			const _projection;
+	unsigned short			const _size;
+
+	List<PersistentObject^>	m_page;
+	int						m_index;
+	array<ValueBox>			^m_after;
+	int						m_passed;
+	bool					m_finished;
+
+	Cursor( Cursor ^cursor );
+
+	bool next_page( void );
+
+	// IEnumerable
+	virtual System::Collections::IEnumerator^ get_enumerator( void ) sealed =
+		System::Collections::IEnumerable::GetEnumerator;
+	// IEnumerator
+	virtual Object^ current_item( void ) sealed =
+		System::Collections::IEnumerator::Current::get;
+
+public:
+	Cursor( RetrieveCriteria ^criteria, unsigned short size );
+	~Cursor( void );
+
+	property PersistentObject^ Current {
+		virtual PersistentObject^ get( void );
+	}
+
+	virtual IEnumerator<PersistentObject^>^ GetEnumerator( void );
+	virtual bool MoveNext( void );
+	virtual void Reset( void );
+};
+_RPL_END
@@ -13,7 +13,7 @@
 /****************************************************************************/
 
 #include "PersistentObject.h"
-#include "RetrieveCriteria.h"
+#include "RetrieveCriteria.Cursor.h"
 
 using namespace _RPL;
 
@@ -30,38 +30,33 @@ using namespace _RPL;
 //-----------------------------------------------------------------------------
 
 //-------------------------------------------------------------------
-/// <summary>
-/// Clear search result.
-/// </summary><remarks>
-/// Call base class implementation and reset current cursor position
-/// that could be modified by using cursor routine "Next".
-/// </remarks>
+//
+// Makes specified objects up-to-date and retrieves full objects from
+// persistence storage if needed (depending on criteria settings).
+//
 //-------------------------------------------------------------------
-void RetrieveCriteria::Reset( void )
+void RetrieveCriteria::retrieve( IEnumerable<PersistentObject^> ^objs )
 {
-	// call to base method
-	PersistentCriteria::Reset();
-	// and reset position
-	m_pos = -1;
+	retrieve( objs, m_asProxies, m_projection );
 }
 
 
 //-------------------------------------------------------------------
-/// <summary>
-/// Performs additional custom processes after filling collection by
-/// proxies: make objects up-to-date and retrieves full objects from
-/// persistence storage if needed.
-/// </summary><remarks>
-/// This is atomar operation, so it performs under transactional
-/// control.
-/// </remarks>
+//
+// Makes specified objects up-to-date and retrieves full objects from
+// persistence storage if needed (depending on specified settings).
+//
+// This is atomar operation, so it performs under transactional
+// control. Must be called under storage lock.
+//
 //-------------------------------------------------------------------
-void RetrieveCriteria::OnPerformComplete( void )
+void RetrieveCriteria::retrieve( IEnumerable<PersistentObject^> ^objs, \
+								 bool asProxies, array<String^> ^projection )
 {
 	// declare stack of changes to emulate transaction
 	Stack<ITransaction^>	changes;
 	try {
-		for each( PersistentObject ^obj in m_list ) {
+		for each( PersistentObject ^obj in objs ) {
 			// save all object's properties
 			safe_cast<ITransaction^>( obj )->Begin();
 			// add push to stack to future rollback
@@ -70,7 +65,12 @@ void RetrieveCriteria::OnPerformComplete( void )
 			// now make request based on type of retrieve criteria
 			// (if no full retrieve is needed then make object
 			// (proxy or full) up-to-date only)
-			obj->Retrieve( !m_asProxies );
+			if( !asProxies && (projection != nullptr) ) {
+				// retrieve specified properties only
+				obj->Retrieve( projection );
+			} else {
+				obj->Retrieve( !asProxies );
+			}
 		}
 		// retrieve operations was completed
 		// successfuly, now commit object changes
@@ -84,6 +84,39 @@ void RetrieveCriteria::OnPerformComplete( void )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Clear search result.
+/// </summary><remarks>
+/// Call base class implementation and reset current cursor position
+/// that could be modified by using cursor routine "Next".
+/// </remarks>
+//-------------------------------------------------------------------
+void RetrieveCriteria::Reset( void )
+{
+	// call to base method
+	PersistentCriteria::Reset();
+	// and reset position
+	m_pos = -1;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Performs additional custom processes after filling collection by
+/// proxies: make objects up-to-date and retrieves full objects from
+/// persistence storage if needed.
+/// </summary><remarks>
+/// This is atomar operation, so it performs under transactional
+/// control.
+/// </remarks>
+//-------------------------------------------------------------------
+void RetrieveCriteria::OnPerformComplete( void )
+{
+	retrieve( %m_list );
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Create instance of the RetrieveCriteria class to retrieve the
@@ -146,6 +179,28 @@ void RetrieveCriteria::AsProxies::set( bool value )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets or sets names of properties to be retrieved.
+/// </summary><remarks>
+/// If this property is set, then full objects will be retrieved with
+/// specified properties only, other properties will be loaded at first
+/// access to them. It is ignored for proxy requests and for objects
+/// that already have all properties loaded. By default is set to null
+/// (all properties are retrieved).
+/// </remarks>
+//-------------------------------------------------------------------
+array<String^>^ RetrieveCriteria::Projection::get( void )
+{
+	return m_projection;
+}
+
+void RetrieveCriteria::Projection::set( array<String^> ^value )
+{
+	m_projection = value;
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Read next count of objects from the recordset.
@@ -187,3 +242,30 @@ bool RetrieveCriteria::Next( unsigned short count )
 
 	return (Count > 0);
 }
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Returns collection that reads all found objects page by page.
+/// </summary><remarks><para>
+/// Unlike "Next", every page is requested from the last object of
+/// the previous one, so storage doesn't skip previous pages and
+/// doesn't count found objects on every request. Only one page of
+/// objects is held in memory, collection content is not changed.
+/// </para><para>
+/// Criteria settings (clauses, limits, retrieving method) are copied
+/// when this routine is called, so their later changes don't affect
+/// returned collection. Every page starts after OrderBy values and ID
+/// of the last object of the previous page, so changes and deletion of
+/// that object don't break enumeration: objects that are inserted,
+/// changed or deleted during enumeration are found or not depending on
+/// their new position.
+/// </para></remarks>
+//-------------------------------------------------------------------
+IEnumerable<PersistentObject^>^ RetrieveCriteria::Enumerate( unsigned short count )
+{
+	// check for page size
+	if( count == 0 ) throw gcnew ArgumentOutOfRangeException("count");
+
+	return gcnew Cursor(this, count);
+}
@@ -17,6 +17,7 @@
 #include "PersistentCriteria.h"
 
 using namespace System;
+using namespace System::Collections::Generic;
 
 
 _RPL_BEGIN
@@ -25,13 +26,22 @@ _RPL_BEGIN
 /// </summary><remarks><para>
 /// This criterial request means action on persistent mechanism. So, it
 /// proceses under transactial control.</para><para>
-/// Also, it add Next() routine that you can use to move throught all records.
+/// Also, it add Next() routine that you can use to move throught all records
+/// and Enumerate() routine to read all records page by page.
 /// </para></remarks>
 public ref class RetrieveCriteria sealed : PersistentCriteria
 {
 private:
-	bool	m_asProxies;
-	int		m_pos;
+	ref class Cursor;
+
+private:
+	bool				m_asProxies;
+	array<String^>		^m_projection;
+	int					m_pos;
+
+	void retrieve( IEnumerable<PersistentObject^> ^objs );
+	static void retrieve( IEnumerable<PersistentObject^> ^objs,
+						  bool asProxies, array<String^> ^projection );
 
 protected:
 	virtual void Reset( void ) override;
@@ -46,7 +56,12 @@ public:
 		bool get( void );
 		void set( bool value );
 	}
+	property array<String^>^ Projection {
+		array<String^>^ get( void );
+		void set( array<String^> ^value );
+	}
 
 	bool Next( unsigned short count );
+	IEnumerable<PersistentObject^>^ Enumerate( unsigned short count );
 };
 _RPL_END
@@ -192,6 +192,63 @@ namespace Storage {
 		int Search( String ^type, Where ^where, OrderBy ^order,
 					int bottom, int count,
 					[Out] array<HEADER>^ %headers );
+		/// <summary>
+		/// Search storage for persistent objects that satisfy specified
+		/// conditions without counting of all found objects.
+		/// </summary>
+		/// <param name="type">Objects type.</param>
+		/// <param name="where">SQL WHERE clause.</param>
+		/// <param name="order">SQL ORDER BY clause.</param>
+		/// <param name="bottom">Bottom limit in the request.</param>
+		/// <param name="count">Count limit in the request.</param>
+		/// <returns>
+		/// Array of found object headers.
+		/// </returns>
+		/// <remarks>
+		/// Works as full search request, but storage can stop search as
+		/// soon as requested page is found.
+		/// </remarks>
+		array<HEADER>^ Search( String ^type, Where ^where, OrderBy ^order,
+							   int bottom, int count );
+		/// <summary>
+		/// Count persistent objects that satisfy specified conditions.
+		/// </summary>
+		/// <param name="type">Objects type.</param>
+		/// <param name="where">SQL WHERE clause.</param>
+		/// <returns>
+		/// Number of objects found
+		/// </returns>
+		int Count( String ^type, Where ^where );
+		/// <summary>
+		/// Search storage for the next page of persistent objects that
+		/// satisfy specified conditions.
+		/// </summary>
+		/// <param name="type">Objects type.</param>
+		/// <param name="where">SQL WHERE clause.</param>
+		/// <param name="order">SQL ORDER BY clause.</param>
+		/// <param name="after">In/Out keyset of the last object of the
+		/// previous page (null reference for the first page).</param>
+		/// <param name="bottom">Count of objects to skip after the keyset.
+		/// </param>
+		/// <param name="count">Count limit in the request.</param>
+		/// <returns>
+		/// Array of found object headers.
+		/// </returns>
+		/// <remarks><para>
+		/// Objects are sorted by specified clause and then by ID. Keyset
+		/// is the array of object values for every OrderBy clause (DBNull
+		/// for missing value) followed by object ID. Page starts with the
+		/// first object that follows specified keyset in this order, so
+		/// storage has neither to read previous pages nor to count all
+		/// found objects (keyset pagination).</para><para>
+		/// Position doesn't depend on the object which keyset is used: it
+		/// can be changed or deleted after previous page is read. On return
+		/// "after" is set to the keyset of the last found object (it is not
+		/// changed if page is empty).
+		/// </para></remarks>
+		array<HEADER>^ SearchAfter( String ^type, Where ^where, OrderBy ^order,
+									array<ValueBox>^ %after, int bottom,
+									int count );
 
 		/// <summary>
 		/// Retrieve object header from storage.
@@ -216,6 +273,37 @@ namespace Storage {
 					   [Out] array<LINK>^ %links,
 					   [Out] array<PROPERTY>^ %props );
 		/// <summary>
+		/// Retrieve object header, links and specified properties from
+		/// storage.
+		/// </summary>
+		/// <param name="header">In/Out header value.</param>
+		/// <param name="names">Names of properties to be retrieved.</param>
+		/// <param name="links">Array of object links.</param>
+		/// <param name="props">Array of requested object properties.</param>
+		/// <remarks><para>
+		/// Type and object ID must be specified while call request.</para><para>
+		/// Works as full retrieve request, but returns only properties with
+		/// specified names (null reference means all properties). So large
+		/// values that are not needed are not transfered.
+		/// </para></remarks>
+		void Retrieve( HEADER %header, array<String^> ^names,
+					   [Out] array<LINK>^ %links,
+					   [Out] array<PROPERTY>^ %props );
+		/// <summary>
+		/// Check stamps of the set of objects in one request.
+		/// </summary>
+		/// <param name="headers">Array of headers with known stamps.</param>
+		/// <returns>
+		/// Array of current headers of the outdated objects only.
+		/// </returns>
+		/// <remarks><para>
+		/// Type, object ID and stamp must be specified for every header.
+		/// </para><para>
+		/// If object doesn't exist in the storage any more, the header with
+		/// the same type and ID and empty stamp is returned.
+		/// </para></remarks>
+		array<HEADER>^ Validate( array<HEADER> ^headers );
+		/// <summary>
 		/// Save object header, links and properties to storage.
 		/// </summary>
 		/// <param name="header">In/Out header value.</param>
@@ -246,6 +334,71 @@ namespace Storage {
 		/// </para></remarks>
 		void Delete( HEADER header );
 
+		/// <summary>
+		/// Open stream property of the object for reading by ranges.
+		/// </summary>
+		/// <param name="header">Header value.</param>
+		/// <param name="name">Name of stream property.</param>
+		/// <param name="hash">SHA-1 hash of property content (null
+		/// reference if storage doesn't know it).</param>
+		/// <returns>Length of property content.</returns>
+		/// <remarks>
+		/// Type and object ID must be specified while call request.
+		/// </remarks>
+		__int64 OpenBlob( HEADER header, String ^name,
+						  [Out] array<unsigned char>^ %hash );
+		/// <summary>
+		/// Read range of stream property content.
+		/// </summary>
+		/// <param name="header">Header value.</param>
+		/// <param name="name">Name of stream property.</param>
+		/// <param name="hash">SHA-1 hash of content returned by OpenBlob
+		/// (null reference to read current content of the property).</param>
+		/// <param name="offset">Offset of the range.</param>
+		/// <param name="count">Maximum length of the range.</param>
+		/// <returns>
+		/// Content of the range (shorter than requested at the end of
+		/// content).
+		/// </returns>
+		/// <remarks>
+		/// Content with specified hash is read while it is stored, even if
+		/// property was changed after it was opened. So all ranges of one
+		/// read belong to the same content.
+		/// </remarks>
+		array<unsigned char>^ ReadBlob( HEADER header, String ^name,
+										array<unsigned char> ^hash,
+										__int64 offset, int count );
+		/// <summary>
+		/// Write range of content that is uploaded to the storage.
+		/// </summary>
+		/// <param name="hash">SHA-1 hash of whole content.</param>
+		/// <param name="offset">Offset of the range.</param>
+		/// <param name="data">Content of the range.</param>
+		/// <returns>Length of content stored for this hash.</returns>
+		/// <remarks><para>
+		/// Uploaded content is identified by its hash, so interrupted upload
+		/// can be resumed from returned length (range with offset greater
+		/// than stored length is not written). If the same content is
+		/// stored already, nothing is written and its full length is
+		/// returned.</para><para>
+		/// Uploaded content is not visible until CommitBlob call.
+		/// </para></remarks>
+		__int64 WriteBlob( array<unsigned char> ^hash,
+						   __int64 offset, array<unsigned char> ^data );
+		/// <summary>
+		/// Assign uploaded content to stream property of the object.
+		/// </summary>
+		/// <param name="header">In/Out header value.</param>
+		/// <param name="name">Name of stream property.</param>
+		/// <param name="hash">SHA-1 hash of uploaded content.</param>
+		/// <remarks><para>
+		/// Type and object ID must be specified while call request.</para><para>
+		/// Storage has to check hash of uploaded content. Object is changed
+		/// by this call, so new stamp is returned through header.
+		/// </para></remarks>
+		void CommitBlob( HEADER %header, String ^name,
+						 array<unsigned char> ^hash );
+
 		/// <summary>
 		/// Submit hardcoded SQL statements to the persistence.
 		/// </summary>
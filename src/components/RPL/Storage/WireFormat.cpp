@@ -0,0 +1,636 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		WireFormat.cpp												*/
+/*																			*/
+/*	Content:	Implementation of Storage::WireFormat class					*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#include "..\PersistentStream.h"
+#include "WireFormat.h"
+
+using namespace System::Text;
+using namespace System::Runtime::Serialization::Formatters::Binary;
+using namespace _RPL;
+using namespace _RPL::Storage;
+
+
+//
+// Define checks for instance mode
+//
+#define CHECK_WRITING														\
+if( m_indexes == nullptr ) throw gcnew InvalidOperationException(			\
+	String::Format( ERR_WIRE_MODE, "reading" ));
+
+#define CHECK_READING														\
+if( m_names == nullptr ) throw gcnew InvalidOperationException(				\
+	String::Format( ERR_WIRE_MODE, "writing" ));
+
+
+//----------------------------------------------------------------------------
+//						Toolkit::RPL::Storage::WireFormat
+//----------------------------------------------------------------------------
+
+//-------------------------------------------------------------------
+//
+// Writes unsigned number by 7 bits per byte (high bit means that
+// next byte follows).
+//
+//-------------------------------------------------------------------
+void WireFormat::write_uint( unsigned __int64 value )
+{
+	while( value >= 0x80 ) {
+		m_stream->WriteByte( static_cast<Byte>( value | 0x80 ) );
+		value >>= 7;
+	}
+	m_stream->WriteByte( static_cast<Byte>( value ) );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Reads unsigned number written by write_uint.
+//
+//-------------------------------------------------------------------
+unsigned __int64 WireFormat::read_uint( void )
+{
+	unsigned __int64	value = 0;
+
+	for( int shift = 0; shift < 64; shift += 7 ) {
+		int		b = m_stream->ReadByte();
+
+		if( b < 0 ) throw gcnew InvalidDataException(ERR_WIRE_DATA);
+
+		value |= static_cast<unsigned __int64>( b & 0x7F ) << shift;
+		if( (b & 0x80) == 0 ) return value;
+	}
+	throw gcnew InvalidDataException(ERR_WIRE_DATA);
+}
+
+
+//-------------------------------------------------------------------
+//
+// Writes signed number: sign is moved to the lowest bit, so small
+// negative numbers are short too.
+//
+//-------------------------------------------------------------------
+void WireFormat::write_int( __int64 value )
+{
+	write_uint( static_cast<unsigned __int64>( (value << 1) ^ (value >> 63) ) );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Reads signed number written by write_int.
+//
+//-------------------------------------------------------------------
+__int64 WireFormat::read_int( void )
+{
+	unsigned __int64	value = read_uint();
+
+	return static_cast<__int64>( value >> 1 ) ^ -static_cast<__int64>( value & 1 );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Writes array of bytes with its length.
+//
+//-------------------------------------------------------------------
+void WireFormat::write_bytes( array<Byte> ^bytes )
+{
+	write_uint( bytes->Length );
+	m_stream->Write( bytes, 0, bytes->Length );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Reads array of bytes written by write_bytes.
+//
+//-------------------------------------------------------------------
+array<Byte>^ WireFormat::read_bytes( void )
+{
+	unsigned __int64	length = read_uint();
+
+	// check for length is in the rest of data
+	if( length > static_cast<unsigned __int64>( m_stream->Length - m_stream->Position ) ) {
+		throw gcnew InvalidDataException(ERR_WIRE_DATA);
+	}
+	array<Byte>	^bytes = gcnew array<Byte>(static_cast<int>( length ));
+	m_stream->Read( bytes, 0, bytes->Length );
+
+	return bytes;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Writes string in UTF-8 encoding (zero length means null
+// reference, so length of string is shifted by one).
+//
+//-------------------------------------------------------------------
+void WireFormat::write_string( String ^s )
+{
+	if( s == nullptr ) {
+		write_uint( 0 );
+		return;
+	}
+	array<Byte>	^bytes = Encoding::UTF8->GetBytes( s );
+
+	write_uint( static_cast<unsigned __int64>( bytes->Length ) + 1 );
+	m_stream->Write( bytes, 0, bytes->Length );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Reads string written by write_string.
+//
+//-------------------------------------------------------------------
+String^ WireFormat::read_string( void )
+{
+	unsigned __int64	length = read_uint();
+
+	if( length == 0 ) return nullptr;
+	// check for string is in the rest of data
+	if( --length > static_cast<unsigned __int64>( m_stream->Length - m_stream->Position ) ) {
+		throw gcnew InvalidDataException(ERR_WIRE_DATA);
+	}
+	String	^s = Encoding::UTF8->GetString( m_data,
+											static_cast<int>( m_stream->Position ),
+											static_cast<int>( length ) );
+	m_stream->Position += static_cast<__int64>( length );
+
+	return s;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Writes string that is expected to be repeated (type and property
+// names): first occurrence is written as is and added to the table,
+// next ones are written as index in this table.
+//
+// Zero means null reference, one means new string, other values
+// are indexes shifted by two.
+//
+//-------------------------------------------------------------------
+void WireFormat::write_name( String ^s )
+{
+	int		index = 0;
+
+	if( s == nullptr ) {
+		write_uint( 0 );
+	} else if( m_indexes->TryGetValue( s, index ) ) {
+		write_uint( static_cast<unsigned __int64>( index ) + 2 );
+	} else {
+		m_indexes->Add( s, m_indexes->Count );
+		write_uint( 1 );
+		write_string( s );
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Reads string written by write_name. New strings are interned, so
+// all values share one instance of every name.
+//
+//-------------------------------------------------------------------
+String^ WireFormat::read_name( void )
+{
+	unsigned __int64	code = read_uint();
+
+	if( code == 0 ) return nullptr;
+	if( code == 1 ) {
+		String	^s = read_string();
+
+		if( s == nullptr ) throw gcnew InvalidDataException(ERR_WIRE_DATA);
+
+		s = String::Intern( s );
+		m_names->Add( s );
+		return s;
+	}
+	// check for index is in the table
+	if( code - 2 >= static_cast<unsigned __int64>( m_names->Count ) ) {
+		throw gcnew InvalidDataException(ERR_WIRE_DATA);
+	}
+	return m_names[static_cast<int>( code - 2 )];
+}
+
+
+//-------------------------------------------------------------------
+//
+// Writes stamp as difference with previous one. Stamps of objects
+// in one request are usually close, so differences are short. Kind
+// of stamp is stored in two lowest bits. Difference that can't be
+// shifted (stamps near the ends of range) is replaced by unused kind
+// value followed by the full stamp.
+//
+//-------------------------------------------------------------------
+void WireFormat::write_stamp( DateTime stamp )
+{
+	__int64		ticks = stamp.Ticks;
+	__int64		delta = ticks - m_stamp;
+
+	if( (delta > (Int64::MaxValue >> 2)) || (delta < (Int64::MinValue >> 2)) ) {
+		write_int( 0x3 );
+		write_uint( (static_cast<unsigned __int64>( ticks ) << 2) |
+					static_cast<unsigned __int64>( stamp.Kind ) );
+	} else {
+		write_int( (delta << 2) | static_cast<__int64>( stamp.Kind ) );
+	}
+	m_stamp = ticks;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Reads stamp written by write_stamp.
+//
+//-------------------------------------------------------------------
+DateTime WireFormat::read_stamp( void )
+{
+	__int64		value = read_int();
+
+	if( value == 0x3 ) {
+		// full stamp
+		unsigned __int64	full = read_uint();
+
+		m_stamp = static_cast<__int64>( full >> 2 );
+		value = static_cast<__int64>( full & 0x3 );
+	} else {
+		m_stamp += (value >> 2);
+	}
+	// check for ticks and kind are in range
+	if( (m_stamp < DateTime::MinValue.Ticks) || (m_stamp > DateTime::MaxValue.Ticks) ||
+		((value & 0x3) == 0x3) ) {
+		throw gcnew InvalidDataException(ERR_WIRE_DATA);
+	}
+	return DateTime( m_stamp, static_cast<DateTimeKind>( value & 0x3 ) );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Writes property value with one byte tag. Streams are written by
+// their own serialization.
+//
+//-------------------------------------------------------------------
+void WireFormat::write_value( ValueBox value )
+{
+	Object	^o = value.ToObject();
+
+	switch( Type::GetTypeCode( o->GetType() ) ) {
+		case TypeCode::Boolean:
+			m_stream->WriteByte( static_cast<Byte>(
+				safe_cast<bool>( o ) ? TAG::True : TAG::False ) );
+			break;
+		case TypeCode::Int32:
+			m_stream->WriteByte( static_cast<Byte>( TAG::Int ) );
+			write_int( safe_cast<int>( o ) );
+			break;
+		case TypeCode::Double:
+			m_stream->WriteByte( static_cast<Byte>( TAG::Double ) );
+			m_stream->Write( BitConverter::GetBytes( safe_cast<double>( o ) ), 0, 8 );
+			break;
+		case TypeCode::DateTime: {
+			DateTime	dt = safe_cast<DateTime>( o );
+
+			// ticks and kind without time zone conversion
+			m_stream->WriteByte( static_cast<Byte>( TAG::DateTime ) );
+			m_stream->Write( BitConverter::GetBytes(
+				dt.Ticks | (static_cast<__int64>( dt.Kind ) << 62) ), 0, 8 );
+			break;
+		}
+		case TypeCode::String:
+			m_stream->WriteByte( static_cast<Byte>( TAG::String ) );
+			write_string( safe_cast<String^>( o ) );
+			break;
+		case TypeCode::Object: {
+			MemoryStream	^ms = gcnew MemoryStream();
+			(gcnew BinaryFormatter())->Serialize( ms, o );
+
+			m_stream->WriteByte( static_cast<Byte>( TAG::Stream ) );
+			write_bytes( ms->ToArray() );
+			break;
+		}
+		default:
+			m_stream->WriteByte( static_cast<Byte>( TAG::Null ) );
+			break;
+	}
+}
+
+
+//-------------------------------------------------------------------
+//
+// Reads property value written by write_value.
+//
+//-------------------------------------------------------------------
+ValueBox WireFormat::read_value( void )
+{
+	int		tag = m_stream->ReadByte();
+
+	switch( static_cast<TAG>( tag ) ) {
+		case TAG::Null:
+			return DBNull::Value;
+		case TAG::False:
+			return false;
+		case TAG::True:
+			return true;
+		case TAG::Int:
+			return static_cast<int>( read_int() );
+		case TAG::Double:
+		case TAG::DateTime: {
+			array<Byte>	^bytes = gcnew array<Byte>(8);
+
+			if( m_stream->Read( bytes, 0, 8 ) < 8 ) break;
+
+			__int64		bits = BitConverter::ToInt64( bytes, 0 );
+			if( static_cast<TAG>( tag ) == TAG::DateTime ) {
+				__int64		ticks = bits & 0x3FFFFFFFFFFFFFFFLL;
+				int			kind = static_cast<int>( (bits >> 62) & 0x3 );
+
+				// check for ticks and kind are in range
+				if( (ticks > DateTime::MaxValue.Ticks) || (kind == 0x3) ) break;
+
+				return DateTime( ticks, static_cast<DateTimeKind>( kind ) );
+			}
+			return BitConverter::Int64BitsToDouble( bits );
+		}
+		case TAG::String: {
+			String	^s = read_string();
+
+			if( s == nullptr ) break;
+			return s;
+		}
+		case TAG::Stream:
+			return safe_cast<PersistentStream^>( (gcnew BinaryFormatter())->
+				Deserialize( gcnew MemoryStream(read_bytes(), false) ) );
+	}
+	// unknown tag or end of data
+	throw gcnew InvalidDataException(ERR_WIRE_DATA);
+}
+
+
+//-------------------------------------------------------------------
+//
+// Writes count of elements in array (zero means null reference).
+// Returns false if there are no elements to write.
+//
+//-------------------------------------------------------------------
+bool WireFormat::write_count( Array ^arr )
+{
+	if( arr == nullptr ) {
+		write_uint( 0 );
+		return false;
+	}
+	write_uint( static_cast<unsigned __int64>( arr->Length ) + 1 );
+	return (arr->Length > 0);
+}
+
+
+//-------------------------------------------------------------------
+//
+// Reads count of elements written by write_count (-1 means null
+// reference).
+//
+//-------------------------------------------------------------------
+int WireFormat::read_count( void )
+{
+	unsigned __int64	count = read_uint();
+
+	// every element takes one byte at least
+	if( count > static_cast<unsigned __int64>( m_stream->Length - m_stream->Position ) + 1 ) {
+		throw gcnew InvalidDataException(ERR_WIRE_DATA);
+	}
+	return static_cast<int>( count ) - 1;
+}
+
+
+//-------------------------------------------------------------------
+//
+// Reads one byte state of link or property (state can't be greater
+// than specified maximum value).
+//
+//-------------------------------------------------------------------
+int WireFormat::read_state( int max )
+{
+	int		state = m_stream->ReadByte();
+
+	// check for end of data and unknown state
+	if( (state < 0) || (state > max) ) throw gcnew InvalidDataException(ERR_WIRE_DATA);
+
+	return state;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Creates instance to write encoded data.
+/// </summary>
+//-------------------------------------------------------------------
+WireFormat::WireFormat( void ): \
+	m_stream(gcnew MemoryStream()), m_data(nullptr), \
+	m_indexes(gcnew Dictionary<String^, int>()), m_names(nullptr), m_stamp(0)
+{
+	// do nothing
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Creates instance to read specified encoded data.
+/// </summary>
+//-------------------------------------------------------------------
+WireFormat::WireFormat( array<Byte> ^data ): \
+	m_stream(nullptr), m_data(data), \
+	m_indexes(nullptr), m_names(gcnew List<String^>()), m_stamp(0)
+{
+	// check for null reference
+	if( data == nullptr ) throw gcnew ArgumentNullException("data");
+
+	m_stream = gcnew MemoryStream(data, false);
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Gets length of encoded data in bytes.
+/// </summary>
+//-------------------------------------------------------------------
+__int64 WireFormat::Length::get( void )
+{
+	return m_stream->Length;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Writes header.
+/// </summary>
+//-------------------------------------------------------------------
+void WireFormat::Write( HEADER header )
+{
+	CHECK_WRITING
+
+	write_name( header.Type );
+	write_int( header.ID );
+	write_stamp( header.Stamp );
+	write_string( header.Name );
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Writes array of headers (null reference is allowed).
+/// </summary>
+//-------------------------------------------------------------------
+void WireFormat::Write( array<HEADER> ^headers )
+{
+	CHECK_WRITING
+
+	if( write_count( headers ) ) {
+		for each( HEADER header in headers ) Write( header );
+	}
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Writes array of links (null reference is allowed).
+/// </summary>
+//-------------------------------------------------------------------
+void WireFormat::Write( array<LINK> ^links )
+{
+	CHECK_WRITING
+
+	if( write_count( links ) ) {
+		for each( LINK link in links ) {
+			Write( link.Header );
+			m_stream->WriteByte( static_cast<Byte>( link.State ) );
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Writes array of properties (null reference is allowed).
+/// </summary>
+//-------------------------------------------------------------------
+void WireFormat::Write( array<PROPERTY> ^props )
+{
+	CHECK_WRITING
+
+	if( write_count( props ) ) {
+		for each( PROPERTY prop in props ) {
+			write_name( prop.Name );
+			write_value( prop.Value );
+			m_stream->WriteByte( static_cast<Byte>( prop.State ) );
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Reads header.
+/// </summary>
+//-------------------------------------------------------------------
+HEADER WireFormat::ReadHeader( void )
+{
+	CHECK_READING
+
+	String		^type = read_name();
+	int			id = static_cast<int>( read_int() );
+	DateTime	stamp = read_stamp();
+	String		^name = read_string();
+
+	return HEADER(type, id, stamp, name);
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Reads array of headers.
+/// </summary>
+//-------------------------------------------------------------------
+array<HEADER>^ WireFormat::ReadHeaders( void )
+{
+	CHECK_READING
+
+	int		count = read_count();
+	if( count < 0 ) return nullptr;
+
+	array<HEADER>	^headers = gcnew array<HEADER>(count);
+	for( int i = 0; i < count; i++ ) headers[i] = ReadHeader();
+
+	return headers;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Reads array of links.
+/// </summary>
+//-------------------------------------------------------------------
+array<LINK>^ WireFormat::ReadLinks( void )
+{
+	CHECK_READING
+
+	int		count = read_count();
+	if( count < 0 ) return nullptr;
+
+	array<LINK>	^links = gcnew array<LINK>(count);
+	for( int i = 0; i < count; i++ ) {
+		HEADER	header = ReadHeader();
+
+		links[i] = LINK(header, static_cast<LINK::STATE>(
+			read_state( static_cast<int>( LINK::STATE::Deleted ) ) ));
+	}
+	return links;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Reads array of properties.
+/// </summary>
+//-------------------------------------------------------------------
+array<PROPERTY>^ WireFormat::ReadProperties( void )
+{
+	CHECK_READING
+
+	int		count = read_count();
+	if( count < 0 ) return nullptr;
+
+	array<PROPERTY>	^props = gcnew array<PROPERTY>(count);
+	for( int i = 0; i < count; i++ ) {
+		String		^name = read_name();
+		ValueBox	value = read_value();
+
+		props[i] = PROPERTY(name, value, static_cast<PROPERTY::STATE>(
+			read_state( static_cast<int>( PROPERTY::STATE::Deleted ) ) ));
+	}
+	return props;
+}
+
+
+//-------------------------------------------------------------------
+/// <summary>
+/// Returns encoded data.
+/// </summary>
+//-------------------------------------------------------------------
+array<Byte>^ WireFormat::ToArray( void )
+{
+	return m_stream->ToArray();
+}
@@ -0,0 +1,95 @@
+/****************************************************************************/
+/*																			*/
+/*	Project:	Robust Persistence Layer									*/
+/*																			*/
+/*	Module:		WireFormat.h												*/
+/*																			*/
+/*	Content:	Definition of Storage::WireFormat class						*/
+/*																			*/
+/*	Author:		Alexey Tkachuk												*/
+/*	Copyright:	Copyright © 2007-2009 Alexey Tkachuk						*/
+/*				All Rights Reserved											*/
+/*																			*/
+/****************************************************************************/
+
+#pragma once
+#include "..\RPL.h"
+#include "IPersistenceStorage.h"
+
+using namespace System;
+using namespace System::IO;
+using namespace System::Collections::Generic;
+
+
+_RPL_BEGIN
+namespace Storage {
+	/// <summary>
+	/// Compact binary encoding of headers, links and properties.
+	/// </summary><remarks><para>
+	/// Default .NET serialization writes type and field names and
+	/// repeats every string for every element. This encoding writes
+	/// only values: type and property names are written once and then
+	/// are referenced by index, integers are written as variable
+	/// length numbers, stamps are written as difference with previous
+	/// stamp and property values are written with one byte type tag.
+	/// </para><para>
+	/// Instance is created for writing (default constructor) or for
+	/// reading of encoded data. Values must be read in the same order
+	/// as they were written.
+	/// </para></remarks>
+	public ref class WireFormat sealed
+	{
+	private:
+		//
+		// Type tags of property values.
+		//
+		enum class TAG : unsigned char {
+			Null = 0, False, True, Int, Double, DateTime, String, Stream
+		};
+
+	private:
+		MemoryStream				^m_stream;
+		array<Byte>					^m_data;
+		Dictionary<String^, int>	^m_indexes;
+		List<String^>				^m_names;
+		__int64						m_stamp;
+
+		void write_uint( unsigned __int64 value );
+		unsigned __int64 read_uint( void );
+		void write_int( __int64 value );
+		__int64 read_int( void );
+		void write_bytes( array<Byte> ^bytes );
+		array<Byte>^ read_bytes( void );
+		void write_string( String ^s );
+		String^ read_string( void );
+		void write_name( String ^s );
+		String^ read_name( void );
+		void write_stamp( DateTime stamp );
+		DateTime read_stamp( void );
+		void write_value( ValueBox value );
+		ValueBox read_value( void );
+		bool write_count( Array ^arr );
+		int read_count( void );
+		int read_state( int max );
+
+	public:
+		WireFormat( void );
+		WireFormat( array<Byte> ^data );
+
+		property __int64 Length {
+			__int64 get( void );
+		}
+
+		void Write( HEADER header );
+		void Write( array<HEADER> ^headers );
+		void Write( array<LINK> ^links );
+		void Write( array<PROPERTY> ^props );
+
+		HEADER ReadHeader( void );
+		array<HEADER>^ ReadHeaders( void );
+		array<LINK>^ ReadLinks( void );
+		array<PROPERTY>^ ReadProperties( void );
+
+		array<Byte>^ ToArray( void );
+	};
+}_RPL_END
@@ -19,54 +19,34 @@ using namespace _RPL;
 
 
 //
-// Define double safe cast operation
+// Define position and mask of DateTime kind in inline data
+// (it is the same layout as DateTime uses internally).
 //
-#define SCAST_(to, from, value)												\
-safe_cast<to>( safe_cast<from>( value ) )
+#define KIND_SHIFT		62
+#define TICKS_MASK		0x3FFFFFFFFFFFFFFFLL
 
 //
-// Define macro for implicit cast operator from
-// specified type to ValueBox.
-//
-#define OP_IMP_FROM_(type)													\
-ValueBox::operator ValueBox( type v )										\
-{																			\
-	return ValueBox( v );													\
-}
-
-//
-// Define macro for explicit cast operator from
-// ValueBox to specified native type.
+// Define macro for explicit cast operator from ValueBox
+// (being in 'tag' type) to specified native type.
 //
-#define OP_EXP_TO_(type)													\
+#define OP_EXP_TO_(type, tag, value)										\
 ValueBox::operator type( ValueBox box )										\
 {																			\
-	Object	^val = box.ToObject();											\
-	Type	^r = val->GetType();											\
-	Type	^t = type::typeid;												\
-																			\
-	if( r == t ) return safe_cast<type>( val );								\
+	if( box.m_type == TYPE::tag ) return value;								\
 																			\
-	throw gcnew InvalidCastException(String::Format(						\
-	ERR_CAST_FROM_TO, r->ToString(), t->ToString() ));						\
+	throw cast_error( box, type::typeid );									\
 }
 
 //
 // Define macro for explicit cast operator from ValueBox
 // (being in 'from' type) to specified 'to' type.
 //
-#define OP_EXP_(to, from)													\
+#define OP_EXP_(to, from, tag, value)										\
 ValueBox::operator to( ValueBox box )										\
 {																			\
-	Object	^val = box.ToObject();											\
-	Type	^r = val->GetType();											\
-	Type	^f = from::typeid;												\
-	Type	^t = to::typeid;												\
+	if( box.m_type == TYPE::tag ) return static_cast<to>( (from) value );	\
 																			\
-	if( r == f ) return SCAST_(to, from, val );								\
-																			\
-	throw gcnew InvalidCastException(String::Format(						\
-	ERR_CAST_FROM_TO, r->ToString(), t->ToString() ));						\
+	throw cast_error( box, to::typeid );									\
 }
 
 
@@ -74,19 +54,139 @@ ValueBox::operator to( ValueBox box )										\
 //							Toolkit::PRL::ValueBox
 //----------------------------------------------------------------------------
 
+//-------------------------------------------------------------------
+//
+// Creates new instance of the ValueBox class with specified tag and
+// data.
+//
+//-------------------------------------------------------------------
+ValueBox::ValueBox( TYPE type, __int64 data, Object ^ref ): \
+	m_type(type), m_data(data), m_ref(ref)
+{
+	// do nothing
+}
+
+
+//-------------------------------------------------------------------
+//
+// Stores specified object as internal data.
+//
+// Type is checked by type code, so only types with Object code
+// (PersistentStream) are compared by identity.
+//
+//-------------------------------------------------------------------
+void ValueBox::assign( Object ^o )
+{
+	// check for null reference
+	if( o == nullptr ) throw gcnew ArgumentNullException("o");
+
+	// get type of value
+	Type	^type = o->GetType();
+
+	// check this type through all supported types (native
+	// types are stored as is, convertible are converted to
+	// native int or double)
+	switch( Type::GetTypeCode( type ) ) {
+		case TypeCode::Boolean:
+			*this = safe_cast<bool>( o );
+			return;
+		case TypeCode::Int32:
+			*this = safe_cast<int>( o );
+			return;
+		case TypeCode::Double:
+			*this = safe_cast<double>( o );
+			return;
+		case TypeCode::DateTime:
+			*this = safe_cast<DateTime>( o );
+			return;
+		case TypeCode::String:
+			*this = safe_cast<String^>( o );
+			return;
+		case TypeCode::DBNull:
+			*this = ValueBox();
+			return;
+		case TypeCode::SByte:
+			*this = static_cast<int>( safe_cast<char>( o ) );
+			return;
+		case TypeCode::Byte:
+			*this = static_cast<int>( safe_cast<unsigned char>( o ) );
+			return;
+		case TypeCode::Int16:
+			*this = static_cast<int>( safe_cast<short>( o ) );
+			return;
+		case TypeCode::UInt16:
+			*this = static_cast<int>( safe_cast<unsigned short>( o ) );
+			return;
+		case TypeCode::UInt32:
+			*this = static_cast<int>( safe_cast<unsigned int>( o ) );
+			return;
+		case TypeCode::Single:
+			*this = static_cast<double>( safe_cast<float>( o ) );
+			return;
+		case TypeCode::Object:
+			if( type == PersistentStream::typeid ) {
+				*this = safe_cast<PersistentStream^>( o );
+				return;
+			}
+			break;
+	}
+	//unsupported type: throw exception
+	throw gcnew ArgumentException(String::Format(
+	ERR_INVALID_TYPE, type->ToString() ));
+}
+
+
+//-------------------------------------------------------------------
+//
+// Returns double value stored inline.
+//
+//-------------------------------------------------------------------
+double ValueBox::get_double( void )
+{
+	return BitConverter::Int64BitsToDouble( m_data );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Returns DateTime value stored inline.
+//
+//-------------------------------------------------------------------
+DateTime ValueBox::get_datetime( void )
+{
+	return DateTime( m_data & TICKS_MASK,
+					 static_cast<DateTimeKind>( (m_data >> KIND_SHIFT) & 0x3 ) );
+}
+
+
+//-------------------------------------------------------------------
+//
+// Creates exception for failed cast of specified box to specified
+// type.
+//
+//-------------------------------------------------------------------
+InvalidCastException^ ValueBox::cast_error( ValueBox box, Type ^type )
+{
+	return gcnew InvalidCastException(String::Format(
+	ERR_CAST_FROM_TO, box.ToObject()->GetType()->ToString(),
+					  type->ToString() ));
+}
+
+
 //-------------------------------------------------------------------
 //
 // Creates a new instance of the ValueBox class using serialization
 // info.
 //
 //-------------------------------------------------------------------
-ValueBox::ValueBox( SerializationInfo ^info, StreamingContext context )
+ValueBox::ValueBox( SerializationInfo ^info, StreamingContext context ): \
+	m_type(TYPE::Null), m_data(0), m_ref(nullptr)
 {
 	// check for null reference
 	if( info == nullptr ) throw gcnew ArgumentNullException("info");
 
 	// restore value from serialization info
-	m_value = info->GetValue( "value", Object::typeid );
+	assign( info->GetValue( "value", Object::typeid ) );
 }
 
 
@@ -97,6 +197,9 @@ ValueBox::ValueBox( SerializationInfo ^info, StreamingContext context )
 // Populates a System.Runtime.Serialization.SerializationInfo with
 // the data needed to serialize the target object.
 //
+// Value is saved as object, so format is the same as for previous
+// versions of ValueBox.
+//
 //-------------------------------------------------------------------
 void ValueBox::get_object_data( SerializationInfo ^info,
 								StreamingContext context )
@@ -105,7 +208,7 @@ void ValueBox::get_object_data( SerializationInfo ^info,
 	if( info == nullptr ) throw gcnew ArgumentNullException("info");
 
 	// save serialization data
-	info->AddValue( "value", m_value );
+	info->AddValue( "value", ToObject() );
 }
 
 
@@ -121,62 +224,9 @@ void ValueBox::get_object_data( SerializationInfo ^info,
 /// </remarks>
 //-------------------------------------------------------------------
 ValueBox::ValueBox( Object ^o ): \
-	m_value(DBNull::Value)
+	m_type(TYPE::Null), m_data(0), m_ref(nullptr)
 {
-	// check for null reference
-	if( o == nullptr ) throw gcnew ArgumentNullException("o");
-
-	// get type of value
-	Type	^type = o->GetType();
-
-	// check this type through all supported types (native
-	// types checks first, so it minimize processing of
-	// cast operators, because of they convert values to
-	// such types, then process all convertible)
-	if( type == bool::typeid ) {
-		// native bool
-		m_value = safe_cast<bool>( o );
-	} else if( type == int::typeid ) {
-		// native int
-		m_value = safe_cast<int>( o );
-	} else if( type == double::typeid ) {
-		// native double
-		m_value = safe_cast<double>( o );
-	} else if( type == DateTime::typeid ) {
-		// native DateTime
-		m_value = safe_cast<DateTime>( o );
-	} else if( type == String::typeid ) {
-		// native String
-		m_value = safe_cast<String^>( o );
-	} else if( type == PersistentStream::typeid ) {
-		// native PersistentStream
-		m_value = safe_cast<PersistentStream^>( o );
-	} else if( type == DBNull::typeid ) {
-		// native DBNull
-		// do nothing: m_value already initialized with it
-	} else if( type == char::typeid ) {
-		// convertible to int
-		m_value = SCAST_(int, char, o);
-	} else if( type == unsigned char::typeid ) {
-		// convertible to int
-		m_value = SCAST_(int, unsigned char, o);
-	} else if( type == short::typeid ) {
-		// convertible to int
-		m_value = SCAST_(int, short, o);
-	} else if( type == unsigned short::typeid ) {
-		// convertible to int
-		m_value = SCAST_(int, unsigned short, o);
-	} else if( type == unsigned int::typeid) {
-		// convertible to int
-		m_value = SCAST_(int, unsigned int, o);
-	} else if( type == float::typeid ) {
-		// convertible to double
-		m_value = SCAST_(double, float, o );
-	} else {
-		//unsupported type: throw exception
-		throw gcnew ArgumentException(String::Format(
-		ERR_INVALID_TYPE, type->ToString() ));
-	}
+	assign( o );
 }
 
 
@@ -185,7 +235,10 @@ ValueBox::ValueBox( Object ^o ): \
 /// Implicit cast operator from bool value to ValueBox.
 /// </summary>
 //-------------------------------------------------------------------
-OP_IMP_FROM_(bool)
+ValueBox::operator ValueBox( bool b )
+{
+	return ValueBox(TYPE::Bool, b ? 1 : 0, nullptr);
+}
 
 
 //-------------------------------------------------------------------
@@ -193,7 +246,10 @@ OP_IMP_FROM_(bool)
 /// Implicit cast operator from int value to ValueBox.
 /// </summary>
 //-------------------------------------------------------------------
-OP_IMP_FROM_(int)
+ValueBox::operator ValueBox( int i )
+{
+	return ValueBox(TYPE::Int, i, nullptr);
+}
 
 
 //-------------------------------------------------------------------
@@ -201,7 +257,10 @@ OP_IMP_FROM_(int)
 /// Implicit cast operator from double value to ValueBox.
 /// </summary>
 //-------------------------------------------------------------------
-OP_IMP_FROM_(double)
+ValueBox::operator ValueBox( double f )
+{
+	return ValueBox(TYPE::Double, BitConverter::DoubleToInt64Bits( f ), nullptr);
+}
 
 
 //-------------------------------------------------------------------
@@ -209,7 +268,12 @@ OP_IMP_FROM_(double)
 /// Implicit cast operator from DateTime value to ValueBox.
 /// </summary>
 //-------------------------------------------------------------------
-OP_IMP_FROM_(DateTime)
+ValueBox::operator ValueBox( DateTime dt )
+{
+	return ValueBox(TYPE::DateTime,
+					dt.Ticks | (static_cast<__int64>( dt.Kind ) << KIND_SHIFT),
+					nullptr);
+}
 
 
 //-------------------------------------------------------------------
@@ -217,7 +281,13 @@ OP_IMP_FROM_(DateTime)
 /// Implicit cast operator from String value to ValueBox.
 /// </summary>
 //-------------------------------------------------------------------
-OP_IMP_FROM_(String^)
+ValueBox::operator ValueBox( String ^s )
+{
+	// check for null reference
+	if( s == nullptr ) throw gcnew ArgumentNullException("s");
+
+	return ValueBox(TYPE::String, 0, s);
+}
 
 
 //-------------------------------------------------------------------
@@ -225,7 +295,13 @@ OP_IMP_FROM_(String^)
 /// Implicit cast operator from PersistentStream value to ValueBox.
 /// </summary>
 //-------------------------------------------------------------------
-OP_IMP_FROM_(PersistentStream^)
+ValueBox::operator ValueBox( PersistentStream ^stream )
+{
+	// check for null reference
+	if( stream == nullptr ) throw gcnew ArgumentNullException("stream");
+
+	return ValueBox(TYPE::Stream, 0, stream);
+}
 
 
 //-------------------------------------------------------------------
@@ -233,7 +309,13 @@ OP_IMP_FROM_(PersistentStream^)
 /// Implicit cast operator from DBNull value to ValueBox.
 /// </summary>
 //-------------------------------------------------------------------
-OP_IMP_FROM_(DBNull^)
+ValueBox::operator ValueBox( DBNull ^null )
+{
+	// check for null reference
+	if( null == nullptr ) throw gcnew ArgumentNullException("null");
+
+	return ValueBox();
+}
 
 
 //-------------------------------------------------------------------
@@ -244,7 +326,7 @@ OP_IMP_FROM_(DBNull^)
 /// be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_TO_(bool)
+OP_EXP_TO_(bool, Bool, box.m_data != 0)
 
 
 //-------------------------------------------------------------------
@@ -255,7 +337,7 @@ OP_EXP_TO_(bool)
 /// be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_TO_(int)
+OP_EXP_TO_(int, Int, static_cast<int>( box.m_data ))
 
 
 //-------------------------------------------------------------------
@@ -266,7 +348,7 @@ OP_EXP_TO_(int)
 /// will be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_TO_(double)
+OP_EXP_TO_(double, Double, box.get_double())
 
 
 //-------------------------------------------------------------------
@@ -277,7 +359,7 @@ OP_EXP_TO_(double)
 /// will be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_TO_(DateTime)
+OP_EXP_TO_(DateTime, DateTime, box.get_datetime())
 
 
 //-------------------------------------------------------------------
@@ -290,14 +372,9 @@ OP_EXP_TO_(DateTime)
 //-------------------------------------------------------------------
 ValueBox::operator String^( ValueBox box )
 {
-	Object	^val = box.ToObject();
-	Type	^r = val->GetType();
-	Type	^t = String::typeid;
+	if( box.m_type == TYPE::String ) return safe_cast<String^>( box.m_ref );
 
-	if( r == t ) return safe_cast<String^>( val );
-
-	throw gcnew InvalidCastException(String::Format(
-	ERR_CAST_FROM_TO, r->ToString(), t->ToString() ));
+	throw cast_error( box, String::typeid );
 }
 
 
@@ -311,17 +388,9 @@ ValueBox::operator String^( ValueBox box )
 //-------------------------------------------------------------------
 ValueBox::operator PersistentStream^( ValueBox box )
 {
-	// get real value
-	Object	^val = box.ToObject();
-
-	PersistentStream	^ps = dynamic_cast<PersistentStream^>( val );
-	if( ps == nullptr ) {
-		// stored value is not a Stream
-		throw gcnew InvalidCastException(String::Format(
-		ERR_CAST_FROM_TO, val->GetType()->ToString(),
-						  PersistentStream::typeid->ToString() ));
-	}
-	return ps;
+	if( box.m_type == TYPE::Stream ) return safe_cast<PersistentStream^>( box.m_ref );
+
+	throw cast_error( box, PersistentStream::typeid );
 }
 
 
@@ -335,15 +404,9 @@ ValueBox::operator PersistentStream^( ValueBox box )
 //-------------------------------------------------------------------
 ValueBox::operator DBNull^( ValueBox box )
 {
-	// get real value
-	Object	^val = box.ToString();
+	if( box.m_type == TYPE::Null ) return DBNull::Value;
 
-	if( val->GetType() == DBNull::typeid ) return DBNull::Value;
-
-	// stored value is not a DBNull/null
-	throw gcnew InvalidCastException(String::Format(
-	ERR_CAST_FROM_TO, val->GetType()->ToString(),
-					  DBNull::typeid->ToString() ));
+	throw cast_error( box, DBNull::typeid );
 }
 
 
@@ -355,7 +418,7 @@ ValueBox::operator DBNull^( ValueBox box )
 /// be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_(char, int)
+OP_EXP_(char, int, Int, box.m_data)
 
 
 //-------------------------------------------------------------------
@@ -366,7 +429,7 @@ OP_EXP_(char, int)
 /// be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_(unsigned char, int);
+OP_EXP_(unsigned char, int, Int, box.m_data)
 
 
 //-------------------------------------------------------------------
@@ -377,7 +440,7 @@ OP_EXP_(unsigned char, int);
 /// be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_(short, int);
+OP_EXP_(short, int, Int, box.m_data)
 
 
 //-------------------------------------------------------------------
@@ -388,7 +451,7 @@ OP_EXP_(short, int);
 /// be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_(unsigned short, int);
+OP_EXP_(unsigned short, int, Int, box.m_data)
 
 
 //-------------------------------------------------------------------
@@ -399,7 +462,7 @@ OP_EXP_(unsigned short, int);
 /// be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_(unsigned int, int);
+OP_EXP_(unsigned int, int, Int, box.m_data)
 
 
 //-------------------------------------------------------------------
@@ -410,7 +473,7 @@ OP_EXP_(unsigned int, int);
 /// be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_(long long, int);
+OP_EXP_(long long, int, Int, box.m_data)
 
 
 //-------------------------------------------------------------------
@@ -421,7 +484,7 @@ OP_EXP_(long long, int);
 /// be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_(unsigned long long, int);
+OP_EXP_(unsigned long long, int, Int, box.m_data)
 
 
 //-------------------------------------------------------------------
@@ -432,7 +495,7 @@ OP_EXP_(unsigned long long, int);
 /// will be raised.
 /// </remarks>
 //-------------------------------------------------------------------
-OP_EXP_(float, double);
+OP_EXP_(float, double, Double, box.get_double())
 
 
 //-------------------------------------------------------------------
@@ -444,7 +507,23 @@ OP_EXP_(float, double);
 //-------------------------------------------------------------------
 bool ValueBox::operator ==( ValueBox box1, ValueBox box2 )
 {
-	return Object::Equals( box1.ToObject(), box2.ToObject() );
+	// values of different types are never equal
+	if( box1.m_type != box2.m_type ) return false;
+
+	switch( box1.m_type ) {
+		case TYPE::Null:
+			return true;
+		case TYPE::Bool:
+		case TYPE::Int:
+			return (box1.m_data == box2.m_data);
+		case TYPE::Double:
+			return box1.get_double().Equals( box2.get_double() );
+		case TYPE::DateTime:
+			// kind is ignored as DateTime::Equals does
+			return ((box1.m_data & TICKS_MASK) == (box2.m_data & TICKS_MASK));
+		default:
+			return Object::Equals( box1.m_ref, box2.m_ref );
+	}
 }
 
 
@@ -498,19 +577,57 @@ bool ValueBox::Equals( Object ^object )
 }
 
 
+//-------------------------------------------------------------------
+/// <summary>
+/// Returns the hash code for this instance.
+/// </summary><remarks>
+/// Equal values have the same hash code.
+/// </remarks>
+//-------------------------------------------------------------------
+int ValueBox::GetHashCode( void )
+{
+	switch( m_type ) {
+		case TYPE::Null:
+			return 0;
+		case TYPE::Bool:
+		case TYPE::Int:
+			return m_data.GetHashCode();
+		case TYPE::Double:
+			return get_double().GetHashCode();
+		case TYPE::DateTime:
+			return get_datetime().GetHashCode();
+		default:
+			return m_ref->GetHashCode();
+	}
+}
+
+
 //-------------------------------------------------------------------
 /// <summary>
 /// Returns a handle to the internal data.
 /// </summary><remarks>
-/// This function returns modified internal data: if box contains
-/// null reference than it returns DBNull::Value. This functionality
-/// prevents from null accessing errors. ToObject is used in all
-/// functions instead of direct m_value access.
+/// This function returns DBNull::Value for empty box. Primitive
+/// values are boxed by every call, so use cast operators to get
+/// them without allocation.
 /// </remarks>
 //-------------------------------------------------------------------
 Object^ ValueBox::ToObject( void )
 {
-	return (m_value != nullptr) ? m_value : DBNull::Value;
+	switch( m_type ) {
+		case TYPE::Bool:
+			return (m_data != 0);
+		case TYPE::Int:
+			return static_cast<int>( m_data );
+		case TYPE::Double:
+			return get_double();
+		case TYPE::DateTime:
+			return get_datetime();
+		case TYPE::String:
+		case TYPE::Stream:
+			return m_ref;
+		default:
+			return DBNull::Value;
+	}
 }
 
 
@@ -525,11 +642,32 @@ Object^ ValueBox::ToObject( void )
 //-------------------------------------------------------------------
 String^ ValueBox::ToString( void )
 {
-	Object	^val = this->ToObject();
+	switch( m_type ) {
+		case TYPE::Bool:
+			return Convert::ToString( m_data != 0 );
+		case TYPE::Int:
+			return Convert::ToString( static_cast<int>( m_data ) );
+		case TYPE::Double:
+			return Convert::ToString( get_double() );
+		case TYPE::DateTime:
+			return get_datetime().ToString();
+		case TYPE::String:
+		case TYPE::Stream:
+			return m_ref->ToString();
+		default:
+			// this is empty value box
+			return "<null>";
+	}
+}
 
-	// this is empty value box
-	if( val == DBNull::Value ) return "<null>";
 
-	// returns call to internal data
-	return val->ToString();
+//-------------------------------------------------------------------
+//
+// Returns stored PersistentStream or null reference for values of
+// other types (without boxing).
+//
+//-------------------------------------------------------------------
+PersistentStream^ ValueBox::AsStream( void )
+{
+	return (m_type == TYPE::Stream) ? safe_cast<PersistentStream^>( m_ref ) : nullptr;
 }
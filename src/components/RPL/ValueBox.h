@@ -26,18 +26,36 @@ ref class PersistentStream;
 
 /// <summary>
 /// This class incapsulate type check for property value.
-/// </summary><remarks>
-/// Value is wrapper arroud Object handle and provide runtime
-/// type check, implicit and explicit cast operators, Equal
-/// comparison.
+/// </summary><remarks><para>
+/// Value is tagged union that provide runtime type check, implicit
+/// and explicit cast operators, Equal comparison.
 /// Now, the following types are supported: bool, int, double,
-/// DateTime, String, PersistentStream and DBNull.
-/// </remarks>
+/// DateTime, String, PersistentStream and DBNull.</para><para>
+/// Primitive values are stored inline (without boxing), so they
+/// are not allocated in the heap until ToObject call.
+/// </para></remarks>
 [Serializable]
 public value class ValueBox : IEquatable<ValueBox>, ISerializable
 {
 private:
-	Object	^m_value;
+	//
+	// Type tag of stored value (default value is DBNull).
+	//
+	enum class TYPE : unsigned char {
+		Null = 0, Bool, Int, Double, DateTime, String, Stream
+	};
+
+private:
+	TYPE	m_type;
+	__int64	m_data;		// bool, int, double bits or DateTime ticks and kind
+	Object	^m_ref;		// String or PersistentStream
+
+	ValueBox( TYPE type, __int64 data, Object ^ref );
+
+	void assign( Object ^o );
+	double get_double( void );
+	DateTime get_datetime( void );
+	static InvalidCastException^ cast_error( ValueBox box, Type ^type );
 
 // ISerializable
 private:
@@ -82,8 +100,12 @@ public:
 
 	virtual bool Equals( ValueBox box );
 	virtual bool Equals( Object ^o ) override;
+	virtual int GetHashCode( void ) override;
 
 	virtual Object^ ToObject( void );
 	virtual String^ ToString( void ) override;
+
+internal:
+	PersistentStream^ AsStream( void );
 };
 _RPL_END
@@ -0,0 +1,311 @@
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Collections.Generic;
+using System.Data;
+using System.Diagnostics;
+using Toolkit.RPL.Factories;
+using Toolkit.RPL.Storage;
+
+namespace Toolkit.RPL.Test
+{
+	[ TestClass() ]
+	public class CacheLoadTest
+	{
+		private const int HEADERS_COUNT = 100000;
+		private TestContext testContextInstance;
+
+		/// <summary>
+		/// Storage that returns specified count of generated headers on
+		/// search request and does nothing on all other requests. It is
+		/// used to measure broker overhead without database access.
+		/// </summary>
+		private class HeadersStorage : IPersistenceStorage
+		{
+			private HEADER[] m_headers;
+
+			public HeadersStorage( string type, int count )
+			{
+				DateTime stamp = DateTime.Now;
+
+				m_headers = new HEADER[count];
+				for( int i = 0; i < count; i++ ) {
+					m_headers[i] = new HEADER( type, i + 1, stamp, "Object " + (i + 1) );
+				}
+			}
+
+			public void TransactionBegin() {}
+			public void TransactionCommit() {}
+			public void TransactionRollback() {}
+
+			public int Search( string type, Where where, OrderBy order,
+							   int bottom, int count, out HEADER[] headers )
+			{
+				headers = m_headers;
+				return m_headers.Length;
+			}
+
+			public HEADER[] Search( string type, Where where, OrderBy order,
+									int bottom, int count )
+			{
+				ValueBox[] after = null;
+
+				return SearchAfter( type, where, order, ref after, bottom, count );
+			}
+
+			public int Count( string type, Where where )
+			{
+				return m_headers.Length;
+			}
+
+			public HEADER[] SearchAfter( string type, Where where, OrderBy order,
+										 ref ValueBox[] after, int bottom, int count )
+			{
+				// headers are ordered by ID (keyset is ID only)
+				int from = (after == null) ? 0 : (int) after[after.Length - 1];
+				from = (int) Math.Min( (long) from + bottom, m_headers.Length );
+				HEADER[] headers = new HEADER[Math.Min( count, m_headers.Length - from )];
+
+				Array.Copy( m_headers, from, headers, 0, headers.Length );
+				if( headers.Length > 0 ) {
+					after = new ValueBox[] { headers[headers.Length - 1].ID };
+				}
+				return headers;
+			}
+
+			public void Retrieve( ref HEADER header ) {}
+
+			public void Retrieve( ref HEADER header, out LINK[] links, out PROPERTY[] props )
+			{
+				links = null;
+				props = null;
+			}
+
+			public void Retrieve( ref HEADER header, string[] names,
+								  out LINK[] links, out PROPERTY[] props )
+			{
+				links = null;
+				props = null;
+			}
+
+			public HEADER[] Validate( HEADER[] headers )
+			{
+				return new HEADER[0];
+			}
+
+			public void Save( ref HEADER header, LINK[] links, PROPERTY[] props,
+							  out LINK[] mlinks, out PROPERTY[] mprops )
+			{
+				throw new NotSupportedException();
+			}
+
+			public void Delete( HEADER header )
+			{
+				throw new NotSupportedException();
+			}
+
+			public long OpenBlob( HEADER header, string name, out byte[] hash )
+			{
+				throw new NotSupportedException();
+			}
+
+			public byte[] ReadBlob( HEADER header, string name, byte[] hash, long offset, int count )
+			{
+				throw new NotSupportedException();
+			}
+
+			public long WriteBlob( byte[] hash, long offset, byte[] data )
+			{
+				throw new NotSupportedException();
+			}
+
+			public void CommitBlob( ref HEADER header, string name, byte[] hash )
+			{
+				throw new NotSupportedException();
+			}
+
+			public DataSet ProcessSQL( string sql, params object[] args )
+			{
+				throw new NotSupportedException();
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the test context which provides
+		/// information about and functionality for the current test run.
+		/// </summary>
+		public TestContext TestContext
+		{
+			get
+			{
+				return testContextInstance;
+			}
+			set
+			{
+				testContextInstance = value;
+			}
+		}
+		#region Additional test attributes
+		//
+		// You can use the following additional attributes as you write your tests:
+		//
+
+		// Use ClassInitialize to run code before running the first test in the class
+
+		[ClassInitialize()]
+		public static void MyClassInitialize( TestContext testContext )
+		{
+			// use local broker ("fat client")
+			PersistenceBroker.Close();
+			PersistenceBroker.BrokerFactory = null;
+			PersistenceBroker.ObjectFactory = delegate( string type, int id, DateTime stamp, string name ) {
+				return new TestObject( id, stamp, name );
+			};
+			PersistenceBroker.Open();
+			PersistenceBroker.Connect( new HeadersStorage( (new TestObject()).Type, HEADERS_COUNT ) );
+		}
+
+		// Use ClassCleanup to run code after all tests in a class have run
+
+		[ClassCleanup()]
+		public static void MyClassCleanup()
+		{
+			PersistenceBroker.Close();
+		}
+		#endregion
+
+		/// <summary>
+		/// Measures PersistentCriteria.Perform for 100k headers. The first
+		/// pass creates objects and fills the cache, the second one finds all
+		/// of them in the cache.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void PerformLoadTest()
+		{
+			RetrieveCriteria crit = new RetrieveCriteria( (new TestObject()).Type );
+			crit.AsProxies = true;
+
+			Stopwatch sw = Stopwatch.StartNew();
+			crit.Perform();
+			sw.Stop();
+			TestContext.WriteLine( "{0} headers, empty cache: {1} ms", crit.Count, sw.ElapsedMilliseconds );
+
+			sw = Stopwatch.StartNew();
+			crit.Perform();
+			sw.Stop();
+			TestContext.WriteLine( "{0} headers, filled cache: {1} ms", crit.Count, sw.ElapsedMilliseconds );
+
+			Assert.AreEqual( HEADERS_COUNT, crit.Count );
+		}
+
+		/// <summary>
+		/// Measures RetrieveCriteria.Enumerate for 100k headers: objects are
+		/// read page by page without recount of found objects.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void EnumerateLoadTest()
+		{
+			RetrieveCriteria crit = new RetrieveCriteria( (new TestObject()).Type );
+			crit.AsProxies = true;
+
+			int count = 0;
+			int last = 0;
+			Stopwatch sw = Stopwatch.StartNew();
+			foreach( PersistentObject obj in crit.Enumerate( 1000 ) ) {
+				Assert.IsTrue( obj.ID > last, "Objects are out of order." );
+				last = obj.ID;
+				count++;
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} headers, pages of 1000: {1} ms", count, sw.ElapsedMilliseconds );
+
+			Assert.AreEqual( HEADERS_COUNT, count );
+			Assert.AreEqual( 0, crit.Count, "Criteria collection must not be changed." );
+		}
+
+		/// <summary>
+		/// Compares in-memory search by compiled Where with interpretation
+		/// of the same tree for every object.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void FilterLoadTest()
+		{
+			const int OBJECTS_COUNT = 20000;
+			const int PASSES = 10;
+
+			PersistentObjects objs = new PersistentObjects();
+			for( int i = 0; i < OBJECTS_COUNT; i++ ) {
+				TestObject obj = new TestObject();
+				obj.Name = "Object " + i;
+				obj._int = i;
+				obj._string = "Value " + (i % 100);
+				objs.Add( obj );
+			}
+			Where where = (new Where.Clause( "_int", Where.Clause.OP.GE, 1000 ) &
+						   new Where.Clause( "_string", "value 1%" )) |
+						  !new Where.Clause( "_int", Where.Clause.OP.LT, OBJECTS_COUNT - 100 );
+
+			// interpret tree for every object
+			int interpreted = 0;
+			Stopwatch sw = Stopwatch.StartNew();
+			for( int pass = 0; pass < PASSES; pass++ ) {
+				interpreted = 0;
+				foreach( PersistentObject obj in objs ) {
+					if( where.Evaluate( obj ) ) interpreted++;
+				}
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects x {1}, interpreted: {2} ms", OBJECTS_COUNT, PASSES, sw.ElapsedMilliseconds );
+
+			// compile tree once per pass
+			PersistentObjects found = null;
+			sw = Stopwatch.StartNew();
+			for( int pass = 0; pass < PASSES; pass++ ) {
+				found = objs.Filter( where, null );
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects x {1}, compiled: {2} ms", OBJECTS_COUNT, PASSES, sw.ElapsedMilliseconds );
+
+			Assert.AreEqual( interpreted, found.Count );
+
+			// check ordering
+			List<PersistentObject> sorted = new List<PersistentObject>( objs.Filter( where,
+				new OrderBy( new OrderBy.Clause( "_int", OrderBy.Clause.SORT.DESC ) ) ) );
+			Assert.AreEqual( OBJECTS_COUNT - 1, ((TestObject)sorted[0])._int );
+			Assert.AreEqual( 1001, ((TestObject)sorted[sorted.Count - 1])._int );
+		}
+
+		/// <summary>
+		/// Measures repeated PersistentCriteria.Perform with page limits
+		/// when search results are cached by broker.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void QueryCacheLoadTest()
+		{
+			const int PASSES = 1000;
+
+			PersistenceBroker.QueryCacheTTL = TimeSpan.FromMinutes( 1 );
+			try {
+				RetrieveCriteria crit = new RetrieveCriteria( (new TestObject()).Type );
+				crit.AsProxies = true;
+				crit.CountLimit = 100;
+
+				long hits = PersistenceBroker.QueryCacheHits;
+				Stopwatch sw = Stopwatch.StartNew();
+				for( int pass = 0; pass < PASSES; pass++ ) crit.Perform();
+				sw.Stop();
+				TestContext.WriteLine( "{0} pages, cached: {1} ms", PASSES, sw.ElapsedMilliseconds );
+
+				Assert.AreEqual( PASSES - 1, PersistenceBroker.QueryCacheHits - hits );
+				Assert.AreEqual( 100, crit.Count );
+
+				// criteria can bypass cache
+				hits = PersistenceBroker.QueryCacheHits;
+				crit.UseCache = false;
+				crit.Perform();
+				Assert.AreEqual( hits, PersistenceBroker.QueryCacheHits );
+			} finally {
+				PersistenceBroker.QueryCacheTTL = TimeSpan.Zero;
+			}
+		}
+	}
+}
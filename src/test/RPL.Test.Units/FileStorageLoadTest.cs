@@ -0,0 +1,421 @@
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Security.Cryptography;
+using Toolkit.RPL.Storage;
+
+namespace Toolkit.RPL.Test
+{
+	[ TestClass() ]
+	public class FileStorageLoadTest
+	{
+		private const int OBJECTS_COUNT = 5000;
+		private TestContext testContextInstance;
+
+		/// <summary>
+		/// Gets or sets the test context which provides
+		/// information about and functionality for the current test run.
+		/// </summary>
+		public TestContext TestContext
+		{
+			get
+			{
+				return testContextInstance;
+			}
+			set
+			{
+				testContextInstance = value;
+			}
+		}
+
+		/// <summary>
+		/// Creates properties of new object.
+		/// </summary>
+		private static PROPERTY[] properties( int i )
+		{
+			return new PROPERTY[] {
+				new PROPERTY( "_int", i, PROPERTY.STATE.New ),
+				new PROPERTY( "_string", "Value " + (i % 100), PROPERTY.STATE.New ),
+				new PROPERTY( "_datetime", new DateTime( 2013, 1, 1 ).AddMinutes( i ), PROPERTY.STATE.New ),
+				new PROPERTY( "_null", DBNull.Value, PROPERTY.STATE.New )
+			};
+		}
+
+		/// <summary>
+		/// Saves specified count of objects to the storage.
+		/// </summary>
+		private static HEADER[] fill( IPersistenceStorage storage, int from, int count )
+		{
+			string type = (new TestObject()).Type;
+			HEADER[] headers = new HEADER[count];
+			LINK[] mlinks;
+			PROPERTY[] mprops;
+
+			for( int i = 0; i < count; i++ ) {
+				headers[i] = new HEADER( type, 0, new DateTime(), "Object " + (from + i) );
+				storage.Save( ref headers[i], new LINK[0], properties( from + i ), out mlinks, out mprops );
+			}
+			return headers;
+		}
+
+		/// <summary>
+		/// Creates new empty directory for storage.
+		/// </summary>
+		private static string create_directory()
+		{
+			string path = Path.Combine( Path.GetTempPath(), "RPL." + Guid.NewGuid().ToString( "N" ) );
+
+			Directory.CreateDirectory( path );
+			return path;
+		}
+
+		/// <summary>
+		/// Copies files of opened storage as they are on disk at the moment
+		/// (like after crash of the process).
+		/// </summary>
+		private static string copy_directory( string path )
+		{
+			string copy = create_directory();
+
+			foreach( string dir in Directory.GetDirectories( path, "*", SearchOption.AllDirectories ) ) {
+				Directory.CreateDirectory( copy + dir.Substring( path.Length ) );
+			}
+			foreach( string file in Directory.GetFiles( path, "*", SearchOption.AllDirectories ) ) {
+				using( FileStream src = new FileStream( file, FileMode.Open, FileAccess.Read, FileShare.ReadWrite | FileShare.Delete ) ) {
+					byte[] data = new byte[src.Length];
+					src.Read( data, 0, data.Length );
+					File.WriteAllBytes( copy + file.Substring( path.Length ), data );
+				}
+			}
+			return copy;
+		}
+
+		/// <summary>
+		/// Returns object properties from the storage.
+		/// </summary>
+		private static Dictionary<string, object> retrieve( IPersistenceStorage storage, HEADER header,
+															 out LINK[] links )
+		{
+			HEADER h = new HEADER( header.Type, header.ID, new DateTime(), header.Name );
+			PROPERTY[] props;
+
+			storage.Retrieve( ref h, out links, out props );
+			Assert.AreEqual( header.Stamp, h.Stamp );
+
+			Dictionary<string, object> result = new Dictionary<string, object>();
+			foreach( PROPERTY prop in props ) {
+				result.Add( prop.Name, prop.Value.ToObject() );
+			}
+			return result;
+		}
+
+		/// <summary>
+		/// Checks that both storages have the same objects.
+		/// </summary>
+		private static void compare( IPersistenceStorage expected, IPersistenceStorage actual )
+		{
+			string type = (new TestObject()).Type;
+			HEADER[] headers = expected.Search( type, null, null, 0, int.MaxValue );
+
+			Assert.AreEqual( headers.Length, actual.Count( type, null ) );
+			foreach( HEADER header in headers ) {
+				LINK[] elinks, alinks;
+				Dictionary<string, object> eprops = retrieve( expected, header, out elinks );
+				Dictionary<string, object> aprops = retrieve( actual, header, out alinks );
+
+				Assert.AreEqual( elinks.Length, alinks.Length );
+				for( int i = 0; i < elinks.Length; i++ ) {
+					Assert.AreEqual( elinks[i].Header.ID, alinks[i].Header.ID );
+				}
+				Assert.AreEqual( eprops.Count, aprops.Count );
+				foreach( KeyValuePair<string, object> prop in eprops ) {
+					if( prop.Value is PersistentStream ) {
+						Assert.AreEqual( Convert.ToBase64String( ((PersistentStream) prop.Value).Hash ),
+										 Convert.ToBase64String( ((PersistentStream) aprops[prop.Key]).Hash ) );
+					} else {
+						Assert.AreEqual( prop.Value, aprops[prop.Key] );
+					}
+				}
+			}
+		}
+
+		/// <summary>
+		/// Measures file storage requests against in-memory storage: save
+		/// with commit of every object, save in one transaction, search and
+		/// open of saved storage.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void StorageLoadTest()
+		{
+			string path = create_directory();
+			string type = (new TestObject()).Type;
+			Where where = new Where.Clause( "_int", Where.Clause.OP.GE, 1000 ) &
+						  new Where.Clause( "_string", "value 1%" );
+			OrderBy order = new OrderBy( new OrderBy.Clause( "_datetime", OrderBy.Clause.SORT.DESC ) );
+
+			try {
+				MemoryStorage memory = new MemoryStorage();
+				FileStorage file = new FileStorage( path );
+				IPersistenceStorage[] storages = new IPersistenceStorage[] { memory, file };
+				HEADER[][] found = new HEADER[storages.Length][];
+				Stopwatch sw;
+
+				for( int i = 0; i < storages.Length; i++ ) {
+					string name = storages[i].GetType().Name;
+
+					sw = Stopwatch.StartNew();
+					fill( storages[i], 0, OBJECTS_COUNT );
+					sw.Stop();
+					TestContext.WriteLine( "{0}: {1} objects, save: {2} ms", name, OBJECTS_COUNT, sw.ElapsedMilliseconds );
+
+					sw = Stopwatch.StartNew();
+					storages[i].TransactionBegin();
+					fill( storages[i], OBJECTS_COUNT, OBJECTS_COUNT );
+					storages[i].TransactionCommit();
+					sw.Stop();
+					TestContext.WriteLine( "{0}: {1} objects, save in transaction: {2} ms", name, OBJECTS_COUNT, sw.ElapsedMilliseconds );
+
+					sw = Stopwatch.StartNew();
+					storages[i].Search( type, where, order, 0, int.MaxValue, out found[i] );
+					sw.Stop();
+					TestContext.WriteLine( "{0}: {1} objects, search: {2} found, {3} ms", name, 2 * OBJECTS_COUNT, found[i].Length, sw.ElapsedMilliseconds );
+				}
+
+				Assert.AreEqual( found[0].Length, found[1].Length );
+				for( int i = 0; i < found[0].Length; i++ ) {
+					Assert.AreEqual( found[0][i].ID, found[1][i].ID );
+				}
+
+				// open from log and from checkpoint
+				string crash = copy_directory( path );
+				try {
+					sw = Stopwatch.StartNew();
+					FileStorage opened = new FileStorage( crash );
+					sw.Stop();
+					TestContext.WriteLine( "FileStorage: {0} objects, open from log: {1} ms", 2 * OBJECTS_COUNT, sw.ElapsedMilliseconds );
+					compare( file, opened );
+					opened.Dispose();
+				} finally {
+					Directory.Delete( crash, true );
+				}
+
+				file.Close();
+				sw = Stopwatch.StartNew();
+				file = new FileStorage( path );
+				sw.Stop();
+				TestContext.WriteLine( "FileStorage: {0} objects, open from checkpoint: {1} ms", 2 * OBJECTS_COUNT, sw.ElapsedMilliseconds );
+
+				Assert.AreEqual( memory.ObjectsCount, file.ObjectsCount );
+				file.Close();
+			} finally {
+				Directory.Delete( path, true );
+			}
+		}
+
+		/// <summary>
+		/// Checks that objects, links and stream contents are restored after
+		/// crash: checkpoints are made while objects are saved, so state is
+		/// restored from checkpoint and log.
+		/// </summary>
+		[TestMethod()]
+		public void RecoveryTest()
+		{
+			string path = create_directory();
+			string crash = null;
+
+			try {
+				FileStorage storage = new FileStorage( path );
+				storage.CheckpointSize = 4096;
+				HEADER[] headers = fill( storage, 0, 100 );
+				LINK[] mlinks;
+				PROPERTY[] mprops;
+
+				// links, stream contents and deleted objects
+				byte[] content = new byte[10000];
+				new Random( 1 ).NextBytes( content );
+				storage.Save( ref headers[0],
+							  new LINK[] { new LINK( headers[1], LINK.STATE.New ),
+										   new LINK( headers[2], LINK.STATE.New ) },
+							  new PROPERTY[] { new PROPERTY( "_stream", new PersistentStream( content ), PROPERTY.STATE.New ) },
+							  out mlinks, out mprops );
+				storage.Delete( headers[2] );
+				storage.Delete( headers[3] );
+				storage.Save( ref headers[4], new LINK[0],
+							  new PROPERTY[] { new PROPERTY( "_int", DBNull.Value, PROPERTY.STATE.Deleted ),
+											   new PROPERTY( "_string", "Changed", PROPERTY.STATE.Changed ) },
+							  out mlinks, out mprops );
+
+				crash = copy_directory( path );
+				FileStorage restored = new FileStorage( crash );
+				Assert.AreEqual( 98, restored.ObjectsCount );
+				Assert.AreEqual( 1, restored.BlobsCount );
+				compare( storage, restored );
+
+				byte[] hash;
+				Assert.AreEqual( content.Length, restored.OpenBlob( headers[0], "_stream", out hash ) );
+				Assert.AreEqual( content[content.Length - 1], restored.ReadBlob( headers[0], "_stream", hash, content.Length - 1, 10 )[0] );
+
+				// new objects get new IDs
+				HEADER[] added = fill( restored, 100, 1 );
+				Assert.IsTrue( added[0].ID > headers[headers.Length - 1].ID );
+				restored.Close();
+
+				// content file is removed with the last property
+				storage.Retrieve( ref headers[0] );
+				storage.Save( ref headers[0], new LINK[0],
+							  new PROPERTY[] { new PROPERTY( "_stream", DBNull.Value, PROPERTY.STATE.Deleted ) },
+							  out mlinks, out mprops );
+				storage.Close();
+				Assert.AreEqual( 0, Directory.GetFiles( Path.Combine( path, "blobs" ) ).Length );
+			} finally {
+				Directory.Delete( path, true );
+				if( crash != null ) Directory.Delete( crash, true );
+			}
+		}
+
+		/// <summary>
+		/// Checks that transaction which was written partially is discarded
+		/// and all previous ones are restored.
+		/// </summary>
+		[TestMethod()]
+		public void TornLogTest()
+		{
+			string path = create_directory();
+			string crash = null;
+
+			try {
+				FileStorage storage = new FileStorage( path );
+				fill( storage, 0, 10 );
+
+				// the last record is cut
+				crash = copy_directory( path );
+				string log = Path.Combine( crash, "objects.log" );
+				using( FileStream file = new FileStream( log, FileMode.Open ) ) {
+					file.SetLength( file.Length - 1 );
+				}
+				FileStorage restored = new FileStorage( crash );
+				Assert.AreEqual( 9, restored.ObjectsCount );
+
+				// new transactions follow the last whole one
+				fill( restored, 10, 2 );
+				restored.Dispose();
+				restored = new FileStorage( crash );
+				Assert.AreEqual( 11, restored.ObjectsCount );
+				restored.Dispose();
+				Directory.Delete( crash, true );
+
+				// the last record is damaged
+				crash = copy_directory( path );
+				log = Path.Combine( crash, "objects.log" );
+				using( FileStream file = new FileStream( log, FileMode.Open ) ) {
+					file.Seek( -2, SeekOrigin.End );
+					int b = file.ReadByte();
+					file.Seek( -1, SeekOrigin.Current );
+					file.WriteByte( (byte) ~b );
+				}
+				restored = new FileStorage( crash );
+				Assert.AreEqual( 9, restored.ObjectsCount );
+				restored.Dispose();
+				storage.Dispose();
+			} finally {
+				Directory.Delete( path, true );
+				if( crash != null ) Directory.Delete( crash, true );
+			}
+		}
+
+		/// <summary>
+		/// Checks that reverted transactions aren't written and that log of
+		/// previous checkpoint is ignored.
+		/// </summary>
+		[TestMethod()]
+		public void CheckpointTest()
+		{
+			string path = create_directory();
+			string crash = null;
+
+			try {
+				FileStorage storage = new FileStorage( path );
+				HEADER[] headers = fill( storage, 0, 5 );
+
+				// rolled back and failed transactions
+				storage.TransactionBegin();
+				fill( storage, 5, 5 );
+				storage.TransactionRollback();
+				try {
+					storage.Delete( new HEADER( headers[0].Type, headers[0].ID, new DateTime(), headers[0].Name ) );
+					Assert.Fail( "Outdated object must not be deleted." );
+				} catch( System.Data.DBConcurrencyException ) {
+				}
+				string log = copy_directory( path );
+
+				storage.Checkpoint();
+				storage.Delete( headers[1] );
+				crash = copy_directory( path );
+				FileStorage restored = new FileStorage( crash );
+				Assert.AreEqual( 4, restored.ObjectsCount );
+				compare( storage, restored );
+				restored.Dispose();
+
+				// crash after new checkpoint is written, but before new log
+				// is started: old log is ignored
+				File.Copy( Path.Combine( log, "objects.log" ), Path.Combine( crash, "objects.log" ), true );
+				File.Delete( Path.Combine( crash, "objects.dat" ) );
+				File.Copy( Path.Combine( path, "objects.dat" ), Path.Combine( crash, "objects.dat" ) );
+				File.WriteAllBytes( Path.Combine( crash, "objects.dat.tmp" ), new byte[] { 1, 2, 3 } );
+				restored = new FileStorage( crash );
+				Assert.AreEqual( 5, restored.ObjectsCount );
+				Assert.IsFalse( File.Exists( Path.Combine( crash, "objects.dat.tmp" ) ) );
+				restored.Dispose();
+				Directory.Delete( log, true );
+				storage.Dispose();
+			} finally {
+				Directory.Delete( path, true );
+				if( crash != null ) Directory.Delete( crash, true );
+			}
+		}
+
+		/// <summary>
+		/// Checks that temporary files of uploads are removed when upload is
+		/// committed and when storage is closed.
+		/// </summary>
+		[TestMethod()]
+		public void UploadTest()
+		{
+			string path = create_directory();
+
+			try {
+				FileStorage storage = new FileStorage( path );
+				HEADER[] headers = fill( storage, 0, 1 );
+
+				byte[] content = new byte[10000];
+				new Random( 1 ).NextBytes( content );
+				byte[] hash = new SHA1Managed().ComputeHash( content );
+				storage.WriteBlob( hash, 0, content );
+				Assert.AreEqual( 1, Directory.GetFiles( path, "*.upload", SearchOption.AllDirectories ).Length );
+
+				// rolled back commit restores upload
+				storage.TransactionBegin();
+				HEADER header = headers[0];
+				storage.CommitBlob( ref header, "_stream", hash );
+				Assert.AreEqual( 1, Directory.GetFiles( path, "*.upload", SearchOption.AllDirectories ).Length );
+				storage.TransactionRollback();
+				Assert.AreEqual( 0, storage.BlobsCount );
+
+				// committed upload is closed
+				storage.CommitBlob( ref headers[0], "_stream", hash );
+				Assert.AreEqual( 0, Directory.GetFiles( path, "*.upload", SearchOption.AllDirectories ).Length );
+
+				// unfinished upload is closed with storage
+				byte[] other = new SHA1Managed().ComputeHash( new byte[] { 1 } );
+				storage.WriteBlob( other, 0, new byte[] { 1 } );
+				Assert.AreEqual( 1, Directory.GetFiles( path, "*.upload", SearchOption.AllDirectories ).Length );
+				storage.Dispose();
+				Assert.AreEqual( 0, Directory.GetFiles( path, "*.upload", SearchOption.AllDirectories ).Length );
+			} finally {
+				Directory.Delete( path, true );
+			}
+		}
+	}
+}
@@ -0,0 +1,354 @@
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Collections.Generic;
+using System.Data;
+using System.Diagnostics;
+using System.IO;
+using System.Security.Cryptography;
+using Toolkit.RPL.Factories;
+using Toolkit.RPL.Storage;
+
+namespace Toolkit.RPL.Test
+{
+	[ TestClass() ]
+	public class MemoryStorageLoadTest
+	{
+		private const int OBJECTS_COUNT = 20000;
+		private TestContext testContextInstance;
+
+		/// <summary>
+		/// Gets or sets the test context which provides
+		/// information about and functionality for the current test run.
+		/// </summary>
+		public TestContext TestContext
+		{
+			get
+			{
+				return testContextInstance;
+			}
+			set
+			{
+				testContextInstance = value;
+			}
+		}
+		#region Additional test attributes
+		//
+		// You can use the following additional attributes as you write your tests:
+		//
+
+		// Use ClassInitialize to run code before running the first test in the class
+
+		[ClassInitialize()]
+		public static void MyClassInitialize( TestContext testContext )
+		{
+			// use local broker ("fat client")
+			PersistenceBroker.Close();
+			PersistenceBroker.BrokerFactory = null;
+			PersistenceBroker.ObjectFactory = delegate( string type, int id, DateTime stamp, string name ) {
+				return new TestObject( id, stamp, name );
+			};
+			PersistenceBroker.Open();
+			PersistenceBroker.Connect( new MemoryStorage() );
+		}
+
+		// Use ClassCleanup to run code after all tests in a class have run
+
+		[ClassCleanup()]
+		public static void MyClassCleanup()
+		{
+			PersistenceBroker.Close();
+		}
+		#endregion
+
+		/// <summary>
+		/// Creates properties of new object.
+		/// </summary>
+		private static PROPERTY[] properties( int i )
+		{
+			return new PROPERTY[] {
+				new PROPERTY( "_int", i, PROPERTY.STATE.New ),
+				new PROPERTY( "_string", "Value " + (i % 100), PROPERTY.STATE.New ),
+				new PROPERTY( "_double", i / 3.0, PROPERTY.STATE.New )
+			};
+		}
+
+		/// <summary>
+		/// Saves specified count of objects to the storage.
+		/// </summary>
+		private static HEADER[] fill( IPersistenceStorage storage, int count )
+		{
+			string type = (new TestObject()).Type;
+			HEADER[] headers = new HEADER[count];
+			LINK[] mlinks;
+			PROPERTY[] mprops;
+
+			for( int i = 0; i < count; i++ ) {
+				headers[i] = new HEADER( type, 0, new DateTime(), "Object " + i );
+				storage.Save( ref headers[i], new LINK[0], properties( i ), out mlinks, out mprops );
+			}
+			return headers;
+		}
+
+		/// <summary>
+		/// Measures storage requests without broker: save, search with
+		/// conditions and ordering, paging and retrieve.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void StorageLoadTest()
+		{
+			MemoryStorage storage = new MemoryStorage();
+			string type = (new TestObject()).Type;
+
+			Stopwatch sw = Stopwatch.StartNew();
+			HEADER[] headers = fill( storage, OBJECTS_COUNT );
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects, save: {1} ms", OBJECTS_COUNT, sw.ElapsedMilliseconds );
+
+			Where where = new Where.Clause( "_int", Where.Clause.OP.GE, 1000 ) &
+						  new Where.Clause( "_string", "value 1%" );
+			OrderBy order = new OrderBy( new OrderBy.Clause( "_double", OrderBy.Clause.SORT.DESC ) );
+			HEADER[] found;
+
+			sw = Stopwatch.StartNew();
+			int count = storage.Search( type, where, order, 0, OBJECTS_COUNT, out found );
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects, search: {1} found, {2} ms", OBJECTS_COUNT, count, sw.ElapsedMilliseconds );
+
+			// "Value 1", "Value 10".."Value 19" for every 100 objects
+			Assert.AreEqual( (OBJECTS_COUNT - 1000) / 100 * 11, count );
+			Assert.AreEqual( count, found.Length );
+			Assert.AreEqual( count, storage.Count( type, where ) );
+			Assert.AreEqual( headers[OBJECTS_COUNT - 81].ID, found[0].ID );
+
+			// the same objects page by page
+			List<HEADER> pages = new List<HEADER>();
+			sw = Stopwatch.StartNew();
+			ValueBox[] after = null;
+			for( HEADER[] page = storage.SearchAfter( type, where, order, ref after, 0, 100 ); page.Length > 0;
+				 page = storage.SearchAfter( type, where, order, ref after, 0, 100 ) ) {
+				pages.AddRange( page );
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects, search after: {1} ms", count, sw.ElapsedMilliseconds );
+
+			Assert.AreEqual( found.Length, pages.Count );
+			for( int i = 0; i < found.Length; i++ ) {
+				Assert.AreEqual( found[i].ID, pages[i].ID );
+			}
+
+			sw = Stopwatch.StartNew();
+			foreach( HEADER header in headers ) {
+				HEADER h = new HEADER( header.Type, header.ID, new DateTime(), header.Name );
+				LINK[] links;
+				PROPERTY[] props;
+
+				storage.Retrieve( ref h, out links, out props );
+				Assert.AreEqual( 3, props.Length );
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects, retrieve: {1} ms", OBJECTS_COUNT, sw.ElapsedMilliseconds );
+		}
+
+		/// <summary>
+		/// Measures broker requests over in-memory storage and checks that
+		/// storage finds the same objects as Filter in memory.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void CriteriaLoadTest()
+		{
+			const int COUNT = OBJECTS_COUNT / 10;
+
+			PersistentObjects objs = new PersistentObjects();
+			Stopwatch sw = Stopwatch.StartNew();
+			for( int i = 0; i < COUNT; i++ ) {
+				TestObject obj = new TestObject();
+				obj.Name = "Criteria " + i;
+				obj._int = i;
+				if( i % 3 != 0 ) obj._string = "Value " + (i % 100);
+				obj.Save();
+				objs.Add( obj );
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects, save: {1} ms", COUNT, sw.ElapsedMilliseconds );
+
+			Where where = new Where.Clause( "Name", "criteria %" ) &
+						  ((new Where.Clause( "_int", Where.Clause.OP.GE, 100 ) &
+							new Where.Clause( "_string", "VALUE 1%" )) |
+						   new Where.Clause( "_string", DBNull.Value ));
+			OrderBy order = new OrderBy( new OrderBy.Clause( "_string", OrderBy.Clause.SORT.ASC ),
+										 new OrderBy.Clause( "_int", OrderBy.Clause.SORT.DESC ) );
+
+			sw = Stopwatch.StartNew();
+			RetrieveCriteria crit = new RetrieveCriteria( (new TestObject()).Type, where, order );
+			crit.Perform();
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects, criteria: {1} found, {2} ms", COUNT, crit.CountFound, sw.ElapsedMilliseconds );
+
+			List<PersistentObject> expected = new List<PersistentObject>( objs.Filter( where, order ) );
+			Assert.AreEqual( expected.Count, crit.CountFound );
+			for( int i = 0; i < expected.Count; i++ ) {
+				Assert.AreEqual( expected[i].ID, crit[i].ID );
+			}
+		}
+
+		/// <summary>
+		/// Checks that object which values were set back to the stored ones
+		/// is not sent to storage (storage gives new stamp on every save).
+		/// </summary>
+		[TestMethod()]
+		public void UnchangedSaveTest()
+		{
+			TestObject obj = new TestObject();
+			obj.Name = "Unchanged";
+			obj._int = 1;
+			obj._string = "Value";
+			obj.Save();
+			DateTime stamp = obj.Stamp;
+
+			// set the same values and revert changed ones
+			obj._int = 1;
+			obj._string = "Changed";
+			obj._string = "Value";
+			obj.Name = "Changed";
+			obj.Name = "Unchanged";
+			obj.Save();
+			Assert.AreEqual( stamp, obj.Stamp );
+			Assert.IsFalse( obj.IsChanged );
+
+			// real change is saved
+			obj._int = 2;
+			obj.Save();
+			Assert.IsTrue( obj.Stamp > stamp );
+		}
+
+		/// <summary>
+		/// Checks nested transactions, stamp conflicts and links.
+		/// </summary>
+		[TestMethod()]
+		public void TransactionTest()
+		{
+			MemoryStorage storage = new MemoryStorage();
+			string type = (new TestObject()).Type;
+			HEADER[] headers = fill( storage, 3 );
+			LINK[] mlinks;
+			PROPERTY[] mprops;
+
+			// link first object with others
+			HEADER parent = headers[0];
+			storage.Save( ref parent,
+						  new LINK[] { new LINK( headers[1], LINK.STATE.New ),
+									   new LINK( headers[2], LINK.STATE.New ) },
+						  new PROPERTY[0], out mlinks, out mprops );
+			Assert.IsTrue( parent.Stamp > headers[0].Stamp );
+
+			// rollback of outer transaction reverts committed nested one
+			storage.TransactionBegin();
+			storage.TransactionBegin();
+			storage.Delete( headers[2] );
+			HEADER h = headers[1];
+			storage.Save( ref h, new LINK[0],
+						  new PROPERTY[] { new PROPERTY( "_int", DBNull.Value, PROPERTY.STATE.Deleted ) },
+						  out mlinks, out mprops );
+			storage.TransactionCommit();
+			Assert.AreEqual( 2, storage.ObjectsCount );
+			Assert.AreEqual( 0, storage.Count( type, new Where.Clause( "_int", 1 ) ) );
+			storage.TransactionRollback();
+
+			Assert.AreEqual( 3, storage.ObjectsCount );
+			Assert.AreEqual( 1, storage.Count( type, new Where.Clause( "_int", 1 ) ) );
+			Assert.AreEqual( 0, storage.Validate( new HEADER[] { parent, headers[1], headers[2] } ).Length );
+
+			LINK[] links;
+			PROPERTY[] props;
+			h = new HEADER( type, parent.ID, new DateTime(), parent.Name );
+			storage.Retrieve( ref h, out links, out props );
+			Assert.AreEqual( 2, links.Length );
+
+			// outdated stamp
+			try {
+				storage.Delete( headers[0] );
+				Assert.Fail( "Outdated object must not be deleted." );
+			} catch( DBConcurrencyException ) {
+			}
+			// parent of links
+			try {
+				storage.Delete( parent );
+				Assert.Fail( "Parent of links must not be deleted." );
+			} catch( InvalidOperationException ) {
+			}
+
+			// child is deleted with links
+			storage.Delete( headers[2] );
+			HEADER[] changed = storage.Validate( new HEADER[] { parent, headers[2] } );
+			Assert.AreEqual( 2, changed.Length );
+			Assert.AreEqual( new DateTime(), changed[1].Stamp );
+
+			h = new HEADER( type, parent.ID, new DateTime(), parent.Name );
+			storage.Retrieve( ref h, out links, out props );
+			Assert.AreEqual( 1, links.Length );
+			Assert.AreEqual( headers[1].ID, links[0].Header.ID );
+		}
+
+		/// <summary>
+		/// Checks BLOB transfer by ranges and storing of equal contents once.
+		/// </summary>
+		[TestMethod()]
+		public void BlobTest()
+		{
+			MemoryStorage storage = new MemoryStorage();
+			HEADER[] headers = fill( storage, 2 );
+
+			byte[] content = new byte[100000];
+			new Random( 1 ).NextBytes( content );
+			byte[] hash = new SHA1Managed().ComputeHash( content );
+
+			// upload content by two ranges
+			byte[] range = new byte[60000];
+			Array.Copy( content, range, range.Length );
+			Assert.AreEqual( 60000, storage.WriteBlob( hash, 0, range ) );
+			range = new byte[content.Length - 50000];
+			Array.Copy( content, 50000, range, 0, range.Length );
+			Assert.AreEqual( content.Length, storage.WriteBlob( hash, 50000, range ) );
+
+			storage.CommitBlob( ref headers[0], "_stream", hash );
+
+			// equal content of other object is not stored again
+			LINK[] mlinks;
+			PROPERTY[] mprops;
+			storage.Save( ref headers[1], new LINK[0],
+						  new PROPERTY[] { new PROPERTY( "_stream", new PersistentStream( content ), PROPERTY.STATE.New ) },
+						  out mlinks, out mprops );
+			Assert.AreEqual( 1, storage.BlobsCount );
+			Assert.AreEqual( content.Length, storage.WriteBlob( hash, 0, new byte[0] ) );
+
+			byte[] stored;
+			Assert.AreEqual( content.Length, storage.OpenBlob( headers[1], "_stream", out stored ) );
+			Assert.AreEqual( Convert.ToBase64String( hash ), Convert.ToBase64String( stored ) );
+			byte[] tail = storage.ReadBlob( headers[1], "_stream", null, content.Length - 10, 100 );
+			Assert.AreEqual( 10, tail.Length );
+			Assert.AreEqual( content[content.Length - 1], tail[9] );
+
+			// opened content is read by hash after the property is changed
+			storage.Save( ref headers[1], new LINK[0],
+						  new PROPERTY[] { new PROPERTY( "_stream", new PersistentStream( new byte[] { 3 } ), PROPERTY.STATE.Changed ) },
+						  out mlinks, out mprops );
+			Assert.AreEqual( 1, storage.ReadBlob( headers[1], "_stream", null, 0, 100 ).Length );
+			tail = storage.ReadBlob( headers[1], "_stream", stored, content.Length - 10, 100 );
+			Assert.AreEqual( content[content.Length - 1], tail[9] );
+
+			// content that doesn't match the hash is rejected
+			byte[] other = new SHA1Managed().ComputeHash( new byte[] { 1 } );
+			storage.WriteBlob( other, 0, new byte[] { 2 } );
+			try {
+				storage.CommitBlob( ref headers[0], "_other", other );
+				Assert.Fail( "Invalid content must be rejected." );
+			} catch( InvalidDataException ) {
+			}
+
+			// content is removed with the last property
+			storage.Delete( headers[0] );
+			storage.Delete( headers[1] );
+			Assert.AreEqual( 0, storage.BlobsCount );
+		}
+	}
+}
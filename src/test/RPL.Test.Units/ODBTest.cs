@@ -460,6 +460,34 @@ public class ODBTest
 	}
 
 
+	/// <summary>
+	/// A test for asynchronous Save, Retrieve and Perform
+	/// </summary>
+	[Priority( 2 ), TestMethod()]
+	public void AsyncSaveRetrieveTest()
+	{
+		TestObject obj = new TestObject();
+		obj.Name = m_obj_name + DateTime.Now.ToString("yyyy-MM-dd HH:mm:ss.fff");
+		obj._int = 987654321;
+
+		// operations on the same object are completed in
+		// the order they were started: retrieve follows save
+		IAsyncResult save = obj.BeginSave( null, null );
+		IAsyncResult retrieve = obj.BeginRetrieve( false, null, null );
+		obj.EndRetrieve( retrieve );
+		Assert.IsTrue( save.IsCompleted, "Save was not completed before retrieve" );
+		obj.EndSave( save );
+		Assert.IsTrue( obj.ID > 0, "Object was not saved" );
+
+		RetrieveCriteria ret_crit = new RetrieveCriteria( 
+			(new TestObject()).Type, 
+			"( ID = " + obj.ID + ")" );
+		ret_crit.EndPerform( ret_crit.BeginPerform( null, null ) );
+		Assert.AreEqual( 1, ret_crit.Count, "Asynchronous search by id failed" );
+		Assert.AreEqual( obj._int, ((TestObject) ret_crit[0])._int );
+	}
+
+
 	/// <summary>
 	/// A test for Search (CPersistentCriteria, ref IEnumerable&lt;CPersistentObject&gt;)
 	/// </summary>
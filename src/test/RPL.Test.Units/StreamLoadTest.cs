@@ -0,0 +1,240 @@
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Diagnostics;
+using System.IO;
+using System.Runtime.Serialization.Formatters.Binary;
+
+namespace Toolkit.RPL.Test
+{
+	[ TestClass() ]
+	public class StreamLoadTest
+	{
+		private const int STREAMS_COUNT = 1000;
+		private const int STREAM_LENGTH = 4096;
+		private TestContext testContextInstance;
+
+		/// <summary>
+		/// Gets or sets the test context which provides
+		/// information about and functionality for the current test run.
+		/// </summary>
+		public TestContext TestContext
+		{
+			get
+			{
+				return testContextInstance;
+			}
+			set
+			{
+				testContextInstance = value;
+			}
+		}
+
+		/// <summary>
+		/// Emulates retrieve of small BLOBs: storage creates streams from
+		/// byte arrays and broker passes them through remoting.
+		/// </summary>
+		private long retrieve( int count, byte[] data )
+		{
+			BinaryFormatter bf = new BinaryFormatter();
+
+			Stopwatch sw = Stopwatch.StartNew();
+			for( int i = 0; i < count; i++ ) {
+				PersistentStream ps = new PersistentStream( data );
+				MemoryStream ms = new MemoryStream();
+				bf.Serialize( ms, ps );
+				ps.Dispose();
+
+				ms.Position = 0;
+				ps = (PersistentStream)bf.Deserialize( ms );
+				Assert.AreEqual( data.Length, ps.Length );
+				ps.Dispose();
+			}
+			sw.Stop();
+			return sw.ElapsedMilliseconds;
+		}
+
+		/// <summary>
+		/// Measures retrieve of 1k small BLOBs kept in memory and in
+		/// temporary files.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void RetrieveLoadTest()
+		{
+			byte[] data = new byte[STREAM_LENGTH];
+			new Random( 0 ).NextBytes( data );
+
+			long limit = PersistentStream.MemoryLimit;
+			try {
+				// warm up
+				retrieve( STREAMS_COUNT / 10, data );
+
+				PersistentStream.MemoryLimit = 0;
+				TestContext.WriteLine( "{0} streams of {1} bytes, files: {2} ms",
+									   STREAMS_COUNT, STREAM_LENGTH, retrieve( STREAMS_COUNT, data ) );
+
+				PersistentStream.MemoryLimit = STREAM_LENGTH;
+				TestContext.WriteLine( "{0} streams of {1} bytes, memory: {2} ms",
+									   STREAMS_COUNT, STREAM_LENGTH, retrieve( STREAMS_COUNT, data ) );
+			} finally {
+				PersistentStream.MemoryLimit = limit;
+			}
+		}
+
+		/// <summary>
+		/// Content must be kept when stream grows over memory limit.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void SpillTest()
+		{
+			byte[] data = new byte[STREAM_LENGTH];
+			new Random( 0 ).NextBytes( data );
+
+			long limit = PersistentStream.MemoryLimit;
+			try {
+				PersistentStream.MemoryLimit = STREAM_LENGTH;
+
+				PersistentStream ps = new PersistentStream( data );
+				ps.Seek( 0, SeekOrigin.End );
+				ps.Write( data, 0, data.Length );
+				Assert.AreEqual( 2 * STREAM_LENGTH, ps.Position );
+
+				byte[] buf = new byte[2 * STREAM_LENGTH];
+				ps.Position = 0;
+				Assert.AreEqual( buf.Length, ps.Read( buf, 0, buf.Length ) );
+				for( int i = 0; i < buf.Length; i++ ) {
+					Assert.AreEqual( data[i % STREAM_LENGTH], buf[i] );
+				}
+				ps.Dispose();
+			} finally {
+				PersistentStream.MemoryLimit = limit;
+			}
+		}
+
+		/// <summary>
+		/// Random access reads must return requested part of content in
+		/// memory and in temporary file without position change.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void ReadAtTest()
+		{
+			byte[] data = new byte[STREAM_LENGTH];
+			new Random( 0 ).NextBytes( data );
+
+			long limit = PersistentStream.MemoryLimit;
+			try {
+				foreach( long l in new long[] { STREAM_LENGTH, 0 } ) {
+					PersistentStream.MemoryLimit = l;
+					PersistentStream ps = new PersistentStream( data );
+					ps.Position = 10;
+
+					byte[] buf = new byte[100];
+					Assert.AreEqual( 100, ps.ReadAt( 1000, buf, 0, 100 ) );
+					Assert.AreEqual( data[1000], buf[0] );
+					Assert.AreEqual( data[1099], buf[99] );
+					Assert.AreEqual( 6, ps.ReadAt( STREAM_LENGTH - 6, buf, 0, 100 ) );
+
+					ArraySegment<byte> slice = ps.Slice( 2000, 100 );
+					Assert.AreEqual( 100, slice.Count );
+					Assert.AreEqual( data[2000], slice.Array[slice.Offset] );
+					Assert.AreEqual( 0, ps.Slice( STREAM_LENGTH, 100 ).Count );
+
+					Assert.AreEqual( 10, ps.Position );
+					ps.Dispose();
+				}
+			} finally {
+				PersistentStream.MemoryLimit = limit;
+			}
+		}
+
+		/// <summary>
+		/// Streams with equal content must have equal hash in memory and
+		/// in temporary file, and hash must follow content changes.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void HashTest()
+		{
+			byte[] data = new byte[STREAM_LENGTH];
+			new Random( 0 ).NextBytes( data );
+
+			long limit = PersistentStream.MemoryLimit;
+			try {
+				PersistentStream.MemoryLimit = STREAM_LENGTH;
+				PersistentStream ps1 = new PersistentStream( data );
+				PersistentStream.MemoryLimit = 0;
+				PersistentStream ps2 = new PersistentStream( data );
+
+				Assert.AreEqual( Convert.ToBase64String( ps1.Hash ), Convert.ToBase64String( ps2.Hash ) );
+
+				ps2.WriteByte( (byte)(data[0] + 1) );
+				Assert.AreNotEqual( Convert.ToBase64String( ps1.Hash ), Convert.ToBase64String( ps2.Hash ) );
+
+				ps1.Dispose();
+				ps2.Dispose();
+			} finally {
+				PersistentStream.MemoryLimit = limit;
+			}
+		}
+
+		/// <summary>
+		/// Large content is serialized by chunks and must be restored with
+		/// the same data and position.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void SerializationTest()
+		{
+			byte[] data = new byte[3 * 1024 * 1024 + 5];
+			new Random( 0 ).NextBytes( data );
+
+			PersistentStream ps = new PersistentStream( data );
+			ps.Position = 7;
+
+			BinaryFormatter bf = new BinaryFormatter();
+			MemoryStream ms = new MemoryStream();
+			bf.Serialize( ms, ps );
+			ps.Dispose();
+
+			ms.Position = 0;
+			ps = (PersistentStream)bf.Deserialize( ms );
+			Assert.AreEqual( data.Length, ps.Length );
+			Assert.AreEqual( 7, ps.Position );
+
+			byte[] buf = new byte[data.Length];
+			ps.Position = 0;
+			for( int read = 0; read < buf.Length; ) {
+				int size = ps.Read( buf, read, buf.Length - read );
+				Assert.IsTrue( size > 0, "Unexpected end of stream." );
+				read += size;
+			}
+			for( int i = 0; i < buf.Length; i++ ) {
+				if( buf[i] != data[i] ) Assert.Fail( "Content differs at {0}.", i );
+			}
+			ps.Dispose();
+		}
+
+		/// <summary>
+		/// Stream that refers to stored content must be serialized as
+		/// reference only and must give its length and hash without
+		/// reading content.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void StoredSerializationTest()
+		{
+			byte[] hash = new byte[20];
+			new Random( 0 ).NextBytes( hash );
+
+			PersistentStream ps = new PersistentStream( "TestObject", 1, "Image",
+														64 * 1024 * 1024, hash );
+			BinaryFormatter bf = new BinaryFormatter();
+			MemoryStream ms = new MemoryStream();
+			bf.Serialize( ms, ps );
+			ps.Dispose();
+			Assert.IsTrue( ms.Length < 4096, "Stored content was serialized." );
+
+			ms.Position = 0;
+			ps = (PersistentStream)bf.Deserialize( ms );
+			Assert.AreEqual( 64 * 1024 * 1024, ps.Length );
+			Assert.AreEqual( Convert.ToBase64String( hash ), Convert.ToBase64String( ps.Hash ) );
+			ps.Dispose();
+		}
+	}
+}
@@ -0,0 +1,114 @@
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Diagnostics;
+using Toolkit.RPL.Factories;
+
+namespace Toolkit.RPL.Test
+{
+	[ TestClass() ]
+	public class TransactionLoadTest
+	{
+		private const int OBJECTS_COUNT = 10000;
+		private TestContext testContextInstance;
+
+		/// <summary>
+		/// Gets or sets the test context which provides
+		/// information about and functionality for the current test run.
+		/// </summary>
+		public TestContext TestContext
+		{
+			get
+			{
+				return testContextInstance;
+			}
+			set
+			{
+				testContextInstance = value;
+			}
+		}
+		#region Additional test attributes
+		//
+		// You can use the following additional attributes as you write your tests:
+		//
+
+		// Use ClassInitialize to run code before running the first test in the class
+
+		[ClassInitialize()]
+		public static void MyClassInitialize( TestContext testContext )
+		{
+			RemotingConfiguration rc = RemotingConfiguration.Instance;
+		}
+
+		// Use ClassCleanup to run code after all tests in a class have run
+
+		[ClassCleanup()]
+		public static void MyClassCleanup()
+		{
+			PersistenceBroker.Close();
+		}
+		#endregion
+
+		/// <summary>
+		/// Counts transaction calls to check that each object is saved
+		/// and restored only once per transaction.
+		/// </summary>
+		private class CountedObject : TestObject
+		{
+			public int Begins = 0;
+			public int Commits = 0;
+
+			protected override void OnTransactionBegin()
+			{
+				Begins++;
+			}
+			protected override void OnTransactionCommit()
+			{
+				Commits++;
+			}
+		}
+
+		/// <summary>
+		/// Process transaction with specified count of objects. Objects are
+		/// not changed (ACTION.None), so only transaction overhead is measured.
+		/// Each object is added twice, but must be touched once only.
+		/// </summary>
+		private void process( int count )
+		{
+			PersistentTransaction trans = new PersistentTransaction();
+			CountedObject[] objs = new CountedObject[count];
+			for ( int i = 0; i < count; i++ ) {
+				objs[i] = new CountedObject();
+				trans.Add( objs[i], PersistentTransaction.ACTION.None );
+			}
+			for ( int i = 0; i < count; i++ ) {
+				trans.Add( objs[i], PersistentTransaction.ACTION.None );
+			}
+
+			Stopwatch sw = Stopwatch.StartNew();
+			trans.Process();
+			sw.Stop();
+
+			TestContext.WriteLine( "{0} objects: {1} ms", count, sw.ElapsedMilliseconds );
+			for ( int i = 0; i < count; i++ ) {
+				Assert.AreEqual( 1, objs[i].Begins, "Object was begun more than once." );
+				Assert.AreEqual( 1, objs[i].Commits, "Object was committed more than once." );
+			}
+		}
+
+		/// <summary>
+		/// Transaction cost must grow linearly with count of touched objects.
+		/// Timings are written to test context only (they depend on machine
+		/// load), and behavior is checked for each size.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void ScalingLoadTest()
+		{
+			// warm up
+			process( OBJECTS_COUNT / 10 );
+
+			process( OBJECTS_COUNT );
+			process( OBJECTS_COUNT * 2 );
+			process( OBJECTS_COUNT * 4 );
+		}
+	}
+}
@@ -0,0 +1,138 @@
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Diagnostics;
+using System.IO;
+using System.Runtime.Serialization.Formatters.Binary;
+
+namespace Toolkit.RPL.Test
+{
+	[ TestClass() ]
+	public class ValueBoxLoadTest
+	{
+		private const int OBJECTS_COUNT = 10000;
+		private const int VALUES_COUNT = 1000000;
+		private TestContext testContextInstance;
+
+		/// <summary>
+		/// Gets or sets the test context which provides
+		/// information about and functionality for the current test run.
+		/// </summary>
+		public TestContext TestContext
+		{
+			get
+			{
+				return testContextInstance;
+			}
+			set
+			{
+				testContextInstance = value;
+			}
+		}
+
+		/// <summary>
+		/// Measures load of primitive properties: values are set to objects
+		/// and read back through cast operators.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void PropertyLoadTest()
+		{
+			DateTime stamp = DateTime.Now;
+			TestObject[] objs = new TestObject[OBJECTS_COUNT];
+			for( int i = 0; i < OBJECTS_COUNT; i++ ) objs[i] = new TestObject();
+
+			int gcs = GC.CollectionCount( 0 );
+			Stopwatch sw = Stopwatch.StartNew();
+			for( int i = 0; i < OBJECTS_COUNT; i++ ) {
+				objs[i]._bool = (i % 2 == 0);
+				objs[i]._int = i;
+				objs[i]._double = i / 2.0;
+				objs[i]._datetime = stamp.AddSeconds( i );
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects x 4 properties, set: {1} ms, {2} collections",
+								   OBJECTS_COUNT, sw.ElapsedMilliseconds, GC.CollectionCount( 0 ) - gcs );
+
+			long sum = 0;
+			gcs = GC.CollectionCount( 0 );
+			sw = Stopwatch.StartNew();
+			for( int i = 0; i < OBJECTS_COUNT; i++ ) {
+				if( objs[i]._bool.Value ) sum++;
+				sum += objs[i]._int.Value;
+				sum += (long)objs[i]._double.Value;
+				sum += objs[i]._datetime.Value.Second;
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects x 4 properties, get: {1} ms, {2} collections",
+								   OBJECTS_COUNT, sw.ElapsedMilliseconds, GC.CollectionCount( 0 ) - gcs );
+
+			Assert.AreEqual( OBJECTS_COUNT - 1, objs[OBJECTS_COUNT - 1]._int );
+			Assert.AreEqual( stamp.AddSeconds( 1 ), objs[1]._datetime );
+			Assert.IsTrue( sum > 0 );
+		}
+
+		/// <summary>
+		/// Compares values in boxes with comparison of the same values
+		/// as objects.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void CompareLoadTest()
+		{
+			ValueBox[] boxes = new ValueBox[VALUES_COUNT];
+			for( int i = 0; i < VALUES_COUNT; i++ ) {
+				switch( i % 4 ) {
+					case 0: boxes[i] = i % 100; break;
+					case 1: boxes[i] = (i % 100) / 2.0; break;
+					case 2: boxes[i] = (i % 3 == 0); break;
+					case 3: boxes[i] = new DateTime( 2009, 1, 1 ).AddDays( i % 100 ); break;
+				}
+			}
+
+			int equal = 0;
+			Stopwatch sw = Stopwatch.StartNew();
+			for( int i = 4; i < VALUES_COUNT; i++ ) {
+				if( boxes[i] == boxes[i - 4] ) equal++;
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} values, boxes: {1} ms", VALUES_COUNT, sw.ElapsedMilliseconds );
+
+			int objects = 0;
+			sw = Stopwatch.StartNew();
+			for( int i = 4; i < VALUES_COUNT; i++ ) {
+				if( object.Equals( boxes[i].ToObject(), boxes[i - 4].ToObject() ) ) objects++;
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} values, objects: {1} ms", VALUES_COUNT, sw.ElapsedMilliseconds );
+
+			Assert.AreEqual( objects, equal );
+			// values of different types are not equal
+			Assert.AreNotEqual( (ValueBox)1, (ValueBox)1.0 );
+			Assert.AreEqual( ((ValueBox)0.5).GetHashCode(), ((ValueBox)(1 / 2.0)).GetHashCode() );
+		}
+
+		/// <summary>
+		/// Checks that values of all types survive serialization and
+		/// keep their types.
+		/// </summary>
+		[TestMethod()]
+		public void SerializationTest()
+		{
+			ValueBox[] boxes = new ValueBox[] {
+				true, 42, 0.25, DateTime.Now, DateTime.UtcNow, "value", DBNull.Value, new ValueBox( (short)7 )
+			};
+
+			BinaryFormatter bf = new BinaryFormatter();
+			MemoryStream ms = new MemoryStream();
+			bf.Serialize( ms, boxes );
+			ms.Position = 0;
+			ValueBox[] restored = (ValueBox[])bf.Deserialize( ms );
+
+			for( int i = 0; i < boxes.Length; i++ ) {
+				Assert.AreEqual( boxes[i], restored[i] );
+				Assert.AreEqual( boxes[i].ToObject().GetType(), restored[i].ToObject().GetType() );
+			}
+			Assert.AreEqual( DateTimeKind.Utc, ((DateTime)restored[4]).Kind );
+			Assert.AreEqual( 7, (int)restored[7] );
+			Assert.AreEqual( DBNull.Value, (DBNull)restored[6] );
+		}
+	}
+}
@@ -0,0 +1,228 @@
+using Microsoft.VisualStudio.TestTools.UnitTesting;
+using System;
+using System.Diagnostics;
+using System.IO;
+using System.Runtime.Serialization.Formatters.Binary;
+using Toolkit.RPL.Storage;
+
+namespace Toolkit.RPL.Test
+{
+	[ TestClass() ]
+	public class WireFormatLoadTest
+	{
+		private const int HEADERS_COUNT = 10000;
+		private const int OBJECTS_COUNT = 1000;
+		private const int PASSES = 10;
+		private TestContext testContextInstance;
+
+		/// <summary>
+		/// Gets or sets the test context which provides
+		/// information about and functionality for the current test run.
+		/// </summary>
+		public TestContext TestContext
+		{
+			get
+			{
+				return testContextInstance;
+			}
+			set
+			{
+				testContextInstance = value;
+			}
+		}
+
+		/// <summary>
+		/// Creates headers of objects saved one by one.
+		/// </summary>
+		private static HEADER[] headers( int count )
+		{
+			string type = (new TestObject()).Type;
+			DateTime stamp = new DateTime( 2009, 1, 1 );
+
+			HEADER[] result = new HEADER[count];
+			for( int i = 0; i < count; i++ ) {
+				result[i] = new HEADER( type, i + 1, stamp.AddMilliseconds( i * 3 ), "Object " + (i + 1) );
+			}
+			return result;
+		}
+
+		/// <summary>
+		/// Creates properties of one object.
+		/// </summary>
+		private static PROPERTY[] properties( int id )
+		{
+			return new PROPERTY[] {
+				new PROPERTY( "_bool", id % 2 == 0, PROPERTY.STATE.None ),
+				new PROPERTY( "_int", id, PROPERTY.STATE.None ),
+				new PROPERTY( "_double", id / 3.0, PROPERTY.STATE.None ),
+				new PROPERTY( "_datetime", new DateTime( 2009, 1, 1 ).AddDays( id ), PROPERTY.STATE.None ),
+				new PROPERTY( "_string", "Value " + id, PROPERTY.STATE.None ),
+				new PROPERTY( "_null", DBNull.Value, PROPERTY.STATE.None )
+			};
+		}
+
+		/// <summary>
+		/// Measures encoding of search result: default serialization
+		/// against WireFormat.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void HeadersLoadTest()
+		{
+			HEADER[] source = headers( HEADERS_COUNT );
+			BinaryFormatter bf = new BinaryFormatter();
+
+			byte[] data = null;
+			HEADER[] restored = null;
+			Stopwatch sw = Stopwatch.StartNew();
+			for( int pass = 0; pass < PASSES; pass++ ) {
+				MemoryStream ms = new MemoryStream();
+				bf.Serialize( ms, source );
+				data = ms.ToArray();
+				restored = (HEADER[])bf.Deserialize( new MemoryStream( data ) );
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} headers x {1}, serialization: {2} bytes, {3} ms",
+								   HEADERS_COUNT, PASSES, data.Length, sw.ElapsedMilliseconds );
+			int serialized = data.Length;
+
+			sw = Stopwatch.StartNew();
+			for( int pass = 0; pass < PASSES; pass++ ) {
+				WireFormat wf = new WireFormat();
+				wf.Write( source );
+				data = wf.ToArray();
+				restored = new WireFormat( data ).ReadHeaders();
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} headers x {1}, wire format: {2} bytes, {3} ms",
+								   HEADERS_COUNT, PASSES, data.Length, sw.ElapsedMilliseconds );
+
+			Assert.AreEqual( source.Length, restored.Length );
+			for( int i = 0; i < source.Length; i++ ) {
+				Assert.AreEqual( source[i].Type, restored[i].Type );
+				Assert.AreEqual( source[i].ID, restored[i].ID );
+				Assert.AreEqual( source[i].Stamp, restored[i].Stamp );
+				Assert.AreEqual( source[i].Name, restored[i].Name );
+			}
+			Assert.IsTrue( data.Length < serialized );
+		}
+
+		/// <summary>
+		/// Measures encoding of retrieved objects state: links and
+		/// properties of 1k objects.
+		/// </summary>
+		[Priority( 1 ), TestMethod()]
+		public void StateLoadTest()
+		{
+			HEADER[] children = headers( 10 );
+			LINK[] links = new LINK[children.Length];
+			for( int i = 0; i < links.Length; i++ ) links[i] = new LINK( children[i], LINK.STATE.None );
+
+			BinaryFormatter bf = new BinaryFormatter();
+			long size = 0;
+			Stopwatch sw = Stopwatch.StartNew();
+			for( int id = 0; id < OBJECTS_COUNT; id++ ) {
+				MemoryStream ms = new MemoryStream();
+				bf.Serialize( ms, new object[] { links, properties( id ) } );
+				size += ms.Length;
+				ms.Position = 0;
+				bf.Deserialize( ms );
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects, serialization: {1} bytes, {2} ms",
+								   OBJECTS_COUNT, size, sw.ElapsedMilliseconds );
+			long serialized = size;
+
+			size = 0;
+			PROPERTY[] props = null;
+			sw = Stopwatch.StartNew();
+			for( int id = 0; id < OBJECTS_COUNT; id++ ) {
+				WireFormat wf = new WireFormat();
+				wf.Write( links );
+				wf.Write( properties( id ) );
+				size += wf.Length;
+
+				WireFormat rf = new WireFormat( wf.ToArray() );
+				Assert.AreEqual( links.Length, rf.ReadLinks().Length );
+				props = rf.ReadProperties();
+			}
+			sw.Stop();
+			TestContext.WriteLine( "{0} objects, wire format: {1} bytes, {2} ms",
+								   OBJECTS_COUNT, size, sw.ElapsedMilliseconds );
+
+			PROPERTY[] source = properties( OBJECTS_COUNT - 1 );
+			for( int i = 0; i < source.Length; i++ ) {
+				Assert.AreEqual( source[i].Name, props[i].Name );
+				Assert.AreEqual( source[i].Value, props[i].Value );
+				Assert.AreEqual( source[i].State, props[i].State );
+			}
+			Assert.IsTrue( size < serialized );
+		}
+
+		/// <summary>
+		/// Checks that null and empty arrays are restored as is and that
+		/// truncated data is rejected.
+		/// </summary>
+		[TestMethod()]
+		public void BoundaryTest()
+		{
+			WireFormat wf = new WireFormat();
+			wf.Write( (LINK[])null );
+			wf.Write( new PROPERTY[0] );
+			wf.Write( headers( 3 ) );
+			byte[] data = wf.ToArray();
+
+			WireFormat rf = new WireFormat( data );
+			Assert.IsNull( rf.ReadLinks() );
+			Assert.AreEqual( 0, rf.ReadProperties().Length );
+			Assert.AreEqual( 3, rf.ReadHeaders().Length );
+
+			byte[] truncated = new byte[data.Length - 1];
+			Array.Copy( data, truncated, truncated.Length );
+			rf = new WireFormat( truncated );
+			rf.ReadLinks();
+			rf.ReadProperties();
+			try {
+				rf.ReadHeaders();
+				Assert.Fail( "Truncated data must be rejected." );
+			} catch( InvalidDataException ) {
+			}
+
+			// property without state
+			wf = new WireFormat();
+			wf.Write( new PROPERTY[] { new PROPERTY( "_int", 1, PROPERTY.STATE.New ) } );
+			data = wf.ToArray();
+			truncated = new byte[data.Length - 1];
+			Array.Copy( data, truncated, truncated.Length );
+			try {
+				new WireFormat( truncated ).ReadProperties();
+				Assert.Fail( "Property without state must be rejected." );
+			} catch( InvalidDataException ) {
+			}
+		}
+
+		/// <summary>
+		/// Checks that stamps at the ends of range are restored as is.
+		/// </summary>
+		[TestMethod()]
+		public void StampRangeTest()
+		{
+			string type = (new TestObject()).Type;
+			HEADER[] source = new HEADER[] {
+				new HEADER( type, 1, DateTime.SpecifyKind( DateTime.MaxValue, DateTimeKind.Utc ), "Max" ),
+				new HEADER( type, 2, DateTime.MinValue, "Min" ),
+				new HEADER( type, 3, DateTime.MaxValue, "Max" ),
+				new HEADER( type, 4, new DateTime( 2013, 1, 1, 0, 0, 0, DateTimeKind.Local ), "Now" )
+			};
+
+			WireFormat wf = new WireFormat();
+			wf.Write( source );
+			HEADER[] restored = new WireFormat( wf.ToArray() ).ReadHeaders();
+
+			Assert.AreEqual( source.Length, restored.Length );
+			for( int i = 0; i < source.Length; i++ ) {
+				Assert.AreEqual( source[i].Stamp, restored[i].Stamp );
+				Assert.AreEqual( source[i].Stamp.Kind, restored[i].Stamp.Kind );
+			}
+		}
+	}
+}